@@ -0,0 +1,152 @@
+#ifndef BENCHUTILS_H
+#define BENCHUTILS_H
+
+#include <QtGlobal>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Bench {
+
+// Peak resident set size of this process so far, in KiB
+inline qint64 peakRssKb()
+{
+#ifdef Q_OS_UNIX
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MACOS
+        return usage.ru_maxrss / 1024; // Bytes on macOS
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+inline double median(std::vector<double> values)
+{
+    if (values.empty()) {
+        return 0.0;
+    }
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    if (values.size() % 2 == 1) {
+        return *middle;
+    }
+    return (*middle + *std::max_element(values.begin(), middle)) / 2.0;
+}
+
+// Nearest-rank percentile, p in [0, 100]
+inline double percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = size_t(std::ceil(p / 100.0 * values.size()));
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// Median absolute deviation: a spread estimate that ignores the odd slow
+// sample caused by an interrupt or migration
+inline double medianAbsoluteDeviation(const std::vector<double> &values)
+{
+    const double center = median(values);
+    std::vector<double> deviations;
+    deviations.reserve(values.size());
+    for (double value : values) {
+        deviations.push_back(std::abs(value - center));
+    }
+    return median(deviations);
+}
+
+// Keep the compiler from discarding a result that is otherwise unused
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+#if defined(Q_CC_GNU) || defined(Q_CC_CLANG)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+// Pin the calling thread to one CPU so frequency and cache state stay
+// comparable between samples. Returns false where unsupported.
+inline bool pinToCpu(int cpu)
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    Q_UNUSED(cpu);
+    return false;
+#endif
+}
+
+// Core cycles of the calling thread via perf events. Unavailable without
+// Linux perf support or when perf_event_paranoid forbids it.
+class CycleCounter
+{
+public:
+    CycleCounter()
+    {
+#ifdef Q_OS_LINUX
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~CycleCounter()
+    {
+#ifdef Q_OS_LINUX
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+    }
+
+    CycleCounter(const CycleCounter &) = delete;
+    CycleCounter &operator=(const CycleCounter &) = delete;
+
+    bool isAvailable() const { return m_fd >= 0; }
+
+    quint64 read() const
+    {
+        quint64 value = 0;
+#ifdef Q_OS_LINUX
+        if (m_fd >= 0 && ::read(m_fd, &value, sizeof(value)) != sizeof(value)) {
+            value = 0;
+        }
+#endif
+        return value;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+}
+
+#endif // BENCHUTILS_H
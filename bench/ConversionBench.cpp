@@ -0,0 +1,222 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <cstdio>
+#include <vector>
+
+#include "BenchUtils.h"
+#include "CorpusGenerator.h"
+#include "core/AudioConverter.h"
+#include "core/FlacStreamInfo.h"
+
+// End-to-end benchmark: generates a deterministic FLAC corpus, then runs full
+// AudioConverter::convertFile jobs over it and prints one JSON document that
+// can be diffed between commits.
+
+namespace {
+struct FileResult {
+    QString name;
+    bool success = false;
+    ConversionStats stats;
+};
+
+double ms(qint64 ns)
+{
+    return ns / 1e6;
+}
+
+QJsonObject stageObject(const ConversionStats &stats)
+{
+    return QJsonObject{
+        {"decode_ms", ms(stats.decodeNs)},
+        {"resample_ms", ms(stats.resampleNs)},
+        {"encode_ms", ms(stats.encodeNs)},
+        {"mux_ms", ms(stats.muxNs)},
+        {"metadata_ms", ms(stats.metadataNs)},
+        {"cache_ms", ms(stats.cacheNs)},
+        {"total_ms", ms(stats.totalNs)}
+    };
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("opus-ripper-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("End-to-end FLAC to Opus conversion benchmark.");
+    parser.addHelpOption();
+
+    QCommandLineOption corpusOption("corpus", "Directory for the generated FLAC corpus.", "path",
+                                    QDir::temp().filePath("opus-ripper-bench/corpus"));
+    QCommandLineOption outputOption("output", "Directory for the Opus outputs.", "path",
+                                    QDir::temp().filePath("opus-ripper-bench/output"));
+    QCommandLineOption quickOption("quick", "Use the small corpus (10 s files, stereo only).");
+    QCommandLineOption repeatOption("repeat", "Number of timed passes over the corpus.", "count", "3");
+    QCommandLineOption jobsOption({"j", "jobs"}, "Concurrent conversions.", "count", "1");
+    QCommandLineOption bitrateOption("bitrate", "Bitrate in bits per second.", "bps", "128000");
+    QCommandLineOption complexityOption("complexity", "Encoder complexity (0-10).", "level", "10");
+    QCommandLineOption labelOption("label", "Free-form label stored in the report, e.g. a commit hash.", "text");
+    QCommandLineOption jsonOption("json", "Write the report to this file instead of stdout.", "path");
+    parser.addOptions({corpusOption, outputOption, quickOption, repeatOption, jobsOption,
+                       bitrateOption, complexityOption, labelOption, jsonOption});
+    parser.process(app);
+
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+    const int jobs = qMax(1, parser.value(jobsOption).toInt());
+    const int bitrate = parser.value(bitrateOption).toInt();
+    const int complexity = parser.value(complexityOption).toInt();
+
+    // Corpus generation is not part of any measurement
+    CorpusGenerator generator(parser.value(corpusOption));
+    const QList<CorpusSpec> specs = CorpusGenerator::standardCorpus(parser.isSet(quickOption));
+
+    QStringList inputs;
+    QList<FlacStreamInfo> streamInfos;
+    double corpusSeconds = 0.0;
+    qint64 corpusBytes = 0;
+    for (const CorpusSpec &spec : specs) {
+        std::fprintf(stderr, "Preparing %s\n", qPrintable(spec.fileName()));
+        QString path = generator.generate(spec);
+        if (path.isEmpty()) {
+            std::fprintf(stderr, "%s\n", qPrintable(generator.lastError()));
+            return 1;
+        }
+
+        FlacStreamInfo info;
+        FlacStreamInfo::probe(path, info);
+        inputs.append(path);
+        streamInfos.append(info);
+        corpusSeconds += info.durationSeconds();
+        corpusBytes += QFileInfo(path).size();
+    }
+
+    QDir outputDir(parser.value(outputOption));
+    outputDir.mkpath(".");
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+
+    QJsonArray runs;
+    std::vector<double> runSeconds;
+    std::vector<FileResult> results(inputs.size());
+    ConversionStats stageTotals;
+    bool allSucceeded = true;
+
+    for (int run = 0; run < repeat; ++run) {
+        QElapsedTimer wall;
+        wall.start();
+
+        for (int i = 0; i < inputs.size(); ++i) {
+            pool.start([&, i]() {
+                AudioConverter converter;
+                converter.setBitrate(bitrate);
+                converter.setComplexity(complexity);
+
+                ConversionTask task;
+                task.inputPath = inputs[i];
+                task.outputPath = outputDir.filePath(QFileInfo(inputs[i]).completeBaseName() + ".opus");
+                task.index = i;
+                task.total = int(inputs.size());
+                task.streamInfo = streamInfos[i];
+                converter.convertFile(task);
+
+                results[i].name = QFileInfo(inputs[i]).fileName();
+                results[i].success = converter.getLastError().isEmpty();
+                results[i].stats = converter.lastStats();
+            });
+        }
+        pool.waitForDone();
+
+        const double seconds = wall.nsecsElapsed() / 1e9;
+        runSeconds.push_back(seconds);
+        runs.append(QJsonObject{
+            {"wall_seconds", seconds},
+            {"files_per_second", inputs.size() / seconds},
+            {"realtime_factor", corpusSeconds / seconds}
+        });
+
+        for (const FileResult &result : results) {
+            allSucceeded = allSucceeded && result.success;
+            stageTotals.decodeNs += result.stats.decodeNs;
+            stageTotals.resampleNs += result.stats.resampleNs;
+            stageTotals.encodeNs += result.stats.encodeNs;
+            stageTotals.muxNs += result.stats.muxNs;
+            stageTotals.metadataNs += result.stats.metadataNs;
+            stageTotals.cacheNs += result.stats.cacheNs;
+            stageTotals.totalNs += result.stats.totalNs;
+        }
+
+        std::fprintf(stderr, "Run %d: %.2f s\n", run + 1, seconds);
+    }
+
+    // Per-run averages, summed over files
+    stageTotals.decodeNs /= repeat;
+    stageTotals.resampleNs /= repeat;
+    stageTotals.encodeNs /= repeat;
+    stageTotals.muxNs /= repeat;
+    stageTotals.metadataNs /= repeat;
+    stageTotals.cacheNs /= repeat;
+    stageTotals.totalNs /= repeat;
+
+    // Per-file detail from the last pass
+    QJsonArray files;
+    for (const FileResult &result : results) {
+        QJsonObject file = stageObject(result.stats);
+        file.insert("name", result.name);
+        file.insert("success", result.success);
+        file.insert("audio_seconds", result.stats.audioSeconds);
+        file.insert("realtime_factor", result.stats.totalNs > 0
+                    ? result.stats.audioSeconds / (result.stats.totalNs / 1e9) : 0.0);
+        files.append(file);
+    }
+
+    const double medianSeconds = Bench::median(runSeconds);
+    QJsonObject report{
+        {"benchmark", "conversion"},
+        {"label", parser.value(labelOption)},
+        {"qt_version", QString(qVersion())},
+        {"settings", QJsonObject{
+            {"bitrate", bitrate},
+            {"complexity", complexity},
+            {"jobs", jobs},
+            {"repeat", repeat},
+            {"quick", parser.isSet(quickOption)}
+        }},
+        {"corpus", QJsonObject{
+            {"files", int(inputs.size())},
+            {"audio_seconds", corpusSeconds},
+            {"bytes", corpusBytes}
+        }},
+        {"median", QJsonObject{
+            {"wall_seconds", medianSeconds},
+            {"files_per_second", inputs.size() / medianSeconds},
+            {"realtime_factor", corpusSeconds / medianSeconds}
+        }},
+        {"runs", runs},
+        {"stages", stageObject(stageTotals)},
+        {"peak_rss_kb", Bench::peakRssKb()},
+        {"files", files}
+    };
+
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            std::fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value(jsonOption)));
+            return 1;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    return allSucceeded ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+#include "CorpusGenerator.h"
+#include <FLAC++/encoder.h>
+#include <FLAC/metadata.h>
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <cmath>
+#include <vector>
+
+namespace {
+// Bump when the synthesized content changes so stale corpora are not reused
+const int CorpusVersion = 1;
+const int BlockFrames = 4096;
+const double TwoPi = 6.283185307179586;
+
+// Small deterministic PRNG (xorshift32); std:: engines differ across libraries
+class Random
+{
+public:
+    explicit Random(quint32 seed) : m_state(seed ? seed : 0x9E3779B9u) {}
+
+    quint32 next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+    // Uniform in [-1, 1)
+    double bipolar() { return next() / 2147483648.0 - 1.0; }
+
+private:
+    quint32 m_state;
+};
+
+quint32 seedFor(const QString &name, quint32 seed)
+{
+    QByteArray hash = QCryptographicHash::hash(name.toUtf8(), QCryptographicHash::Sha1);
+    quint32 value = seed;
+    for (int i = 0; i < 4; ++i) {
+        value = value * 31 + quint8(hash[i]);
+    }
+    return value;
+}
+
+bool addComment(FLAC__StreamMetadata *block, const char *name, const QByteArray &value)
+{
+    FLAC__StreamMetadata_VorbisComment_Entry entry;
+    return FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, name, value.constData()) &&
+           FLAC__metadata_object_vorbiscomment_append_comment(block, entry, /*copy=*/false);
+}
+}
+
+QString CorpusSpec::fileName() const
+{
+    QString name = QString("v%1_%2hz_%3bit_%4ch_%5s")
+        .arg(CorpusVersion).arg(sampleRate).arg(bitsPerSample).arg(channels).arg(durationSeconds);
+    if (coverArtBytes > 0) {
+        name += QString("_art%1k").arg(coverArtBytes / 1024);
+    }
+    if (extraTags > 0) {
+        name += QString("_tags%1").arg(extraTags);
+    }
+    return name + ".flac";
+}
+
+CorpusGenerator::CorpusGenerator(const QString &directory, quint32 seed)
+    : m_directory(directory)
+    , m_seed(seed)
+{
+}
+
+QList<CorpusSpec> CorpusGenerator::standardCorpus(bool quick)
+{
+    const QList<int> rates{44100, 48000, 96000, 192000};
+    const QList<int> depths{16, 24};
+    const QList<int> channelCounts = quick ? QList<int>{2} : QList<int>{1, 2};
+    const QList<int> durations = quick ? QList<int>{10} : QList<int>{30, 180};
+
+    QList<CorpusSpec> specs;
+    for (int rate : rates) {
+        for (int depth : depths) {
+            for (int channels : channelCounts) {
+                for (int duration : durations) {
+                    CorpusSpec spec;
+                    spec.sampleRate = rate;
+                    spec.bitsPerSample = depth;
+                    spec.channels = channels;
+                    spec.durationSeconds = duration;
+                    specs.append(spec);
+                }
+            }
+        }
+    }
+
+    // Metadata-heavy files stress the tag and picture copy rather than the codec
+    CorpusSpec tagged;
+    tagged.durationSeconds = quick ? 10 : 30;
+    tagged.coverArtBytes = 512 * 1024;
+    tagged.extraTags = 200;
+    specs.append(tagged);
+
+    if (quick) {
+        CorpusSpec mono;
+        mono.sampleRate = 48000;
+        mono.bitsPerSample = 24;
+        mono.channels = 1;
+        specs.append(mono);
+    } else {
+        CorpusSpec hugeArt = tagged;
+        hugeArt.coverArtBytes = 8 * 1024 * 1024;
+        hugeArt.extraTags = 0;
+        specs.append(hugeArt);
+    }
+
+    return specs;
+}
+
+QString CorpusGenerator::generate(const CorpusSpec &spec)
+{
+    QDir dir(m_directory);
+    if (!dir.mkpath(".")) {
+        m_lastError = QString("Cannot create %1").arg(m_directory);
+        return QString();
+    }
+
+    const QString path = dir.filePath(spec.fileName());
+    if (QFile::exists(path)) {
+        return path;
+    }
+
+    Random random(seedFor(spec.fileName(), m_seed));
+    const quint64 totalFrames = quint64(spec.sampleRate) * spec.durationSeconds;
+
+    // Metadata blocks: a realistic tag set, padded out with long custom tags
+    std::vector<FLAC__StreamMetadata*> metadata;
+    FLAC__StreamMetadata *comments = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
+    addComment(comments, "TITLE", "Synthetic " + spec.fileName().toUtf8());
+    addComment(comments, "ARTIST", "Opus Ripper Bench");
+    addComment(comments, "ALBUM", "Corpus v" + QByteArray::number(CorpusVersion));
+    addComment(comments, "TRACKNUMBER", "1");
+    addComment(comments, "DATE", "2024");
+    for (int i = 0; i < spec.extraTags; ++i) {
+        QByteArray value(64, 'a' + char(random.next() % 26));
+        addComment(comments, QByteArray("BENCH_TAG_" + QByteArray::number(i)).constData(), value);
+    }
+    metadata.push_back(comments);
+
+    if (spec.coverArtBytes > 0) {
+        // JPEG markers around noise: nothing decodes it, but it is copied like real art
+        QByteArray art(spec.coverArtBytes, '\0');
+        for (int i = 0; i < art.size(); ++i) {
+            art[i] = char(random.next());
+        }
+        art.replace(0, 4, QByteArray("\xFF\xD8\xFF\xE0", 4));
+        art.replace(art.size() - 2, 2, QByteArray("\xFF\xD9", 2));
+
+        FLAC__StreamMetadata *picture = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PICTURE);
+        picture->data.picture.type = FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER;
+        picture->data.picture.width = 1000;
+        picture->data.picture.height = 1000;
+        picture->data.picture.depth = 24;
+        FLAC__metadata_object_picture_set_mime_type(picture, const_cast<char*>("image/jpeg"), true);
+        FLAC__metadata_object_picture_set_description(picture, reinterpret_cast<FLAC__byte*>(const_cast<char*>("")), true);
+        FLAC__metadata_object_picture_set_data(picture, reinterpret_cast<FLAC__byte*>(art.data()),
+                                               FLAC__uint32(art.size()), true);
+        metadata.push_back(picture);
+    }
+
+    const QString partialPath = path + ".partial";
+    FLAC::Encoder::File encoder;
+    encoder.set_channels(spec.channels);
+    encoder.set_bits_per_sample(spec.bitsPerSample);
+    encoder.set_sample_rate(spec.sampleRate);
+    encoder.set_compression_level(5);
+    encoder.set_total_samples_estimate(totalFrames);
+    encoder.set_metadata(metadata.data(), unsigned(metadata.size()));
+
+    bool success = encoder.init(QFile::encodeName(partialPath).toStdString()) == FLAC__STREAM_ENCODER_INIT_STATUS_OK;
+    if (!success) {
+        m_lastError = QString("Failed to initialize FLAC encoder for %1").arg(partialPath);
+    }
+
+    // Per channel: three partials plus filtered noise at about -6 dBFS, so the
+    // encoder sees music-like spectra rather than trivially compressible tones
+    struct Voice {
+        double phase[3];
+        double step[3];
+        double noise = 0.0;
+    };
+    std::vector<Voice> voices(spec.channels);
+    for (Voice &voice : voices) {
+        for (int p = 0; p < 3; ++p) {
+            double frequency = 55.0 * std::pow(2.0, (random.next() % 60) / 12.0);
+            voice.phase[p] = 0.0;
+            voice.step[p] = TwoPi * frequency / spec.sampleRate;
+        }
+    }
+
+    const double fullScale = double((1 << (spec.bitsPerSample - 1)) - 1);
+    std::vector<FLAC__int32> block(size_t(BlockFrames) * spec.channels);
+
+    for (quint64 frame = 0; success && frame < totalFrames; frame += BlockFrames) {
+        const unsigned frames = unsigned(qMin<quint64>(BlockFrames, totalFrames - frame));
+        for (unsigned i = 0; i < frames; ++i) {
+            for (int ch = 0; ch < spec.channels; ++ch) {
+                Voice &voice = voices[ch];
+                double sample = 0.0;
+                for (int p = 0; p < 3; ++p) {
+                    sample += std::sin(voice.phase[p]) * (0.2 / (p + 1));
+                    voice.phase[p] = std::fmod(voice.phase[p] + voice.step[p], TwoPi);
+                }
+                voice.noise = 0.95 * voice.noise + 0.05 * random.bipolar();
+                sample += voice.noise * 0.5;
+                block[size_t(i) * spec.channels + ch] = FLAC__int32(std::lround(sample * fullScale));
+            }
+        }
+
+        if (!encoder.process_interleaved(block.data(), frames)) {
+            m_lastError = QString("FLAC encoding failed: %1").arg(encoder.get_state().as_cstring());
+            success = false;
+        }
+    }
+
+    if (!encoder.finish()) {
+        success = false;
+    }
+
+    for (FLAC__StreamMetadata *object : metadata) {
+        FLAC__metadata_object_delete(object);
+    }
+
+    if (!success || !QFile::rename(partialPath, path)) {
+        QFile::remove(partialPath);
+        if (m_lastError.isEmpty()) {
+            m_lastError = QString("Failed to write %1").arg(path);
+        }
+        return QString();
+    }
+
+    return path;
+}
@@ -0,0 +1,41 @@
+#ifndef CORPUSGENERATOR_H
+#define CORPUSGENERATOR_H
+
+#include <QList>
+#include <QString>
+
+// One synthetic test file. The audio, tags and cover art are a pure function
+// of the spec and the generator seed, so a corpus is identical on every machine.
+struct CorpusSpec {
+    int sampleRate = 44100;
+    int bitsPerSample = 16;
+    int channels = 2;
+    int durationSeconds = 10;
+    int coverArtBytes = 0;    // 0 for no PICTURE block
+    int extraTags = 0;        // Vorbis comments beyond the basic set
+
+    QString fileName() const;
+};
+
+class CorpusGenerator
+{
+public:
+    explicit CorpusGenerator(const QString &directory, quint32 seed = 1);
+
+    // Rates 44.1/48/96/192 kHz at 16 and 24 bit, plus mono and heavily tagged files
+    static QList<CorpusSpec> standardCorpus(bool quick);
+
+    // Write the file for spec unless it already exists; returns its path, or
+    // an empty string on failure
+    QString generate(const CorpusSpec &spec);
+
+    QString directory() const { return m_directory; }
+    QString lastError() const { return m_lastError; }
+
+private:
+    QString m_directory;
+    quint32 m_seed;
+    QString m_lastError;
+};
+
+#endif // CORPUSGENERATOR_H
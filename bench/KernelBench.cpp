@@ -0,0 +1,430 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include <ogg/ogg.h>
+#include <opus/opus.h>
+#include <samplerate.h>
+#include <taglib/xiphcomment.h>
+
+#include "BenchUtils.h"
+#include "core/LoudnessAnalyzer.h"
+#include "core/MetadataHandler.h"
+#include "core/OggOpusWriter.h"
+#include "core/PcmConversion.h"
+
+// Micro-benchmarks for the per-sample kernels of the conversion pipeline. Each
+// kernel runs on the same synthetic input, pinned to one CPU, warmed up, then
+// timed per iteration so the report can give median, p99 and MAD.
+
+namespace {
+const double TwoPi = 6.283185307179586;
+const int FlacBlockFrames = 4096;
+
+struct Options {
+    int iterations = 50;
+    qint64 warmupNs = 300000000;
+    QString filter;
+};
+
+struct Kernel {
+    QString name;
+    QString unit;              // What unitsPerIteration counts: sample, call or byte
+    double unitsPerIteration;
+    std::function<void()> run;
+};
+
+// Interleaved float test signal: a chord plus a little noise, at -6 dBFS
+std::vector<float> makeSignal(int sampleRate, int channels, int frames)
+{
+    std::vector<float> pcm(size_t(frames) * channels);
+    quint32 noise = 22222;
+    for (int i = 0; i < frames; ++i) {
+        for (int ch = 0; ch < channels; ++ch) {
+            noise = noise * 1664525u + 1013904223u;
+            double t = double(i) / sampleRate;
+            double sample = 0.2 * std::sin(TwoPi * (220.0 + 110.0 * ch) * t) +
+                            0.15 * std::sin(TwoPi * 659.25 * t) +
+                            0.1 * std::sin(TwoPi * 1318.5 * t) +
+                            0.05 * (noise / 2147483648.0 - 1.0);
+            pcm[size_t(i) * channels + ch] = float(sample);
+        }
+    }
+    return pcm;
+}
+
+QJsonObject measure(const Kernel &kernel, const Options &options, Bench::CycleCounter &cycles)
+{
+    QElapsedTimer clock;
+
+    // Warm caches, branch predictors and the CPU clock before sampling
+    clock.start();
+    int warmupRuns = 0;
+    while (clock.nsecsElapsed() < options.warmupNs || warmupRuns < 3) {
+        kernel.run();
+        ++warmupRuns;
+    }
+
+    std::vector<double> nsPerUnit;
+    std::vector<double> cyclesPerUnit;
+    nsPerUnit.reserve(options.iterations);
+    cyclesPerUnit.reserve(options.iterations);
+
+    for (int i = 0; i < options.iterations; ++i) {
+        quint64 cycleStart = cycles.read();
+        clock.start();
+        kernel.run();
+        qint64 elapsed = clock.nsecsElapsed();
+        quint64 cycleEnd = cycles.read();
+
+        nsPerUnit.push_back(elapsed / kernel.unitsPerIteration);
+        if (cycles.isAvailable()) {
+            cyclesPerUnit.push_back((cycleEnd - cycleStart) / kernel.unitsPerIteration);
+        }
+    }
+
+    QJsonObject result{
+        {"name", kernel.name},
+        {"unit", kernel.unit},
+        {"units_per_iteration", kernel.unitsPerIteration},
+        {"iterations", options.iterations},
+        {"ns_per_unit", QJsonObject{
+            {"median", Bench::median(nsPerUnit)},
+            {"p99", Bench::percentile(nsPerUnit, 99.0)},
+            {"mad", Bench::medianAbsoluteDeviation(nsPerUnit)},
+            {"min", *std::min_element(nsPerUnit.begin(), nsPerUnit.end())}
+        }}
+    };
+    if (!cyclesPerUnit.empty()) {
+        result.insert("cycles_per_unit", QJsonObject{
+            {"median", Bench::median(cyclesPerUnit)},
+            {"p99", Bench::percentile(cyclesPerUnit, 99.0)},
+            {"mad", Bench::medianAbsoluteDeviation(cyclesPerUnit)}
+        });
+    }
+
+    std::fprintf(stderr, "%-40s %12.3f ns/%s  p99 %10.3f  mad %8.3f",
+                 qPrintable(kernel.name), Bench::median(nsPerUnit), qPrintable(kernel.unit),
+                 Bench::percentile(nsPerUnit, 99.0), Bench::medianAbsoluteDeviation(nsPerUnit));
+    if (!cyclesPerUnit.empty()) {
+        std::fprintf(stderr, "  %8.2f cycles/%s", Bench::median(cyclesPerUnit), qPrintable(kernel.unit));
+    }
+    std::fprintf(stderr, "\n");
+
+    return result;
+}
+
+// FlacStreamTranscoder::write_callback: planar FLAC integers to interleaved
+// float, and the dual-mono check before it
+void addPcmKernels(std::vector<Kernel> &kernels)
+{
+    struct Layout { int bits; int channels; };
+    for (Layout layout : {Layout{16, 1}, Layout{16, 2}, Layout{24, 2}, Layout{24, 6}}) {
+        auto planes = std::make_shared<std::vector<std::vector<FLAC__int32>>>(layout.channels);
+        auto pointers = std::make_shared<std::vector<const FLAC__int32*>>();
+        const int peak = (1 << (layout.bits - 1)) - 1;
+        quint32 state = 1;
+        for (auto &plane : *planes) {
+            plane.resize(FlacBlockFrames);
+            for (FLAC__int32 &value : plane) {
+                state = state * 1664525u + 1013904223u;
+                value = FLAC__int32(state % (2u * peak)) - peak;
+            }
+            pointers->push_back(plane.data());
+        }
+        auto out = std::make_shared<std::vector<float>>(size_t(FlacBlockFrames) * layout.channels);
+
+        kernels.push_back({
+            QString("pcm_to_float/%1bit/%2ch").arg(layout.bits).arg(layout.channels),
+            "sample", double(FlacBlockFrames) * layout.channels,
+            [=]() {
+                flacToInterleavedFloat(pointers->data(), layout.channels, FlacBlockFrames,
+                                       unsigned(layout.bits), out->data());
+                Bench::doNotOptimize(out->data());
+            }
+        });
+    }
+
+    // Dual-mono check on identical planes, the case that reads the whole block
+    auto plane = std::make_shared<std::vector<FLAC__int32>>(FlacBlockFrames);
+    std::iota(plane->begin(), plane->end(), -FlacBlockFrames / 2);
+    auto copy = std::make_shared<std::vector<FLAC__int32>>(*plane);
+    kernels.push_back({
+        "dual_mono_check", "sample", double(FlacBlockFrames) * 2,
+        [=]() {
+            bool identical = planesIdentical(plane->data(), copy->data(), FlacBlockFrames);
+            Bench::doNotOptimize(identical);
+        }
+    });
+}
+
+// LoudnessAnalyzer::process: K-weighting, gating blocks and true peak, in FLAC-sized blocks
+void addLoudnessKernels(std::vector<Kernel> &kernels)
+{
+    for (int channels : {1, 2, 6}) {
+        auto input = std::make_shared<std::vector<float>>(makeSignal(44100, channels, 44100));
+        auto analyzer = std::make_shared<LoudnessAnalyzer>();
+        analyzer->init(44100, channels);
+
+        kernels.push_back({
+            QString("loudness/%1ch").arg(channels),
+            "sample", 44100.0 * channels,
+            [=]() {
+                for (int offset = 0; offset < 44100; offset += FlacBlockFrames) {
+                    analyzer->process(input->data() + size_t(offset) * channels,
+                                      std::min(FlacBlockFrames, 44100 - offset));
+                }
+                LoudnessStats stats = analyzer->takeTrack();
+                Bench::doNotOptimize(stats.truePeak);
+            }
+        });
+    }
+}
+
+// StreamResampler: streaming src_process in decoder-sized blocks, one second per iteration
+void addResamplerKernels(std::vector<Kernel> &kernels)
+{
+    struct Tier { int quality; const char *name; };
+    const Tier tiers[] = {
+        {SRC_SINC_BEST_QUALITY, "sinc_best"},
+        {SRC_SINC_MEDIUM_QUALITY, "sinc_medium"},
+        {SRC_SINC_FASTEST, "sinc_fastest"},
+        {SRC_LINEAR, "linear"},
+    };
+
+    for (int inputRate : {44100, 96000}) {
+        auto input = std::make_shared<std::vector<float>>(makeSignal(inputRate, 2, inputRate));
+        for (const Tier &tier : tiers) {
+            int error = 0;
+            std::shared_ptr<SRC_STATE> state(src_new(tier.quality, 2, &error), src_delete);
+            if (!state) {
+                continue;
+            }
+            auto output = std::make_shared<std::vector<float>>(4096 * 2);
+            const double ratio = 48000.0 / inputRate;
+
+            kernels.push_back({
+                QString("resample/%1/%2").arg(tier.name).arg(inputRate),
+                "sample", double(inputRate) * 2,
+                [=]() {
+                    SRC_DATA data = {};
+                    data.src_ratio = ratio;
+                    for (long offset = 0; offset < inputRate;) {
+                        data.data_in = input->data() + offset * 2;
+                        data.input_frames = std::min<long>(FlacBlockFrames, inputRate - offset);
+                        data.data_out = output->data();
+                        data.output_frames = long(output->size() / 2);
+                        if (src_process(state.get(), &data) != 0) {
+                            break;
+                        }
+                        offset += data.input_frames_used;
+                    }
+                    Bench::doNotOptimize(output->data());
+                }
+            });
+        }
+    }
+}
+
+// libopus alone, at the settings OggOpusWriter uses: 20 ms frames, one second
+// per iteration. The writer's own framing and paging are not included.
+void addLibopusKernels(std::vector<Kernel> &kernels)
+{
+    const int frameSize = 960;
+    const int channels = 2;
+    auto input = std::make_shared<std::vector<float>>(makeSignal(48000, channels, 48000));
+
+    for (int complexity : {0, 5, 8, 10}) {
+        int error = 0;
+        std::shared_ptr<OpusEncoder> encoder(
+            opus_encoder_create(48000, channels, OPUS_APPLICATION_AUDIO, &error), opus_encoder_destroy);
+        if (error != OPUS_OK) {
+            continue;
+        }
+        opus_encoder_ctl(encoder.get(), OPUS_SET_BITRATE(128000));
+        opus_encoder_ctl(encoder.get(), OPUS_SET_COMPLEXITY(complexity));
+        opus_encoder_ctl(encoder.get(), OPUS_SET_VBR(1));
+        opus_encoder_ctl(encoder.get(), OPUS_SET_VBR_CONSTRAINT(0));
+
+        auto frame = std::make_shared<std::vector<float>>(size_t(frameSize) * channels);
+        auto packet = std::make_shared<std::vector<unsigned char>>(4000);
+
+        kernels.push_back({
+            QString("libopus_encode/complexity%1").arg(complexity),
+            "sample", 48000.0 * channels,
+            [=]() {
+                for (int offset = 0; offset < 48000; offset += frameSize) {
+                    std::memcpy(frame->data(), input->data() + size_t(offset) * channels,
+                                sizeof(float) * frameSize * channels);
+                    opus_int32 length = opus_encode_float(encoder.get(), frame->data(), frameSize,
+                                                          packet->data(), opus_int32(packet->size()));
+                    Bench::doNotOptimize(length);
+                }
+            }
+        });
+    }
+}
+
+// OpusHead/OpusTags construction, run once per output file
+void addHeaderKernels(std::vector<Kernel> &kernels)
+{
+    const int calls = 1000;
+    kernels.push_back({
+        "opus_headers", "call", double(calls),
+        []() {
+            for (int i = 0; i < calls; ++i) {
+                QByteArray header = OggOpusWriter::createOpusHeader(2, 312, 44100);
+                QByteArray comment = OggOpusWriter::createOpusComment();
+                Bench::doNotOptimize(header.constData());
+                Bench::doNotOptimize(comment.constData());
+            }
+        }
+    });
+}
+
+// libogg alone: packet in, pages out, for one second of 20 ms packets, the
+// way OggOpusWriter::writePages drives it
+void addLiboggKernels(std::vector<Kernel> &kernels)
+{
+    auto packet = std::make_shared<std::vector<unsigned char>>(320, 0x5a);
+    auto sink = std::make_shared<qint64>(0);
+
+    kernels.push_back({
+        "libogg_paging", "sample", 48000.0,
+        [=]() {
+            ogg_stream_state stream;
+            ogg_stream_init(&stream, 1);
+            ogg_page page;
+            for (int i = 0; i < 50; ++i) {
+                ogg_packet op;
+                op.packet = packet->data();
+                op.bytes = long(packet->size());
+                op.b_o_s = i == 0;
+                op.e_o_s = i == 49;
+                op.granulepos = (i + 1) * 960;
+                op.packetno = i;
+                ogg_stream_packetin(&stream, &op);
+                while (ogg_stream_pageout(&stream, &page)) {
+                    *sink += page.header_len + page.body_len;
+                }
+            }
+            while (ogg_stream_flush(&stream, &page)) {
+                *sink += page.header_len + page.body_len;
+            }
+            ogg_stream_clear(&stream);
+            Bench::doNotOptimize(*sink);
+        }
+    });
+}
+
+// MetadataHandler::embedOpusPicture: PICTURE block render plus base64
+void addPictureKernels(std::vector<Kernel> &kernels)
+{
+    auto handler = std::make_shared<MetadataHandler>();
+    for (int size : {64 * 1024, 512 * 1024, 4 * 1024 * 1024}) {
+        auto art = std::make_shared<QByteArray>(size, '\0');
+        quint32 state = 7;
+        for (int i = 0; i < size; ++i) {
+            state = state * 1664525u + 1013904223u;
+            (*art)[i] = char(state >> 24);
+        }
+
+        kernels.push_back({
+            QString("embed_picture/%1k").arg(size / 1024),
+            "byte", double(size),
+            [=]() {
+                TagLib::Ogg::XiphComment comment;
+                handler->embedOpusPicture(&comment, *art, "image/jpeg");
+                Bench::doNotOptimize(comment.fieldCount());
+            }
+        });
+    }
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("opus-ripper-kernel-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Micro-benchmarks for the conversion pipeline kernels.");
+    parser.addHelpOption();
+
+    QCommandLineOption cpuOption("cpu", "CPU to pin to, or -1 to leave scheduling alone.", "index", "0");
+    QCommandLineOption iterationsOption("iterations", "Timed iterations per kernel.", "count", "50");
+    QCommandLineOption warmupOption("warmup-ms", "Minimum warm-up time per kernel.", "ms", "300");
+    QCommandLineOption filterOption("filter", "Only run kernels whose name contains this text.", "text");
+    QCommandLineOption labelOption("label", "Free-form label stored in the report, e.g. a commit hash.", "text");
+    QCommandLineOption jsonOption("json", "Write the report to this file instead of stdout.", "path");
+    parser.addOptions({cpuOption, iterationsOption, warmupOption, filterOption, labelOption, jsonOption});
+    parser.process(app);
+
+    Options options;
+    options.iterations = qMax(5, parser.value(iterationsOption).toInt());
+    options.warmupNs = qint64(qMax(0, parser.value(warmupOption).toInt())) * 1000000;
+    options.filter = parser.value(filterOption);
+
+    const int cpu = parser.value(cpuOption).toInt();
+    const bool pinned = cpu >= 0 && Bench::pinToCpu(cpu);
+    if (cpu >= 0 && !pinned) {
+        std::fprintf(stderr, "Could not pin to CPU %d; results may be noisier\n", cpu);
+    }
+
+    Bench::CycleCounter cycles;
+    if (!cycles.isAvailable()) {
+        std::fprintf(stderr, "Cycle counter unavailable (perf events); reporting time only\n");
+    }
+
+    std::vector<Kernel> kernels;
+    addPcmKernels(kernels);
+    addLoudnessKernels(kernels);
+    addResamplerKernels(kernels);
+    addLibopusKernels(kernels);
+    addHeaderKernels(kernels);
+    addLiboggKernels(kernels);
+    addPictureKernels(kernels);
+
+    QJsonArray results;
+    for (const Kernel &kernel : kernels) {
+        if (!options.filter.isEmpty() && !kernel.name.contains(options.filter)) {
+            continue;
+        }
+        results.append(measure(kernel, options, cycles));
+    }
+
+    QJsonObject report{
+        {"benchmark", "kernels"},
+        {"label", parser.value(labelOption)},
+        {"qt_version", QString(qVersion())},
+        {"opus_version", QString(opus_get_version_string())},
+        {"samplerate_version", QString(src_get_version())},
+        {"cpu", pinned ? cpu : -1},
+        {"cycles_available", cycles.isAvailable()},
+        {"kernels", results}
+    };
+
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            std::fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value(jsonOption)));
+            return 1;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    return 0;
+}
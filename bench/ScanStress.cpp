@@ -0,0 +1,387 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "BenchUtils.h"
+#include "controllers/ConversionController.h"
+
+// Library-scale stress test for the scan and model path. It builds synthetic
+// trees (empty files, so tmpfs holds millions of them) and drives the real
+// controller headlessly: scan, rescan with a warm index, then a conversion
+// pass in which every file fails fast. Only the bookkeeping around the
+// encoder is exercised, which is where per-file costs that grow with library
+// size would show up.
+
+namespace {
+std::atomic<quint64> g_allocations{0};
+}
+
+// Count every C++ allocation in the process, Qt's included
+void *operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+struct TreeSpec {
+    int entries = 10000;
+    int depth = 3;
+    int fanout = 8;
+    double clutter = 0.25;   // Fraction of entries that are not FLAC
+};
+
+// Watches the main event loop with a short timer; any gap well beyond the
+// interval is time the GUI thread could not paint or handle input
+class StallMonitor : public QObject
+{
+public:
+    explicit StallMonitor(int intervalMs = 5)
+        : m_intervalMs(intervalMs)
+    {
+        m_timer.setInterval(intervalMs);
+        m_timer.setTimerType(Qt::PreciseTimer);
+        QObject::connect(&m_timer, &QTimer::timeout, this, [this]() {
+            qint64 gap = m_clock.restart();
+            qint64 stall = gap - m_intervalMs;
+            if (stall > m_intervalMs) {
+                m_totalMs += stall;
+                m_maxMs = qMax(m_maxMs, stall);
+            }
+        });
+    }
+
+    void start()
+    {
+        m_maxMs = 0;
+        m_totalMs = 0;
+        m_clock.start();
+        m_timer.start();
+    }
+
+    void stop() { m_timer.stop(); }
+    qint64 maxMs() const { return m_maxMs; }
+    qint64 totalMs() const { return m_totalMs; }
+
+private:
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    int m_intervalMs;
+    qint64 m_maxMs = 0;
+    qint64 m_totalMs = 0;
+};
+
+QString defaultRoot()
+{
+#ifdef Q_OS_LINUX
+    if (QFileInfo("/dev/shm").isWritable()) {
+        return "/dev/shm/opus-ripper-scan-stress";
+    }
+#endif
+    return QDir::temp().filePath("opus-ripper-scan-stress");
+}
+
+// Directories form a complete tree of the given depth and fan-out; entries are
+// dealt round-robin to the leaves. Returns the number of FLAC files created.
+int generateTree(const QString &root, const TreeSpec &spec, QString &error)
+{
+    QStringList leaves{root};
+    for (int level = 0; level < spec.depth; ++level) {
+        QStringList next;
+        for (const QString &parent : std::as_const(leaves)) {
+            for (int i = 0; i < spec.fanout; ++i) {
+                next.append(QString("%1/d%2_%3").arg(parent).arg(level).arg(i));
+            }
+        }
+        leaves = next;
+    }
+    for (const QString &leaf : std::as_const(leaves)) {
+        if (!QDir().mkpath(leaf)) {
+            error = QString("Cannot create %1").arg(leaf);
+            return -1;
+        }
+    }
+
+    static const char *const clutterSuffixes[] = {"jpg", "cue", "log", "txt", "m3u"};
+    quint32 state = 12345;
+    int flacFiles = 0;
+    for (int i = 0; i < spec.entries; ++i) {
+        state = state * 1664525u + 1013904223u;
+        const bool clutter = (state >> 8) % 10000 < quint32(spec.clutter * 10000);
+        const QString &leaf = leaves[i % leaves.size()];
+        QString path = clutter
+            ? QString("%1/extra %2.%3").arg(leaf).arg(i).arg(clutterSuffixes[state % 5])
+            : QString("%1/%2 - Track %3.flac").arg(leaf).arg(i / 12).arg(i % 12 + 1, 2, 10, QChar('0'));
+
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            error = QString("Cannot create %1: %2").arg(path, file.errorString());
+            return -1;
+        }
+        if (!clutter) {
+            flacFiles++;
+        }
+    }
+    return flacFiles;
+}
+
+struct Phase {
+    double wallMs = 0.0;
+    qint64 maxStallMs = 0;
+    qint64 totalStallMs = 0;
+    quint64 allocations = 0;
+};
+
+QJsonObject phaseObject(const Phase &phase, int files)
+{
+    return QJsonObject{
+        {"wall_ms", phase.wallMs},
+        {"us_per_file", files > 0 ? phase.wallMs * 1000.0 / files : 0.0},
+        {"max_stall_ms", phase.maxStallMs},
+        {"total_stall_ms", phase.totalStallMs},
+        {"allocations", double(phase.allocations)},
+        {"allocations_per_file", files > 0 ? double(phase.allocations) / files : 0.0}
+    };
+}
+
+// Run start() and spin the event loop until one of the finishing signals fires
+template <typename StartFn, typename Signal>
+Phase runPhase(ConversionController &controller, StallMonitor &monitor, StartFn start,
+               Signal finished, QString &error)
+{
+    QEventLoop loop;
+    QObject::connect(&controller, finished, &loop, [&loop]() { loop.quit(); });
+    QObject::connect(&controller, &ConversionController::scanError, &loop,
+                     [&](const QString &message) { error = message; loop.quit(); });
+    QObject::connect(&controller, &ConversionController::conversionError, &loop,
+                     [&](const QString &message) { error = message; loop.quit(); });
+
+    Phase phase;
+    quint64 allocationsBefore = g_allocations.load();
+    QElapsedTimer wall;
+    monitor.start();
+    wall.start();
+
+    // Queue the start so the monitor is already ticking when work begins
+    QTimer::singleShot(0, &controller, start);
+    loop.exec();
+
+    phase.wallMs = wall.nsecsElapsed() / 1e6;
+    monitor.stop();
+    phase.maxStallMs = monitor.maxMs();
+    phase.totalStallMs = monitor.totalMs();
+    phase.allocations = g_allocations.load() - allocationsBefore;
+    return phase;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    // Own cache location, so the library index never touches the real app's
+    app.setApplicationName("opus-ripper-scan-stress");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Scan and model stress test on synthetic directory trees.");
+    parser.addHelpOption();
+
+    QCommandLineOption rootOption("root", "Where the trees are generated (tmpfs recommended).", "path", defaultRoot());
+    QCommandLineOption entriesOption("entries", "Comma-separated tree sizes in directory entries.", "list", "10000,100000");
+    QCommandLineOption depthOption("depth", "Directory depth.", "levels", "3");
+    QCommandLineOption fanoutOption("fanout", "Subdirectories per directory.", "count", "8");
+    QCommandLineOption clutterOption("clutter", "Fraction of non-FLAC entries (0-1).", "ratio", "0.25");
+    QCommandLineOption threadsOption({"j", "threads"}, "Conversion threads for the model pass.", "count", "4");
+    QCommandLineOption maxGrowthOption("max-growth", "Fail when per-file cost grows by more than this factor "
+                                       "between the smallest and largest tree.", "factor", "3");
+    QCommandLineOption keepOption("keep", "Keep generated trees for the next run.");
+    QCommandLineOption labelOption("label", "Free-form label stored in the report, e.g. a commit hash.", "text");
+    QCommandLineOption jsonOption("json", "Write the report to this file instead of stdout.", "path");
+    parser.addOptions({rootOption, entriesOption, depthOption, fanoutOption, clutterOption, threadsOption,
+                       maxGrowthOption, keepOption, labelOption, jsonOption});
+    parser.process(app);
+
+    // Every file fails in the conversion pass; per-file log lines would
+    // dominate the timings
+    qInstallMessageHandler([](QtMsgType type, const QMessageLogContext &, const QString &message) {
+        if (type == QtCriticalMsg || type == QtFatalMsg) {
+            std::fprintf(stderr, "%s\n", qPrintable(message));
+        }
+    });
+
+    QList<int> sizes;
+    for (const QString &value : parser.value(entriesOption).split(',', Qt::SkipEmptyParts)) {
+        int entries = value.trimmed().toInt();
+        if (entries <= 0) {
+            std::fprintf(stderr, "Invalid tree size: %s\n", qPrintable(value));
+            return 2;
+        }
+        sizes.append(entries);
+    }
+    std::sort(sizes.begin(), sizes.end());
+
+    const QString root = parser.value(rootOption);
+    const double maxGrowth = parser.value(maxGrowthOption).toDouble();
+
+    QJsonArray trees;
+    QList<QJsonObject> phaseRecords;
+    QStringList regressions;
+
+    for (int entries : std::as_const(sizes)) {
+        TreeSpec spec;
+        spec.entries = entries;
+        spec.depth = qMax(0, parser.value(depthOption).toInt());
+        spec.fanout = qMax(1, parser.value(fanoutOption).toInt());
+        spec.clutter = qBound(0.0, parser.value(clutterOption).toDouble(), 1.0);
+
+        const QString treeName = QString("tree_%1_d%2_f%3_c%4")
+            .arg(entries).arg(spec.depth).arg(spec.fanout).arg(qRound(spec.clutter * 100));
+        const QString inputDir = QDir(root).filePath(treeName + "/input");
+        const QString outputDir = QDir(root).filePath(treeName + "/output");
+
+        // Trees are only kept complete; an interrupted generation is redone
+        QDir(QDir(root).filePath(treeName)).removeRecursively();
+        std::fprintf(stderr, "Generating %s\n", qPrintable(treeName));
+        QElapsedTimer generateClock;
+        generateClock.start();
+        QString error;
+        int flacFiles = generateTree(inputDir, spec, error);
+        if (flacFiles < 0) {
+            std::fprintf(stderr, "%s\n", qPrintable(error));
+            return 3;
+        }
+        const double generateSeconds = generateClock.nsecsElapsed() / 1e9;
+
+        StallMonitor monitor;
+        QJsonObject phases;
+        {
+            ConversionController controller;
+            controller.setInputDirectory(inputDir);
+            controller.setOutputDirectory(outputDir);
+            controller.setThreadCount(parser.value(threadsOption).toInt());
+
+            Phase scan = runPhase(controller, monitor, [&]() { controller.scanForFiles(); },
+                                  &ConversionController::scanCompleted, error);
+            Phase rescan = runPhase(controller, monitor, [&]() { controller.scanForFiles(); },
+                                    &ConversionController::scanCompleted, error);
+            Phase convert = runPhase(controller, monitor, [&]() { controller.startConversion(); },
+                                     &ConversionController::conversionCompleted, error);
+            if (!error.isEmpty()) {
+                std::fprintf(stderr, "%s\n", qPrintable(error));
+                return 3;
+            }
+            if (controller.filesFound() != flacFiles) {
+                std::fprintf(stderr, "Scan found %d files, expected %d\n", controller.filesFound(), flacFiles);
+                return 3;
+            }
+
+            phases.insert("scan", phaseObject(scan, flacFiles));
+            phases.insert("rescan", phaseObject(rescan, flacFiles));
+            phases.insert("convert", phaseObject(convert, flacFiles));
+
+            std::fprintf(stderr, "  %d files: scan %.0f ms, rescan %.0f ms, convert %.0f ms, "
+                         "max stall %lld/%lld/%lld ms\n",
+                         flacFiles, scan.wallMs, rescan.wallMs, convert.wallMs,
+                         scan.maxStallMs, rescan.maxStallMs, convert.maxStallMs);
+        }
+
+        phases.insert("files", flacFiles);
+        phaseRecords.append(phases);
+
+        trees.append(QJsonObject{
+            {"entries", entries},
+            {"flac_files", flacFiles},
+            {"depth", spec.depth},
+            {"fanout", spec.fanout},
+            {"clutter", spec.clutter},
+            {"generate_seconds", generateSeconds},
+            {"phases", phases},
+            {"peak_rss_kb", Bench::peakRssKb()}
+        });
+
+        if (!parser.isSet(keepOption)) {
+            QDir(QDir(root).filePath(treeName)).removeRecursively();
+        }
+    }
+
+    // Per-file cost should be flat in library size; a clear rise between the
+    // smallest and largest tree points at something superlinear
+    QJsonObject growth;
+    if (phaseRecords.size() >= 2) {
+        for (const char *name : {"scan", "rescan", "convert"}) {
+            double first = phaseRecords.first().value(name).toObject().value("us_per_file").toDouble();
+            double last = phaseRecords.last().value(name).toObject().value("us_per_file").toDouble();
+            double factor = first > 0.0 ? last / first : 0.0;
+            growth.insert(name, factor);
+            if (maxGrowth > 0.0 && factor > maxGrowth) {
+                regressions.append(QString("%1 cost per file grew %2x").arg(name).arg(factor, 0, 'f', 1));
+            }
+        }
+    }
+
+    QJsonObject report{
+        {"benchmark", "scan_stress"},
+        {"label", parser.value(labelOption)},
+        {"qt_version", QString(qVersion())},
+        {"root", root},
+        {"trees", trees},
+        {"per_file_growth", growth},
+        {"regressions", QJsonArray::fromStringList(regressions)}
+    };
+
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            std::fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value(jsonOption)));
+            return 3;
+        }
+    } else {
+        std::fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    for (const QString &regression : std::as_const(regressions)) {
+        std::fprintf(stderr, "Possible superlinear behaviour: %s\n", qPrintable(regression));
+    }
+    return regressions.isEmpty() ? 0 : 1;
+}
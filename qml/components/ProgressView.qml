@@ -34,7 +34,7 @@ Item {
                     Item { Layout.fillWidth: true }
                     
                     Label {
-                        text: model ? qsTr("%1 / %2").arg(model.filesCompleted).arg(model.totalFiles) : "0 / 0"
+                        text: model ? qsTr("%1 / %2").arg(model.filesCompleted + model.filesSkipped).arg(model.totalFiles) : "0 / 0"
                         font.pixelSize: Style.regularFontSize
                         color: Style.textSecondary
                     }
@@ -138,6 +138,12 @@ Item {
             }
         }
         
+        StatsPanel {
+            Layout.fillWidth: true
+            model: root.model
+            visible: model && model.isConverting
+        }
+        
         // File list
         ScrollView {
             Layout.fillWidth: true
@@ -165,13 +171,15 @@ Item {
                             height: 8
                             radius: 4
                             color: {
-                                switch(modelData.status) {
+                                switch(model.status) {
                                 case "pending":
                                     return Style.textSecondary
                                 case "converting":
                                     return Style.primaryColor
                                 case "completed":
                                     return Style.successColor
+                                case "skipped":
+                                    return Style.primaryLight
                                 case "failed":
                                     return Style.errorColor
                                 default:
@@ -182,17 +190,17 @@ Item {
                         
                         Label {
                             Layout.fillWidth: true
-                            text: modelData.fileName
+                            text: model.fileName
                             font.pixelSize: Style.smallFontSize
-                            color: modelData.status === "failed" ? Style.errorColor : Style.textPrimary
+                            color: model.status === "failed" ? Style.errorColor : Style.textPrimary
                             elide: Text.ElideMiddle
                         }
                         
                         Label {
-                            text: modelData.status === "converting" ? qsTr("%1%").arg(modelData.progress) : ""
+                            text: model.status === "converting" ? qsTr("%1%").arg(model.progress) : ""
                             font.pixelSize: Style.smallFontSize
                             color: Style.textSecondary
-                            visible: modelData.status === "converting"
+                            visible: model.status === "converting"
                         }
                     }
                     
@@ -202,8 +210,8 @@ Item {
                         hoverEnabled: true
                         
                         ToolTip {
-                            visible: mouseArea.containsMouse && modelData.error !== ""
-                            text: modelData.error
+                            visible: mouseArea.containsMouse && model.error !== ""
+                            text: model.error
                             delay: 500
                         }
                     }
@@ -164,6 +164,46 @@ Drawer {
                             }
                         }
                     }
+                    
+                    // Dual-mono stereo as one channel
+                    Switch {
+                        id: foldMonoSwitch
+                        text: qsTr("Encode identical stereo channels as mono")
+                        checked: controller ? controller.foldDualMono : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.foldDualMono = checked
+                            }
+                        }
+                    }
+                    
+                    // EBU R128 loudness, tagged as R128 track and album gain
+                    Switch {
+                        id: loudnessSwitch
+                        text: qsTr("Measure loudness (R128 gain tags)")
+                        checked: controller ? controller.analyzeLoudness : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.analyzeLoudness = checked
+                            }
+                        }
+                    }
+                    
+                    Switch {
+                        id: trackGainSwitch
+                        Layout.leftMargin: Style.largeSpacing
+                        visible: loudnessSwitch.checked
+                        text: qsTr("Apply track gain in the Opus header")
+                        checked: controller ? controller.applyTrackGain : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.applyTrackGain = checked
+                            }
+                        }
+                    }
                 }
             }
             
@@ -215,6 +255,126 @@ Drawer {
                         }
                     }
                     
+                    // Adaptive concurrency; the slider above becomes the ceiling
+                    Switch {
+                        id: adaptiveSwitch
+                        text: controller && controller.adaptiveConcurrency && controller.isConverting
+                              ? qsTr("Adapt to system load (now %1)").arg(controller.activeWorkerLimit)
+                              : qsTr("Adapt to system load")
+                        checked: controller ? controller.adaptiveConcurrency : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.adaptiveConcurrency = checked
+                            }
+                        }
+                    }
+                    
+                    ColumnLayout {
+                        Layout.fillWidth: true
+                        Layout.leftMargin: Style.largeSpacing
+                        spacing: Style.smallSpacing
+                        visible: adaptiveSwitch.checked
+                        
+                        Label {
+                            text: qsTr("Minimum Parallel Conversions")
+                            font.pixelSize: Style.regularFontSize
+                            color: Style.textPrimary
+                        }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Slider {
+                                id: minThreadSlider
+                                Layout.fillWidth: true
+                                from: 1
+                                to: threadSlider.value
+                                stepSize: 1
+                                value: controller ? controller.minThreadCount : 1
+                                
+                                onValueChanged: {
+                                    if (controller) {
+                                        controller.minThreadCount = value
+                                    }
+                                }
+                            }
+                            
+                            Label {
+                                Layout.preferredWidth: 60
+                                text: qsTr("%1").arg(minThreadSlider.value)
+                                font.pixelSize: Style.regularFontSize
+                                color: Style.textSecondary
+                                horizontalAlignment: Text.AlignRight
+                            }
+                        }
+                        
+                        Switch {
+                            id: yieldSwitch
+                            text: qsTr("Yield to other applications")
+                            checked: controller ? controller.yieldToForeground : false
+                            
+                            onToggled: {
+                                if (controller) {
+                                    controller.yieldToForeground = checked
+                                }
+                            }
+                        }
+                    }
+                    
+                    // Idle CPU and I/O priority for the conversion workers
+                    Switch {
+                        id: backgroundSwitch
+                        text: qsTr("Run in background")
+                        checked: controller ? controller.backgroundPriority : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.backgroundPriority = checked
+                            }
+                        }
+                    }
+                    
+                    // Estimated memory all running conversions may use together
+                    ColumnLayout {
+                        Layout.fillWidth: true
+                        spacing: Style.smallSpacing
+                        
+                        Label {
+                            text: qsTr("Memory Budget")
+                            font.pixelSize: Style.regularFontSize
+                            color: Style.textPrimary
+                        }
+                        
+                        RowLayout {
+                            Layout.fillWidth: true
+                            
+                            Slider {
+                                id: memoryBudgetSlider
+                                Layout.fillWidth: true
+                                from: 0
+                                to: 4096
+                                stepSize: 64
+                                value: controller ? controller.memoryBudgetMB : 0
+                                
+                                onValueChanged: {
+                                    if (controller) {
+                                        controller.memoryBudgetMB = value
+                                    }
+                                }
+                            }
+                            
+                            Label {
+                                Layout.preferredWidth: 60
+                                text: memoryBudgetSlider.value > 0 ? qsTr("%1 MB").arg(memoryBudgetSlider.value)
+                                                                   : qsTr("No limit")
+                                font.pixelSize: Style.regularFontSize
+                                color: Style.textSecondary
+                                horizontalAlignment: Text.AlignRight
+                            }
+                        }
+                    }
+                    
                     // Preserve folder structure
                     Switch {
                         id: preserveStructureSwitch
@@ -240,6 +400,45 @@ Drawer {
                             }
                         }
                     }
+                    
+                    // Output cache
+                    Switch {
+                        id: cacheSwitch
+                        text: qsTr("Reuse encodes of identical audio")
+                        checked: controller ? controller.useOutputCache : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.useOutputCache = checked
+                            }
+                        }
+                    }
+                    
+                    // Prune orphaned outputs
+                    Switch {
+                        id: pruneSwitch
+                        text: qsTr("Remove outputs whose source is gone")
+                        checked: controller ? controller.pruneOrphans : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.pruneOrphans = checked
+                            }
+                        }
+                    }
+                    
+                    // Watch mode
+                    Switch {
+                        id: watchSwitch
+                        text: qsTr("Watch input folder for new files")
+                        checked: controller ? controller.watchMode : false
+                        
+                        onToggled: {
+                            if (controller) {
+                                controller.watchMode = checked
+                            }
+                        }
+                    }
                 }
             }
             
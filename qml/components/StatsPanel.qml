@@ -0,0 +1,140 @@
+import QtQuick 2.15
+import QtQuick.Controls 2.15
+import QtQuick.Layouts 1.15
+import OpusRipperGUI 1.0
+
+// Live throughput and per-stage latency of the running batch
+Item {
+    id: root
+    
+    property ProgressModel model: null
+    
+    implicitHeight: content.implicitHeight
+    
+    ColumnLayout {
+        id: content
+        anchors.left: parent.left
+        anchors.right: parent.right
+        spacing: Style.smallSpacing
+        
+        RowLayout {
+            Layout.fillWidth: true
+            spacing: Style.mediumSpacing
+            
+            Label {
+                text: model ? qsTr("%1x realtime").arg(model.realtimeFactor.toFixed(1)) : ""
+                font.pixelSize: Style.regularFontSize
+                font.bold: true
+                color: Style.textPrimary
+            }
+            
+            Label {
+                text: model ? qsTr("read %1 MB/s").arg(model.readMBps.toFixed(1)) : ""
+                font.pixelSize: Style.smallFontSize
+                color: Style.textSecondary
+            }
+            
+            Label {
+                text: model ? qsTr("write %1 MB/s").arg(model.writeMBps.toFixed(1)) : ""
+                font.pixelSize: Style.smallFontSize
+                color: Style.textSecondary
+            }
+            
+            Item { Layout.fillWidth: true }
+            
+            Label {
+                text: model ? qsTr("workers %1% busy").arg(Math.round(model.averageUtilization * 100)) : ""
+                font.pixelSize: Style.smallFontSize
+                color: Style.textSecondary
+            }
+        }
+        
+        // Estimated memory of the running jobs, against the budget if there is one
+        Label {
+            text: !model ? ""
+                  : model.memoryBudgetMB > 0
+                    ? qsTr("memory %1 of %2 MB, peak %3 MB").arg(model.memoryInUseMB.toFixed(1))
+                          .arg(model.memoryBudgetMB.toFixed(0)).arg(model.memoryPeakMB.toFixed(1))
+                    : qsTr("memory %1 MB, peak %2 MB").arg(model.memoryInUseMB.toFixed(1))
+                          .arg(model.memoryPeakMB.toFixed(1))
+            font.pixelSize: Style.smallFontSize
+            color: Style.textSecondary
+        }
+        
+        // One bar per worker thread
+        Row {
+            Layout.fillWidth: true
+            Layout.preferredHeight: 16
+            spacing: 2
+            
+            Repeater {
+                model: root.model ? root.model.workerUtilization : []
+                
+                Rectangle {
+                    width: 10
+                    height: 16
+                    radius: 2
+                    color: Style.dividerColor
+                    
+                    Rectangle {
+                        anchors.bottom: parent.bottom
+                        width: parent.width
+                        height: parent.height * modelData
+                        radius: 2
+                        color: Style.primaryColor
+                    }
+                    
+                    ToolTip.visible: barMouse.containsMouse
+                    ToolTip.text: qsTr("Worker %1: %2% busy").arg(index + 1).arg(Math.round(modelData * 100))
+                    
+                    MouseArea {
+                        id: barMouse
+                        anchors.fill: parent
+                        hoverEnabled: true
+                    }
+                }
+            }
+        }
+        
+        // Stage latency percentiles, in milliseconds per file
+        GridLayout {
+            Layout.fillWidth: true
+            columns: 5
+            columnSpacing: Style.mediumSpacing
+            rowSpacing: 2
+            
+            Repeater {
+                model: [qsTr("Stage"), qsTr("Files"), qsTr("p50"), qsTr("p95"), qsTr("p99")]
+                
+                Label {
+                    text: modelData
+                    font.pixelSize: Style.smallFontSize
+                    font.bold: true
+                    color: Style.textSecondary
+                }
+            }
+            
+            Repeater {
+                model: root.model ? root.model.stageLatencies : []
+                
+                delegate: Repeater {
+                    property var stage: modelData
+                    model: [stage.stage, stage.count,
+                            formatMs(stage.p50), formatMs(stage.p95), formatMs(stage.p99)]
+                    
+                    Label {
+                        text: modelData
+                        font.pixelSize: Style.smallFontSize
+                        color: Style.textPrimary
+                    }
+                }
+            }
+        }
+    }
+    
+    function formatMs(ms) {
+        if (ms <= 0)
+            return "-"
+        return ms >= 1000 ? qsTr("%1 s").arg((ms / 1000).toFixed(2)) : qsTr("%1 ms").arg(ms.toFixed(1))
+    }
+}
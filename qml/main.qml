@@ -110,6 +110,22 @@ ApplicationWindow {
             
             Item { Layout.fillWidth: true }
             
+            Button {
+                id: pauseButton
+                text: conversionController.isPaused ? qsTr("Resume") : qsTr("Pause")
+                visible: conversionController.isConverting
+                
+                onClicked: {
+                    if (conversionController.isPaused) {
+                        conversionController.resumeConversion()
+                    } else {
+                        conversionController.pauseConversion()
+                    }
+                }
+                
+                Layout.preferredWidth: 150
+            }
+            
             Button {
                 id: convertButton
                 text: conversionController.isConverting ? qsTr("Stop") : qsTr("Start Conversion")
@@ -169,6 +185,26 @@ ApplicationWindow {
                 font.pixelSize: Style.smallFontSize
                 color: Style.textSecondary
             }
+            
+            Label {
+                visible: !conversionController.isConverting &&
+                         (conversionController.filesConverted + conversionController.filesSkipped + conversionController.filesPruned) > 0
+                text: {
+                    var summary = qsTr("%1 converted, %2 skipped, %3 pruned")
+                        .arg(conversionController.filesConverted)
+                        .arg(conversionController.filesSkipped)
+                        .arg(conversionController.filesPruned)
+                    if (conversionController.useOutputCache) {
+                        summary += qsTr(" | cache: %1 hits, %2 misses, %3 s saved")
+                            .arg(conversionController.cacheHits)
+                            .arg(conversionController.cacheMisses)
+                            .arg(conversionController.cacheSavedCpuSeconds.toFixed(1))
+                    }
+                    return summary
+                }
+                font.pixelSize: Style.smallFontSize
+                color: Style.textSecondary
+            }
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,524 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QTimer>
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+#include "controllers/ConversionController.h"
+#include "core/OpusEncoder.h"
+#include "core/OutputCache.h"
+#include "core/Rendition.h"
+#include "core/Tracer.h"
+#include "core/WorkerPriority.h"
+#include "server/MetricsExporter.h"
+#include "server/TranscodeServer.h"
+
+namespace {
+enum ExitCode {
+    ExitSuccess = 0,
+    ExitSomeFilesFailed = 1,
+    ExitUsageError = 2,
+    ExitRuntimeError = 3
+};
+
+volatile std::sig_atomic_t g_stopRequested = 0;
+
+void requestStop(int)
+{
+    g_stopRequested = 1;
+}
+
+#ifdef Q_OS_UNIX
+// SIGUSR1 pauses running conversions in place, SIGUSR2 resumes them
+volatile std::sig_atomic_t g_pauseRequested = 0;
+
+void requestPause(int signal)
+{
+    g_pauseRequested = signal == SIGUSR1 ? 1 : 0;
+}
+#endif
+
+// One compact JSON object per line on stdout; diagnostics go to stderr
+void emitEvent(const QString &event, QJsonObject fields = QJsonObject())
+{
+    fields.insert("event", event);
+    fields.insert("time", QDateTime::currentMSecsSinceEpoch());
+    QByteArray line = QJsonDocument(fields).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    std::fwrite(line.constData(), 1, line.size(), stdout);
+    std::fflush(stdout);
+}
+
+// Records spans while alive and writes them as a Chrome trace on the way out,
+// after everything declared later (the controller and its workers) is gone
+class TraceDump
+{
+public:
+    TraceDump(const QString &path, Tracer::Level level)
+        : m_path(path)
+    {
+        Tracer::setLevel(level);
+        Tracer::setThreadName("Main");
+    }
+
+    ~TraceDump()
+    {
+        Tracer::setLevel(Tracer::Off);
+        QString error;
+        if (!Tracer::writeChromeTrace(m_path, &error)) {
+            std::fprintf(stderr, "%s\n", qPrintable(error));
+        }
+    }
+
+private:
+    QString m_path;
+};
+
+// Decode FLAC from stdin and write Ogg Opus to stdout, e.g. curl ... | opus-ripper-cli - | upload
+int transcodePipe(int bitrate, int complexity, bool vbr)
+{
+    QFile output;
+    if (!output.open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        std::fprintf(stderr, "Cannot write to stdout: %s\n", qPrintable(output.errorString()));
+        return ExitRuntimeError;
+    }
+
+    OpusEncoderImpl encoder;
+    encoder.setBitrate(bitrate);
+    encoder.setComplexity(complexity);
+    encoder.setVbr(vbr);
+
+    if (!encoder.encodeStream(fileno(stdin), &output)) {
+        std::fprintf(stderr, "%s\n", qPrintable(encoder.getLastError()));
+        return ExitRuntimeError;
+    }
+
+    return ExitSuccess;
+}
+
+// Serve the library as on-demand Opus streams until SIGINT/SIGTERM
+int serveDirectory(const QString &rootDirectory, const QString &address, quint16 port, int maxStreams,
+                   int bitrate, int complexity, std::shared_ptr<OutputCache> cache)
+{
+    TranscodeServer server(rootDirectory);
+    server.setMaxStreams(maxStreams);
+    server.setDefaultBitrate(bitrate);
+    server.setComplexity(complexity);
+    server.setOutputCache(cache);
+
+    if (!server.listen(address, port)) {
+        emitEvent("error", {{"message", server.getLastError()}});
+        return ExitRuntimeError;
+    }
+
+    QObject::connect(&server, &TranscodeServer::requestFinished,
+                     [](const QString &path, int status, qint64 bytesSent, qint64 firstByteMs,
+                        qint64 elapsedMs, bool fromCache) {
+        emitEvent("request", {{"path", path}, {"status", status}, {"bytes", bytesSent},
+                              {"first_byte_ms", firstByteMs}, {"elapsed_ms", elapsedMs},
+                              {"cached", fromCache}});
+    });
+
+    emitEvent("serving", {{"root", rootDirectory}, {"address", address},
+                          {"port", server.serverPort()}, {"max_streams", server.maxStreams()}});
+
+    QTimer stopPoll;
+    QObject::connect(&stopPoll, &QTimer::timeout, [&]() {
+        if (g_stopRequested) {
+            stopPoll.stop();
+            server.close();
+            emitEvent("stopped", {{"rejected", server.rejectedRequests()}});
+            QCoreApplication::exit(ExitSuccess);
+        }
+    });
+    stopPoll.start(200);
+
+    return QCoreApplication::exec();
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // Same names as the GUI so both front ends share the library index and encode cache
+    app.setOrganizationName("OpusRipper");
+    app.setOrganizationDomain("opusripper.local");
+    app.setApplicationName("Opus Ripper GUI");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Batch convert a FLAC library to Opus without a display.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Directory to scan for FLAC files, or - to read one FLAC stream from stdin.");
+    parser.addPositionalArgument("output", "Directory to write Opus files to, or - for stdout.");
+
+    QCommandLineOption bitrateOption({"b", "bitrate"}, "Target bitrate in kbps (6-510).", "kbps", "128");
+    QCommandLineOption complexityOption({"c", "complexity"}, "Encoder complexity (0-10).", "level", "10");
+    QCommandLineOption cbrOption("cbr", "Use constant bitrate instead of VBR.");
+    QCommandLineOption threadsOption({"j", "threads"}, "Number of parallel conversions.", "count",
+                                     QString::number(QThread::idealThreadCount()));
+    QCommandLineOption adaptiveOption("adaptive", "Vary the number of parallel conversions with system load; -j is the maximum.");
+    QCommandLineOption minThreadsOption("min-threads", "Fewest parallel conversions --adaptive may drop to.", "count", "1");
+    QCommandLineOption yieldOption("yield", "With --adaptive, also back off when other processes wait for CPU.");
+    QCommandLineOption backgroundOption("background", "Run conversions at idle CPU and I/O priority (SCHED_IDLE, idle I/O class).");
+    QCommandLineOption niceOption("nice", "Like --background, but at this nice level (1-19) with low best-effort I/O.", "level");
+    QCommandLineOption cpusOption("cpus", "Pin conversion workers to these CPUs, e.g. 0-3,8.", "list");
+    QCommandLineOption numaNodeOption("numa-node", "Pin conversion workers, and their buffers, to this NUMA node.", "node");
+    QCommandLineOption memoryBudgetOption("memory-budget", "Only run conversions together while their estimated memory fits in this many MB.", "MB", "0");
+    QCommandLineOption renditionOption("rendition", "Also encode every file with these settings into DIR, from the same decode. Repeatable; left-out settings follow -b, -c and --cbr.", "kbps[,cN][,cbr]:dir");
+    QCommandLineOption parallelRenditionsOption("parallel-renditions", "Run the encoders of the renditions of a file on separate threads.");
+    QCommandLineOption loudnessOption("loudness", "Measure EBU R128 loudness while encoding and tag R128_TRACK_GAIN and R128_ALBUM_GAIN.");
+    QCommandLineOption outputGainOption("output-gain", "With --loudness, put the track gain into the Opus header output gain.");
+    QCommandLineOption foldMonoOption("fold-mono", "Encode stereo files whose channels are identical as mono.");
+    QCommandLineOption flatOption("flat", "Write all outputs into the output directory instead of mirroring the input tree.");
+    QCommandLineOption overwriteOption("overwrite", "Replace existing outputs.");
+    QCommandLineOption pruneOption("prune", "Remove outputs whose source was deleted since an earlier scan.");
+    QCommandLineOption cacheOption("cache", "Reuse encodes of identical audio.");
+    QCommandLineOption cacheDirOption("cache-dir", "Directory for the encode cache (implies --cache).", "path");
+    QCommandLineOption watchOption("watch", "Keep running and convert files as they appear in the input directory.");
+    QCommandLineOption serveOption("serve", "Serve the input directory as Opus over HTTP on this port instead of converting it.", "port");
+    QCommandLineOption listenOption("listen", "Address for --serve to bind to.", "address", "127.0.0.1");
+    QCommandLineOption traceOption("trace", "Write a Chrome trace (open in ui.perfetto.dev) to this file on exit.", "path");
+    QCommandLineOption traceLevelOption("trace-level", "Trace detail: files, or blocks for every frame.", "level", "files");
+    QCommandLineOption reportDirOption("report-dir", "Directory for the per-batch JSON and CSV reports.", "path");
+    QCommandLineOption metricsPortOption("metrics-port", "Serve Prometheus metrics on 127.0.0.1:<port>/metrics.", "port");
+    QCommandLineOption metricsFileOption("metrics-textfile", "Keep Prometheus metrics in this file for node_exporter's textfile collector.", "path");
+    parser.addOptions({bitrateOption, complexityOption, cbrOption, threadsOption,
+                       adaptiveOption, minThreadsOption, yieldOption, backgroundOption,
+                       niceOption, cpusOption, numaNodeOption, memoryBudgetOption, renditionOption,
+                       parallelRenditionsOption, loudnessOption, outputGainOption, foldMonoOption, flatOption,
+                       overwriteOption, pruneOption, cacheOption, cacheDirOption, watchOption,
+                       serveOption, listenOption, traceOption, traceLevelOption,
+                       reportDirOption, metricsPortOption, metricsFileOption});
+
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    const bool pipeMode = arguments.value(0) == "-";
+    const bool serveMode = parser.isSet(serveOption);
+    bool argumentsOk;
+    if (pipeMode) {
+        argumentsOk = arguments.size() <= 2 && arguments.value(1, "-") == "-";
+    } else if (serveMode) {
+        argumentsOk = arguments.size() == 1;
+    } else {
+        argumentsOk = arguments.size() == 2;
+    }
+    if (!argumentsOk) {
+        std::fputs(qPrintable(parser.helpText()), stderr);
+        return ExitUsageError;
+    }
+
+    bool bitrateOk = false;
+    bool complexityOk = false;
+    bool threadsOk = false;
+    int bitrate = parser.value(bitrateOption).toInt(&bitrateOk);
+    int complexity = parser.value(complexityOption).toInt(&complexityOk);
+    int threads = parser.value(threadsOption).toInt(&threadsOk);
+    bool minThreadsOk = false;
+    int minThreads = parser.value(minThreadsOption).toInt(&minThreadsOk);
+
+    if (!bitrateOk || bitrate < 6 || bitrate > 510 ||
+        !complexityOk || complexity < 0 || complexity > 10 ||
+        !threadsOk || threads < 1 || !minThreadsOk || minThreads < 1 || minThreads > threads) {
+        std::fputs("Invalid bitrate, complexity or thread count\n", stderr);
+        return ExitUsageError;
+    }
+
+    bool memoryBudgetOk = false;
+    const int memoryBudget = parser.value(memoryBudgetOption).toInt(&memoryBudgetOk);
+    if (!memoryBudgetOk || memoryBudget < 0) {
+        std::fputs("Invalid memory budget\n", stderr);
+        return ExitUsageError;
+    }
+
+    WorkerPriority priority;
+    priority.background = parser.isSet(backgroundOption) || parser.isSet(niceOption);
+    if (parser.isSet(niceOption)) {
+        bool niceOk = false;
+        priority.niceLevel = parser.value(niceOption).toInt(&niceOk);
+        if (!niceOk || priority.niceLevel < 1 || priority.niceLevel > 19) {
+            std::fputs("Invalid nice level, use 1-19\n", stderr);
+            return ExitUsageError;
+        }
+    }
+    if (parser.isSet(cpusOption)) {
+        bool cpusOk = false;
+        priority.cpus = WorkerPriority::parseCpuList(parser.value(cpusOption), &cpusOk);
+        if (!cpusOk) {
+            std::fputs("Invalid CPU list\n", stderr);
+            return ExitUsageError;
+        }
+    }
+    if (parser.isSet(numaNodeOption)) {
+        bool nodeOk = false;
+        priority.numaNode = parser.value(numaNodeOption).toInt(&nodeOk);
+        if (!nodeOk || WorkerPriority::numaNodeCpus(priority.numaNode).isEmpty()) {
+            std::fputs("Invalid or unknown NUMA node\n", stderr);
+            return ExitUsageError;
+        }
+    }
+
+    const QString traceLevel = parser.value(traceLevelOption);
+    if (traceLevel != "files" && traceLevel != "blocks") {
+        std::fputs("Invalid trace level, use files or blocks\n", stderr);
+        return ExitUsageError;
+    }
+    std::unique_ptr<TraceDump> traceDump;
+    if (parser.isSet(traceOption)) {
+        traceDump = std::make_unique<TraceDump>(parser.value(traceOption),
+                                                traceLevel == "blocks" ? Tracer::Blocks : Tracer::Files);
+    }
+
+    if (pipeMode) {
+        return transcodePipe(bitrate * 1000, complexity, !parser.isSet(cbrOption));
+    }
+
+    QFileInfo inputInfo(arguments.at(0));
+    if (!inputInfo.isDir()) {
+        std::fprintf(stderr, "Input directory does not exist: %s\n", qPrintable(arguments.at(0)));
+        return ExitUsageError;
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+#ifdef Q_OS_UNIX
+    std::signal(SIGUSR1, requestPause);
+    std::signal(SIGUSR2, requestPause);
+#endif
+
+    if (serveMode) {
+        bool portOk = false;
+        quint16 port = parser.value(serveOption).toUShort(&portOk);
+        if (!portOk) {
+            std::fputs("Invalid port\n", stderr);
+            return ExitUsageError;
+        }
+
+        std::shared_ptr<OutputCache> cache;
+        if (parser.isSet(cacheOption) || parser.isSet(cacheDirOption)) {
+            cache = std::make_shared<OutputCache>(parser.value(cacheDirOption));
+        }
+
+        // Each stream takes one worker; -j bounds the concurrent streams
+        return serveDirectory(inputInfo.absoluteFilePath(), parser.value(listenOption), port,
+                              threads, bitrate * 1000, complexity, cache);
+    }
+
+    const QString outputDirectory = QFileInfo(arguments.at(1)).absoluteFilePath();
+    Rendition primary;
+    primary.outputDirectory = outputDirectory;
+    primary.bitrate = bitrate * 1000;
+    primary.complexity = complexity;
+    primary.vbr = !parser.isSet(cbrOption);
+    QList<Rendition> renditions;
+    QStringList outputRoots = {QDir::cleanPath(outputDirectory)};
+    for (const QString &spec : parser.values(renditionOption)) {
+        Rendition rendition;
+        QString error;
+        if (!Rendition::parse(spec, primary, rendition, &error)) {
+            std::fprintf(stderr, "%s\n", qPrintable(error));
+            return ExitUsageError;
+        }
+        // Every tree gets its own root, not shared with or nested in another;
+        // two writers on the same .part would corrupt both outputs
+        rendition.outputDirectory = QDir::cleanPath(QFileInfo(rendition.outputDirectory).absoluteFilePath());
+        for (const QString &root : std::as_const(outputRoots)) {
+            if (rendition.outputDirectory == root || rendition.outputDirectory.startsWith(root + '/') ||
+                root.startsWith(rendition.outputDirectory + '/')) {
+                std::fprintf(stderr, "Rendition directory %s overlaps %s\n",
+                             qPrintable(rendition.outputDirectory), qPrintable(root));
+                return ExitUsageError;
+            }
+        }
+        outputRoots.append(rendition.outputDirectory);
+        renditions.append(rendition);
+    }
+
+    if (parser.isSet(outputGainOption) && !parser.isSet(loudnessOption)) {
+        std::fputs("--output-gain requires --loudness\n", stderr);
+        return ExitUsageError;
+    }
+
+    ConversionController controller;
+    controller.setInputDirectory(inputInfo.absoluteFilePath());
+    controller.setOutputDirectory(outputDirectory);
+    controller.setBitrate(bitrate * 1000);
+    controller.setComplexity(complexity);
+    controller.setVbr(!parser.isSet(cbrOption));
+    controller.setThreadCount(threads);
+    controller.setAdaptiveConcurrency(parser.isSet(adaptiveOption));
+    controller.setMinThreadCount(minThreads);
+    controller.setYieldToForeground(parser.isSet(yieldOption));
+    controller.setWorkerPriority(priority);
+    controller.setMemoryBudgetMB(memoryBudget);
+    controller.setRenditions(renditions);
+    controller.setParallelRenditions(parser.isSet(parallelRenditionsOption));
+    controller.setAnalyzeLoudness(parser.isSet(loudnessOption));
+    controller.setApplyTrackGain(parser.isSet(outputGainOption));
+    controller.setFoldDualMono(parser.isSet(foldMonoOption));
+    controller.setPreserveFolderStructure(!parser.isSet(flatOption));
+    controller.setOverwriteExisting(parser.isSet(overwriteOption));
+    controller.setPruneOrphans(parser.isSet(pruneOption));
+    controller.setUseOutputCache(parser.isSet(cacheOption) || parser.isSet(cacheDirOption));
+    controller.setOutputCacheDirectory(parser.value(cacheDirOption));
+    controller.setReportDirectory(parser.value(reportDirOption));
+    
+    // Loopback only: the endpoint has no authentication
+    MetricsExporter metricsExporter(controller.metrics());
+    if (parser.isSet(metricsPortOption)) {
+        bool portOk = false;
+        quint16 port = parser.value(metricsPortOption).toUShort(&portOk);
+        if (!portOk) {
+            std::fputs("Invalid metrics port\n", stderr);
+            return ExitUsageError;
+        }
+        if (!metricsExporter.listen("127.0.0.1", port)) {
+            emitEvent("error", {{"message", metricsExporter.getLastError()}});
+            return ExitRuntimeError;
+        }
+        emitEvent("metrics_listening", {{"port", metricsExporter.serverPort()}});
+    }
+    if (parser.isSet(metricsFileOption) && !metricsExporter.startTextfile(parser.value(metricsFileOption))) {
+        emitEvent("error", {{"message", metricsExporter.getLastError()}});
+        return ExitRuntimeError;
+    }
+
+    const bool watch = parser.isSet(watchOption);
+    int exitCode = ExitSuccess;
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QObject::connect(&controller, &ConversionController::scanStarted, [&]() {
+        emitEvent("scan_started", {{"input", controller.inputDirectory()}});
+    });
+
+    QObject::connect(&controller, &ConversionController::scanError, [&](const QString &error) {
+        emitEvent("error", {{"message", error}});
+        // Watch errors (e.g. running out of inotify watches) are not fatal once running
+        if (controller.isScanning() || !watch) {
+            QCoreApplication::exit(ExitRuntimeError);
+        }
+    });
+
+    QObject::connect(&controller, &ConversionController::conversionError, [&](const QString &error) {
+        emitEvent("error", {{"message", error}});
+        QCoreApplication::exit(ExitRuntimeError);
+    });
+
+    QObject::connect(&controller, &ConversionController::scanCompleted, [&](int filesFound) {
+        emitEvent("scan_completed", {{"files", filesFound}, {"elapsed_ms", elapsed.elapsed()}});
+
+        if (watch) {
+            controller.setWatchMode(true);
+            emitEvent("watching", {{"input", controller.inputDirectory()}});
+        }
+
+        if (filesFound > 0) {
+            controller.startConversion();
+        } else if (!watch) {
+            emitEvent("summary", {{"converted", 0}, {"skipped", 0}, {"failed", 0}, {"pruned", 0},
+                                  {"elapsed_ms", elapsed.elapsed()}});
+            QCoreApplication::exit(ExitSuccess);
+        }
+    });
+
+    QObject::connect(&controller, &ConversionController::conversionStarted, [&]() {
+        emitEvent("conversion_started", {{"files", controller.filesFound()},
+                                         {"skipped", controller.filesSkipped()},
+                                         {"resumed", controller.filesResumed()}});
+    });
+
+    QObject::connect(&controller, &ConversionController::fileConverted,
+                     [&](const QString &inputFile, const QString &outputFile) {
+        emitEvent("file", {{"status", "converted"}, {"input", inputFile}, {"output", outputFile},
+                           {"completed", controller.filesCompleted()}, {"total", controller.filesFound()},
+                           {"progress", controller.progressModel()->overallProgress()},
+                           {"eta_s", controller.progressModel()->etaSeconds()}});
+    });
+
+    QObject::connect(&controller, &ConversionController::fileFailed,
+                     [&](const QString &inputFile, const QString &error) {
+        emitEvent("file", {{"status", "failed"}, {"input", inputFile}, {"error", error},
+                           {"completed", controller.filesCompleted()}, {"total", controller.filesFound()},
+                           {"progress", controller.progressModel()->overallProgress()},
+                           {"eta_s", controller.progressModel()->etaSeconds()}});
+    });
+
+    QObject::connect(&controller, &ConversionController::activeWorkerLimitChanged, [&]() {
+        if (controller.isConverting() && controller.adaptiveConcurrency()) {
+            emitEvent("concurrency", {{"limit", controller.activeWorkerLimit()},
+                                      {"reason", controller.concurrencyReason()}});
+        }
+    });
+
+    QObject::connect(&controller, &ConversionController::reportWritten, [&](const QString &jsonPath) {
+        emitEvent("report", {{"path", jsonPath}});
+    });
+
+    QObject::connect(&controller, &ConversionController::conversionSummary,
+                     [&](int converted, int skipped, int failed, int pruned) {
+        QJsonObject summary{{"converted", converted}, {"skipped", skipped}, {"failed", failed},
+                            {"pruned", pruned}, {"elapsed_ms", elapsed.elapsed()}};
+        if (controller.useOutputCache()) {
+            summary.insert("cache_hits", controller.cacheHits());
+            summary.insert("cache_misses", controller.cacheMisses());
+            summary.insert("cache_saved_cpu_seconds", controller.cacheSavedCpuSeconds());
+        }
+        summary.insert("memory_peak_mb", double(controller.memoryPeakBytes()) / (1024 * 1024));
+        emitEvent("summary", summary);
+
+        if (failed > 0) {
+            exitCode = ExitSomeFilesFailed;
+        }
+        if (!watch) {
+            QCoreApplication::exit(exitCode);
+        }
+    });
+
+    QObject::connect(&controller, &ConversionController::isPausedChanged, [&]() {
+        if (!controller.isConverting()) {
+            return;
+        }
+        emitEvent(controller.isPaused() ? "paused" : "resumed",
+                  {{"completed", controller.filesCompleted()}, {"total", controller.filesFound()}});
+    });
+
+    // SIGINT/SIGTERM cancel running conversions at their next FLAC block.
+    // Their partial outputs are removed and the journal keeps them as
+    // interrupted, so the next run converts them again.
+    QTimer stopPoll;
+    QObject::connect(&stopPoll, &QTimer::timeout, [&]() {
+#ifdef Q_OS_UNIX
+        if (bool(g_pauseRequested) != controller.isPaused()) {
+            if (g_pauseRequested) {
+                controller.pauseConversion();
+            } else {
+                controller.resumeConversion();
+            }
+        }
+#endif
+        if (g_stopRequested) {
+            stopPoll.stop();
+            controller.setWatchMode(false);
+            controller.stopConversion();
+            emitEvent("stopped", {{"completed", controller.filesCompleted()}, {"total", controller.filesFound()}});
+            QCoreApplication::exit(exitCode);
+        }
+    });
+    stopPoll.start(200);
+
+    QTimer::singleShot(0, &controller, &ConversionController::scanForFiles);
+
+    return app.exec();
+}
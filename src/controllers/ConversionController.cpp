@@ -1,41 +1,111 @@
 #include "ConversionController.h"
 #include "core/FileScanner.h"
+#include "core/AlbumGain.h"
+#include "core/ConcurrencyGovernor.h"
+#include "core/JobJournal.h"
+#include "core/LibraryIndex.h"
+#include "core/OutputCache.h"
+#include "core/DirectoryWatcher.h"
 #include "core/AudioConverter.h"
+#include "core/BatchReport.h"
+#include "core/CancellationToken.h"
+#include "core/CueSheet.h"
+#include "core/ConversionMetrics.h"
+#include "core/Tracer.h"
 #include "models/ConversionModel.h"
 #include "models/ProgressModel.h"
 #include <QDir>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QSet>
 #include <QRunnable>
 #include <QDebug>
 #include <QCoreApplication>
+#include <algorithm>
+#include <utility>
+
+// Settings and shared state that every file of a batch runs with
+struct BatchContext {
+    int bitrate = 0;
+    int complexity = 0;
+    bool vbr = false;
+    std::shared_ptr<OutputCache> outputCache;
+    std::shared_ptr<ConversionMetrics> metrics;
+    std::shared_ptr<BatchReport> report;
+    std::shared_ptr<JobJournal> journal;
+    std::shared_ptr<CancellationToken> token;
+    WorkerPriority priority;
+    QList<Rendition> renditions;
+    bool parallelRenditions = false;
+    bool analyzeLoudness = false;
+    bool applyTrackGain = false;
+    std::shared_ptr<AlbumGain> albumGain;
+    bool foldDualMono = false;
+};
 
 class ConversionRunnable : public QRunnable
 {
 public:
-    ConversionRunnable(ConversionController *controller, const ConversionItem &item, 
-                      int index, int total, int bitrate, int complexity, bool vbr)
+    ConversionRunnable(ConversionController *controller, std::shared_ptr<const BatchContext> batch,
+                      const ConversionItem &item, int index, int total, const QStringList &renditionPaths)
         : m_controller(controller)
+        , m_batch(std::move(batch))
         , m_item(item)
         , m_index(index)
         , m_total(total)
-        , m_bitrate(bitrate)
-        , m_complexity(complexity)
-        , m_vbr(vbr)
+        , m_renditionPaths(renditionPaths)
+        , m_metrics(m_batch->metrics.get())
+        , m_journal(m_batch->journal.get())
+        , m_albumGain(m_batch->albumGain.get())
+        , m_dispatchedNs(m_metrics->now())
+        , m_queuedNs(Tracer::isEnabled() ? Tracer::now() : -1)
     {
         setAutoDelete(true);
     }
     
     void run() override
     {
+        // Time spent waiting for a free worker shows up as its own span
+        if (m_queuedNs >= 0) {
+            Tracer::record("queue_wait", "pool", m_queuedNs, Tracer::now(), m_index);
+        }
+        // Pool threads are shared by every batch, so the policy is checked per file
+        QString priorityError;
+        if (!m_batch->priority.applyToCurrentThread(&priorityError)) {
+            static std::atomic<bool> warned{false};
+            if (!warned.exchange(true)) {
+                qWarning().noquote() << priorityError;
+            }
+        }
+        
+        TraceSpan span("convert_file", "worker");
+        span.setValue(m_index);
+        m_metrics->workerStarted(m_dispatchedNs);
+        
         // Create converter in the worker thread
         AudioConverter converter;
-        converter.setBitrate(m_bitrate);
-        converter.setComplexity(m_complexity);
-        converter.setVbr(m_vbr);
+        converter.setBitrate(m_batch->bitrate);
+        converter.setComplexity(m_batch->complexity);
+        converter.setVbr(m_batch->vbr);
+        converter.setOutputCache(m_batch->outputCache.get());
+        converter.setCancellationToken(m_batch->token.get());
+        converter.setParallelRenditions(m_batch->parallelRenditions, m_batch->priority);
+        converter.setAnalyzeLoudness(m_batch->analyzeLoudness, m_batch->applyTrackGain);
+        converter.setFoldDualMono(m_batch->foldDualMono);
         
-        // Connect signals - progress updates
+        // Connect signals - progress updates. The audio they stand for feeds
+        // the governor's throughput before the file is done. Progress only
+        // drops when a file starts over, and then the audio is taken back.
+        const double audioSeconds = ConversionModel::audioSeconds(m_item);
+        int reportedProgress = 0;
         QObject::connect(&converter, &AudioConverter::conversionProgress,
-                        [this](int progress) {
+                        [this, audioSeconds, &reportedProgress](int progress) {
+                            progress = qBound(0, progress, 100);
+                            if (progress != reportedProgress) {
+                                m_metrics->addProgressAudio(audioSeconds * (progress - reportedProgress) / 100.0);
+                                reportedProgress = progress;
+                            }
                             QString path = m_item.inputPath;
                             QMetaObject::invokeMethod(m_controller, "updateFileProgress", 
                                                     Qt::QueuedConnection,
@@ -48,15 +118,97 @@ public:
         task.outputPath = m_item.outputPath;
         task.index = m_index;
         task.total = m_total;
+        task.streamInfo = m_item.streamInfo;
+        task.albumImage = m_item.isAlbumImage();
+        task.cueSheetPath = m_item.cueSheetPath;
+        task.renditions = m_batch->renditions;
+        task.renditionPaths = m_renditionPaths;
         
         // Perform the conversion
         converter.convertFile(task);
         
+        // A stopped job is neither a failure nor a commit. It stays "started"
+        // in the journal, so resuming the batch converts it again.
+        if (converter.wasCancelled()) {
+            if (m_albumGain) {
+                m_albumGain->dropTrack(AlbumGain::albumOf(m_item.outputPath));
+            }
+            m_metrics->workerFinished();
+            QMetaObject::invokeMethod(m_controller, "onConversionCancelled",
+                                    Qt::QueuedConnection,
+                                    Q_ARG(QString, m_item.inputPath));
+            return;
+        }
+        
         // Notify completion on the main thread
         QString errorMsg = converter.getLastError();
         QString inputPath = m_item.inputPath;
         QString outputPath = m_item.outputPath;
         
+        // The last track of a directory rewrites the album gain of all of
+        // them, before the job is committed so resuming never sees it half done
+        if (m_albumGain && !m_item.isAlbumImage()) {
+            const QString album = AlbumGain::albumOf(outputPath);
+            QList<AlbumGain::Track> tracks;
+            LoudnessStats albumStats;
+            const AlbumGain::Track track{m_item.relativePath, QStringList{outputPath} + m_renditionPaths,
+                                         converter.lastStats().headerGain};
+            if (!errorMsg.isEmpty() || !converter.lastStats().loudnessMeasured) {
+                m_albumGain->dropTrack(album);
+            } else if (m_albumGain->addTrack(album, track, converter.lastLoudness(), &tracks, &albumStats)) {
+                TraceSpan albumSpan("album_gain", "worker");
+                QString albumError;
+                if (!AlbumGain::writeAlbumGain(tracks, albumStats, &albumError)) {
+                    qWarning().noquote() << albumError;
+                }
+                // The added tag changes the size the journal recorded for the
+                // tracks that finished earlier
+                if (m_journal) {
+                    for (const AlbumGain::Track &albumTrack : std::as_const(tracks)) {
+                        if (albumTrack.relativePath != m_item.relativePath) {
+                            const QString albumOutput = albumTrack.outputPaths.first();
+                            m_journal->jobCommitted(albumTrack.relativePath, albumOutput,
+                                                    AudioConverter::outputSize(albumOutput));
+                        }
+                    }
+                }
+            }
+        }
+        
+        // The journal commits the primary output; metrics and the report count
+        // the bytes of every rendition
+        const qint64 outputSize = errorMsg.isEmpty() ? AudioConverter::outputSize(outputPath) : 0;
+        qint64 totalOutputSize = outputSize;
+        if (errorMsg.isEmpty()) {
+            for (const QString &renditionPath : std::as_const(m_renditionPaths)) {
+                totalOutputSize += AudioConverter::outputSize(renditionPath);
+            }
+        }
+        if (m_journal) {
+            if (errorMsg.isEmpty()) {
+                m_journal->jobCommitted(m_item.relativePath, outputPath, outputSize);
+            } else {
+                m_journal->jobFailed(m_item.relativePath);
+            }
+        }
+        if (errorMsg.isEmpty()) {
+            m_metrics->recordFile(converter.lastStats(), m_item.fileSize, totalOutputSize);
+        } else {
+            m_metrics->recordFailure();
+        }
+        m_metrics->workerFinished();
+        
+        if (m_batch->report) {
+            BatchJobRecord record;
+            record.inputPath = inputPath;
+            record.outputPath = outputPath;
+            record.inputBytes = m_item.fileSize;
+            record.outputBytes = totalOutputSize;
+            record.stats = converter.lastStats();
+            record.error = errorMsg;
+            m_batch->report->addJob(record);
+        }
+        
         // Use a more traditional approach to avoid lambda issues
         if (errorMsg.isEmpty()) {
             QMetaObject::invokeMethod(m_controller, "onFileConverted", 
@@ -74,12 +226,17 @@ public:
     
 private:
     ConversionController *m_controller;
+    std::shared_ptr<const BatchContext> m_batch;
     ConversionItem m_item;
     int m_index;
     int m_total;
-    int m_bitrate;
-    int m_complexity;
-    bool m_vbr;
+    QStringList m_renditionPaths;
+    // Shortcuts into m_batch
+    ConversionMetrics *m_metrics;
+    JobJournal *m_journal;
+    AlbumGain *m_albumGain;
+    qint64 m_dispatchedNs;
+    qint64 m_queuedNs;
 };
 
 ConversionController::ConversionController(QObject *parent)
@@ -88,9 +245,30 @@ ConversionController::ConversionController(QObject *parent)
     , m_progressModel(std::make_unique<ProgressModel>(this))
     , m_fileScanner(std::make_unique<FileScanner>(this))
     , m_threadPool(new QThreadPool(this))
+    , m_maintenancePool(new QThreadPool(this))
+    , m_metrics(std::make_shared<ConversionMetrics>())
+    , m_governor(std::make_unique<ConcurrencyGovernor>(m_metrics.get(), this))
 {
     m_progressModel->setConversionModel(m_conversionModel.get());
+    m_progressModel->setMetrics(m_metrics.get());
+    m_progressModel->setWorkerCount(m_threadCount);
+    
+    // The ETA assumes as many files run at once as the governor allows
+    connect(this, &ConversionController::activeWorkerLimitChanged, this, [this]() {
+        m_progressModel->setWorkerCount(activeWorkerLimit());
+    });
     m_threadPool->setMaxThreadCount(m_threadCount);
+    m_maintenancePool->setMaxThreadCount(1);
+    
+    // A higher limit can start more files right away; a lower one takes
+    // effect as running files finish
+    connect(m_governor.get(), &ConcurrencyGovernor::limitChanged, this, [this]() {
+        qInfo().noquote() << QString("Concurrency limit %1 (%2)").arg(m_governor->limit()).arg(m_governor->lastReason());
+        emit activeWorkerLimitChanged();
+        if (m_isConverting) {
+            processNextFile();
+        }
+    });
     
     // Connect scanner signals
     connect(m_fileScanner.get(), &FileScanner::scanCompleted,
@@ -98,6 +276,7 @@ ConversionController::ConversionController(QObject *parent)
     connect(m_fileScanner.get(), &FileScanner::scanStarted,
             [this]() {
                 m_isScanning = true;
+                m_metrics->scanStarted();
                 emit isScanningChanged();
                 emit scanStarted();
             });
@@ -105,12 +284,25 @@ ConversionController::ConversionController(QObject *parent)
             this, &ConversionController::scanError);
 }
 
-ConversionController::~ConversionController() = default;
+ConversionController::~ConversionController()
+{
+    // Workers post their results back to this object, so drain them while
+    // the models are still alive
+    m_threadPool->clear();
+    m_threadPool->waitForDone();
+    m_maintenancePool->waitForDone();
+}
 
 void ConversionController::setInputDirectory(const QString &directory)
 {
     if (m_inputDirectory != directory) {
         m_inputDirectory = directory;
+        if (!m_isScanning) {
+            loadLibraryIndex();
+        }
+        if (m_watchMode) {
+            restartWatcher();
+        }
         emit inputDirectoryChanged();
     }
 }
@@ -157,6 +349,129 @@ void ConversionController::setThreadCount(int count)
     }
 }
 
+void ConversionController::setAdaptiveConcurrency(bool enabled)
+{
+    if (m_adaptiveConcurrency != enabled) {
+        m_adaptiveConcurrency = enabled;
+        // Switching on takes effect with the next batch, switching off right away
+        if (!enabled) {
+            m_governor->stop();
+        }
+        emit adaptiveConcurrencyChanged();
+        emit activeWorkerLimitChanged();
+        if (m_isConverting) {
+            processNextFile();
+        }
+    }
+}
+
+void ConversionController::setMinThreadCount(int count)
+{
+    count = qBound(1, count, maxThreadCount());
+    if (m_minThreadCount != count) {
+        m_minThreadCount = count;
+        emit minThreadCountChanged();
+    }
+}
+
+void ConversionController::setWorkerPriority(const WorkerPriority &priority)
+{
+    if (m_workerPriority != priority) {
+        m_workerPriority = priority;
+        emit workerPriorityChanged();
+    }
+}
+
+void ConversionController::setBackgroundPriority(bool background)
+{
+    WorkerPriority priority = m_workerPriority;
+    priority.background = background;
+    setWorkerPriority(priority);
+}
+
+void ConversionController::setRenditions(const QList<Rendition> &renditions)
+{
+    if (m_renditions != renditions) {
+        m_renditions = renditions;
+        emit renditionsChanged();
+    }
+}
+
+void ConversionController::setParallelRenditions(bool parallel)
+{
+    if (m_parallelRenditions != parallel) {
+        m_parallelRenditions = parallel;
+        emit renditionsChanged();
+    }
+}
+
+void ConversionController::setAnalyzeLoudness(bool analyze)
+{
+    if (m_analyzeLoudness != analyze) {
+        m_analyzeLoudness = analyze;
+        emit loudnessChanged();
+    }
+}
+
+void ConversionController::setApplyTrackGain(bool apply)
+{
+    if (m_applyTrackGain != apply) {
+        m_applyTrackGain = apply;
+        emit loudnessChanged();
+    }
+}
+
+void ConversionController::setFoldDualMono(bool fold)
+{
+    if (m_foldDualMono != fold) {
+        m_foldDualMono = fold;
+        emit foldDualMonoChanged();
+    }
+}
+
+QStringList ConversionController::renditionPaths(const ConversionItem &item) const
+{
+    // Each rendition mirrors the primary output tree under its own root
+    const QString relativePath = QDir(m_outputDirectory).relativeFilePath(item.outputPath);
+    QStringList paths;
+    for (const Rendition &rendition : m_renditions) {
+        paths.append(QDir(rendition.outputDirectory).filePath(relativePath));
+    }
+    return paths;
+}
+
+void ConversionController::setMemoryBudgetMB(int megabytes)
+{
+    megabytes = qMax(0, megabytes);
+    if (memoryBudgetMB() != megabytes) {
+        m_memoryBudget.setLimit(qint64(megabytes) * 1024 * 1024);
+        m_progressModel->setMemoryUsage(m_memoryBudget.used(), m_memoryBudget.peak(), m_memoryBudget.limit());
+        emit memoryBudgetMBChanged();
+        if (m_isConverting) {
+            processNextFile();
+        }
+    }
+}
+
+void ConversionController::setYieldToForeground(bool yield)
+{
+    if (m_yieldToForeground != yield) {
+        m_yieldToForeground = yield;
+        m_governor->setYieldToForeground(yield);
+        emit yieldToForegroundChanged();
+    }
+}
+
+int ConversionController::activeWorkerLimit() const
+{
+    return m_governor->isRunning() ? m_governor->limit() : m_threadCount;
+}
+
+QString ConversionController::concurrencyReason() const
+{
+    return m_governor->lastReason();
+}
+
 void ConversionController::setPreserveFolderStructure(bool preserve)
 {
     if (m_preserveFolderStructure != preserve) {
@@ -173,6 +488,56 @@ void ConversionController::setOverwriteExisting(bool overwrite)
     }
 }
 
+void ConversionController::setPruneOrphans(bool prune)
+{
+    if (m_pruneOrphans != prune) {
+        m_pruneOrphans = prune;
+        emit pruneOrphansChanged();
+    }
+}
+
+void ConversionController::setWatchMode(bool enabled)
+{
+    if (m_watchMode != enabled) {
+        m_watchMode = enabled;
+        restartWatcher();
+        emit watchModeChanged();
+    }
+}
+
+void ConversionController::setUseOutputCache(bool use)
+{
+    if (m_useOutputCache != use) {
+        m_useOutputCache = use;
+        emit useOutputCacheChanged();
+    }
+}
+
+void ConversionController::setReportDirectory(const QString &directory)
+{
+    m_reportDirectory = directory;
+}
+
+void ConversionController::setOutputCacheDirectory(const QString &directory)
+{
+    m_outputCacheDirectory = directory;
+}
+
+int ConversionController::cacheHits() const
+{
+    return m_outputCache ? m_outputCache->hits() : 0;
+}
+
+int ConversionController::cacheMisses() const
+{
+    return m_outputCache ? m_outputCache->misses() : 0;
+}
+
+double ConversionController::cacheSavedCpuSeconds() const
+{
+    return m_outputCache ? m_outputCache->savedCpuMs() / 1000.0 : 0.0;
+}
+
 void ConversionController::scanForFiles()
 {
     if (m_inputDirectory.isEmpty()) {
@@ -184,6 +549,10 @@ void ConversionController::scanForFiles()
     m_filesFound = 0;
     emit filesFoundChanged();
     
+    if (!m_libraryIndex || m_libraryIndex->rootDirectory() != m_inputDirectory) {
+        loadLibraryIndex();
+    }
+    m_fileScanner->setLibraryIndex(m_libraryIndex.get());
     m_fileScanner->scanDirectory(m_inputDirectory);
 }
 
@@ -200,14 +569,110 @@ void ConversionController::startConversion()
     }
     
     m_isConverting = true;
+    m_isPaused = false;
     m_filesCompleted = 0;
+    m_filesConverted = 0;
+    m_filesSkipped = 0;
+    m_filesFailed = 0;
+    m_filesPruned = 0;
+    m_filesResumed = 0;
+    
+    // A batch that was interrupted with the same settings picks up where it
+    // stopped: its committed outputs count as done even with overwrite on
+    const QString settings = journalSettings();
+    const QString journalPath = JobJournal::defaultPath(m_inputDirectory, m_outputDirectory);
+    if (!m_journal || m_journal->path() != journalPath) {
+        // Workers still draining from a stopped run keep writing to the same object
+        m_journal = std::make_shared<JobJournal>(journalPath);
+    }
+    if (!m_journal->load()) {
+        qWarning().noquote() << m_journal->getLastError();
+    }
+    const bool resume = m_journal->hasUnfinishedBatch() && m_journal->unfinishedSettings() == settings;
+    
+    // Every run re-evaluates the whole library against the output tree
+    QList<int> upToDate;
+    for (int i = 0; i < m_conversionModel->totalFiles(); ++i) {
+        const ConversionItem item = m_conversionModel->getItem(i);
+        if (m_journal->interruptedJobs().contains(item.relativePath)) {
+            // Cut off mid-file; its output may not have reached the disk. A
+            // split drops its own partial files when it runs again.
+            if (!item.isAlbumImage()) {
+                for (const QString &output : QStringList{item.outputPath} + renditionPaths(item)) {
+                    const QFileInfo outputInfo(output);
+                    AudioConverter::removePartials(outputInfo.absolutePath(), {outputInfo.fileName()});
+                }
+            }
+            continue;
+        }
+        auto committed = m_journal->committedOutputs().constFind(item.relativePath);
+        if (resume && committed != m_journal->committedOutputs().constEnd() &&
+            AudioConverter::outputSize(item.outputPath) == committed->size) {
+            upToDate.append(i);
+            m_filesResumed++;
+        } else if (shouldSkipFile(item)) {
+            upToDate.append(i);
+        }
+    }
+    m_conversionModel->resetStatuses();
+    m_conversionModel->updateStatuses(upToDate, "skipped");
+    m_filesSkipped = upToDate.size();
+    m_filesCompleted = m_filesSkipped;
+    
+    m_journal->beginBatch(settings, resume);
+    syncJournal();
+    if (resume) {
+        qInfo().noquote() << QString("Resuming interrupted batch: %1 files already converted").arg(m_filesResumed);
+    }
+    
+    // A prune still running for an earlier batch no longer counts towards this one
+    m_pruneRun++;
+    m_pruneInFlight = false;
+    m_completeAfterPrune = false;
+    if (m_pruneOrphans) {
+        startPrune();
+    }
+    beginAlbumGain(upToDate);
+    
+    // Workers share ownership, so runs still draining keep their cache alive
+    if (!m_useOutputCache) {
+        m_outputCache.reset();
+    } else if (!m_outputCache || (!m_outputCacheDirectory.isEmpty() &&
+                                  m_outputCache->directory() != m_outputCacheDirectory)) {
+        m_outputCache = std::make_shared<OutputCache>(m_outputCacheDirectory);
+    }
+    if (m_outputCache) {
+        m_outputCache->resetStatistics();
+    }
+    m_metrics->resetLatencies();
+    m_progressModel->setWorkerCount(m_threadCount);
+    beginBatchReport();
+    
+    // Workers of a stopped run keep the old, cancelled token
+    m_cancelToken = std::make_shared<CancellationToken>();
+    resetMemoryBudget();
+    if (!m_workerPriority.isDefault()) {
+        qInfo().noquote() << QString("Conversion workers run with %1").arg(m_workerPriority.toString());
+    }
+    for (const Rendition &rendition : std::as_const(m_renditions)) {
+        qInfo().noquote() << QString("Rendition %1%2").arg(rendition.toString(),
+                                                           m_parallelRenditions ? " (parallel)" : "");
+    }
+    
     emit isConvertingChanged();
     emit filesCompletedChanged();
+    emit syncSummaryChanged();
     emit conversionStarted();
     
     m_progressModel->startConversion();
     
+    if (m_filesCompleted >= m_filesFound) {
+        onAllConversionsCompleted();
+        return;
+    }
+    
     // Start conversion tasks
+    startGovernor();
     processNextFile();
 }
 
@@ -215,27 +680,78 @@ void ConversionController::stopConversion()
 {
     m_isConverting = false;
     m_threadPool->clear();
+    // A prune still running only updates the count; the batch has no summary
+    m_completeAfterPrune = false;
+    
+    // Running workers notice at their next FLAC block and drop their partial output
+    if (m_cancelToken) {
+        m_cancelToken->cancel();
+    }
+    m_governor->stop();
+    emit activeWorkerLimitChanged();
     m_progressModel->stopConversion();
+    m_metrics->setJobsPending(0);
+    
+    // The batch stays open in the journal, so the next start resumes it
+    syncJournal();
     
+    if (m_isPaused) {
+        m_isPaused = false;
+        emit isPausedChanged();
+    }
     emit isConvertingChanged();
 }
 
 void ConversionController::pauseConversion()
 {
-    // TODO: Implement pause functionality
+    // Running files are parked mid-file and nothing new is dispatched until resumed
+    if (!m_isConverting || m_isPaused) {
+        return;
+    }
+    
+    m_isPaused = true;
+    if (m_cancelToken) {
+        m_cancelToken->pause();
+    }
+    // An idle pool says nothing about how many workers the machine can take
+    m_governor->stop();
+    emit activeWorkerLimitChanged();
+    syncJournal();
+    emit isPausedChanged();
 }
 
 void ConversionController::resumeConversion()
 {
-    // TODO: Implement resume functionality
+    if (!m_isPaused) {
+        return;
+    }
+    
+    m_isPaused = false;
+    if (m_cancelToken) {
+        m_cancelToken->resume();
+    }
+    emit isPausedChanged();
+    
+    if (m_isConverting) {
+        startGovernor();
+        processNextFile();
+    }
 }
 
 void ConversionController::onScanCompleted(int totalFiles, qint64 totalSize)
 {
     Q_UNUSED(totalSize)
+    TraceSpan span("populate_model", "controller");
     
     m_isScanning = false;
     m_filesFound = totalFiles;
+    m_metrics->scanFinished(totalFiles);
+    
+    // The index forgets removed sources once rewritten, so they are kept
+    // until the next batch decides whether to prune their outputs
+    for (const RemovedFile &removed : m_fileScanner->getRemovedFiles()) {
+        m_removedSources.insert(removed.relativePath, removed.albumImage);
+    }
     
     // Add scanned files to conversion model in batches to avoid UI freeze
     const int batchSize = 100;
@@ -247,12 +763,10 @@ void ConversionController::onScanCompleted(int totalFiles, qint64 totalSize)
         
         for (int j = i; j < end; ++j) {
             const auto &scannedFile = scannedFiles[j];
-            ConversionItem item;
-            item.inputPath = scannedFile.absolutePath;
-            item.relativePath = scannedFile.relativePath;
-            item.fileName = QFileInfo(scannedFile.absolutePath).fileName();
-            item.fileSize = scannedFile.size;
-            item.outputPath = generateOutputPath(item.inputPath, item.relativePath);
+            ConversionItem item = createItem(scannedFile.absolutePath, scannedFile.relativePath,
+                                             scannedFile.size, scannedFile.lastModified,
+                                             scannedFile.streamInfo, scannedFile.cueSheetPath);
+            item.lastOutcome = scannedFile.lastOutcome;
             
             batch.append(item);
         }
@@ -272,13 +786,22 @@ void ConversionController::onScanCompleted(int totalFiles, qint64 totalSize)
 
 void ConversionController::onFileConverted(const QString &inputFile, const QString &outputFile)
 {
-    Q_UNUSED(outputFile)
+    TraceSpan span("file_converted", "controller");
+    if (m_libraryIndex) {
+        m_libraryIndex->setOutcome(m_conversionModel->getItemByPath(inputFile).relativePath,
+                                   ConversionOutcome::Converted);
+    }
     
+    releaseMemory(inputFile);
     m_conversionModel->updateFileStatus(inputFile, "completed");
     m_filesCompleted++;
+    m_filesConverted++;
     emit filesCompletedChanged();
+    emit fileConverted(inputFile, outputFile);
     
-    if (m_filesCompleted >= m_filesFound) {
+    if (m_requeueAfterConversion.remove(inputFile)) {
+        onWatchedFileReady(inputFile);
+    } else if (m_filesCompleted >= m_filesFound) {
         onAllConversionsCompleted();
     } else {
         processNextFile();
@@ -287,67 +810,502 @@ void ConversionController::onFileConverted(const QString &inputFile, const QStri
 
 void ConversionController::onConversionFailed(const QString &inputFile, const QString &error)
 {
+    TraceSpan span("file_failed", "controller");
+    if (m_libraryIndex) {
+        m_libraryIndex->setOutcome(m_conversionModel->getItemByPath(inputFile).relativePath,
+                                   ConversionOutcome::Failed);
+    }
+    
+    releaseMemory(inputFile);
     m_conversionModel->updateFileStatus(inputFile, "failed", 0, error);
     m_filesCompleted++;
+    m_filesFailed++;
     emit filesCompletedChanged();
+    emit fileFailed(inputFile, error);
     
-    if (m_filesCompleted >= m_filesFound) {
+    if (m_requeueAfterConversion.remove(inputFile)) {
+        onWatchedFileReady(inputFile);
+    } else if (m_filesCompleted >= m_filesFound) {
         onAllConversionsCompleted();
     } else {
         processNextFile();
     }
 }
 
+void ConversionController::onConversionCancelled(const QString &inputFile)
+{
+    // Counted again by whichever run picks the file up next
+    // A new run may already have dispatched the same file; leave its reservation alone
+    m_requeueAfterConversion.remove(inputFile);
+    if (!m_isConverting) {
+        releaseMemory(inputFile);
+        m_conversionModel->updateFileStatus(inputFile, "pending");
+    }
+}
+
+void ConversionController::failUnreadableFile(const ConversionItem &item)
+{
+    const QString error = QString("Not a valid FLAC file: no STREAMINFO block");
+    if (m_albumGain && !item.isAlbumImage()) {
+        m_albumGain->dropTrack(AlbumGain::albumOf(item.outputPath));
+    }
+    if (m_libraryIndex) {
+        m_libraryIndex->setOutcome(item.relativePath, ConversionOutcome::Failed);
+    }
+    m_conversionModel->updateFileStatus(item.inputPath, "failed", 0, error);
+    m_filesCompleted++;
+    m_filesFailed++;
+    emit filesCompletedChanged();
+    m_metrics->recordFailure();
+    if (m_batchReport) {
+        BatchJobRecord record;
+        record.inputPath = item.inputPath;
+        record.outputPath = item.outputPath;
+        record.inputBytes = item.fileSize;
+        record.error = error;
+        m_batchReport->addJob(record);
+    }
+    emit fileFailed(item.inputPath, error);
+}
+
 void ConversionController::onAllConversionsCompleted()
 {
+    // The summary includes what the prune removed
+    if (m_pruneInFlight) {
+        m_completeAfterPrune = true;
+        return;
+    }
+    
     m_isConverting = false;
+    m_governor->stop();
+    emit activeWorkerLimitChanged();
     m_progressModel->stopConversion();
     
+    qInfo().noquote() << QString("Sync finished: %1 converted, %2 skipped, %3 failed, %4 pruned")
+        .arg(m_filesConverted).arg(m_filesSkipped).arg(m_filesFailed).arg(m_filesPruned);
+    if (m_outputCache) {
+        qInfo().noquote() << QString("Output cache: %1 hits, %2 misses, %3 s of encoder CPU time saved")
+            .arg(cacheHits()).arg(cacheMisses()).arg(cacheSavedCpuSeconds(), 0, 'f', 1);
+    }
+    
+    writeBatchReport();
+    if (m_journal) {
+        m_journal->endBatch();
+        syncJournal();
+    }
+    if (m_isPaused) {
+        m_isPaused = false;
+        emit isPausedChanged();
+    }
+    
     emit isConvertingChanged();
+    emit syncSummaryChanged();
+    emit conversionSummary(m_filesConverted, m_filesSkipped, m_filesFailed, m_filesPruned);
     emit conversionCompleted();
 }
 
-void ConversionController::processNextFile()
+void ConversionController::onWatchedFileReady(const QString &filePath)
 {
+    QFileInfo info(filePath);
+    QString relativePath = QDir(m_inputDirectory).relativeFilePath(info.absoluteFilePath());
+    FlacStreamInfo streamInfo;
+    FlacStreamInfo::probe(info.absoluteFilePath(), streamInfo);
+    ConversionItem item = createItem(info.absoluteFilePath(), relativePath, info.size(), info.lastModified(),
+                                     streamInfo, CueSheet::sidecarPath(info.absoluteFilePath()));
     
-    // Limit the number of concurrent conversions to avoid overwhelming the system
-    int activeConversions = 0;
-    for (int i = 0; i < m_conversionModel->totalFiles(); ++i) {
-        ConversionItem checkItem = m_conversionModel->getItem(i);
-        if (checkItem.status == "converting") {
-            activeConversions++;
+    ConversionItem existing = m_conversionModel->getItemByPath(item.inputPath);
+    if (existing.inputPath.isEmpty()) {
+        m_conversionModel->addFile(item);
+        m_filesFound++;
+        emit filesFoundChanged();
+    } else if (existing.status == "converting") {
+        // The running job read an older version; convert again once it finishes
+        m_requeueAfterConversion.insert(item.inputPath);
+        return;
+    } else {
+        // The file is counted again by the run that converts it
+        if (existing.status != "pending") {
+            m_filesCompleted--;
+            if (existing.status == "completed") {
+                m_filesConverted--;
+            } else if (existing.status == "skipped") {
+                m_filesSkipped--;
+            } else if (existing.status == "failed") {
+                m_filesFailed--;
+            }
+            emit filesCompletedChanged();
+            emit syncSummaryChanged();
         }
+        m_conversionModel->updateItem(item);
+    }
+    
+    if (!m_isConverting) {
+        if (m_outputDirectory.isEmpty()) {
+            return;
+        }
+        m_isConverting = true;
+        beginBatchReport();
+        // Watched files get a journal of their own, so an interrupted full run
+        // stays resumable
+        const QString journalPath = JobJournal::defaultPath(m_inputDirectory, m_outputDirectory, "watch");
+        if (!m_journal || m_journal->path() != journalPath) {
+            m_journal = std::make_shared<JobJournal>(journalPath);
+        }
+        m_journal->beginBatch(journalSettings(), false);
+        syncJournal();
+        // Files arrive one by one, so there is no directory to complete
+        m_albumGain.reset();
+        m_cancelToken = std::make_shared<CancellationToken>();
+        resetMemoryBudget();
+        emit isConvertingChanged();
+        emit conversionStarted();
+        m_progressModel->startConversion();
+        startGovernor();
+    }
+    
+    processNextFile();
+}
+
+void ConversionController::startGovernor()
+{
+    if (!m_adaptiveConcurrency) {
+        return;
+    }
+    m_governor->setRange(m_minThreadCount, m_threadCount);
+    m_governor->setYieldToForeground(m_yieldToForeground);
+    m_governor->start();
+    emit activeWorkerLimitChanged();
+}
+
+QString ConversionController::journalSettings() const
+{
+    QString settings = QString("bitrate=%1 complexity=%2 vbr=%3").arg(m_bitrate).arg(m_complexity).arg(m_vbr ? 1 : 0);
+    for (const Rendition &rendition : m_renditions) {
+        settings += QString(" rendition=%1").arg(rendition.toString());
+    }
+    // Only when enabled, so journals of earlier batches still match
+    if (m_analyzeLoudness) {
+        settings += m_applyTrackGain ? " loudness=1 track_gain_header=1" : " loudness=1";
+    }
+    if (m_foldDualMono) {
+        settings += " fold_dual_mono=1";
+    }
+    return settings;
+}
+
+void ConversionController::beginBatchReport()
+{
+    QJsonArray renditionList;
+    for (const Rendition &rendition : std::as_const(m_renditions)) {
+        renditionList.append(rendition.toString());
+    }
+    
+    m_batchReport = std::make_shared<BatchReport>();
+    m_batchReport->setSettings(QJsonObject{
+        {"input_directory", m_inputDirectory},
+        {"output_directory", m_outputDirectory},
+        {"bitrate", m_bitrate},
+        {"complexity", m_complexity},
+        {"vbr", m_vbr},
+        {"threads", m_threadCount},
+        {"output_cache", m_useOutputCache},
+        {"worker_priority", m_workerPriority.toString()},
+        {"memory_budget_mb", memoryBudgetMB()},
+        {"renditions", renditionList},
+        {"parallel_renditions", m_parallelRenditions},
+        {"analyze_loudness", m_analyzeLoudness},
+        {"apply_track_gain", m_analyzeLoudness && m_applyTrackGain},
+        {"fold_dual_mono", m_foldDualMono},
+    });
+}
+
+std::shared_ptr<const BatchContext> ConversionController::batchContext() const
+{
+    auto batch = std::make_shared<BatchContext>();
+    batch->bitrate = m_bitrate;
+    batch->complexity = m_complexity;
+    batch->vbr = m_vbr;
+    batch->outputCache = m_outputCache;
+    batch->metrics = m_metrics;
+    batch->report = m_batchReport;
+    batch->journal = m_journal;
+    batch->token = m_cancelToken;
+    batch->priority = m_workerPriority;
+    batch->renditions = m_renditions;
+    batch->parallelRenditions = m_parallelRenditions;
+    batch->analyzeLoudness = m_analyzeLoudness;
+    batch->applyTrackGain = m_applyTrackGain;
+    batch->albumGain = m_albumGain;
+    batch->foldDualMono = m_foldDualMono;
+    return batch;
+}
+
+void ConversionController::syncJournal()
+{
+    // syncfs can take seconds behind a large write-back, so it never runs on
+    // the event loop. The task keeps the journal alive if a new one replaces it.
+    if (!m_journal) {
+        return;
+    }
+    std::shared_ptr<JobJournal> journal = m_journal;
+    m_maintenancePool->start([journal]() {
+        if (!journal->sync()) {
+            qWarning().noquote() << journal->getLastError();
+        }
+    });
+}
+
+void ConversionController::writeBatchReport()
+{
+    // Runs where every file was up to date have nothing to report
+    std::shared_ptr<BatchReport> report = std::move(m_batchReport);
+    if (!report || report->jobCount() == 0) {
+        return;
+    }
+    
+    QString directory = m_reportDirectory.isEmpty() ? BatchReport::defaultDirectory() : m_reportDirectory;
+    QString path;
+    QString error;
+    if (!report->write(directory, &path, &error)) {
+        qWarning().noquote() << error;
+        return;
+    }
+    
+    m_lastReportPath = path;
+    qInfo().noquote() << "Batch report written to" << path;
+    emit reportWritten(path);
+}
+
+void ConversionController::restartWatcher()
+{
+    m_directoryWatcher.reset();
+    
+    if (!m_watchMode || m_inputDirectory.isEmpty()) {
+        return;
     }
     
-    // Queue pending files for conversion up to thread count limit
-    for (int i = 0; i < m_conversionModel->totalFiles() && activeConversions < m_threadCount; ++i) {
+    m_directoryWatcher = std::make_unique<DirectoryWatcher>();
+    m_directoryWatcher->setLibraryIndex(m_libraryIndex.get());
+    connect(m_directoryWatcher.get(), &DirectoryWatcher::fileReady,
+            this, &ConversionController::onWatchedFileReady);
+    connect(m_directoryWatcher.get(), &DirectoryWatcher::watchError,
+            this, &ConversionController::scanError);
+    
+    if (!m_directoryWatcher->start(m_inputDirectory)) {
+        emit scanError(m_directoryWatcher->getLastError());
+        m_directoryWatcher.reset();
+    }
+}
+
+ConversionItem ConversionController::createItem(const QString &inputPath, const QString &relativePath,
+                                                qint64 size, const QDateTime &lastModified,
+                                                const FlacStreamInfo &streamInfo, const QString &cueSheetPath)
+{
+    ConversionItem item;
+    item.inputPath = inputPath;
+    item.relativePath = relativePath;
+    item.fileName = QFileInfo(inputPath).fileName();
+    item.fileSize = size;
+    item.lastModified = lastModified;
+    item.streamInfo = streamInfo;
+    item.cueSheetPath = cueSheetPath;
+    item.outputPath = generateOutputPath(item.inputPath, item.relativePath, item.isAlbumImage());
+    return item;
+}
+
+void ConversionController::processNextFile()
+{
+    TraceSpan span("dispatch", "controller");
+    
+    if (m_isPaused) {
+        return;
+    }
+    
+    // Limit the number of concurrent conversions to avoid overwhelming the system.
+    // The model tracks both counts, so this stays O(1) per finished file.
+    int activeConversions = m_conversionModel->activeFiles();
+    
+    // Queue pending files for conversion up to the thread count, or up to
+    // what the governor currently allows
+    const int limit = activeWorkerLimit();
+    bool failedUnreadable = false;
+    std::shared_ptr<const BatchContext> batch;
+    while (activeConversions < limit) {
+        qint64 estimate = 0;
+        int i = nextAdmissibleIndex(&estimate);
+        if (i < 0) {
+            break;
+        }
         ConversionItem item = m_conversionModel->getItem(i);
         
-        if (item.status == "pending") {
-            
-            // Update status to converting
-            m_conversionModel->updateFileStatus(item.inputPath, "converting");
-            m_progressModel->setCurrentFile(item.inputPath);
-            
-            // Create runnable with conversion parameters
-            ConversionRunnable *task = new ConversionRunnable(
-                this, item, i, m_filesFound, 
-                m_bitrate, m_complexity, m_vbr
-            );
-            m_threadPool->start(task);
-            
-            activeConversions++;
-            if (activeConversions >= m_threadCount) {
-                break;
+        // The scan found no fLaC marker or STREAMINFO, possibly because the file
+        // was still being written. Probe it again before failing it without a
+        // worker; one that reads now goes back through admission.
+        if (!item.streamInfo.valid) {
+            FlacStreamInfo streamInfo;
+            if (!FlacStreamInfo::probe(item.inputPath, streamInfo)) {
+                failUnreadableFile(item);
+                failedUnreadable = true;
+                continue;
             }
+            const bool wasAlbumImage = item.isAlbumImage();
+            item.streamInfo = streamInfo;
+            if (m_albumGain && !wasAlbumImage && item.isAlbumImage()) {
+                m_albumGain->dropTrack(AlbumGain::albumOf(item.outputPath));
+            }
+            item.outputPath = generateOutputPath(item.inputPath, item.relativePath, item.isAlbumImage());
+            m_conversionModel->updateItem(item);
+            continue;
+        }
+        
+        m_memoryBudget.acquire(estimate);
+        m_admittedBytes.insert(item.inputPath, estimate);
+        
+        // Update status to converting
+        m_conversionModel->updateFileStatus(item.inputPath, "converting");
+        m_progressModel->setCurrentFile(item.inputPath);
+        if (m_journal) {
+            m_journal->jobStarted(item.relativePath);
+        }
+        
+        // The files dispatched together share one snapshot of the batch settings
+        if (!batch) {
+            batch = batchContext();
         }
+        ConversionRunnable *task = new ConversionRunnable(this, batch, item, i, m_filesFound, renditionPaths(item));
+        m_threadPool->start(task);
+        
+        activeConversions++;
+    }
+    
+    m_metrics->setJobsPending(m_conversionModel->pendingFiles());
+    m_progressModel->setMemoryUsage(m_memoryBudget.used(), m_memoryBudget.peak(), m_memoryBudget.limit());
+    
+    if (failedUnreadable && m_filesCompleted >= m_filesFound) {
+        onAllConversionsCompleted();
     }
 }
 
-QString ConversionController::generateOutputPath(const QString &inputPath, const QString &relativePath)
+int ConversionController::nextAdmissibleIndex(qint64 *estimate)
 {
+    // How far past a deferred job to look for one that fits, and how many may
+    // overtake it before dispatch waits for it. The cap keeps a large job from
+    // starving behind a stream of small ones.
+    const int AdmissionLookahead = 64;
+    const int MaxDeferredBypasses = 32;
+    
+    const int head = m_conversionModel->nextPendingIndex();
+    if (head < 0) {
+        return -1;
+    }
+    const ConversionItem headItem = m_conversionModel->getItem(head);
+    *estimate = MemoryBudget::estimateJobBytes(headItem.streamInfo, 1 + m_renditions.size(), m_foldDualMono);
+    if (m_memoryBudget.fits(*estimate)) {
+        return head;
+    }
+    
+    if (m_deferredPath != headItem.inputPath) {
+        m_deferredPath = headItem.inputPath;
+        m_deferredBypasses = 0;
+        qInfo().noquote() << QString("Deferring %1 (%2 MB estimated) until memory is free")
+            .arg(headItem.relativePath).arg(*estimate / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+    if (m_deferredBypasses >= MaxDeferredBypasses) {
+        return -1;
+    }
+    
+    int row = head;
+    for (int scanned = 0; scanned < AdmissionLookahead; ++scanned) {
+        row = m_conversionModel->nextPendingIndex(row);
+        if (row < 0) {
+            break;
+        }
+        const qint64 rowEstimate = MemoryBudget::estimateJobBytes(m_conversionModel->getItem(row).streamInfo,
+                                                                   1 + m_renditions.size(), m_foldDualMono);
+        if (m_memoryBudget.fits(rowEstimate)) {
+            *estimate = rowEstimate;
+            m_deferredBypasses++;
+            return row;
+        }
+    }
+    return -1;
+}
+
+void ConversionController::releaseMemory(const QString &inputPath)
+{
+    auto it = m_admittedBytes.find(inputPath);
+    if (it == m_admittedBytes.end()) {
+        return;
+    }
+    m_memoryBudget.release(it.value());
+    m_admittedBytes.erase(it);
+    m_progressModel->setMemoryUsage(m_memoryBudget.used(), m_memoryBudget.peak(), m_memoryBudget.limit());
+}
+
+void ConversionController::resetMemoryBudget()
+{
+    // Reservations of a stopped run's draining workers are dropped with it
+    m_memoryBudget.reset();
+    m_admittedBytes.clear();
+    m_deferredPath.clear();
+    m_deferredBypasses = 0;
+    m_progressModel->setMemoryUsage(0, 0, m_memoryBudget.limit());
+}
+
+void ConversionController::beginAlbumGain(const QList<int> &upToDate)
+{
+    // Workers of a stopped run keep their own tracker. A flat output tree
+    // would make the whole library one album.
+    m_albumGain.reset();
+    if (!m_analyzeLoudness || !m_preserveFolderStructure) {
+        return;
+    }
+    
+    // Every track of a directory is counted before any is dropped, so a
+    // directory with an up-to-date track can't complete without it. Album
+    // images are albums of their own.
+    m_albumGain = std::make_shared<AlbumGain>();
+    for (int i = 0; i < m_conversionModel->totalFiles(); ++i) {
+        const ConversionItem item = m_conversionModel->getItem(i);
+        if (!item.isAlbumImage()) {
+            m_albumGain->expectTrack(AlbumGain::albumOf(item.outputPath));
+        }
+    }
+    for (int i : upToDate) {
+        const ConversionItem item = m_conversionModel->getItem(i);
+        if (!item.isAlbumImage()) {
+            m_albumGain->dropTrack(AlbumGain::albumOf(item.outputPath));
+        }
+    }
+}
+
+void ConversionController::loadLibraryIndex()
+{
+    m_fileScanner->setLibraryIndex(nullptr);
+    if (m_directoryWatcher) {
+        m_directoryWatcher->setLibraryIndex(nullptr);
+    }
+    m_libraryIndex.reset();
+    m_removedSources.clear();
+    
+    if (m_inputDirectory.isEmpty()) {
+        return;
+    }
+    
+    // Maps the index from the previous scan, if there is one
+    m_libraryIndex = std::make_unique<LibraryIndex>(m_inputDirectory);
+    m_libraryIndex->load();
+    if (m_directoryWatcher) {
+        m_directoryWatcher->setLibraryIndex(m_libraryIndex.get());
+    }
+}
+
+QString ConversionController::generateOutputPath(const QString &inputPath, const QString &relativePath,
+                                                 bool albumImage)
+{
+    // An album image becomes a directory of tracks named after it
     QFileInfo inputInfo(inputPath);
-    QString outputFileName = inputInfo.completeBaseName() + ".opus";
+    QString outputFileName = inputInfo.completeBaseName() + (albumImage ? QString() : QString(".opus"));
     
     if (m_preserveFolderStructure) {
         QFileInfo relativeInfo(relativePath);
@@ -361,13 +1319,153 @@ QString ConversionController::generateOutputPath(const QString &inputPath, const
     return QDir(m_outputDirectory).filePath(outputFileName);
 }
 
-bool ConversionController::shouldSkipFile(const QString &outputPath)
+bool ConversionController::shouldSkipFile(const ConversionItem &item) const
 {
     if (m_overwriteExisting) {
         return false;
     }
     
-    return QFile::exists(outputPath);
+    // A rendition added to the batch needs every file converted again; the
+    // output cache makes that cheap for the renditions that already exist
+    for (const QString &renditionPath : renditionPaths(item)) {
+        if (AudioConverter::outputSize(renditionPath) == 0) {
+            return false;
+        }
+    }
+    
+    QFileInfo outputInfo(item.outputPath);
+    if (!outputInfo.exists() || AudioConverter::outputSize(item.outputPath) == 0) {
+        return false;
+    }
+    
+    // A source retagged or re-ripped in place is newer than its output
+    return outputInfo.lastModified() >= item.lastModified;
+}
+
+void ConversionController::startPrune()
+{
+    // Only outputs of sources the index recorded and a later scan found gone
+    // are candidates. A shared output tree, a source directory that could not
+    // be listed or a scan cut short therefore never cost an output.
+    QSet<QString> expectedOutputs;
+    expectedOutputs.reserve(m_conversionModel->totalFiles() * (1 + m_renditions.size()));
+    for (int i = 0; i < m_conversionModel->totalFiles(); ++i) {
+        const ConversionItem &item = m_conversionModel->getItem(i);
+        expectedOutputs.insert(QDir::cleanPath(QFileInfo(item.outputPath).absoluteFilePath()));
+        for (const QString &renditionPath : renditionPaths(item)) {
+            expectedOutputs.insert(QDir::cleanPath(QFileInfo(renditionPath).absoluteFilePath()));
+        }
+    }
+    
+    // An output another source maps to stays, as in a flat output tree
+    QStringList orphans;
+    for (auto it = m_removedSources.constBegin(); it != m_removedSources.constEnd(); ++it) {
+        ConversionItem removed;
+        removed.inputPath = QDir(m_inputDirectory).filePath(it.key());
+        removed.relativePath = it.key();
+        removed.outputPath = generateOutputPath(removed.inputPath, removed.relativePath, it.value());
+        const QStringList outputs = QStringList{removed.outputPath} + renditionPaths(removed);
+        for (const QString &output : outputs) {
+            const QString outputPath = QDir::cleanPath(QFileInfo(output).absoluteFilePath());
+            if (!expectedOutputs.contains(outputPath)) {
+                orphans.append(outputPath);
+            }
+        }
+    }
+    m_removedSources.clear();
+    if (orphans.isEmpty()) {
+        return;
+    }
+    
+    QStringList outputRoots = {m_outputDirectory};
+    for (const Rendition &rendition : std::as_const(m_renditions)) {
+        outputRoots.append(rendition.outputDirectory);
+    }
+    
+    const int run = m_pruneRun;
+    const QString inputDirectory = m_inputDirectory;
+    m_pruneInFlight = true;
+    m_maintenancePool->start([this, run, inputDirectory, outputRoots, orphans]() {
+        const int pruned = pruneOrphanedOutputs(inputDirectory, outputRoots, orphans);
+        QMetaObject::invokeMethod(this, [this, run, pruned]() {
+            onPruneFinished(run, pruned);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ConversionController::onPruneFinished(int run, int pruned)
+{
+    if (run != m_pruneRun) {
+        return;
+    }
+    
+    m_pruneInFlight = false;
+    m_filesPruned = pruned;
+    emit syncSummaryChanged();
+    
+    if (m_completeAfterPrune) {
+        m_completeAfterPrune = false;
+        onAllConversionsCompleted();
+    }
+}
+
+int ConversionController::pruneOrphanedOutputs(const QString &inputDirectory, const QStringList &outputRoots,
+                                               const QStringList &orphans)
+{
+    // Never prune when the trees overlap, the output tree could hold sources
+    const QString inputRoot = QDir(inputDirectory).canonicalPath();
+    QStringList roots;
+    for (const QString &outputDirectory : outputRoots) {
+        const QString outputRoot = QDir(outputDirectory).canonicalPath();
+        if (inputRoot.isEmpty() || outputRoot.isEmpty() || inputRoot == outputRoot ||
+            inputRoot.startsWith(outputRoot + '/') || outputRoot.startsWith(inputRoot + '/')) {
+            continue;
+        }
+        roots.append(QDir::cleanPath(QFileInfo(outputDirectory).absoluteFilePath()));
+    }
+    
+    int pruned = 0;
+    for (const QString &orphan : orphans) {
+        auto root = std::find_if(roots.cbegin(), roots.cend(), [&orphan](const QString &outputRoot) {
+            return orphan.startsWith(outputRoot + '/');
+        });
+        if (root == roots.cend()) {
+            continue;
+        }
+        
+        // An album image's directory loses only the tracks its split recorded
+        QFileInfo orphanInfo(orphan);
+        QStringList files;
+        if (orphanInfo.isDir()) {
+            for (const QString &track : AudioConverter::splitTracks(orphan)) {
+                files.append(QDir(orphan).filePath(track));
+            }
+        } else if (orphanInfo.isFile()) {
+            files.append(orphan);
+        }
+        for (const QString &file : std::as_const(files)) {
+            if (!QFile::remove(file)) {
+                qDebug() << "Failed to remove orphaned output" << file;
+                continue;
+            }
+            pruned++;
+        }
+        if (orphanInfo.isDir()) {
+            QFile::remove(AudioConverter::splitManifestPath(orphan));
+            QDir().rmdir(orphan);
+        }
+        
+        // Drop directories the removal left empty, up to the output root
+        QDir parent = orphanInfo.dir();
+        while (parent.absolutePath() != *root && parent.isEmpty()) {
+            QString emptyDir = parent.absolutePath();
+            if (!parent.cdUp() || !parent.rmdir(emptyDir)) {
+                break;
+            }
+        }
+    }
+    
+    return pruned;
 }
 
 void ConversionController::updateFileProgress(const QString &filePath, int progress)
@@ -4,15 +4,30 @@
 #include <QObject>
 #include <QString>
 #include <QThreadPool>
+#include <QHash>
+#include <QSet>
 #include <memory>
 #include <atomic>
 
 #include "models/ConversionModel.h"
 #include "models/ProgressModel.h"
+#include "core/MemoryBudget.h"
+#include "core/Rendition.h"
+#include "core/WorkerPriority.h"
 
 class FileScanner;
+class LibraryIndex;
+class OutputCache;
+class ConversionMetrics;
+class AlbumGain;
+class BatchReport;
+class CancellationToken;
+class JobJournal;
+class ConcurrencyGovernor;
+class DirectoryWatcher;
 class AudioConverter;
 class ConversionRunnable;
+struct BatchContext;
 
 class ConversionController : public QObject
 {
@@ -25,8 +40,12 @@ class ConversionController : public QObject
     // Status properties
     Q_PROPERTY(bool isScanning READ isScanning NOTIFY isScanningChanged)
     Q_PROPERTY(bool isConverting READ isConverting NOTIFY isConvertingChanged)
+    Q_PROPERTY(bool isPaused READ isPaused NOTIFY isPausedChanged)
     Q_PROPERTY(int filesFound READ filesFound NOTIFY filesFoundChanged)
     Q_PROPERTY(int filesCompleted READ filesCompleted NOTIFY filesCompletedChanged)
+    Q_PROPERTY(int filesConverted READ filesConverted NOTIFY syncSummaryChanged)
+    Q_PROPERTY(int filesSkipped READ filesSkipped NOTIFY syncSummaryChanged)
+    Q_PROPERTY(int filesPruned READ filesPruned NOTIFY syncSummaryChanged)
     
     // Settings properties
     Q_PROPERTY(int bitrate READ bitrate WRITE setBitrate NOTIFY bitrateChanged)
@@ -34,8 +53,23 @@ class ConversionController : public QObject
     Q_PROPERTY(bool vbr READ vbr WRITE setVbr NOTIFY vbrChanged)
     Q_PROPERTY(int threadCount READ threadCount WRITE setThreadCount NOTIFY threadCountChanged)
     Q_PROPERTY(int maxThreadCount READ maxThreadCount CONSTANT)
+    Q_PROPERTY(bool adaptiveConcurrency READ adaptiveConcurrency WRITE setAdaptiveConcurrency NOTIFY adaptiveConcurrencyChanged)
+    Q_PROPERTY(int minThreadCount READ minThreadCount WRITE setMinThreadCount NOTIFY minThreadCountChanged)
+    Q_PROPERTY(bool yieldToForeground READ yieldToForeground WRITE setYieldToForeground NOTIFY yieldToForegroundChanged)
+    Q_PROPERTY(int activeWorkerLimit READ activeWorkerLimit NOTIFY activeWorkerLimitChanged)
+    Q_PROPERTY(bool backgroundPriority READ backgroundPriority WRITE setBackgroundPriority NOTIFY workerPriorityChanged)
+    Q_PROPERTY(int memoryBudgetMB READ memoryBudgetMB WRITE setMemoryBudgetMB NOTIFY memoryBudgetMBChanged)
     Q_PROPERTY(bool preserveFolderStructure READ preserveFolderStructure WRITE setPreserveFolderStructure NOTIFY preserveFolderStructureChanged)
     Q_PROPERTY(bool overwriteExisting READ overwriteExisting WRITE setOverwriteExisting NOTIFY overwriteExistingChanged)
+    Q_PROPERTY(bool pruneOrphans READ pruneOrphans WRITE setPruneOrphans NOTIFY pruneOrphansChanged)
+    Q_PROPERTY(bool watchMode READ watchMode WRITE setWatchMode NOTIFY watchModeChanged)
+    Q_PROPERTY(bool analyzeLoudness READ analyzeLoudness WRITE setAnalyzeLoudness NOTIFY loudnessChanged)
+    Q_PROPERTY(bool applyTrackGain READ applyTrackGain WRITE setApplyTrackGain NOTIFY loudnessChanged)
+    Q_PROPERTY(bool foldDualMono READ foldDualMono WRITE setFoldDualMono NOTIFY foldDualMonoChanged)
+    Q_PROPERTY(bool useOutputCache READ useOutputCache WRITE setUseOutputCache NOTIFY useOutputCacheChanged)
+    Q_PROPERTY(int cacheHits READ cacheHits NOTIFY syncSummaryChanged)
+    Q_PROPERTY(int cacheMisses READ cacheMisses NOTIFY syncSummaryChanged)
+    Q_PROPERTY(double cacheSavedCpuSeconds READ cacheSavedCpuSeconds NOTIFY syncSummaryChanged)
     
     // Models
     Q_PROPERTY(ConversionModel* conversionModel READ conversionModel CONSTANT)
@@ -55,8 +89,13 @@ public:
     // Status getters
     bool isScanning() const { return m_isScanning; }
     bool isConverting() const { return m_isConverting; }
+    bool isPaused() const { return m_isPaused; }
     int filesFound() const { return m_filesFound; }
     int filesCompleted() const { return m_filesCompleted; }
+    int filesConverted() const { return m_filesConverted; }
+    int filesSkipped() const { return m_filesSkipped; }
+    int filesPruned() const { return m_filesPruned; }
+    int filesResumed() const { return m_filesResumed; }
     
     // Settings getters/setters
     int bitrate() const { return m_bitrate; }
@@ -73,15 +112,81 @@ public:
     
     int maxThreadCount() const { return QThread::idealThreadCount(); }
     
+    // With adaptive concurrency threadCount is the ceiling and minThreadCount
+    // the floor; the governor picks the number in between while converting
+    bool adaptiveConcurrency() const { return m_adaptiveConcurrency; }
+    void setAdaptiveConcurrency(bool enabled);
+    int minThreadCount() const { return m_minThreadCount; }
+    void setMinThreadCount(int count);
+    bool yieldToForeground() const { return m_yieldToForeground; }
+    void setYieldToForeground(bool yield);
+    int activeWorkerLimit() const;
+    QString concurrencyReason() const;
+    
+    // Scheduling, I/O class and CPU placement of the conversion workers.
+    // Takes effect as each worker picks up its next file.
+    const WorkerPriority &workerPriority() const { return m_workerPriority; }
+    void setWorkerPriority(const WorkerPriority &priority);
+    bool backgroundPriority() const { return m_workerPriority.background; }
+    void setBackgroundPriority(bool background);
+    
+    // Jobs are only dispatched while their estimated peak memory fits in the
+    // budget; larger ones wait and smaller ones may overtake them. 0: unlimited.
+    int memoryBudgetMB() const { return int(m_memoryBudget.limit() / (1024 * 1024)); }
+    void setMemoryBudgetMB(int megabytes);
+    qint64 memoryPeakBytes() const { return m_memoryBudget.peak(); } // Estimated, this batch
+    
+    // Extra encodes of every file at other settings, each into its own tree
+    // mirroring the output directory, all from a single decode. With parallel
+    // renditions the encoders of one file run on separate threads.
+    const QList<Rendition> &renditions() const { return m_renditions; }
+    void setRenditions(const QList<Rendition> &renditions);
+    bool parallelRenditions() const { return m_parallelRenditions; }
+    void setParallelRenditions(bool parallel);
+    
+    // EBU R128 loudness of every file, measured while encoding and written
+    // as R128_TRACK_GAIN and R128_ALBUM_GAIN; the album is the output
+    // directory, so a flat output tree gets no album gain. With track gain
+    // applied, the OpusHead output gain carries the track gain and the tags
+    // are relative to it.
+    bool analyzeLoudness() const { return m_analyzeLoudness; }
+    void setAnalyzeLoudness(bool analyze);
+    bool applyTrackGain() const { return m_applyTrackGain; }
+    void setApplyTrackGain(bool apply);
+    
+    // Stereo files whose channels are identical are encoded as mono
+    bool foldDualMono() const { return m_foldDualMono; }
+    void setFoldDualMono(bool fold);
+    
     bool preserveFolderStructure() const { return m_preserveFolderStructure; }
     void setPreserveFolderStructure(bool preserve);
     
     bool overwriteExisting() const { return m_overwriteExisting; }
     void setOverwriteExisting(bool overwrite);
     
+    bool pruneOrphans() const { return m_pruneOrphans; }
+    void setPruneOrphans(bool prune);
+    
+    bool watchMode() const { return m_watchMode; }
+    void setWatchMode(bool enabled);
+    
+    bool useOutputCache() const { return m_useOutputCache; }
+    void setUseOutputCache(bool use);
+    void setOutputCacheDirectory(const QString &directory);
+    int cacheHits() const;
+    int cacheMisses() const;
+    double cacheSavedCpuSeconds() const;
+    
+    // Every finished batch writes a JSON and CSV report here
+    // (BatchReport::defaultDirectory() when empty)
+    void setReportDirectory(const QString &directory);
+    QString reportDirectory() const { return m_reportDirectory; }
+    QString lastReportPath() const { return m_lastReportPath; }
+    
     // Models
     ConversionModel* conversionModel() const { return m_conversionModel.get(); }
     ProgressModel* progressModel() const { return m_progressModel.get(); }
+    const ConversionMetrics *metrics() const { return m_metrics.get(); }
     
 public slots:
     void scanForFiles();
@@ -96,14 +201,28 @@ signals:
     void outputDirectoryChanged();
     void isScanningChanged();
     void isConvertingChanged();
+    void isPausedChanged();
     void filesFoundChanged();
     void filesCompletedChanged();
     void bitrateChanged();
     void complexityChanged();
     void vbrChanged();
     void threadCountChanged();
+    void adaptiveConcurrencyChanged();
+    void minThreadCountChanged();
+    void yieldToForegroundChanged();
+    void workerPriorityChanged();
+    void memoryBudgetMBChanged();
+    void renditionsChanged();
+    void loudnessChanged();
+    void foldDualMonoChanged();
+    void activeWorkerLimitChanged();
     void preserveFolderStructureChanged();
     void overwriteExistingChanged();
+    void pruneOrphansChanged();
+    void useOutputCacheChanged();
+    void watchModeChanged();
+    void syncSummaryChanged();
     
     void scanStarted();
     void scanCompleted(int filesFound);
@@ -111,15 +230,22 @@ signals:
     
     void conversionStarted();
     void conversionCompleted();
+    void fileConverted(const QString &inputFile, const QString &outputFile);
+    void fileFailed(const QString &inputFile, const QString &error);
+    void conversionSummary(int converted, int skipped, int failed, int pruned);
     void conversionError(const QString &error);
+    void reportWritten(const QString &jsonPath);
     
 public slots:
     void onScanCompleted(int totalFiles, qint64 totalSize);
     void onFileConverted(const QString &inputFile, const QString &outputFile);
     void onConversionFailed(const QString &inputFile, const QString &error);
+    void onConversionCancelled(const QString &inputFile);
     
 private slots:
     void onAllConversionsCompleted();
+    void onWatchedFileReady(const QString &filePath);
+    void onPruneFinished(int run, int pruned);
     
 private:
     // Models
@@ -128,7 +254,17 @@ private:
     
     // Core components
     std::unique_ptr<FileScanner> m_fileScanner;
+    std::unique_ptr<LibraryIndex> m_libraryIndex;
+    std::shared_ptr<OutputCache> m_outputCache;
+    std::unique_ptr<DirectoryWatcher> m_directoryWatcher;
     QThreadPool *m_threadPool;
+    QThreadPool *m_maintenancePool; // Pruning, kept off the GUI thread
+    std::shared_ptr<ConversionMetrics> m_metrics;
+    std::shared_ptr<BatchReport> m_batchReport;
+    std::shared_ptr<JobJournal> m_journal;
+    std::shared_ptr<AlbumGain> m_albumGain;           // Per batch, when measuring loudness
+    std::shared_ptr<CancellationToken> m_cancelToken; // Per batch, shared with its workers
+    std::unique_ptr<ConcurrencyGovernor> m_governor;
     
     // Directories
     QString m_inputDirectory;
@@ -139,21 +275,72 @@ private:
     std::atomic<bool> m_isConverting{false};
     std::atomic<int> m_filesFound{0};
     std::atomic<int> m_filesCompleted{0};
+    QSet<QString> m_requeueAfterConversion; // Changed on disk while being converted
+    int m_filesConverted = 0;
+    int m_filesSkipped = 0;
+    int m_filesFailed = 0;
+    int m_filesPruned = 0;
+    int m_filesResumed = 0;
+    QHash<QString, bool> m_removedSources; // Relative path to whether it was an album image
+    int m_pruneRun = 0;
+    bool m_pruneInFlight = false;
+    bool m_completeAfterPrune = false;
+    bool m_isPaused = false;
+    MemoryBudget m_memoryBudget;
+    QHash<QString, qint64> m_admittedBytes; // Input path to its reservation
+    QString m_deferredPath;                 // Head of the queue, waiting for memory
+    int m_deferredBypasses = 0;
     
     // Settings
     int m_bitrate = 128000;
     int m_complexity = 10;
     bool m_vbr = true;
     int m_threadCount = 4;
+    bool m_adaptiveConcurrency = false;
+    int m_minThreadCount = 1;
+    bool m_yieldToForeground = false;
+    WorkerPriority m_workerPriority;
+    QList<Rendition> m_renditions;
+    bool m_parallelRenditions = false;
+    bool m_analyzeLoudness = false;
+    bool m_applyTrackGain = false;
+    bool m_foldDualMono = false;
     bool m_preserveFolderStructure = true;
     bool m_overwriteExisting = false;
+    bool m_pruneOrphans = false;
+    bool m_useOutputCache = false;
+    bool m_watchMode = false;
+    QString m_outputCacheDirectory;
+    QString m_reportDirectory;
+    QString m_lastReportPath;
     
     // Helper methods
     void processNextFile();
-    QString generateOutputPath(const QString &inputPath, const QString &relativePath);
-    bool shouldSkipFile(const QString &outputPath);
+    int nextAdmissibleIndex(qint64 *estimate);
+    void releaseMemory(const QString &inputPath);
+    void failUnreadableFile(const ConversionItem &item);
+    void resetMemoryBudget();
+    void beginAlbumGain(const QList<int> &upToDate);
+    void loadLibraryIndex();
+    void restartWatcher();
+    ConversionItem createItem(const QString &inputPath, const QString &relativePath, qint64 size,
+                              const QDateTime &lastModified, const FlacStreamInfo &streamInfo,
+                              const QString &cueSheetPath);
+    QString generateOutputPath(const QString &inputPath, const QString &relativePath, bool albumImage = false);
+    QStringList renditionPaths(const ConversionItem &item) const;
+    bool shouldSkipFile(const ConversionItem &item) const;
+    void startPrune();
+    static int pruneOrphanedOutputs(const QString &inputDirectory, const QStringList &outputRoots,
+                                    const QStringList &orphans);
+    void beginBatchReport();
+    QString journalSettings() const;
+    std::shared_ptr<const BatchContext> batchContext() const;
+    void syncJournal();
+    void startGovernor();
+    void writeBatchReport();
     
     friend class ConversionRunnable;
+struct BatchContext;
 };
 
 #endif // CONVERSIONCONTROLLER_H
\ No newline at end of file
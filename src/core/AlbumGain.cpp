@@ -0,0 +1,83 @@
+#include "AlbumGain.h"
+#include "MetadataHandler.h"
+#include <QFileInfo>
+#include <QMap>
+#include <algorithm>
+
+QString AlbumGain::albumOf(const QString &outputPath)
+{
+    return QFileInfo(outputPath).absolutePath();
+}
+
+void AlbumGain::expectTrack(const QString &album)
+{
+    QMutexLocker locker(&m_mutex);
+    m_albums[album].pending++;
+}
+
+void AlbumGain::dropTrack(const QString &album)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_albums.find(album);
+    if (it == m_albums.end()) {
+        return;
+    }
+    it->measurable = false;
+    it->tracks.clear();
+    if (--it->pending <= 0) {
+        m_albums.erase(it);
+    }
+}
+
+bool AlbumGain::addTrack(const QString &album, const Track &track, const LoudnessStats &stats,
+                         QList<Track> *tracks, LoudnessStats *albumStats)
+{
+    QMutexLocker locker(&m_mutex);
+    // Files that appear during the batch, e.g. in watch mode, were not counted
+    auto it = m_albums.find(album);
+    if (it == m_albums.end()) {
+        return false;
+    }
+    if (it->measurable) {
+        it->tracks.append(track);
+        it->stats.merge(stats);
+    }
+    if (--it->pending > 0) {
+        return false;
+    }
+
+    const bool complete = it->measurable;
+    if (complete) {
+        *tracks = std::move(it->tracks);
+        *albumStats = std::move(it->stats);
+    }
+    m_albums.erase(it);
+    return complete;
+}
+
+bool AlbumGain::writeAlbumGain(const QList<Track> &tracks, const LoudnessStats &albumStats, QString *error)
+{
+    MetadataHandler metadataHandler;
+    bool success = true;
+    for (const Track &track : tracks) {
+        const QMap<QString, QString> fields{
+            {"R128_ALBUM_GAIN", gainField(albumStats.r128Gain(), track.headerGain)}};
+        for (const QString &outputPath : track.outputPaths) {
+            if (!metadataHandler.updateOpusFields(outputPath, fields)) {
+                success = false;
+                if (error) {
+                    *error = QString("Failed to write album gain to %1: %2")
+                        .arg(outputPath, metadataHandler.getLastError());
+                }
+            }
+        }
+    }
+    return success;
+}
+
+QString AlbumGain::gainField(int gain, int headerGain)
+{
+    const int relative = std::clamp(gain - headerGain, -32768, 32767);
+    return relative < 0 ? QString("-%1").arg(-relative, 5, 10, QChar('0'))
+                        : QString("%1").arg(relative, 6, 10, QChar('0'));
+}
@@ -0,0 +1,59 @@
+#ifndef ALBUMGAIN_H
+#define ALBUMGAIN_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include "LoudnessAnalyzer.h"
+
+// Album gain of output directories whose tracks are converted by different
+// jobs. Tracks are written without R128_ALBUM_GAIN; the job that finishes the
+// last track of a directory merges the blocks of all of them and adds it. A
+// directory with a track that is skipped, fails or is stopped gets none.
+// Thread safe.
+class AlbumGain
+{
+public:
+    struct Track {
+        QString relativePath;      // Source, as the job journal knows it
+        QStringList outputPaths;   // The output of every rendition
+        int headerGain = 0;        // Q7.8 dB already in their OpusHead
+    };
+
+    // The album of an output: the directory it is written to
+    static QString albumOf(const QString &outputPath);
+
+    // Count a track towards its album; all of them before the first job ends
+    void expectTrack(const QString &album);
+
+    // A track that will not be measured, so its album can't be
+    void dropTrack(const QString &album);
+
+    // A measured track. When it completes the album, returns true with all of
+    // its tracks and their merged stats.
+    bool addTrack(const QString &album, const Track &track, const LoudnessStats &stats,
+                  QList<Track> *tracks, LoudnessStats *albumStats);
+
+    // Add R128_ALBUM_GAIN to the tracks of a finished album
+    static bool writeAlbumGain(const QList<Track> &tracks, const LoudnessStats &albumStats,
+                               QString *error = nullptr);
+
+    // R128 gain field relative to the OpusHead gain, always six characters
+    static QString gainField(int gain, int headerGain);
+
+private:
+    struct Album {
+        int pending = 0;
+        bool measurable = true;
+        QList<Track> tracks;
+        LoudnessStats stats;
+    };
+
+    QMutex m_mutex;
+    QHash<QString, Album> m_albums;
+};
+
+#endif // ALBUMGAIN_H
@@ -1,8 +1,94 @@
 #include "AudioConverter.h"
+#include "AlbumGain.h"
+#include "CancellationToken.h"
+#include "CueSheet.h"
 #include "OpusEncoder.h"
 #include "MetadataHandler.h"
+#include "OggOpusWriter.h"
+#include "OutputCache.h"
+#include "ThreadCpuTime.h"
+#include "Tracer.h"
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <cstdio>
+#endif
+
+namespace {
+std::atomic<quint64> nextJob{1};
+
+// Move a finished output over the old one. On POSIX the destination is
+// replaced atomically, so a reader sees either the old or the new file.
+bool replaceFile(const QString &from, const QString &to)
+{
+#ifdef Q_OS_UNIX
+    return std::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#else
+    QFile::remove(to);
+    return QFile::rename(from, to);
+#endif
+}
+
+// Tags of one track of an album image: the image's own tags, with the
+// per-track fields taken from the cue sheet
+AudioMetadata trackMetadata(const AudioMetadata &album, const CueSheet &sheet, int index)
+{
+    const CueTrack &track = sheet.tracks.at(index);
+    AudioMetadata metadata = album;
+    
+    metadata.title = track.title.isEmpty() ? QString("Track %1").arg(track.number) : track.title;
+    metadata.track = track.number;
+    if (!track.performer.isEmpty()) {
+        metadata.artist = track.performer;
+    } else if (!sheet.performer.isEmpty()) {
+        metadata.artist = sheet.performer;
+    }
+    if (!sheet.title.isEmpty()) {
+        metadata.album = sheet.title;
+    }
+    if (metadata.albumArtist.isEmpty()) {
+        metadata.albumArtist = sheet.performer;
+    }
+    if (metadata.genre.isEmpty()) {
+        metadata.genre = sheet.genre;
+    }
+    if (metadata.date.isEmpty()) {
+        metadata.date = sheet.date;
+    }
+    
+    // The embedded sheet describes the whole image, not this track
+    metadata.customTags.remove("CUESHEET");
+    metadata.customTags.remove("ISRC");
+    metadata.customTags.remove("COMPOSER");
+    metadata.customTags["TRACKTOTAL"] = QString::number(sheet.tracks.size());
+    if (!track.isrc.isEmpty()) {
+        metadata.customTags["ISRC"] = track.isrc;
+    }
+    if (!track.songwriter.isEmpty()) {
+        metadata.customTags["COMPOSER"] = track.songwriter;
+    }
+    return metadata;
+}
+
+// Gain tags from our own measurement replace whatever the source carried;
+// ReplayGain fields don't belong in Opus and the FLAC's refer to the FLAC.
+// R128_ALBUM_GAIN is only written once the album is measured.
+void setLoudnessTags(AudioMetadata &metadata, int trackGain, int headerGain)
+{
+    const QStringList keys = metadata.customTags.keys();
+    for (const QString &key : keys) {
+        if (key.startsWith("REPLAYGAIN_", Qt::CaseInsensitive) || key.startsWith("R128_", Qt::CaseInsensitive)) {
+            metadata.customTags.remove(key);
+        }
+    }
+    metadata.customTags["R128_TRACK_GAIN"] = AlbumGain::gainField(trackGain, headerGain);
+}
+}
 
 AudioConverter::AudioConverter(QObject *parent)
     : QObject(parent)
@@ -19,34 +105,36 @@ void AudioConverter::convertFile(const ConversionTask &task)
 {
     m_isConverting = true;
     m_shouldStop = false;
+    m_cancelled = false;
+    m_job = nextJob.fetch_add(1, std::memory_order_relaxed);
+    m_stats = ConversionStats();
     
-    emit conversionStarted(task.inputPath);
-    
-    // Ensure output directory exists
-    if (!ensureOutputDirectory(task.outputPath)) {
-        m_lastError = "Failed to create output directory";
-        emit conversionFailed(task.inputPath, m_lastError);
+    // A job that was queued before a stop, or that waited out a pause only to
+    // find the batch stopped, never touches its output
+    if (m_token && !m_token->checkpoint()) {
+        m_cancelled = true;
+        m_lastError = "Conversion stopped";
         m_isConverting = false;
         return;
     }
     
+    QElapsedTimer clock;
+    clock.start();
+    const qint64 fileCpuStart = threadCpuTimeMs();
+    
+    emit conversionStarted(task.inputPath);
+    
     // Connect progress signals
     connect(m_encoder.get(), &OpusEncoderImpl::progressUpdated,
             this, &AudioConverter::conversionProgress);
     
-    // Perform conversion
-    bool success = m_encoder->encodeFlacToOpus(task.inputPath, task.outputPath);
+    bool success = task.albumImage ? splitAlbumImage(task, clock) : convertSingleFile(task, clock);
     
     if (success) {
-        // Copy metadata
-        if (!m_metadataHandler->copyMetadata(task.inputPath, task.outputPath)) {
-            qDebug() << "Warning: Failed to copy metadata for" << task.inputPath;
-        }
-        
         m_lastError.clear();
         emit conversionCompleted(task.inputPath, task.outputPath);
     } else {
-        m_lastError = m_encoder->getLastError();
+        m_cancelled = m_token && m_token->isCancelled();
         emit conversionFailed(task.inputPath, m_lastError);
     }
     
@@ -54,6 +142,8 @@ void AudioConverter::convertFile(const ConversionTask &task)
     disconnect(m_encoder.get(), &OpusEncoderImpl::progressUpdated,
                this, &AudioConverter::conversionProgress);
     
+    m_stats.totalNs = clock.nsecsElapsed();
+    m_stats.cpuMs = threadCpuTimeMs() - fileCpuStart;
     m_isConverting = false;
     
     // Check if this was the last file
@@ -62,6 +152,369 @@ void AudioConverter::convertFile(const ConversionTask &task)
     }
 }
 
+bool AudioConverter::convertSingleFile(const ConversionTask &task, const QElapsedTimer &clock)
+{
+    // The primary output and one per extra rendition. Each is written to a
+    // partial file of this job that only replaces the output once it is
+    // complete and tagged; an interrupted job leaves no truncated .opus.
+    const QList<Rendition> renditions = QList<Rendition>{m_encoder->settings()} + task.renditions;
+    const QStringList outputs = QStringList{task.outputPath} + task.renditionPaths;
+    QStringList partials;
+    for (const QString &output : outputs) {
+        if (!ensureOutputDirectory(output)) {
+            m_lastError = "Failed to create output directory";
+            return false;
+        }
+        partials.append(partialPath(output, m_job));
+    }
+    
+    // Reuse earlier encodes of the same audio with the same settings; only
+    // the renditions the cache misses are encoded
+    QStringList cacheKeys;
+    QList<Rendition> missing;
+    QStringList missingPartials;
+    m_loudness = LoudnessStats();
+    bool measured = false;
+    for (int i = 0; i < renditions.size(); ++i) {
+        QString cacheKey;
+        bool cacheHit = false;
+        if (m_outputCache) {
+            TraceSpan span("cache_fetch", "convert");
+            qint64 start = clock.nsecsElapsed();
+            cacheKey = OutputCache::cacheKey(task.streamInfo, renditions[i].bitrate, renditions[i].complexity,
+                                             renditions[i].vbr, m_encoder->resamplerQuality(), m_foldDualMono);
+            cacheHit = m_outputCache->fetch(cacheKey, partials[i]);
+            m_stats.cacheNs += clock.nsecsElapsed() - start;
+        }
+        cacheKeys.append(cacheKey);
+        if (!cacheHit) {
+            missing.append(renditions[i]);
+            missingPartials.append(partials[i]);
+        } else if (m_analyzeLoudness && !measured) {
+            measured = LoudnessStats::fromByteArray(m_outputCache->loudness(cacheKey), m_loudness);
+        }
+    }
+    
+    // Entries cached before loudness was measured need one decode; the
+    // primary output is encoded again as part of it
+    if (m_analyzeLoudness && missing.isEmpty() && !measured) {
+        missing.append(renditions[0]);
+        missingPartials.append(partials[0]);
+    }
+    
+    // Perform conversion
+    bool success = true;
+    if (!missing.isEmpty()) {
+        qint64 cpuStart = threadCpuTimeMs();
+        {
+            TraceSpan span("encode", "convert");
+            success = m_encoder->encodeFlacToFiles(task.inputPath, missing, {missingPartials}, {0});
+        }
+        recordEncodeTimings();
+        if (success && m_analyzeLoudness) {
+            m_loudness = m_encoder->trackLoudness().value(0);
+            measured = true;
+        }
+        
+        // Cache the untagged streams without output gain; tags and gain are
+        // applied to every output anyway
+        if (success && m_outputCache) {
+            TraceSpan span("cache_store", "convert");
+            qint64 start = clock.nsecsElapsed();
+            const qint64 encodeCpuMs = (threadCpuTimeMs() - cpuStart) / missing.size();
+            const QByteArray loudness = measured ? m_loudness.toByteArray() : QByteArray();
+            for (int i = 0; i < renditions.size(); ++i) {
+                if (missingPartials.contains(partials[i])) {
+                    m_outputCache->store(cacheKeys[i], partials[i], encodeCpuMs, loudness);
+                }
+            }
+            m_stats.cacheNs += clock.nsecsElapsed() - start;
+        }
+    } else {
+        emit conversionProgress(100);
+        m_stats.cacheHit = true;
+        m_stats.audioSeconds = task.streamInfo.durationSeconds();
+        m_stats.sampleRate = int(task.streamInfo.sampleRate);
+        // A folded entry is the same encode, so it counts as folded again
+        m_stats.folded = m_foldDualMono && task.streamInfo.channels == 2 &&
+                         OggOpusWriter::headerChannels(partials[0]) == 1;
+    }
+    
+    if (success) {
+        // The album gain is added once the rest of the directory is measured
+        const int trackGain = m_loudness.r128Gain();
+        const int headerGain = measured && m_applyTrackGain ? trackGain : 0;
+        if (measured) {
+            recordLoudness(m_loudness, headerGain);
+            applyHeaderGain(partials, headerGain);
+        }
+        
+        // Copy metadata, read once for all renditions
+        TraceSpan span("metadata", "convert");
+        qint64 start = clock.nsecsElapsed();
+        AudioMetadata metadata;
+        const bool haveMetadata = m_metadataHandler->readFlacMetadata(task.inputPath, metadata);
+        if (!haveMetadata) {
+            qDebug() << "Warning: Failed to copy metadata for" << task.inputPath;
+        }
+        if (measured) {
+            setLoudnessTags(metadata, trackGain, headerGain);
+        }
+        if (haveMetadata || measured) {
+            for (const QString &partial : std::as_const(partials)) {
+                if (!m_metadataHandler->writeOpusMetadata(partial, metadata)) {
+                    qDebug() << "Warning: Failed to copy metadata for" << task.inputPath;
+                }
+            }
+        }
+        m_stats.metadataNs = clock.nsecsElapsed() - start;
+        
+        for (int i = 0; i < outputs.size() && success; ++i) {
+            if (!replaceFile(partials[i], outputs[i])) {
+                success = false;
+                m_lastError = QString("Failed to move the finished output into place: %1").arg(outputs[i]);
+            }
+        }
+    } else {
+        m_lastError = m_encoder->getLastError();
+    }
+    
+    if (!success) {
+        for (const QString &partial : std::as_const(partials)) {
+            QFile::remove(partial);
+        }
+    }
+    return success;
+}
+
+bool AudioConverter::splitAlbumImage(const ConversionTask &task, const QElapsedTimer &clock)
+{
+    CueSheet sheet;
+    QString error;
+    const bool loaded = task.cueSheetPath.isEmpty()
+        ? CueSheet::readEmbedded(task.inputPath, task.streamInfo.sampleRate, sheet, &error)
+        : CueSheet::load(task.cueSheetPath, task.streamInfo.sampleRate, sheet, &error);
+    if (!loaded || !sheet.isValidFor(task.streamInfo.totalSamples, &error)) {
+        m_lastError = "Cannot split album image: " + error;
+        return false;
+    }
+    
+    // The tracks go into a directory named after the image, one per
+    // rendition, each through its own partial file. Partials of an
+    // interrupted split, under its old or new track names, are dropped first.
+    const QList<Rendition> renditions = QList<Rendition>{m_encoder->settings()} + task.renditions;
+    QList<QDir> outputDirs;
+    QList<QStringList> previousTracks;
+    for (const QString &outputDir : QStringList{task.outputPath} + task.renditionPaths) {
+        outputDirs.append(QDir(outputDir));
+        if (!outputDirs.last().mkpath(".")) {
+            m_lastError = "Failed to create output directory";
+            return false;
+        }
+        previousTracks.append(splitTracks(outputDir));
+        QStringList names = previousTracks.last();
+        for (int i = 0; i < sheet.tracks.size(); ++i) {
+            names.append(sheet.trackFileName(i));
+        }
+        removePartials(outputDir, names);
+    }
+    
+    QList<QStringList> outputs;
+    QList<QStringList> partials;
+    QList<quint64> trackStarts;
+    for (int i = 0; i < sheet.tracks.size(); ++i) {
+        QStringList trackOutputs;
+        QStringList trackPartials;
+        for (const QDir &outputDir : std::as_const(outputDirs)) {
+            trackOutputs.append(outputDir.filePath(sheet.trackFileName(i)));
+            trackPartials.append(partialPath(trackOutputs.last(), m_job));
+        }
+        outputs.append(trackOutputs);
+        partials.append(trackPartials);
+        trackStarts.append(sheet.tracks[i].startSample);
+    }
+    
+    // One decode for the whole album. The output cache holds whole-file
+    // encodes keyed by the source audio, so splits bypass it.
+    bool success;
+    {
+        TraceSpan span("encode", "convert");
+        success = m_encoder->encodeFlacToFiles(task.inputPath, renditions, partials, trackStarts);
+    }
+    recordEncodeTimings();
+    if (!success) {
+        m_lastError = m_encoder->getLastError();
+        return false;
+    }
+    
+    // The tracks of one image are an album of their own
+    const QList<LoudnessStats> trackLoudness = m_encoder->trackLoudness();
+    const bool measured = m_analyzeLoudness && trackLoudness.size() == sheet.tracks.size();
+    m_loudness = LoudnessStats();
+    for (const LoudnessStats &track : trackLoudness) {
+        m_loudness.merge(track);
+    }
+    QList<int> headerGains;
+    for (int i = 0; i < sheet.tracks.size(); ++i) {
+        headerGains.append(measured && m_applyTrackGain ? trackLoudness[i].r128Gain() : 0);
+        if (measured) {
+            applyHeaderGain(partials[i], headerGains[i]);
+        }
+    }
+    if (measured) {
+        recordLoudness(m_loudness, 0);
+    }
+    
+    {
+        TraceSpan span("metadata", "convert");
+        qint64 start = clock.nsecsElapsed();
+        AudioMetadata album;
+        if (!m_metadataHandler->readFlacMetadata(task.inputPath, album)) {
+            qDebug() << "Warning: Failed to read metadata for" << task.inputPath;
+        }
+        for (int i = 0; i < sheet.tracks.size(); ++i) {
+            AudioMetadata metadata = trackMetadata(album, sheet, i);
+            if (measured) {
+                setLoudnessTags(metadata, trackLoudness[i].r128Gain(), headerGains[i]);
+                metadata.customTags["R128_ALBUM_GAIN"] = AlbumGain::gainField(m_loudness.r128Gain(), headerGains[i]);
+            }
+            for (const QString &partial : std::as_const(partials[i])) {
+                if (!m_metadataHandler->writeOpusMetadata(partial, metadata)) {
+                    qDebug() << "Warning: Failed to write metadata for" << partial;
+                }
+            }
+        }
+        m_stats.metadataNs = clock.nsecsElapsed() - start;
+    }
+    
+    QStringList trackNames;
+    for (int i = 0; i < outputs.size(); ++i) {
+        for (int r = 0; r < outputs[i].size(); ++r) {
+            if (!replaceFile(partials[i][r], outputs[i][r])) {
+                m_lastError = QString("Failed to move the finished output into place: %1").arg(outputs[i][r]);
+                for (const QStringList &trackPartials : std::as_const(partials)) {
+                    for (const QString &partial : trackPartials) {
+                        QFile::remove(partial);
+                    }
+                }
+                return false;
+            }
+        }
+        trackNames.append(sheet.trackFileName(i));
+    }
+    
+    // Tracks of an earlier split whose titles or numbering have since
+    // changed. Only names that split recorded are removed.
+    for (int r = 0; r < outputDirs.size(); ++r) {
+        for (const QString &previous : std::as_const(previousTracks[r])) {
+            if (!trackNames.contains(previous)) {
+                QFile::remove(outputDirs[r].filePath(previous));
+            }
+        }
+        QSaveFile manifest(splitManifestPath(outputDirs[r].absolutePath()));
+        if (!manifest.open(QIODevice::WriteOnly) ||
+            manifest.write(trackNames.join('\n').toUtf8() + '\n') < 0 || !manifest.commit()) {
+            qDebug() << "Warning: Failed to record the tracks of" << outputDirs[r].absolutePath();
+        }
+    }
+    return true;
+}
+
+void AudioConverter::recordEncodeTimings()
+{
+    const EncodeTimings &timings = m_encoder->lastTimings();
+    m_stats.decodeNs = timings.decodeNs;
+    m_stats.resampleNs = timings.resampleNs;
+    m_stats.encodeNs = timings.encodeNs;
+    m_stats.muxNs = timings.muxNs;
+    m_stats.analysisNs = timings.analysisNs;
+    if (timings.sampleRate > 0) {
+        m_stats.audioSeconds = double(timings.samples) / timings.sampleRate;
+    }
+    m_stats.sampleRate = timings.sampleRate;
+    m_stats.resampled = timings.resampled;
+    m_stats.folded = timings.folded;
+    m_stats.peakBufferBytes = timings.peakBufferBytes;
+}
+
+void AudioConverter::recordLoudness(const LoudnessStats &stats, int headerGain)
+{
+    m_stats.loudnessMeasured = true;
+    m_stats.loudnessLufs = stats.integratedLufs();
+    m_stats.truePeakDbtp = stats.isEmpty() ? 0.0 : stats.truePeakDbtp();
+    m_stats.headerGain = headerGain;
+}
+
+void AudioConverter::applyHeaderGain(const QStringList &partials, int headerGain)
+{
+    if (headerGain == 0) {
+        return;
+    }
+    for (const QString &partial : partials) {
+        QString error;
+        if (!OggOpusWriter::setOutputGain(partial, headerGain, &error)) {
+            qDebug() << "Warning: Failed to set output gain of" << partial << error;
+        }
+    }
+}
+
+void AudioConverter::removePartials(const QString &directory, const QStringList &outputNames)
+{
+    // <output>.<job>.part
+    QDir dir(directory);
+    const QStringList partials = dir.entryList({"*.part"}, QDir::Files | QDir::Hidden);
+    for (const QString &partial : partials) {
+        const int jobDot = partial.lastIndexOf('.', partial.size() - 6);
+        if (jobDot > 0 && outputNames.contains(partial.left(jobDot))) {
+            dir.remove(partial);
+        }
+    }
+}
+
+qint64 AudioConverter::outputSize(const QString &outputPath)
+{
+    QFileInfo info(outputPath);
+    if (!info.isDir()) {
+        return info.size();
+    }
+    
+    // A split from before the track list was kept counts as missing and is
+    // done once more
+    qint64 size = 0;
+    const QDir outputDir(outputPath);
+    for (const QString &track : splitTracks(outputPath)) {
+        size += QFileInfo(outputDir.filePath(track)).size();
+    }
+    return size;
+}
+
+QString AudioConverter::splitManifestPath(const QString &outputDirectory)
+{
+    return QDir(outputDirectory).filePath(".opus-ripper-tracks");
+}
+
+QStringList AudioConverter::splitTracks(const QString &outputDirectory)
+{
+    QFile manifest(splitManifestPath(outputDirectory));
+    if (!manifest.open(QIODevice::ReadOnly)) {
+        return QStringList();
+    }
+    // Names only, never paths out of the directory
+    QStringList tracks;
+    for (const QString &line : QString::fromUtf8(manifest.readAll()).split('\n', Qt::SkipEmptyParts)) {
+        if (!line.contains('/') && !line.contains('\\') && line != "." && line != "..") {
+            tracks.append(line);
+        }
+    }
+    return tracks;
+}
+
+void AudioConverter::setCancellationToken(CancellationToken *token)
+{
+    m_token = token;
+    m_encoder->setCancellationToken(token);
+}
+
 void AudioConverter::stopConversion()
 {
     m_shouldStop = true;
@@ -88,6 +541,24 @@ void AudioConverter::setVbr(bool enabled)
     m_encoder->setVbr(enabled);
 }
 
+void AudioConverter::setAnalyzeLoudness(bool analyze, bool applyTrackGain)
+{
+    m_analyzeLoudness = analyze;
+    m_applyTrackGain = analyze && applyTrackGain;
+    m_encoder->setAnalyzeLoudness(analyze);
+}
+
+void AudioConverter::setFoldDualMono(bool fold)
+{
+    m_foldDualMono = fold;
+    m_encoder->setFoldDualMono(fold);
+}
+
+void AudioConverter::setParallelRenditions(bool parallel, const WorkerPriority &priority)
+{
+    m_encoder->setParallelRenditions(parallel, priority);
+}
+
 bool AudioConverter::ensureOutputDirectory(const QString &outputPath)
 {
     QFileInfo info(outputPath);
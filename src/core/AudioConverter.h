@@ -1,20 +1,57 @@
 #ifndef AUDIOCONVERTER_H
 #define AUDIOCONVERTER_H
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QThread>
 #include <memory>
 #include <atomic>
 
+#include "FlacStreamInfo.h"
+#include "LoudnessAnalyzer.h"
+#include "Rendition.h"
+#include "WorkerPriority.h"
+
 class OpusEncoderImpl;
 class MetadataHandler;
+class OutputCache;
+class CancellationToken;
 
 struct ConversionTask {
     QString inputPath;
     QString outputPath;
     int index;
     int total;
+    FlacStreamInfo streamInfo; // From the scan, used as the cache key
+    bool albumImage = false;   // Split per track into the directory at outputPath
+    QString cueSheetPath;      // Sidecar of an album image, empty for an embedded sheet
+    QList<Rendition> renditions;   // Extra encodings from the same decode
+    QStringList renditionPaths;    // Where each of them goes, like outputPath
+};
+
+// Where the time of the last convertFile() went, in nanoseconds
+struct ConversionStats {
+    qint64 decodeNs = 0;
+    qint64 resampleNs = 0;
+    qint64 encodeNs = 0;
+    qint64 muxNs = 0;
+    qint64 analysisNs = 0;    // Loudness measurement
+    qint64 cacheNs = 0;       // Lookup plus fetch or store
+    qint64 metadataNs = 0;
+    qint64 totalNs = 0;
+    double audioSeconds = 0.0;
+    bool cacheHit = false;
+    int sampleRate = 0;
+    bool resampled = false;
+    bool folded = false;      // Dual-mono stereo encoded as mono
+    qint64 cpuMs = 0;         // Thread CPU time for the whole file
+    qint64 peakBufferBytes = 0;
+    bool loudnessMeasured = false;
+    double loudnessLufs = 0.0;    // Integrated; of all tracks for an album image
+    double truePeakDbtp = 0.0;
+    int headerGain = 0;           // Q7.8 dB written to the OpusHead
 };
 
 class AudioConverter : public QObject
@@ -26,15 +63,53 @@ public:
     ~AudioConverter();
     
     void convertFile(const ConversionTask &task);
+    
+    // Where an output is written until it is complete. The name is unique to
+    // the job, so a stopped job cleaning up after itself can't remove the
+    // partial file of a newer one writing the same output.
+    static QString partialPath(const QString &outputPath, quint64 job) {
+        return outputPath + '.' + QString::number(job) + ".part";
+    }
+    // Partial files that earlier jobs left for these outputs of one directory
+    static void removePartials(const QString &directory, const QStringList &outputNames);
+    // Bytes of a finished output; for an album image, of all its tracks
+    static qint64 outputSize(const QString &outputPath);
+    // Track files the last split of an album image wrote into its output
+    // directory. Other files there, e.g. of a folder with the same name as
+    // the image, are not the split's to replace or remove.
+    static QStringList splitTracks(const QString &outputDirectory);
+    static QString splitManifestPath(const QString &outputDirectory);
     void stopConversion();
     bool isConverting() const { return m_isConverting; }
+    bool wasCancelled() const { return m_cancelled; } // Last convertFile() was stopped by the token
     QString getLastError() const { return m_lastError; }
+    const ConversionStats &lastStats() const { return m_stats; }
     
     // Encoding settings
     void setBitrate(int bitrate);
     void setComplexity(int complexity);
     void setVbr(bool enabled);
     
+    // Encode the renditions of a task on separate threads
+    void setParallelRenditions(bool parallel, const WorkerPriority &priority = WorkerPriority());
+    
+    // Measure EBU R128 loudness while encoding and write R128_TRACK_GAIN, and
+    // R128_ALBUM_GAIN for the tracks of an image; with applyTrackGain the
+    // track gain also goes into the OpusHead output gain and the tags become
+    // relative to it
+    void setAnalyzeLoudness(bool analyze, bool applyTrackGain = false);
+    const LoudnessStats &lastLoudness() const { return m_loudness; } // Empty unless measured
+    
+    // Encode stereo whose channels are identical as mono
+    void setFoldDualMono(bool fold);
+    
+    // Shared cache of finished encodes; not owned, may be null
+    void setOutputCache(OutputCache *cache) { m_outputCache = cache; }
+    
+    // Batch-wide stop and pause, checked before the file and between FLAC
+    // blocks; not owned, may be null
+    void setCancellationToken(CancellationToken *token);
+    
 signals:
     void conversionStarted(const QString &inputFile);
     void conversionProgress(int percentage);
@@ -45,14 +120,28 @@ signals:
 private:
     std::unique_ptr<OpusEncoderImpl> m_encoder;
     std::unique_ptr<MetadataHandler> m_metadataHandler;
+    OutputCache *m_outputCache = nullptr;
+    CancellationToken *m_token = nullptr;
+    bool m_cancelled = false;
+    quint64 m_job = 0;      // Of the current convertFile(), unique within the process
     std::atomic<bool> m_isConverting;
     std::atomic<bool> m_shouldStop;
     
     int m_bitrate = 128000; // 128 kbps default
     int m_complexity = 10;  // Maximum quality
     bool m_vbr = true;      // Variable bitrate
+    bool m_analyzeLoudness = false;
+    bool m_applyTrackGain = false;
+    bool m_foldDualMono = false;
     QString m_lastError;
+    ConversionStats m_stats;
+    LoudnessStats m_loudness;
     
+    bool convertSingleFile(const ConversionTask &task, const QElapsedTimer &clock);
+    bool splitAlbumImage(const ConversionTask &task, const QElapsedTimer &clock);
+    void recordEncodeTimings();
+    void recordLoudness(const LoudnessStats &stats, int headerGain);
+    void applyHeaderGain(const QStringList &partials, int headerGain);
     bool ensureOutputDirectory(const QString &outputPath);
     QString generateOutputPath(const QString &inputPath, const QString &outputBase);
 };
@@ -0,0 +1,273 @@
+#include "BatchReport.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <numeric>
+
+namespace {
+double ms(qint64 ns)
+{
+    return ns / 1e6;
+}
+
+QJsonObject jobToJson(const BatchJobRecord &job)
+{
+    const ConversionStats &stats = job.stats;
+    QJsonObject object{
+        {"input", job.inputPath},
+        {"output", job.outputPath},
+        {"input_bytes", job.inputBytes},
+        {"output_bytes", job.outputBytes},
+        {"audio_seconds", stats.audioSeconds},
+        {"sample_rate", stats.sampleRate},
+        {"resampled", stats.resampled},
+        {"folded", stats.folded},
+        {"cache_hit", stats.cacheHit},
+        {"wall_ms", QJsonObject{
+            {"decode", ms(stats.decodeNs)},
+            {"resample", ms(stats.resampleNs)},
+            {"encode", ms(stats.encodeNs)},
+            {"mux", ms(stats.muxNs)},
+            {"analysis", ms(stats.analysisNs)},
+            {"cache", ms(stats.cacheNs)},
+            {"metadata", ms(stats.metadataNs)},
+            {"total", ms(stats.totalNs)}}},
+        {"cpu_ms", stats.cpuMs},
+        {"peak_buffer_bytes", stats.peakBufferBytes},
+        {"effective_bitrate", qRound(job.effectiveBitrate())},
+    };
+    if (stats.loudnessMeasured) {
+        object.insert("loudness_lufs", stats.loudnessLufs);
+        object.insert("true_peak_dbtp", stats.truePeakDbtp);
+    }
+    if (!job.error.isEmpty()) {
+        object.insert("error", job.error);
+    }
+    return object;
+}
+
+QByteArray csvField(const QString &value)
+{
+    QByteArray field = value.toUtf8();
+    if (field.contains(',') || field.contains('"') || field.contains('\n') || field.contains('\r')) {
+        field.replace("\"", "\"\"");
+        field = '"' + field + '"';
+    }
+    return field;
+}
+
+// Wall time per second of audio; failed or empty jobs sort last
+double secondsPerAudioSecond(const BatchJobRecord &job)
+{
+    return job.stats.audioSeconds > 0 ? job.stats.totalNs / 1e9 / job.stats.audioSeconds : 0.0;
+}
+}
+
+double BatchJobRecord::effectiveBitrate() const
+{
+    return stats.audioSeconds > 0 ? outputBytes * 8.0 / stats.audioSeconds : 0.0;
+}
+
+BatchReport::BatchReport()
+    : m_started(QDateTime::currentDateTime())
+{
+}
+
+void BatchReport::setSettings(const QJsonObject &settings)
+{
+    QMutexLocker locker(&m_mutex);
+    m_settings = settings;
+}
+
+void BatchReport::addJob(const BatchJobRecord &job)
+{
+    QMutexLocker locker(&m_mutex);
+    m_jobs.append(job);
+}
+
+int BatchReport::jobCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_jobs.size();
+}
+
+QJsonObject BatchReport::toJson() const
+{
+    QMutexLocker locker(&m_mutex);
+    const QDateTime finished = QDateTime::currentDateTime();
+    const double wallSeconds = m_started.msecsTo(finished) / 1000.0;
+
+    int failed = 0;
+    int cacheHits = 0;
+    int resampled = 0;
+    int folded = 0;
+    qint64 inputBytes = 0;
+    qint64 outputBytes = 0;
+    qint64 cpuMs = 0;
+    qint64 peakBufferBytes = 0;
+    double audioSeconds = 0.0;
+    qint64 stageNs[7] = {};
+    QJsonArray jobs;
+    for (const BatchJobRecord &job : m_jobs) {
+        const ConversionStats &stats = job.stats;
+        failed += job.error.isEmpty() ? 0 : 1;
+        cacheHits += stats.cacheHit ? 1 : 0;
+        resampled += stats.resampled ? 1 : 0;
+        folded += stats.folded ? 1 : 0;
+        inputBytes += job.inputBytes;
+        outputBytes += job.outputBytes;
+        cpuMs += stats.cpuMs;
+        peakBufferBytes = qMax(peakBufferBytes, stats.peakBufferBytes);
+        audioSeconds += stats.audioSeconds;
+        stageNs[0] += stats.decodeNs;
+        stageNs[1] += stats.resampleNs;
+        stageNs[2] += stats.encodeNs;
+        stageNs[3] += stats.muxNs;
+        stageNs[4] += stats.cacheNs;
+        stageNs[5] += stats.metadataNs;
+        stageNs[6] += stats.analysisNs;
+        jobs.append(jobToJson(job));
+    }
+
+    QJsonObject totals{
+        {"jobs", m_jobs.size()},
+        {"failed", failed},
+        {"cache_hits", cacheHits},
+        {"resampled", resampled},
+        {"folded", folded},
+        {"input_bytes", inputBytes},
+        {"output_bytes", outputBytes},
+        {"audio_seconds", audioSeconds},
+        {"wall_seconds", wallSeconds},
+        {"cpu_seconds", cpuMs / 1000.0},
+        {"realtime_factor", wallSeconds > 0 ? audioSeconds / wallSeconds : 0.0},
+        {"effective_bitrate", audioSeconds > 0 ? qRound(outputBytes * 8.0 / audioSeconds) : 0},
+        {"max_peak_buffer_bytes", peakBufferBytes},
+        {"stage_wall_ms", QJsonObject{
+            {"decode", ms(stageNs[0])},
+            {"resample", ms(stageNs[1])},
+            {"encode", ms(stageNs[2])},
+            {"mux", ms(stageNs[3])},
+            {"cache", ms(stageNs[4])},
+            {"metadata", ms(stageNs[5])},
+            {"analysis", ms(stageNs[6])}}},
+    };
+
+    // Indices of the worst jobs by absolute time and by time per audio second
+    auto worst = [this](auto key) {
+        QList<int> order(m_jobs.size());
+        std::iota(order.begin(), order.end(), 0);
+        const int count = qMin(int(OutlierCount), int(order.size()));
+        std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                          [&](int a, int b) { return key(m_jobs[a]) > key(m_jobs[b]); });
+        QJsonArray outliers;
+        for (int i = 0; i < count; ++i) {
+            const BatchJobRecord &job = m_jobs[order[i]];
+            outliers.append(QJsonObject{
+                {"input", job.inputPath},
+                {"wall_ms", ms(job.stats.totalNs)},
+                {"audio_seconds", job.stats.audioSeconds},
+                {"wall_seconds_per_audio_second", secondsPerAudioSecond(job)}});
+        }
+        return outliers;
+    };
+
+    return QJsonObject{
+        {"started", m_started.toString(Qt::ISODateWithMs)},
+        {"finished", finished.toString(Qt::ISODateWithMs)},
+        {"settings", m_settings},
+        {"totals", totals},
+        {"slowest", worst([](const BatchJobRecord &job) { return double(job.stats.totalNs); })},
+        {"slowest_per_audio_second", worst(secondsPerAudioSecond)},
+        {"jobs", jobs},
+    };
+}
+
+QByteArray BatchReport::toCsv() const
+{
+    QMutexLocker locker(&m_mutex);
+    QByteArray csv = "input,output,input_bytes,output_bytes,audio_seconds,sample_rate,resampled,folded,cache_hit,"
+                     "decode_ms,resample_ms,encode_ms,mux_ms,analysis_ms,cache_ms,metadata_ms,total_ms,"
+                     "cpu_ms,peak_buffer_bytes,effective_bitrate,loudness_lufs,true_peak_dbtp,error\n";
+    for (const BatchJobRecord &job : m_jobs) {
+        const ConversionStats &stats = job.stats;
+        QByteArrayList fields{
+            csvField(job.inputPath),
+            csvField(job.outputPath),
+            QByteArray::number(job.inputBytes),
+            QByteArray::number(job.outputBytes),
+            QByteArray::number(stats.audioSeconds, 'f', 3),
+            QByteArray::number(stats.sampleRate),
+            stats.resampled ? "1" : "0",
+            stats.folded ? "1" : "0",
+            stats.cacheHit ? "1" : "0",
+            QByteArray::number(ms(stats.decodeNs), 'f', 3),
+            QByteArray::number(ms(stats.resampleNs), 'f', 3),
+            QByteArray::number(ms(stats.encodeNs), 'f', 3),
+            QByteArray::number(ms(stats.muxNs), 'f', 3),
+            QByteArray::number(ms(stats.analysisNs), 'f', 3),
+            QByteArray::number(ms(stats.cacheNs), 'f', 3),
+            QByteArray::number(ms(stats.metadataNs), 'f', 3),
+            QByteArray::number(ms(stats.totalNs), 'f', 3),
+            QByteArray::number(stats.cpuMs),
+            QByteArray::number(stats.peakBufferBytes),
+            QByteArray::number(qRound(job.effectiveBitrate())),
+            stats.loudnessMeasured ? QByteArray::number(stats.loudnessLufs, 'f', 2) : QByteArray(),
+            stats.loudnessMeasured ? QByteArray::number(stats.truePeakDbtp, 'f', 2) : QByteArray(),
+            csvField(job.error),
+        };
+        csv += fields.join(',') + '\n';
+    }
+    return csv;
+}
+
+bool BatchReport::write(const QString &directory, QString *jsonPath, QString *error) const
+{
+    QDir dir(directory);
+    if (!dir.mkpath(".")) {
+        *error = QString("Failed to create report directory %1").arg(directory);
+        return false;
+    }
+
+    // Watch mode finishes a batch per burst of files, often within the same
+    // second, and a second instance may share the directory
+    const QString baseName = QString("batch-%1-%2")
+        .arg(m_started.toString("yyyyMMdd-HHmmss-zzz"))
+        .arg(QCoreApplication::applicationPid());
+    const QList<QPair<QString, QByteArray>> files{
+        {dir.filePath(baseName + ".json"), QJsonDocument(toJson()).toJson()},
+        {dir.filePath(baseName + ".csv"), toCsv()},
+    };
+    for (const auto &file : files) {
+        QSaveFile output(file.first);
+        if (!output.open(QIODevice::WriteOnly) || output.write(file.second) < 0 || !output.commit()) {
+            *error = QString("Failed to write report %1: %2").arg(file.first, output.errorString());
+            return false;
+        }
+    }
+
+    *jsonPath = files.first().first;
+    removeOldReports(dir);
+    return true;
+}
+
+void BatchReport::removeOldReports(const QDir &dir)
+{
+    // Names start with the start time, so they sort oldest first
+    const QStringList reports = dir.entryList({"batch-*.json"}, QDir::Files, QDir::Name);
+    for (int i = 0; i < reports.size() - MaxReports; ++i) {
+        const QString baseName = reports.at(i).chopped(5);
+        dir.remove(baseName + ".json");
+        dir.remove(baseName + ".csv");
+    }
+}
+
+QString BatchReport::defaultDirectory()
+{
+    QString dataDir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    return QDir(dataDir).filePath("reports");
+}
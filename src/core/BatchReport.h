@@ -0,0 +1,60 @@
+#ifndef BATCHREPORT_H
+#define BATCHREPORT_H
+
+#include <QDateTime>
+#include <QDir>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+#include "AudioConverter.h"
+
+struct BatchJobRecord {
+    QString inputPath;
+    QString outputPath;
+    qint64 inputBytes = 0;
+    qint64 outputBytes = 0;
+    ConversionStats stats;
+    QString error;          // Empty on success
+
+    // Output bits per second of audio, 0 when the duration is unknown
+    double effectiveBitrate() const;
+};
+
+// Per-job record of one batch, written as JSON (with totals and the slowest
+// outliers) and as CSV (one row per job) once the batch is done. Workers add
+// their jobs directly; the lock is taken once per file.
+class BatchReport
+{
+public:
+    BatchReport();
+
+    // Encoder settings and anything else worth keeping with the numbers
+    void setSettings(const QJsonObject &settings);
+
+    void addJob(const BatchJobRecord &job);
+    int jobCount() const;
+
+    QJsonObject toJson() const;
+    QByteArray toCsv() const;
+
+    // Writes batch-<start time>-<pid>.json and .csv into directory and drops
+    // the oldest reports beyond MaxReports
+    bool write(const QString &directory, QString *jsonPath, QString *error) const;
+
+    static QString defaultDirectory();
+
+private:
+    static const int OutlierCount = 10;
+    static const int MaxReports = 200;
+
+    mutable QMutex m_mutex;
+    QList<BatchJobRecord> m_jobs;
+    QJsonObject m_settings;
+    QDateTime m_started;
+
+    static void removeOldReports(const QDir &dir);
+};
+
+#endif // BATCHREPORT_H
@@ -0,0 +1,38 @@
+#include "CancellationToken.h"
+#include <QElapsedTimer>
+
+void CancellationToken::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled.store(true, std::memory_order_release);
+    m_resumed.wakeAll();
+}
+
+void CancellationToken::pause()
+{
+    QMutexLocker locker(&m_mutex);
+    m_paused.store(true, std::memory_order_release);
+}
+
+void CancellationToken::resume()
+{
+    QMutexLocker locker(&m_mutex);
+    m_paused.store(false, std::memory_order_release);
+    m_resumed.wakeAll();
+}
+
+bool CancellationToken::waitWhilePaused(qint64 *pausedNs)
+{
+    QElapsedTimer clock;
+    clock.start();
+
+    QMutexLocker locker(&m_mutex);
+    while (m_paused.load(std::memory_order_relaxed) && !m_cancelled.load(std::memory_order_relaxed)) {
+        m_resumed.wait(&m_mutex);
+    }
+
+    if (pausedNs) {
+        *pausedNs += clock.nsecsElapsed();
+    }
+    return !m_cancelled.load(std::memory_order_relaxed);
+}
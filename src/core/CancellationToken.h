@@ -0,0 +1,42 @@
+#ifndef CANCELLATIONTOKEN_H
+#define CANCELLATIONTOKEN_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QtGlobal>
+#include <atomic>
+
+// Shared by the controller and every worker of a batch. Workers call
+// checkpoint() between FLAC blocks: it is two atomic loads while running,
+// parks the thread while paused (decoder, resampler and encoder state stay
+// where they are) and returns false once the batch is cancelled.
+class CancellationToken
+{
+public:
+    void cancel();
+    void pause();
+    void resume();
+
+    bool isCancelled() const { return m_cancelled.load(std::memory_order_acquire); }
+    bool isPaused() const { return m_paused.load(std::memory_order_acquire); }
+
+    // False when the work should be abandoned. Time spent parked is added to
+    // *pausedNs so stage timings can leave it out.
+    bool checkpoint(qint64 *pausedNs = nullptr)
+    {
+        if (Q_LIKELY(!m_paused.load(std::memory_order_acquire))) {
+            return !isCancelled();
+        }
+        return waitWhilePaused(pausedNs);
+    }
+
+private:
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<bool> m_paused{false};
+    QMutex m_mutex;
+    QWaitCondition m_resumed;
+
+    bool waitWhilePaused(qint64 *pausedNs);
+};
+
+#endif // CANCELLATIONTOKEN_H
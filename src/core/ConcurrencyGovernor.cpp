@@ -0,0 +1,221 @@
+#include "ConcurrencyGovernor.h"
+#include "ConversionMetrics.h"
+#include <QDir>
+#include <QFile>
+#include <QThread>
+
+namespace {
+// Percent of time some task was stalled that counts as contention or idleness
+const double CpuPressureHigh = 25.0;
+const double CpuPressureIdle = 5.0;
+const double IoPressureHigh = 40.0;
+const double IoPressureIdle = 10.0;
+const double IdleLoadPerCore = 0.9;
+// Sustained clocks this far below maximum under load mean thermal or power limits
+const double ThrottledFrequencyRatio = 0.5;
+// A probed worker has to add at least this much throughput to be kept
+const double MinimumRaiseGain = 1.05;
+
+QByteArray readSmallFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.read(4096) : QByteArray();
+}
+
+// "some avg10=1.23 avg60=... total=..." from a /proc/pressure file
+bool readPressure(const QString &path, double *avg10)
+{
+    const QByteArray contents = readSmallFile(path);
+    const int start = contents.indexOf("some avg10=");
+    if (start < 0) {
+        return false;
+    }
+    const int valueStart = start + int(qstrlen("some avg10="));
+    const int valueEnd = contents.indexOf(' ', valueStart);
+    bool ok = false;
+    *avg10 = contents.mid(valueStart, valueEnd - valueStart).toDouble(&ok);
+    return ok;
+}
+
+qint64 readNumber(const QString &path)
+{
+    bool ok = false;
+    qint64 value = readSmallFile(path).trimmed().toLongLong(&ok);
+    return ok ? value : -1;
+}
+}
+
+ConcurrencyGovernor::ConcurrencyGovernor(const ConversionMetrics *metrics, QObject *parent)
+    : QObject(parent)
+    , m_metrics(metrics)
+{
+    m_timer.setInterval(TickMs);
+    connect(&m_timer, &QTimer::timeout, this, &ConcurrencyGovernor::tick);
+    m_clock.start();
+}
+
+void ConcurrencyGovernor::setRange(int floor, int ceiling)
+{
+    m_ceiling = qMax(1, ceiling);
+    m_floor = qBound(1, floor, m_ceiling);
+    m_limit = qBound(m_floor, m_limit, m_ceiling);
+}
+
+void ConcurrencyGovernor::start()
+{
+    m_lastSample = sampleSystem();
+    m_holdTicks = HoldTicks;
+    m_probeBackoffTicks = 0;
+    m_throughputBeforeRaise = -1.0;
+    m_windowStartMs = m_clock.elapsed();
+    m_windowStartAudio = m_metrics->progressAudioSeconds();
+
+    // Start wide on an idle machine and narrow on a busy one
+    QString reason;
+    if (isContended(m_lastSample, 0, &reason)) {
+        setLimit(m_floor, reason);
+    } else {
+        setLimit(m_ceiling, "start");
+    }
+    m_timer.start();
+}
+
+void ConcurrencyGovernor::stop()
+{
+    m_timer.stop();
+}
+
+void ConcurrencyGovernor::tick()
+{
+    const SystemSample sample = sampleSystem();
+    const quint64 newThrottleEvents = sample.throttleEvents > m_lastSample.throttleEvents
+        ? sample.throttleEvents - m_lastSample.throttleEvents : 0;
+    m_lastSample = sample;
+
+    if (m_probeBackoffTicks > 0) {
+        m_probeBackoffTicks--;
+    }
+    if (m_holdTicks > 0) {
+        m_holdTicks--;
+    }
+
+    // Backing off doesn't wait out the whole hold; a few seconds is enough for
+    // the pressure a previous step caused to start falling
+    QString reason;
+    if (isContended(sample, newThrottleEvents, &reason)) {
+        m_throughputBeforeRaise = -1.0;
+        if (m_limit > m_floor && m_holdTicks <= HoldTicks - 2) {
+            setLimit(m_limit - qMax(1, m_limit / 4), reason);
+        }
+        return;
+    }
+
+    if (m_holdTicks > 0) {
+        return;
+    }
+
+    const double elapsedSeconds = (m_clock.elapsed() - m_windowStartMs) / 1000.0;
+    const double throughput = elapsedSeconds > 0
+        ? (m_metrics->progressAudioSeconds() - m_windowStartAudio) / elapsedSeconds : 0.0;
+
+    // Judge the last probe before deciding anything else
+    if (m_throughputBeforeRaise >= 0.0) {
+        const double before = m_throughputBeforeRaise;
+        m_throughputBeforeRaise = -1.0;
+        if (throughput < before * MinimumRaiseGain) {
+            m_probeBackoffTicks = ProbeBackoffTicks;
+            setLimit(m_limit - 1, "no throughput gain");
+            return;
+        }
+    }
+
+    if (isIdle(sample) && m_limit < m_ceiling && m_probeBackoffTicks == 0) {
+        m_throughputBeforeRaise = throughput;
+        setLimit(m_limit + 1, "idle");
+    }
+}
+
+bool ConcurrencyGovernor::isContended(const SystemSample &sample, quint64 newThrottleEvents, QString *reason) const
+{
+    if (sample.ioPressure >= IoPressureHigh) {
+        *reason = "io pressure";
+        return true;
+    }
+    if (m_yieldToForeground && sample.cpuPressure >= CpuPressureHigh) {
+        *reason = "cpu pressure";
+        return true;
+    }
+    if (newThrottleEvents > 0 ||
+        (sample.frequencyRatio < ThrottledFrequencyRatio && sample.loadPerCore >= IdleLoadPerCore)) {
+        *reason = "throttling";
+        return true;
+    }
+    return false;
+}
+
+bool ConcurrencyGovernor::isIdle(const SystemSample &sample) const
+{
+    // Without PSI only the load average is left to go by
+    if (sample.pressureAvailable &&
+        (sample.cpuPressure > CpuPressureIdle || sample.ioPressure > IoPressureIdle)) {
+        return false;
+    }
+    return sample.loadPerCore < IdleLoadPerCore;
+}
+
+void ConcurrencyGovernor::setLimit(int limit, const QString &reason)
+{
+    limit = qBound(m_floor, limit, m_ceiling);
+    m_holdTicks = HoldTicks;
+    m_windowStartMs = m_clock.elapsed();
+    m_windowStartAudio = m_metrics->progressAudioSeconds();
+    if (limit == m_limit) {
+        return;
+    }
+
+    m_limit = limit;
+    m_lastReason = reason;
+    emit limitChanged(m_limit);
+}
+
+ConcurrencyGovernor::SystemSample ConcurrencyGovernor::sampleSystem()
+{
+    SystemSample sample;
+
+#ifdef Q_OS_LINUX
+    sample.pressureAvailable = readPressure("/proc/pressure/cpu", &sample.cpuPressure);
+    readPressure("/proc/pressure/io", &sample.ioPressure);
+
+    const QByteArray loadavg = readSmallFile("/proc/loadavg");
+    sample.loadPerCore = loadavg.left(loadavg.indexOf(' ')).toDouble() / qMax(1, QThread::idealThreadCount());
+
+    // cpufreq policies cover groups of cores; thermal_throttle only exists on x86
+    const QString cpuRoot = "/sys/devices/system/cpu";
+    qint64 current = 0;
+    qint64 maximum = 0;
+    const QStringList policies = QDir(cpuRoot + "/cpufreq").entryList({"policy*"}, QDir::Dirs);
+    for (const QString &policy : policies) {
+        qint64 cur = readNumber(cpuRoot + "/cpufreq/" + policy + "/scaling_cur_freq");
+        qint64 max = readNumber(cpuRoot + "/cpufreq/" + policy + "/cpuinfo_max_freq");
+        if (cur > 0 && max > 0) {
+            current += cur;
+            maximum += max;
+        }
+    }
+    if (maximum > 0) {
+        sample.frequencyRatio = double(current) / maximum;
+    }
+
+    const QStringList cpus = QDir(cpuRoot).entryList({"cpu[0-9]*"}, QDir::Dirs);
+    for (const QString &cpu : cpus) {
+        for (const char *counter : {"core_throttle_count", "package_throttle_count"}) {
+            qint64 count = readNumber(cpuRoot + "/" + cpu + "/thermal_throttle/" + counter);
+            if (count > 0) {
+                sample.throttleEvents += quint64(count);
+            }
+        }
+    }
+#endif
+
+    return sample;
+}
@@ -0,0 +1,84 @@
+#ifndef CONCURRENCYGOVERNOR_H
+#define CONCURRENCYGOVERNOR_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+class ConversionMetrics;
+
+// Adjusts how many conversions run at once while a batch is in progress.
+// Every tick it reads pressure stall information (/proc/pressure/cpu and io),
+// the load average, CPU throttling and the batch's own encode throughput:
+//
+// - contention (I/O pressure, throttling and, when yielding to foreground
+//   work, CPU pressure) drops a quarter of the workers
+// - an idle machine gets one more worker, which is kept only if it raised
+//   throughput; otherwise the governor steps back and stops probing for a while
+//
+// After every change it holds still for one PSI averaging window.
+class ConcurrencyGovernor : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct SystemSample {
+        bool pressureAvailable = false;
+        double cpuPressure = 0.0;      // "some" avg10, percent of time stalled
+        double ioPressure = 0.0;
+        double loadPerCore = 0.0;      // 1-minute load average / logical CPUs
+        double frequencyRatio = 1.0;   // Current / maximum clock, averaged over policies
+        quint64 throttleEvents = 0;    // Thermal throttle counters, summed
+    };
+
+    explicit ConcurrencyGovernor(const ConversionMetrics *metrics, QObject *parent = nullptr);
+
+    void setRange(int floor, int ceiling);
+    void setYieldToForeground(bool yield) { m_yieldToForeground = yield; }
+
+    void start();
+    void stop();
+    bool isRunning() const { return m_timer.isActive(); }
+
+    int limit() const { return m_limit; }
+    QString lastReason() const { return m_lastReason; }
+
+    static SystemSample sampleSystem();
+
+signals:
+    void limitChanged(int limit);
+
+private slots:
+    void tick();
+
+private:
+    static const int TickMs = 2000;
+    static const int HoldTicks = 5;          // PSI avg10 needs ~10 s to reflect a change
+    static const int ProbeBackoffTicks = 30;
+
+    const ConversionMetrics *m_metrics;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+
+    int m_floor = 1;
+    int m_ceiling = 1;
+    int m_limit = 1;
+    bool m_yieldToForeground = false;
+    QString m_lastReason;
+
+    SystemSample m_lastSample;
+    int m_holdTicks = 0;
+    int m_probeBackoffTicks = 0;
+
+    // Throughput over the window since the last change, in audio seconds per second
+    qint64 m_windowStartMs = 0;
+    double m_windowStartAudio = 0.0;
+    double m_throughputBeforeRaise = -1.0;
+
+    bool isContended(const SystemSample &sample, quint64 newThrottleEvents, QString *reason) const;
+    bool isIdle(const SystemSample &sample) const;
+    void setLimit(int limit, const QString &reason);
+};
+
+#endif // CONCURRENCYGOVERNOR_H
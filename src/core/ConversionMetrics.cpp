@@ -0,0 +1,212 @@
+#include "ConversionMetrics.h"
+#include "AudioConverter.h"
+#include "ThreadCpuTime.h"
+#include <QtAlgorithms>
+#include <cmath>
+
+namespace {
+static_assert(ConversionMetrics::MaxWorkers == 64, "worker slots are tracked in a 64-bit mask");
+thread_local int t_workerSlot = -1;
+thread_local qint64 t_cpuStartMs = 0;
+}
+
+void LatencyHistogram::record(qint64 ns)
+{
+    ns = qMax<qint64>(0, ns);
+    m_counts[bucketIndex(quint64(ns) / 1000)].fetch_add(1, std::memory_order_relaxed);
+    m_total.fetch_add(1, std::memory_order_relaxed);
+    m_sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    m_total.store(0, std::memory_order_relaxed);
+    m_sumNs.store(0, std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    const quint64 total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    const quint64 target = qMax<quint64>(1, quint64(std::ceil(p / 100.0 * total)));
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return qint64(bucketUpperBound(i)) * 1000;
+        }
+    }
+    // Buckets were incremented after the total was read
+    return qint64(bucketUpperBound(BucketCount - 1)) * 1000;
+}
+
+int LatencyHistogram::bucketIndex(quint64 us)
+{
+    // Below 16 us every microsecond has its own bucket
+    if (us < quint64(SubBuckets)) {
+        return int(us);
+    }
+
+    int magnitude = 63 - qCountLeadingZeroBits(us);
+    if (magnitude > MaxMagnitude) {
+        return BucketCount - 1;
+    }
+    int shift = magnitude - SubBucketBits;
+    int sub = int(us >> shift) - SubBuckets;
+    return SubBuckets * (shift + 1) + sub;
+}
+
+quint64 LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < SubBuckets) {
+        return quint64(index);
+    }
+    int shift = index / SubBuckets - 1;
+    int sub = index % SubBuckets;
+    return ((quint64(SubBuckets + sub + 1)) << shift) - 1;
+}
+
+ConversionMetrics::ConversionMetrics()
+{
+    m_clock.start();
+}
+
+void ConversionMetrics::resetLatencies()
+{
+    for (LatencyHistogram &histogram : m_stages) {
+        histogram.reset();
+    }
+    m_queueLatency.reset();
+}
+
+void ConversionMetrics::workerStarted(qint64 dispatchedNs)
+{
+    const qint64 startNs = now();
+    if (dispatchedNs >= 0) {
+        m_queueLatency.record(startNs - dispatchedNs);
+        m_lifetimeQueueLatency.record(startNs - dispatchedNs);
+    }
+    m_jobsActive.fetch_add(1, std::memory_order_relaxed);
+    t_cpuStartMs = threadCpuTimeMs();
+    t_workerSlot = acquireWorkerSlot();
+    if (t_workerSlot >= 0) {
+        m_workers[t_workerSlot].busySinceNs.store(startNs, std::memory_order_relaxed);
+    }
+}
+
+void ConversionMetrics::workerFinished()
+{
+    if (t_workerSlot >= 0) {
+        WorkerSlot &slot = m_workers[t_workerSlot];
+        qint64 since = slot.busySinceNs.exchange(-1, std::memory_order_relaxed);
+        if (since >= 0) {
+            slot.busyNs.fetch_add(now() - since, std::memory_order_relaxed);
+        }
+        releaseWorkerSlot(t_workerSlot);
+        t_workerSlot = -1;
+    }
+    m_cpuMs.fetch_add(threadCpuTimeMs() - t_cpuStartMs, std::memory_order_relaxed);
+    m_jobsActive.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ConversionMetrics::recordFile(const ConversionStats &stats, qint64 bytesRead, qint64 bytesWritten)
+{
+    m_audioUs.fetch_add(qint64(stats.audioSeconds * 1e6), std::memory_order_relaxed);
+    m_bytesRead.fetch_add(bytesRead, std::memory_order_relaxed);
+    m_bytesWritten.fetch_add(bytesWritten, std::memory_order_relaxed);
+    m_files.fetch_add(1, std::memory_order_relaxed);
+
+    if (!stats.cacheHit && stats.totalNs > 0) {
+        recordStage(Decode, stats.decodeNs);
+        if (stats.resampleNs > 0) {
+            recordStage(Resample, stats.resampleNs);
+        }
+        recordStage(Encode, stats.encodeNs + stats.muxNs);
+    }
+    if (stats.metadataNs > 0) {
+        recordStage(Tag, stats.metadataNs);
+    }
+}
+
+void ConversionMetrics::recordStage(Stage stage, qint64 ns)
+{
+    m_stages[stage].record(ns);
+    m_lifetimeStages[stage].record(ns);
+}
+
+void ConversionMetrics::scanFinished(int filesFound)
+{
+    qint64 startNs = m_scanStartNs.exchange(-1, std::memory_order_relaxed);
+    if (startNs < 0) {
+        return;
+    }
+    qint64 elapsedNs = qMax<qint64>(1, now() - startNs);
+    m_scans.fetch_add(1, std::memory_order_relaxed);
+    m_filesScanned.fetch_add(quint64(filesFound), std::memory_order_relaxed);
+    m_scanNs.fetch_add(elapsedNs, std::memory_order_relaxed);
+    m_lastScanRate.store(filesFound / (elapsedNs / 1e9), std::memory_order_relaxed);
+}
+
+const char *ConversionMetrics::stageName(Stage stage)
+{
+    switch (stage) {
+    case Decode:
+        return "decode";
+    case Resample:
+        return "resample";
+    case Encode:
+        return "encode";
+    case Tag:
+        return "tag";
+    default:
+        return "";
+    }
+}
+
+qint64 ConversionMetrics::workerBusyNs(int slot) const
+{
+    if (slot < 0 || slot >= MaxWorkers) {
+        return 0;
+    }
+    const WorkerSlot &worker = m_workers[slot];
+    qint64 busy = worker.busyNs.load(std::memory_order_relaxed);
+    qint64 since = worker.busySinceNs.load(std::memory_order_relaxed);
+    if (since >= 0) {
+        busy += qMax<qint64>(0, now() - since);
+    }
+    return busy;
+}
+
+int ConversionMetrics::workerSlots() const
+{
+    return m_slotsUsed.load(std::memory_order_relaxed);
+}
+
+int ConversionMetrics::acquireWorkerSlot()
+{
+    quint64 busy = m_busySlots.load(std::memory_order_relaxed);
+    for (;;) {
+        // Past MaxWorkers running at once, the extra files go unaccounted
+        if (busy == ~quint64(0)) {
+            return -1;
+        }
+        const int slot = int(qCountTrailingZeroBits(~busy));
+        if (m_busySlots.compare_exchange_weak(busy, busy | (quint64(1) << slot), std::memory_order_acquire)) {
+            int used = m_slotsUsed.load(std::memory_order_relaxed);
+            while (used <= slot && !m_slotsUsed.compare_exchange_weak(used, slot + 1, std::memory_order_relaxed)) {
+            }
+            return slot;
+        }
+    }
+}
+
+void ConversionMetrics::releaseWorkerSlot(int slot)
+{
+    m_busySlots.fetch_and(~(quint64(1) << slot), std::memory_order_release);
+}
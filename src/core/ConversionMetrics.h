@@ -0,0 +1,152 @@
+#ifndef CONVERSIONMETRICS_H
+#define CONVERSIONMETRICS_H
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+#include <atomic>
+
+struct ConversionStats;
+
+// Log-linear latency histogram in the style of HdrHistogram: 16 linear
+// sub-buckets per power of two, so any percentile is within about 6% of the
+// true value from 1 us to several hours. Recording is one relaxed increment.
+class LatencyHistogram
+{
+public:
+    void record(qint64 ns);
+    void reset();
+
+    quint64 count() const { return m_total.load(std::memory_order_relaxed); }
+    qint64 sumNs() const { return m_sumNs.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the p-th percentile (0-100), in ns
+    qint64 percentile(double p) const;
+
+private:
+    static const int SubBucketBits = 4;
+    static const int SubBuckets = 1 << SubBucketBits;
+    static const int MaxMagnitude = 36;   // 2^36 us, about 19 hours
+    static const int BucketCount = SubBuckets * (MaxMagnitude - SubBucketBits + 2);
+
+    static int bucketIndex(quint64 us);
+    static quint64 bucketUpperBound(int index);
+
+    std::atomic<quint64> m_counts[BucketCount] = {};
+    std::atomic<quint64> m_total{0};
+    std::atomic<qint64> m_sumNs{0};
+};
+
+// Throughput and latency figures of the converter. Workers and the controller
+// write with relaxed atomics only; readers (the progress UI, exporters) poll.
+// Totals are cumulative for the process so exporters see monotonic counters.
+class ConversionMetrics
+{
+public:
+    enum Stage {
+        Decode,
+        Resample,
+        Encode,     // Opus encoding plus Ogg muxing
+        Tag,
+        StageCount
+    };
+
+    static const int MaxWorkers = 64;
+
+    ConversionMetrics();
+
+    // Restart the stage histograms for a new batch; totals, and the lifetime
+    // histograms exporters read, keep counting
+    void resetLatencies();
+
+    // Called by a worker around each file it handles; dispatchedNs is now()
+    // when the job was handed to the pool and feeds the queue latency
+    void workerStarted(qint64 dispatchedNs = -1);
+    void workerFinished();
+
+    // Account a finished file; stages only count when something was encoded
+    void recordFile(const ConversionStats &stats, qint64 bytesRead, qint64 bytesWritten);
+    void recordFailure() { m_jobsFailed.fetch_add(1, std::memory_order_relaxed); }
+
+    // Audio worked through so far, advanced by workers while a file is still
+    // in progress; unlike audioSeconds() it moves between completions
+    void addProgressAudio(double seconds) {
+        m_progressAudioUs.fetch_add(qint64(seconds * 1e6), std::memory_order_relaxed);
+    }
+    double progressAudioSeconds() const { return m_progressAudioUs.load(std::memory_order_relaxed) / 1e6; }
+
+    // Files still waiting for a worker, maintained by the controller
+    void setJobsPending(int count) { m_jobsPending.store(count, std::memory_order_relaxed); }
+
+    void scanStarted() { m_scanStartNs.store(now(), std::memory_order_relaxed); }
+    void scanFinished(int filesFound);
+
+    // Totals since the process started; nothing resets them
+    double audioSeconds() const { return m_audioUs.load(std::memory_order_relaxed) / 1e6; }
+    qint64 bytesRead() const { return m_bytesRead.load(std::memory_order_relaxed); }
+    qint64 bytesWritten() const { return m_bytesWritten.load(std::memory_order_relaxed); }
+    quint64 filesRecorded() const { return m_files.load(std::memory_order_relaxed); }
+    quint64 jobsFailed() const { return m_jobsFailed.load(std::memory_order_relaxed); }
+    int jobsPending() const { return m_jobsPending.load(std::memory_order_relaxed); }
+    int jobsActive() const { return m_jobsActive.load(std::memory_order_relaxed); }
+    double cpuSeconds() const { return m_cpuMs.load(std::memory_order_relaxed) / 1000.0; }
+
+    quint64 scans() const { return m_scans.load(std::memory_order_relaxed); }
+    quint64 filesScanned() const { return m_filesScanned.load(std::memory_order_relaxed); }
+    double scanSeconds() const { return m_scanNs.load(std::memory_order_relaxed) / 1e9; }
+    double lastScanRate() const { return m_lastScanRate.load(std::memory_order_relaxed); }
+
+    // This batch's latencies
+    const LatencyHistogram &stage(Stage stage) const { return m_stages[stage]; }
+    const LatencyHistogram &queueLatency() const { return m_queueLatency; }
+    // Since the process started, so exported sums and counts never go back
+    const LatencyHistogram &lifetimeStage(Stage stage) const { return m_lifetimeStages[stage]; }
+    const LatencyHistogram &lifetimeQueueLatency() const { return m_lifetimeQueueLatency; }
+    static const char *stageName(Stage stage);
+
+    // Busy time of one worker slot up to now, including a file still in progress
+    qint64 workerBusyNs(int slot) const;
+    int workerSlots() const;
+
+    // Monotonic clock the busy times are measured on
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+
+private:
+    struct alignas(64) WorkerSlot {
+        std::atomic<qint64> busyNs{0};
+        std::atomic<qint64> busySinceNs{-1};   // -1 while idle
+    };
+
+    // A file holds the lowest free slot while it runs, so the slots in use
+    // never exceed the most workers that ran at once, however often the pool
+    // recycles its threads
+    int acquireWorkerSlot();
+    void releaseWorkerSlot(int slot);
+    void recordStage(Stage stage, qint64 ns);
+
+    QElapsedTimer m_clock;
+    std::atomic<qint64> m_audioUs{0};
+    std::atomic<qint64> m_progressAudioUs{0};
+    std::atomic<qint64> m_bytesRead{0};
+    std::atomic<qint64> m_bytesWritten{0};
+    std::atomic<quint64> m_files{0};
+    std::atomic<quint64> m_jobsFailed{0};
+    std::atomic<int> m_jobsPending{0};
+    std::atomic<int> m_jobsActive{0};
+    std::atomic<qint64> m_cpuMs{0};
+
+    std::atomic<qint64> m_scanStartNs{-1};
+    std::atomic<quint64> m_scans{0};
+    std::atomic<quint64> m_filesScanned{0};
+    std::atomic<qint64> m_scanNs{0};
+    std::atomic<double> m_lastScanRate{0.0};
+
+    LatencyHistogram m_stages[StageCount];
+    LatencyHistogram m_queueLatency;
+    LatencyHistogram m_lifetimeStages[StageCount];
+    LatencyHistogram m_lifetimeQueueLatency;
+    WorkerSlot m_workers[MaxWorkers];
+    std::atomic<quint64> m_busySlots{0};   // One bit per slot
+    std::atomic<int> m_slotsUsed{0};
+};
+
+#endif // CONVERSIONMETRICS_H
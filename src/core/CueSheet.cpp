@@ -0,0 +1,285 @@
+#include "CueSheet.h"
+#include <FLAC/metadata.h>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringDecoder>
+#include <QStringList>
+#include <vector>
+
+namespace {
+const int FramesPerSecond = 75;           // CD frames, the unit of INDEX times
+const qint64 MaxCueSheetBytes = 1 << 20;
+const int MaxFileNameLength = 200;
+
+void setError(QString *error, const QString &message)
+{
+    if (error) {
+        *error = message;
+    }
+}
+
+// Whitespace-separated words, with double quotes grouping a value
+QStringList tokenize(const QString &line)
+{
+    QStringList tokens;
+    const int length = line.size();
+    int i = 0;
+    while (i < length) {
+        while (i < length && line.at(i).isSpace()) {
+            ++i;
+        }
+        if (i >= length) {
+            break;
+        }
+        if (line.at(i) == '"') {
+            int end = line.indexOf('"', i + 1);
+            if (end < 0) {
+                end = length;
+            }
+            tokens.append(line.mid(i + 1, end - i - 1));
+            i = end + 1;
+        } else {
+            const int start = i;
+            while (i < length && !line.at(i).isSpace()) {
+                ++i;
+            }
+            tokens.append(line.mid(start, i - start));
+        }
+    }
+    return tokens;
+}
+
+// mm:ss:ff to CD frames
+bool parseMsf(const QString &time, quint64 &frames)
+{
+    const QStringList parts = time.split(':');
+    if (parts.size() != 3) {
+        return false;
+    }
+    bool okMinutes, okSeconds, okFrames;
+    const quint64 minutes = parts[0].toULongLong(&okMinutes);
+    const quint64 seconds = parts[1].toULongLong(&okSeconds);
+    const quint64 frame = parts[2].toULongLong(&okFrames);
+    if (!okMinutes || !okSeconds || !okFrames || seconds >= 60 || frame >= quint64(FramesPerSecond)) {
+        return false;
+    }
+    frames = (minutes * 60 + seconds) * FramesPerSecond + frame;
+    return true;
+}
+}
+
+bool CueSheet::parse(const QString &text, quint32 sampleRate, CueSheet &sheet, QString *error)
+{
+    sheet = CueSheet();
+
+    int files = 0;
+    int current = -1;         // Audio track the commands apply to, -1 for a data track
+    bool inTrack = false;     // Past the first TRACK, so TITLE and PERFORMER are per track
+    std::vector<bool> hasStart;
+
+    const QStringList lines = text.split('\n');
+    for (const QString &line : lines) {
+        const QStringList tokens = tokenize(line.trimmed());
+        if (tokens.isEmpty()) {
+            continue;
+        }
+        const QString command = tokens[0].toUpper();
+
+        if (command == "FILE") {
+            if (++files > 1) {
+                setError(error, "CUE sheet spans several files");
+                return false;
+            }
+        } else if (command == "TRACK" && tokens.size() >= 3) {
+            inTrack = true;
+            current = -1;
+            if (tokens[2].toUpper() == "AUDIO") {
+                CueTrack track;
+                track.number = tokens[1].toInt();
+                sheet.tracks.append(track);
+                hasStart.push_back(false);
+                current = sheet.tracks.size() - 1;
+            }
+        } else if (command == "INDEX" && tokens.size() >= 3 && current >= 0) {
+            // INDEX 00 starts the pregap, which stays with the previous track
+            if (tokens[1].toInt() != 1) {
+                continue;
+            }
+            quint64 frames;
+            if (!parseMsf(tokens[2], frames)) {
+                setError(error, QString("Invalid INDEX time \"%1\" in track %2")
+                    .arg(tokens[2]).arg(sheet.tracks[current].number));
+                return false;
+            }
+            sheet.tracks[current].startSample = frames * sampleRate / FramesPerSecond;
+            hasStart[size_t(current)] = true;
+        } else if (command == "TITLE" && tokens.size() >= 2) {
+            if (!inTrack) {
+                sheet.title = tokens[1];
+            } else if (current >= 0) {
+                sheet.tracks[current].title = tokens[1];
+            }
+        } else if (command == "PERFORMER" && tokens.size() >= 2) {
+            if (!inTrack) {
+                sheet.performer = tokens[1];
+            } else if (current >= 0) {
+                sheet.tracks[current].performer = tokens[1];
+            }
+        } else if (command == "SONGWRITER" && tokens.size() >= 2 && current >= 0) {
+            sheet.tracks[current].songwriter = tokens[1];
+        } else if (command == "ISRC" && tokens.size() >= 2 && current >= 0) {
+            sheet.tracks[current].isrc = tokens[1];
+        } else if (command == "REM" && tokens.size() >= 3 && !inTrack) {
+            const QString key = tokens[1].toUpper();
+            const QString value = tokens.mid(2).join(' ');
+            if (key == "GENRE") {
+                sheet.genre = value;
+            } else if (key == "DATE") {
+                sheet.date = value;
+            }
+        }
+    }
+
+    if (sheet.tracks.isEmpty()) {
+        setError(error, "CUE sheet lists no audio tracks");
+        return false;
+    }
+    for (int i = 0; i < sheet.tracks.size(); ++i) {
+        if (!hasStart[size_t(i)]) {
+            setError(error, QString("Track %1 of the CUE sheet has no INDEX 01").arg(sheet.tracks[i].number));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CueSheet::load(const QString &cuePath, quint32 sampleRate, CueSheet &sheet, QString *error)
+{
+    QFile file(cuePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, QString("Failed to open CUE sheet: %1").arg(file.errorString()));
+        return false;
+    }
+    if (file.size() > MaxCueSheetBytes) {
+        setError(error, "CUE sheet is too large");
+        return false;
+    }
+    const QByteArray data = file.readAll();
+
+    // Older rippers wrote the local code page; Latin-1 at least keeps ASCII intact
+    QStringDecoder decoder(QStringDecoder::Utf8);
+    QString text = decoder(data);
+    if (decoder.hasError()) {
+        text = QString::fromLatin1(data);
+    }
+    return parse(text, sampleRate, sheet, error);
+}
+
+bool CueSheet::readEmbedded(const QString &flacPath, quint32 sampleRate, CueSheet &sheet, QString *error)
+{
+    const QByteArray path = QFile::encodeName(flacPath);
+
+    FLAC__StreamMetadata *tags = nullptr;
+    if (FLAC__metadata_get_tags(path.constData(), &tags)) {
+        QString text;
+        const FLAC__StreamMetadata_VorbisComment &comments = tags->data.vorbis_comment;
+        for (FLAC__uint32 i = 0; i < comments.num_comments && text.isEmpty(); ++i) {
+            const QByteArray field(reinterpret_cast<const char*>(comments.comments[i].entry),
+                                   int(comments.comments[i].length));
+            const int separator = field.indexOf('=');
+            if (separator > 0 && field.left(separator).toUpper() == "CUESHEET") {
+                text = QString::fromUtf8(field.mid(separator + 1));
+            }
+        }
+        FLAC__metadata_object_delete(tags);
+        if (!text.isEmpty()) {
+            return parse(text, sampleRate, sheet, error);
+        }
+    }
+
+    FLAC__StreamMetadata *block = nullptr;
+    if (!FLAC__metadata_get_cuesheet(path.constData(), &block)) {
+        setError(error, "No CUE sheet in the FLAC file");
+        return false;
+    }
+
+    sheet = CueSheet();
+    const FLAC__StreamMetadata_CueSheet &cue = block->data.cue_sheet;
+    for (FLAC__uint32 i = 0; i < cue.num_tracks; ++i) {
+        const FLAC__StreamMetadata_CueSheet_Track &track = cue.tracks[i];
+        // 170 is the lead-out of a CD, 255 that of other media
+        if (track.number == 170 || track.number == 255 || track.type != 0) {
+            continue;
+        }
+        CueTrack entry;
+        entry.number = track.number;
+        entry.startSample = track.offset;
+        for (FLAC__byte j = 0; j < track.num_indices; ++j) {
+            if (track.indices[j].number == 1) {
+                entry.startSample = track.offset + track.indices[j].offset;
+                break;
+            }
+        }
+        entry.isrc = QString::fromLatin1(track.isrc).trimmed();
+        sheet.tracks.append(entry);
+    }
+    FLAC__metadata_object_delete(block);
+
+    if (sheet.tracks.isEmpty()) {
+        setError(error, "CUE sheet lists no audio tracks");
+        return false;
+    }
+    return true;
+}
+
+QString CueSheet::sidecarPath(const QString &flacPath)
+{
+    const QFileInfo info(flacPath);
+    const QString base = info.path() + '/' + info.completeBaseName();
+    for (const QString &candidate : {base + ".cue", base + ".CUE", flacPath + ".cue"}) {
+        if (QFileInfo::exists(candidate)) {
+            return candidate;
+        }
+    }
+    return QString();
+}
+
+bool CueSheet::isValidFor(quint64 totalSamples, QString *error) const
+{
+    if (tracks.isEmpty()) {
+        setError(error, "CUE sheet lists no audio tracks");
+        return false;
+    }
+    for (int i = 0; i < tracks.size(); ++i) {
+        if (i > 0 && tracks[i].startSample <= tracks[i - 1].startSample) {
+            setError(error, QString("Track %1 of the CUE sheet does not start after track %2")
+                .arg(tracks[i].number).arg(tracks[i - 1].number));
+            return false;
+        }
+        if (totalSamples > 0 && tracks[i].startSample >= totalSamples) {
+            setError(error, QString("Track %1 of the CUE sheet starts past the end of the audio")
+                .arg(tracks[i].number));
+            return false;
+        }
+    }
+    return true;
+}
+
+QString CueSheet::trackFileName(int track) const
+{
+    const CueTrack &entry = tracks.at(track);
+    const QString number = QString("%1").arg(entry.number, 2, 10, QChar('0'));
+
+    QString title;
+    title.reserve(entry.title.size());
+    for (QChar c : entry.title) {
+        title.append(c.unicode() < 0x20 || QStringLiteral("/\\:*?\"<>|").contains(c) ? QChar('_') : c);
+    }
+    title = title.left(MaxFileNameLength).trimmed();
+    while (title.endsWith('.')) {
+        title.chop(1);
+    }
+
+    return title.isEmpty() ? QString("Track %1.opus").arg(number)
+                           : QString("%1 - %2.opus").arg(number, title);
+}
@@ -0,0 +1,47 @@
+#ifndef CUESHEET_H
+#define CUESHEET_H
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+struct CueTrack {
+    int number = 0;
+    quint64 startSample = 0;  // INDEX 01, per channel; a pregap belongs to the track before
+    QString title;
+    QString performer;
+    QString songwriter;
+    QString isrc;
+};
+
+// Track layout of a single-file album image, from a .cue sidecar, a CUESHEET
+// Vorbis comment or the FLAC CUESHEET metadata block
+struct CueSheet {
+    QString title;
+    QString performer;
+    QString genre;
+    QString date;
+    QList<CueTrack> tracks;   // Audio tracks in disc order
+
+    // Parse cue sheet text. INDEX times are CD frames (1/75 s) and are
+    // converted at sampleRate. Sheets that span several files are rejected.
+    static bool parse(const QString &text, quint32 sampleRate, CueSheet &sheet, QString *error = nullptr);
+
+    // Read a .cue file, as UTF-8 if it decodes cleanly and as Latin-1 otherwise
+    static bool load(const QString &cuePath, quint32 sampleRate, CueSheet &sheet, QString *error = nullptr);
+
+    // Sheet embedded in a FLAC file: the CUESHEET comment if there is one, as
+    // it carries titles, otherwise the track offsets of the CUESHEET block
+    static bool readEmbedded(const QString &flacPath, quint32 sampleRate, CueSheet &sheet, QString *error = nullptr);
+
+    // "album.cue" or "album.flac.cue" next to the image, or empty
+    static QString sidecarPath(const QString &flacPath);
+
+    // Tracks in increasing order, all starting before the end of the audio
+    bool isValidFor(quint64 totalSamples, QString *error = nullptr) const;
+
+    // Output name of a track: "07 - Title.opus", or "Track 07.opus" untitled
+    QString trackFileName(int track) const;
+};
+
+#endif // CUESHEET_H
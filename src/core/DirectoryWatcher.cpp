@@ -0,0 +1,333 @@
+#include "DirectoryWatcher.h"
+#include "FileScanner.h"
+#include "LibraryIndex.h"
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QDebug>
+#include <utility>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+#ifdef Q_OS_LINUX
+// IN_MODIFY is left out on purpose: it fires for every write() and floods the
+// queue; files still being written are caught by the settle polling instead
+const uint32_t WatchMask = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                           IN_DELETE | IN_ONLYDIR | IN_EXCL_UNLINK;
+#endif
+
+const int SettlePollInterval = 500;
+
+// Events dropped by an overflow can predate the last one we saw by a little
+const qint64 OverflowSlackMs = 5000;
+}
+
+DirectoryWatcher::DirectoryWatcher(QObject *parent)
+    : QObject(parent)
+    , m_settleTimer(new QTimer(this))
+{
+    m_settleTimer->setInterval(SettlePollInterval);
+    connect(m_settleTimer, &QTimer::timeout, this, &DirectoryWatcher::checkPendingFiles);
+    m_clock.start();
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    stop();
+}
+
+bool DirectoryWatcher::start(const QString &rootDirectory)
+{
+    stop();
+
+#ifdef Q_OS_LINUX
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        m_lastError = QString("Failed to initialize inotify: %1").arg(strerror(errno));
+        return false;
+    }
+
+    m_rootDirectory = QDir(rootDirectory).absolutePath();
+    m_lastEventMs = QDateTime::currentMSecsSinceEpoch();
+
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &DirectoryWatcher::readEvents);
+
+    addWatchRecursive(m_rootDirectory, false);
+    if (m_watchPaths.isEmpty()) {
+        m_lastError = QString("Cannot watch %1").arg(m_rootDirectory);
+        stop();
+        return false;
+    }
+
+    return true;
+#else
+    Q_UNUSED(rootDirectory)
+    m_lastError = "Watch mode requires inotify and is only available on Linux";
+    return false;
+#endif
+}
+
+void DirectoryWatcher::stop()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+
+    m_fd = -1;
+    m_watchPaths.clear();
+    m_pathWatches.clear();
+    m_pending.clear();
+    m_settleTimer->stop();
+}
+
+void DirectoryWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    while (m_fd >= 0) {
+        ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+
+        bool overflowed = false;
+        for (char *ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+
+            QString directory = m_watchPaths.value(event->wd);
+            if (directory.isEmpty()) {
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                m_watchPaths.remove(event->wd);
+                m_pathWatches.remove(directory);
+                continue;
+            }
+
+            if (event->len == 0) {
+                continue;
+            }
+
+            QString path = directory + '/' + QFile::decodeName(event->name);
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // Anything that landed before the watch existed is reported too
+                    addWatchRecursive(path, true);
+                } else if (event->mask & IN_MOVED_FROM) {
+                    removeWatchRecursive(path);
+                }
+                continue;
+            }
+
+            if (event->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                touchPending(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                m_pending.remove(path);
+            }
+        }
+
+        if (overflowed) {
+            recoverFromOverflow();
+        }
+        m_lastEventMs = QDateTime::currentMSecsSinceEpoch();
+    }
+#endif
+}
+
+void DirectoryWatcher::checkPendingFiles()
+{
+    qint64 now = m_clock.elapsed();
+    QStringList ready;
+
+    for (auto it = m_pending.begin(); it != m_pending.end(); ) {
+        QFileInfo info(it.key());
+        if (!info.exists()) {
+            it = m_pending.erase(it);
+            continue;
+        }
+
+        qint64 size = info.size();
+        qint64 mtimeMs = info.lastModified().toMSecsSinceEpoch();
+        if (size != it->size || mtimeMs != it->mtimeMs) {
+            it->size = size;
+            it->mtimeMs = mtimeMs;
+            it->lastChange = now;
+        } else if (now - it->lastChange >= m_settleTime) {
+            ready.append(it.key());
+            it = m_pending.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    if (m_pending.isEmpty()) {
+        m_settleTimer->stop();
+    }
+
+    for (const QString &filePath : ready) {
+        emit fileReady(filePath);
+    }
+}
+
+void DirectoryWatcher::addWatchRecursive(const QString &directory, bool reportExisting)
+{
+#ifdef Q_OS_LINUX
+    QStringList directories{directory};
+    QDirIterator it(directory, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        directories.append(it.next());
+    }
+
+    for (const QString &path : std::as_const(directories)) {
+        if (m_pathWatches.contains(path)) {
+            continue;
+        }
+
+        int wd = inotify_add_watch(m_fd, QFile::encodeName(path).constData(), WatchMask);
+        if (wd < 0) {
+            // Typically ENOSPC once fs.inotify.max_user_watches is exhausted
+            m_lastError = QString("Failed to watch %1: %2").arg(path, strerror(errno));
+            emit watchError(m_lastError);
+            continue;
+        }
+
+        m_watchPaths.insert(wd, path);
+        m_pathWatches.insert(path, wd);
+
+        if (reportExisting) {
+            queueExistingFiles(path, 0);
+        }
+    }
+#else
+    Q_UNUSED(directory)
+    Q_UNUSED(reportExisting)
+#endif
+}
+
+void DirectoryWatcher::removeWatchRecursive(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    const QString prefix = directory + '/';
+    for (auto it = m_pathWatches.begin(); it != m_pathWatches.end(); ) {
+        if (it.key() == directory || it.key().startsWith(prefix)) {
+            inotify_rm_watch(m_fd, it.value());
+            m_watchPaths.remove(it.value());
+            it = m_pathWatches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+#else
+    Q_UNUSED(directory)
+#endif
+}
+
+void DirectoryWatcher::recoverFromOverflow()
+{
+    // Events were dropped. Rather than rescanning the library, only list the
+    // directories whose mtime says entries were added since the last event
+    // we did see, and pick up subdirectories that are not watched yet. Files
+    // of the other directories are compared against the index instead.
+    qint64 sinceMs = m_lastEventMs - OverflowSlackMs;
+    qDebug() << "inotify queue overflowed, rescanning directories changed since"
+             << QDateTime::fromMSecsSinceEpoch(sinceMs);
+
+    const QStringList directories = m_pathWatches.keys();
+    for (const QString &directory : directories) {
+        QFileInfo info(directory);
+        if (!info.isDir()) {
+            continue;
+        }
+        if (info.lastModified().toMSecsSinceEpoch() < sinceMs) {
+            queueRewrittenFiles(directory, sinceMs);
+            continue;
+        }
+
+        const QFileInfoList subdirectories = QDir(directory).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
+        for (const QFileInfo &subdirectory : subdirectories) {
+            if (!subdirectory.isSymLink() && !m_pathWatches.contains(subdirectory.absoluteFilePath())) {
+                addWatchRecursive(subdirectory.absoluteFilePath(), true);
+            }
+        }
+
+        queueExistingFiles(directory, sinceMs);
+    }
+}
+
+void DirectoryWatcher::queueExistingFiles(const QString &directory, qint64 modifiedSinceMs)
+{
+    const QFileInfoList files = QDir(directory).entryInfoList(QDir::Files);
+    for (const QFileInfo &file : files) {
+        if (file.lastModified().toMSecsSinceEpoch() >= modifiedSinceMs) {
+            touchPending(file.absoluteFilePath());
+        }
+    }
+}
+
+void DirectoryWatcher::queueRewrittenFiles(const QString &directory, qint64 modifiedSinceMs)
+{
+    // One stat per indexed file, no listing
+    if (!m_libraryIndex) {
+        return;
+    }
+    const QString relativePath = QDir(m_rootDirectory).relativeFilePath(directory);
+    const int indexed = m_libraryIndex->findDirectory(relativePath == "." ? QString() : relativePath);
+    if (indexed < 0) {
+        return;
+    }
+    for (const LibraryIndexFile &indexedFile : m_libraryIndex->files(indexed)) {
+        const QFileInfo file(directory + '/' + indexedFile.name);
+        const qint64 mtimeMs = file.lastModified().toMSecsSinceEpoch();
+        if (file.exists() && mtimeMs >= modifiedSinceMs &&
+            (mtimeMs != indexedFile.mtimeMs || file.size() != indexedFile.size)) {
+            touchPending(file.absoluteFilePath());
+        }
+    }
+}
+
+void DirectoryWatcher::touchPending(const QString &filePath)
+{
+    if (!isFlacFile(filePath)) {
+        return;
+    }
+
+    // Restart the settle period; the poll records the current size and mtime
+    PendingFile &pending = m_pending[filePath];
+    pending.size = -1;
+    pending.mtimeMs = -1;
+    pending.lastChange = m_clock.elapsed();
+
+    if (!m_settleTimer->isActive()) {
+        m_settleTimer->start();
+    }
+}
+
+bool DirectoryWatcher::isFlacFile(const QString &filePath) const
+{
+    return FileScanner::hasFlacExtension(filePath);
+}
@@ -0,0 +1,74 @@
+#ifndef DIRECTORYWATCHER_H
+#define DIRECTORYWATCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QElapsedTimer>
+
+class QSocketNotifier;
+class QTimer;
+class LibraryIndex;
+
+// Recursive inotify watch on an input tree. FLAC files that are created,
+// rewritten or moved in are reported once their size and mtime have stopped
+// changing for the settle time, so copies in progress are never picked up.
+class DirectoryWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DirectoryWatcher(QObject *parent = nullptr);
+    ~DirectoryWatcher();
+
+    bool start(const QString &rootDirectory);
+    void stop();
+    bool isWatching() const { return m_fd >= 0; }
+    QString rootDirectory() const { return m_rootDirectory; }
+    QString getLastError() const { return m_lastError; }
+
+    void setSettleTime(int msecs) { m_settleTime = msecs; }
+    // Index of the watched tree; after an overflow its files are checked for
+    // in-place rewrites, which don't show in their directory's mtime
+    void setLibraryIndex(const LibraryIndex *index) { m_libraryIndex = index; }
+    int watchCount() const { return m_watchPaths.size(); }
+
+signals:
+    void fileReady(const QString &filePath);
+    void watchError(const QString &error);
+
+private slots:
+    void readEvents();
+    void checkPendingFiles();
+
+private:
+    struct PendingFile {
+        qint64 size = -1;
+        qint64 mtimeMs = -1;
+        qint64 lastChange = 0;
+    };
+
+    int m_fd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QTimer *m_settleTimer;
+    QElapsedTimer m_clock;
+    QString m_rootDirectory;
+    QString m_lastError;
+    int m_settleTime = 2000;
+    qint64 m_lastEventMs = 0; // Wall clock of the last event, for overflow recovery
+    const LibraryIndex *m_libraryIndex = nullptr;
+
+    QHash<int, QString> m_watchPaths;
+    QHash<QString, int> m_pathWatches;
+    QHash<QString, PendingFile> m_pending;
+
+    void addWatchRecursive(const QString &directory, bool reportExisting);
+    void removeWatchRecursive(const QString &directory);
+    void recoverFromOverflow();
+    void queueExistingFiles(const QString &directory, qint64 modifiedSinceMs);
+    void queueRewrittenFiles(const QString &directory, qint64 modifiedSinceMs);
+    void touchPending(const QString &filePath);
+    bool isFlacFile(const QString &filePath) const;
+};
+
+#endif // DIRECTORYWATCHER_H
@@ -1,17 +1,77 @@
 #include "FileScanner.h"
+#include "CueSheet.h"
+#include "Tracer.h"
 #include <QDir>
-#include <QDirIterator>
+#include <QFile>
 #include <QThread>
 #include <QDebug>
 #include <QCoreApplication>
 #include <QMutexLocker>
+#include <QSet>
+#include <algorithm>
+#include <utility>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <sys/stat.h>
+#endif
+
+namespace {
+// Each probe is one small pread, so a few threads are enough to keep ahead of the traversal
+const int ProbeThreads = 4;
+
+quint64 fileInode(const QString &filePath)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(filePath).constData(), &st) == 0) {
+        return quint64(st.st_ino);
+    }
+#else
+    Q_UNUSED(filePath)
+#endif
+    return 0;
+}
+
+// Refresh size, mtime and inode of an indexed file with a single stat. Only a
+// missing file sets gone; other errors keep what the index recorded.
+bool statFile(const QString &filePath, LibraryIndexFile &file, bool *gone)
+{
+    *gone = false;
+#ifdef Q_OS_LINUX
+    struct stat st;
+    if (::stat(QFile::encodeName(filePath).constData(), &st) != 0) {
+        *gone = errno == ENOENT;
+        return false;
+    }
+    file.size = qint64(st.st_size);
+    file.mtimeMs = qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+    file.inode = quint64(st.st_ino);
+#else
+    QFileInfo info(filePath);
+    if (!info.exists()) {
+        *gone = true;
+        return false;
+    }
+    file.size = info.size();
+    file.mtimeMs = info.lastModified().toMSecsSinceEpoch();
+    file.inode = fileInode(filePath);
+#endif
+    return true;
+}
+}
 
 FileScanner::FileScanner(QObject *parent)
     : QObject(parent)
 {
+    m_probePool.setMaxThreadCount(ProbeThreads);
 }
 
-FileScanner::~FileScanner() = default;
+FileScanner::~FileScanner()
+{
+    m_probePool.clear();
+    m_probePool.waitForDone();
+}
 
 void FileScanner::scanDirectory(const QString &directory)
 {
@@ -21,6 +81,7 @@ void FileScanner::scanDirectory(const QString &directory)
     
     QMutexLocker locker(&m_mutex);
     m_scannedFiles.clear();
+    m_removedFiles.clear();
     m_totalSize = 0;
     m_shouldStop = false;
     
@@ -45,64 +106,286 @@ void FileScanner::stopScanning()
 
 void FileScanner::scanDirectoryRecursive(const QString &directory, const QString &baseDirectory)
 {
-    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    Q_UNUSED(baseDirectory)
+    
+    m_indexDirectories.clear();
+    m_indexChanged = false;
+    m_filesFound = 0;
+    
+    scanIndexedDirectory(QDir(directory).absolutePath(), QString());
+    applyProbes();
+    
+    // Rewrite the index only when some directory had to be listed again
+    if (m_libraryIndex && !m_shouldStop && m_indexChanged) {
+        m_libraryIndex->save(m_indexDirectories);
+    }
+    m_indexDirectories.clear();
+    
+    m_isScanning = false;
+    
+    if (!m_shouldStop) {
+        int totalFiles;
+        qint64 totalSize;
+        {
+            QMutexLocker locker(&m_mutex);
+            totalFiles = m_scannedFiles.size();
+            totalSize = m_totalSize;
+        }
+        emit scanCompleted(totalFiles, totalSize);
+    }
+}
+
+void FileScanner::scanIndexedDirectory(const QString &directory, const QString &relativeDirectory)
+{
+    if (m_shouldStop) {
+        return;
+    }
+    
+    QFileInfo directoryInfo(directory);
+    if (!directoryInfo.isDir()) {
+        return;
+    }
+    
+    LibraryIndexDirectory entry;
+    entry.relativePath = relativeDirectory;
+    entry.mtimeMs = directoryInfo.lastModified().toMSecsSinceEpoch();
+    
+    int indexed = m_libraryIndex ? m_libraryIndex->findDirectory(relativeDirectory) : -1;
     
-    int filesFound = 0;
-    int totalFilesChecked = 0;
-    while (it.hasNext() && !m_shouldStop) {
-        it.next();
-        QFileInfo fileInfo = it.fileInfo();
-        totalFilesChecked++;
+    // A directory that can't be listed keeps what the index knew about it;
+    // an empty listing would otherwise read as everything in it being gone
+    const bool listable = directoryInfo.isReadable() && directoryInfo.isExecutable();
+    if (!listable && indexed < 0) {
+        qWarning().noquote() << "Cannot list" << directory;
+        return;
+    }
+    
+    if (indexed >= 0 && (!listable || m_libraryIndex->directoryMtime(indexed) == entry.mtimeMs)) {
+        if (!listable) {
+            qWarning().noquote() << "Cannot list" << directory << "- keeping its indexed entries";
+            entry.mtimeMs = m_libraryIndex->directoryMtime(indexed);
+        }
+        // Nothing was added, removed or renamed here since the last scan, so the
+        // recorded entries are reused without listing the directory. Each file is
+        // still stat'ed, since rewriting one in place leaves the directory alone.
+        entry.subdirectories = m_libraryIndex->subdirectories(indexed);
+        entry.files = m_libraryIndex->files(indexed);
+        for (int i = 0; i < entry.files.size();) {
+            LibraryIndexFile &file = entry.files[i];
+            if (listable) {
+                const QString filePath = directory + '/' + file.name;
+                LibraryIndexFile current = file;
+                bool gone = false;
+                if (!statFile(filePath, current, &gone) && gone) {
+                    m_indexChanged = true;
+                    addRemovedFile(relativeDirectory, file);
+                    entry.files.removeAt(i);
+                    continue;
+                }
+                if (current.size != file.size || current.mtimeMs != file.mtimeMs || current.inode != file.inode) {
+                    m_indexChanged = true;
+                    current.streamInfo = FlacStreamInfo();
+                    current.outcome = ConversionOutcome::Unknown;
+                    file = current;
+                    queueProbe(filePath, i);
+                }
+            }
+            addScannedFile(directory, relativeDirectory, file);
+            ++i;
+        }
+    } else {
+        m_indexChanged = true;
         
-        if (isFlacFile(fileInfo)) {
-            ScannedFile file;
-            file.absolutePath = fileInfo.absoluteFilePath();
-            file.relativePath = QDir(baseDirectory).relativeFilePath(file.absolutePath);
-            file.size = fileInfo.size();
-            file.lastModified = fileInfo.lastModified();
+        const QFileInfoList entries = QDir(directory).entryInfoList(
+            QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+        
+        // Album images are only looked for where there is a cue sheet at all
+        const bool hasCueFiles = std::any_of(entries.cbegin(), entries.cend(), [](const QFileInfo &info) {
+            return info.suffix().compare("cue", Qt::CaseInsensitive) == 0;
+        });
+        
+        for (const QFileInfo &fileInfo : entries) {
+            if (m_shouldStop) {
+                return;
+            }
             
-            {
-                QMutexLocker locker(&m_mutex);
-                m_scannedFiles.append(file);
-                m_totalSize += file.size;
+            if (fileInfo.isDir()) {
+                // Like QDirIterator without FollowSymlinks, don't descend into links
+                if (!fileInfo.isSymLink()) {
+                    entry.subdirectories.append(fileInfo.fileName());
+                }
+                continue;
             }
-            filesFound++;
             
-            emit fileFound(file.absolutePath);
+            if (!isFlacFile(fileInfo)) {
+                continue;
+            }
+            
+            LibraryIndexFile file;
+            file.name = fileInfo.fileName();
+            file.size = fileInfo.size();
+            file.mtimeMs = fileInfo.lastModified().toMSecsSinceEpoch();
+            file.inode = fileInode(fileInfo.absoluteFilePath());
+            file.hasSidecarCue = hasCueFiles && !CueSheet::sidecarPath(fileInfo.absoluteFilePath()).isEmpty();
             
-            // Emit progress more frequently for large directories
-            if (filesFound % 10 == 0) {
-                emit scanProgress(filesFound, m_totalSize);
+            // Keep what we already know about files that are unchanged
+            LibraryIndexFile previous;
+            if (indexed >= 0 && m_libraryIndex->findFile(indexed, file.name, previous) &&
+                previous.size == file.size && previous.mtimeMs == file.mtimeMs &&
+                previous.inode == file.inode) {
+                file.streamInfo = previous.streamInfo;
+                file.outcome = previous.outcome;
+            } else {
+                queueProbe(fileInfo.absoluteFilePath(), entry.files.size());
             }
             
-            // Process events periodically to keep UI responsive
-            if (filesFound % 100 == 0) {
-                QCoreApplication::processEvents();
+            entry.files.append(file);
+            addScannedFile(directory, relativeDirectory, file);
+        }
+        
+        // What the index had here and the listing no longer shows
+        if (indexed >= 0) {
+            QSet<QString> listed;
+            for (const LibraryIndexFile &file : std::as_const(entry.files)) {
+                listed.insert(file.name);
+            }
+            for (const LibraryIndexFile &previous : m_libraryIndex->files(indexed)) {
+                if (!listed.contains(previous.name)) {
+                    addRemovedFile(relativeDirectory, previous);
+                }
+            }
+            for (const QString &name : m_libraryIndex->subdirectories(indexed)) {
+                if (!entry.subdirectories.contains(name)) {
+                    addRemovedDirectory(relativeDirectory.isEmpty() ? name : relativeDirectory + '/' + name);
+                }
             }
         }
     }
     
-    m_isScanning = false;
+    const QStringList subdirectories = entry.subdirectories;
+    m_indexDirectories.append(entry);
+    
+    for (const QString &name : subdirectories) {
+        scanIndexedDirectory(directory + '/' + name,
+                             relativeDirectory.isEmpty() ? name : relativeDirectory + '/' + name);
+    }
+}
+
+void FileScanner::addScannedFile(const QString &directory, const QString &relativeDirectory,
+                                 const LibraryIndexFile &indexedFile)
+{
+    ScannedFile file;
+    file.absolutePath = directory + '/' + indexedFile.name;
+    file.relativePath = relativeDirectory.isEmpty() ? indexedFile.name
+                                                    : relativeDirectory + '/' + indexedFile.name;
+    file.size = indexedFile.size;
+    file.lastModified = QDateTime::fromMSecsSinceEpoch(indexedFile.mtimeMs);
+    file.inode = indexedFile.inode;
+    file.streamInfo = indexedFile.streamInfo;
+    file.lastOutcome = indexedFile.outcome;
+    if (indexedFile.hasSidecarCue) {
+        file.cueSheetPath = CueSheet::sidecarPath(file.absolutePath);
+    }
+    
+    {
+        QMutexLocker locker(&m_mutex);
+        m_scannedFiles.append(file);
+        m_totalSize += file.size;
+    }
+    m_filesFound++;
+    
+    emit fileFound(file.absolutePath);
+    
+    // Emit progress more frequently for large directories
+    if (m_filesFound % 10 == 0) {
+        emit scanProgress(m_filesFound, m_totalSize);
+    }
+    
+    // Process events periodically to keep UI responsive
+    if (m_filesFound % 100 == 0) {
+        QCoreApplication::processEvents();
+    }
+}
+
+void FileScanner::addRemovedFile(const QString &relativeDirectory, const LibraryIndexFile &indexedFile)
+{
+    RemovedFile file;
+    file.relativePath = relativeDirectory.isEmpty() ? indexedFile.name
+                                                    : relativeDirectory + '/' + indexedFile.name;
+    file.albumImage = indexedFile.streamInfo.hasCueSheet || indexedFile.hasSidecarCue;
+    
+    QMutexLocker locker(&m_mutex);
+    m_removedFiles.append(file);
+}
+
+void FileScanner::addRemovedDirectory(const QString &relativePath)
+{
+    // Everything the index recorded below a directory that is gone
+    const int indexed = m_libraryIndex->findDirectory(relativePath);
+    if (indexed < 0) {
+        return;
+    }
+    for (const LibraryIndexFile &file : m_libraryIndex->files(indexed)) {
+        addRemovedFile(relativePath, file);
+    }
+    for (const QString &name : m_libraryIndex->subdirectories(indexed)) {
+        addRemovedDirectory(relativePath + '/' + name);
+    }
+}
+
+void FileScanner::queueProbe(const QString &filePath, int file)
+{
+    // The directory entry is appended once its files are listed, and this file
+    // is the next one added to the scan results
+    PendingProbe probe;
+    probe.directory = m_indexDirectories.size();
+    probe.file = file;
+    {
+        QMutexLocker locker(&m_mutex);
+        probe.scanned = m_scannedFiles.size();
+    }
+    probe.result = std::make_shared<FlacStreamInfo>();
+    
+    std::shared_ptr<FlacStreamInfo> result = probe.result;
+    m_probePool.start([filePath, result]() {
+        FlacStreamInfo::probe(filePath, *result);
+    });
+    m_pendingProbes.append(probe);
+}
+
+void FileScanner::applyProbes()
+{
+    TraceSpan span("probe_join", "scanner");
+    if (m_shouldStop) {
+        m_probePool.clear();
+    }
+    m_probePool.waitForDone();
     
     if (!m_shouldStop) {
-        int totalFiles;
-        qint64 totalSize;
-        {
-            QMutexLocker locker(&m_mutex);
-            totalFiles = m_scannedFiles.size();
-            totalSize = m_totalSize;
+        QMutexLocker locker(&m_mutex);
+        for (const PendingProbe &probe : std::as_const(m_pendingProbes)) {
+            m_indexDirectories[probe.directory].files[probe.file].streamInfo = *probe.result;
+            m_scannedFiles[probe.scanned].streamInfo = *probe.result;
         }
-        emit scanCompleted(totalFiles, totalSize);
     }
+    m_pendingProbes.clear();
 }
 
 bool FileScanner::isFlacFile(const QFileInfo &fileInfo) const
 {
-    QString suffix = fileInfo.suffix().toLower();
-    
-    // Check if the suffix matches (without the dot since suffix() returns without dot)
-    for (const QString &ext : m_flacExtensions) {
-        if (ext == "." + suffix) {
+    return hasFlacExtension(fileInfo.fileName());
+}
+
+const QStringList &FileScanner::flacExtensions()
+{
+    static const QStringList extensions = {".flac", ".fla"};
+    return extensions;
+}
+
+bool FileScanner::hasFlacExtension(const QString &filePath)
+{
+    for (const QString &ext : flacExtensions()) {
+        if (filePath.endsWith(ext, Qt::CaseInsensitive)) {
             return true;
         }
     }
@@ -118,6 +401,10 @@ FileScannerWorker::FileScannerWorker(FileScanner *scanner, const QString &direct
 
 void FileScannerWorker::process()
 {
+    if (Tracer::isEnabled()) {
+        Tracer::setThreadName("Scanner");
+    }
+    TraceSpan span("scan", "scanner");
     m_scanner->scanDirectoryRecursive(m_directory, m_directory);
     emit finished();
 }
\ No newline at end of file
@@ -8,13 +8,27 @@
 #include <QDateTime>
 #include <QThread>
 #include <QMutex>
+#include <QThreadPool>
 #include <atomic>
+#include <memory>
+
+#include "LibraryIndex.h"
 
 struct ScannedFile {
     QString absolutePath;
     QString relativePath; // Relative to input directory
     qint64 size;
     QDateTime lastModified;
+    quint64 inode = 0;
+    FlacStreamInfo streamInfo;
+    ConversionOutcome lastOutcome = ConversionOutcome::Unknown;
+    QString cueSheetPath; // Sidecar of an album image, empty if there is none
+};
+
+// A file the library index recorded that the scan no longer found
+struct RemovedFile {
+    QString relativePath;
+    bool albumImage = false;
 };
 
 class FileScanner : public QObject
@@ -28,14 +42,28 @@ public:
     void scanDirectory(const QString &directory);
     void stopScanning();
     
+    // Index used to skip unchanged directories; not owned, may be null
+    void setLibraryIndex(LibraryIndex *index) { m_libraryIndex = index; }
+    
     QList<ScannedFile> getScannedFiles() const { 
         QMutexLocker locker(&m_mutex);
         return m_scannedFiles; 
     }
+    // Sources of the last completed scan that the index had and that are
+    // gone. Directories that could not be listed don't count as gone.
+    QList<RemovedFile> getRemovedFiles() const {
+        QMutexLocker locker(&m_mutex);
+        return m_removedFiles;
+    }
     int getFileCount() const { return m_scannedFiles.size(); }
     qint64 getTotalSize() const { return m_totalSize; }
     bool isScanning() const { return m_isScanning; }
     
+    // Extensions read as FLAC. The watcher and the transcode server accept
+    // the same ones, so every way in sees the same library.
+    static const QStringList &flacExtensions();
+    static bool hasFlacExtension(const QString &filePath);
+    
 signals:
     void scanStarted();
     void fileFound(const QString &filePath);
@@ -45,18 +73,39 @@ signals:
     
 private:
     void scanDirectoryRecursive(const QString &directory, const QString &baseDirectory);
+    void scanIndexedDirectory(const QString &directory, const QString &relativeDirectory);
+    void addScannedFile(const QString &directory, const QString &relativeDirectory, const LibraryIndexFile &indexedFile);
+    void addRemovedFile(const QString &relativeDirectory, const LibraryIndexFile &indexedFile);
+    void addRemovedDirectory(const QString &relativePath);
     bool isFlacFile(const QFileInfo &fileInfo) const;
+    void queueProbe(const QString &filePath, int file);
+    void applyProbes();
     
     friend class FileScannerWorker;
     
     QList<ScannedFile> m_scannedFiles;
+    QList<RemovedFile> m_removedFiles;
     qint64 m_totalSize = 0;
     std::atomic<bool> m_isScanning{false};
     std::atomic<bool> m_shouldStop{false};
     mutable QMutex m_mutex;
     
-    // File extensions to scan
-    const QStringList m_flacExtensions = {".flac", ".fla"};
+    // Snapshot of the tree written back to the index after the scan
+    LibraryIndex *m_libraryIndex = nullptr;
+    QList<LibraryIndexDirectory> m_indexDirectories;
+    bool m_indexChanged = false;
+    int m_filesFound = 0;
+    
+    // Header probes of new and changed files run on a few threads while the
+    // traversal goes on, and are joined before the scan completes
+    struct PendingProbe {
+        int directory;  // In m_indexDirectories
+        int file;       // In that directory's files
+        int scanned;    // In m_scannedFiles
+        std::shared_ptr<FlacStreamInfo> result;
+    };
+    QThreadPool m_probePool;
+    QList<PendingProbe> m_pendingProbes;
 };
 
 // Worker class for background scanning
@@ -0,0 +1,219 @@
+#include "FlacStreamInfo.h"
+#include <QByteArray>
+#include <QFile>
+#include <cstring>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// "fLaC" marker, 4-byte block header and the 34-byte STREAMINFO body
+const qint64 StreamInfoEnd = 4 + 4 + 34;
+const int PaddingBlock = 1;
+const int VorbisCommentBlock = 4;
+const int CueSheetBlock = 5;
+const int MaxMetadataBlocks = 1024;
+const qint64 ProbeReadSize = 4096;
+const quint32 MaxCommentBytes = 1 << 20;
+// Catalog number, lead-in and flags come before the track count
+const qint64 CueSheetTrackCountOffset = 128 + 8 + 259;
+// Offset, number, ISRC, flags and reserved bytes, then the index count; each
+// index is an offset, a number and 3 reserved bytes
+const quint32 CueSheetTrackSize = 8 + 1 + 12 + 1 + 13 + 1;
+const quint32 CueSheetIndexSize = 8 + 1 + 3;
+// A file is only split when it holds at least this many audio tracks
+const int MinImageTracks = 2;
+const QByteArray CueSheetField = "CUESHEET=";
+
+quint32 readLittleEndian32(const unsigned char *data)
+{
+    return quint32(data[0]) | (quint32(data[1]) << 8) | (quint32(data[2]) << 16) | (quint32(data[3]) << 24);
+}
+
+// Audio tracks of a CUESHEET block body, without the lead-out (170 on a CD,
+// 255 otherwise) and data tracks
+int cueSheetAudioTracks(const unsigned char *data, quint32 length)
+{
+    if (length <= CueSheetTrackCountOffset) {
+        return 0;
+    }
+    const int count = data[CueSheetTrackCountOffset];
+    quint32 offset = CueSheetTrackCountOffset + 1;
+    int audioTracks = 0;
+    for (int i = 0; i < count && offset + CueSheetTrackSize <= length; ++i) {
+        const int number = data[offset + 8];
+        const bool audio = !(data[offset + 8 + 1 + 12] & 0x80);
+        const int indices = data[offset + CueSheetTrackSize - 1];
+        if (audio && number != 170 && number != 255) {
+            audioTracks++;
+        }
+        offset += CueSheetTrackSize + indices * CueSheetIndexSize;
+    }
+    return audioTracks;
+}
+
+// AUDIO tracks of a cue sheet in text form
+int cueTextAudioTracks(const QByteArray &text)
+{
+    int audioTracks = 0;
+    for (const QByteArray &line : text.split('\n')) {
+        const QByteArray trimmed = line.trimmed().toUpper();
+        if (trimmed.startsWith("TRACK ") && trimmed.endsWith(" AUDIO")) {
+            audioTracks++;
+        }
+    }
+    return audioTracks;
+}
+
+// Whether a VORBIS_COMMENT block body holds a CUESHEET field with enough
+// tracks to split
+bool commentsHaveCueSheet(const unsigned char *data, quint32 length)
+{
+    if (length < 8) {
+        return false;
+    }
+    quint64 offset = 4 + quint64(readLittleEndian32(data)); // Vendor string
+    if (offset + 4 > length) {
+        return false;
+    }
+    const quint32 count = readLittleEndian32(data + offset);
+    offset += 4;
+    for (quint32 i = 0; i < count && offset + 4 <= length; ++i) {
+        const quint32 fieldLength = readLittleEndian32(data + offset);
+        offset += 4;
+        if (offset + fieldLength > length) {
+            break;
+        }
+        const char *field = reinterpret_cast<const char*>(data + offset);
+        if (fieldLength > quint32(CueSheetField.size()) &&
+            qstrnicmp(field, CueSheetField.constData(), CueSheetField.size()) == 0) {
+            const QByteArray text(field + CueSheetField.size(), int(fieldLength) - CueSheetField.size());
+            return cueTextAudioTracks(text) >= MinImageTracks;
+        }
+        offset += fieldLength;
+    }
+    return false;
+}
+}
+
+bool FlacStreamInfo::hasMd5() const
+{
+    for (quint8 byte : md5) {
+        if (byte != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FlacStreamInfo::parse(const unsigned char *data, qint64 size, FlacStreamInfo &info)
+{
+    info = FlacStreamInfo();
+
+    if (size < StreamInfoEnd || memcmp(data, "fLaC", 4) != 0) {
+        return false;
+    }
+
+    // STREAMINFO must be the first metadata block and is always 34 bytes
+    const unsigned char *header = data + 4;
+    int blockType = header[0] & 0x7F;
+    int blockLength = (header[1] << 16) | (header[2] << 8) | header[3];
+    if (blockType != 0 || blockLength != 34) {
+        return false;
+    }
+
+    const unsigned char *b = header + 4;
+    info.maxBlockSize = static_cast<quint16>((b[2] << 8) | b[3]);
+    info.sampleRate = (quint32(b[10]) << 12) | (quint32(b[11]) << 4) | (b[12] >> 4);
+    info.channels = static_cast<quint8>(((b[12] >> 1) & 0x07) + 1);
+    info.bitsPerSample = static_cast<quint8>((((b[12] & 0x01) << 4) | (b[13] >> 4)) + 1);
+    info.totalSamples = (quint64(b[13] & 0x0F) << 32) | (quint64(b[14]) << 24) |
+                        (quint64(b[15]) << 16) | (quint64(b[16]) << 8) | quint64(b[17]);
+    memcpy(info.md5, b + 18, sizeof(info.md5));
+
+    info.valid = info.sampleRate > 0;
+    return info.valid;
+}
+
+bool FlacStreamInfo::probe(const QString &filePath, FlacStreamInfo &info)
+{
+    info = FlacStreamInfo();
+    unsigned char head[ProbeReadSize];
+
+#ifdef Q_OS_UNIX
+    // One pread usually covers STREAMINFO and the headers of the tag and
+    // picture blocks behind it; larger metadata costs one more per block
+    const int fd = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    const qint64 headSize = qint64(::pread(fd, head, sizeof(head), 0));
+    auto readAt = [fd](qint64 offset, unsigned char *data, qint64 size) {
+        return qint64(::pread(fd, data, size_t(size), off_t(offset))) == size;
+    };
+#else
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 headSize = file.read(reinterpret_cast<char*>(head), sizeof(head));
+    auto readAt = [&file](qint64 offset, unsigned char *data, qint64 size) {
+        return file.seek(offset) && file.read(reinterpret_cast<char*>(data), size) == size;
+    };
+#endif
+
+    const bool ok = parse(head, headSize, info);
+    if (ok) {
+        // Walk the remaining block headers; the bodies are skipped except for
+        // the little it takes to tell whether the file carries a cue sheet
+        qint64 offset = StreamInfoEnd;
+        bool last = head[4] & 0x80;
+        for (int i = 0; !last && i < MaxMetadataBlocks; ++i) {
+            unsigned char header[4];
+            if (offset + 4 <= headSize) {
+                memcpy(header, head + offset, sizeof(header));
+            } else if (!readAt(offset, header, sizeof(header))) {
+                break;
+            }
+            last = header[0] & 0x80;
+            const int type = header[0] & 0x7F;
+            const quint32 length = (quint32(header[1]) << 16) | (quint32(header[2]) << 8) | header[3];
+            if (type != PaddingBlock) {
+                info.metadataBytes += length;
+            }
+
+            // Two audio tracks at least; a per-track file may carry a cue
+            // sheet of its own single track plus the lead-out
+            if (type == CueSheetBlock && length > CueSheetTrackCountOffset && length <= MaxCommentBytes) {
+                std::vector<unsigned char> body(length);
+                if (offset + 4 + length <= headSize) {
+                    memcpy(body.data(), head + offset + 4, length);
+                } else if (!readAt(offset + 4, body.data(), length)) {
+                    body.clear();
+                }
+                if (!body.empty() && cueSheetAudioTracks(body.data(), length) >= MinImageTracks) {
+                    info.hasCueSheet = true;
+                }
+            }
+
+            if (type == VorbisCommentBlock && !info.hasCueSheet && length <= MaxCommentBytes) {
+                if (offset + 4 + length <= headSize) {
+                    info.hasCueSheet = commentsHaveCueSheet(head + offset + 4, length);
+                } else {
+                    std::vector<unsigned char> body(length);
+                    info.hasCueSheet = readAt(offset + 4, body.data(), length) &&
+                                       commentsHaveCueSheet(body.data(), length);
+                }
+            }
+            offset += 4 + length;
+        }
+    }
+
+#ifdef Q_OS_UNIX
+    ::close(fd);
+#endif
+    return ok;
+}
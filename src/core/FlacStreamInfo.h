@@ -0,0 +1,33 @@
+#ifndef FLACSTREAMINFO_H
+#define FLACSTREAMINFO_H
+
+#include <QString>
+#include <QtGlobal>
+
+// Contents of the mandatory STREAMINFO block at the start of every FLAC file
+struct FlacStreamInfo {
+    bool valid = false;
+    quint32 sampleRate = 0;
+    quint8 channels = 0;
+    quint8 bitsPerSample = 0;
+    quint16 maxBlockSize = 0;
+    quint64 totalSamples = 0; // Per channel, 0 if unknown
+    quint8 md5[16] = {};      // MD5 of the decoded audio, all zero if unset
+    quint32 metadataBytes = 0; // Tags, pictures and other blocks after STREAMINFO, padding excluded
+    bool hasCueSheet = false;  // CUESHEET block with audio tracks, or a CUESHEET comment
+
+    double durationSeconds() const {
+        return sampleRate > 0 ? static_cast<double>(totalSamples) / sampleRate : 0.0;
+    }
+    bool hasMd5() const;
+
+    // Parse the "fLaC" marker and STREAMINFO block from the first bytes of a file
+    static bool parse(const unsigned char *data, qint64 size, FlacStreamInfo &info);
+
+    // Read and parse the STREAMINFO block without initializing a decoder, then
+    // walk the remaining metadata block headers to size them and spot an
+    // embedded cue sheet
+    static bool probe(const QString &filePath, FlacStreamInfo &info);
+};
+
+#endif // FLACSTREAMINFO_H
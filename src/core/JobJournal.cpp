@@ -0,0 +1,262 @@
+#include "JobJournal.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <utility>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+QByteArray record(QJsonObject fields)
+{
+    return QJsonDocument(fields).toJson(QJsonDocument::Compact) + '\n';
+}
+}
+
+JobJournal::JobJournal(const QString &path)
+    : m_file(path)
+{
+    m_sinceSync.start();
+}
+
+JobJournal::~JobJournal()
+{
+    QMutexLocker syncLocker(&m_syncMutex);
+    writeBuffered();
+}
+
+bool JobJournal::load()
+{
+    QMutexLocker locker(&m_mutex);
+    m_unfinished = false;
+    m_unfinishedSettings.clear();
+    m_committed.clear();
+    m_interrupted.clear();
+
+    QFile file(m_file.fileName());
+    if (file.exists()) {
+        if (!file.open(QIODevice::ReadOnly)) {
+            m_lastError = QString("Failed to read journal %1: %2").arg(file.fileName(), file.errorString());
+            return false;
+        }
+        // A torn last line from a crash ends the replay
+        while (!file.atEnd() && replay(file.readLine())) {
+        }
+    }
+
+    // Records not yet on disk come last. A group whose write is under way
+    // may also be in the file already; replaying it twice changes nothing.
+    for (const QByteArray &pending : {m_writing, m_buffer}) {
+        for (const QByteArray &line : pending.split('\n')) {
+            if (!line.isEmpty()) {
+                replay(line);
+            }
+        }
+    }
+
+    if (!m_unfinished) {
+        m_committed.clear();
+        m_interrupted.clear();
+    }
+    return true;
+}
+
+bool JobJournal::replay(const QByteArray &line)
+{
+    QJsonObject fields = QJsonDocument::fromJson(line).object();
+    if (fields.isEmpty()) {
+        return false;
+    }
+
+    const QString op = fields.value("op").toString();
+    const QString path = fields.value("path").toString();
+    if (op == "begin") {
+        m_unfinished = true;
+        m_unfinishedSettings = fields.value("settings").toString();
+        m_committed.clear();
+        m_interrupted.clear();
+    } else if (op == "start") {
+        m_interrupted.insert(path);
+    } else if (op == "commit") {
+        m_interrupted.remove(path);
+        CommittedOutput output;
+        output.size = qint64(fields.value("size").toDouble());
+        m_committed.insert(path, output);
+    } else if (op == "fail") {
+        m_interrupted.remove(path);
+        m_committed.remove(path);
+    } else if (op == "end") {
+        m_unfinished = false;
+    }
+    return true;
+}
+
+void JobJournal::beginBatch(const QString &settings, bool resume)
+{
+    // The file is reopened by the next write, so this never waits for a sync
+    QMutexLocker locker(&m_mutex);
+    m_buffer.clear();
+    m_unsyncedOutputs.clear();
+    m_batchOpen = true;
+    m_reopen = true;
+    m_reopenMode = QIODevice::WriteOnly | (resume ? QIODevice::Append : QIODevice::Truncate);
+    m_closeAfterWrite = false;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    append(resume ? record({{"op", "resume"}, {"time", now}})
+                  : record({{"op", "begin"}, {"settings", settings}, {"time", now}}));
+}
+
+void JobJournal::endBatch()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_batchOpen) {
+        return;
+    }
+    append(record({{"op", "end"}, {"time", QDateTime::currentMSecsSinceEpoch()}}));
+    m_batchOpen = false;
+    m_closeAfterWrite = true;
+}
+
+void JobJournal::jobStarted(const QString &relativePath)
+{
+    QMutexLocker locker(&m_mutex);
+    append(record({{"op", "start"}, {"path", relativePath}}));
+}
+
+void JobJournal::jobCommitted(const QString &relativePath, const QString &outputPath, qint64 size)
+{
+    bool due = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        append(record({{"op", "commit"}, {"path", relativePath}, {"size", size}}));
+        m_unsyncedOutputs.append(outputPath);
+        due = m_unsyncedOutputs.size() >= SyncEveryCommits || m_sinceSync.elapsed() >= SyncIntervalMs;
+    }
+
+    if (due) {
+        sync();
+    }
+}
+
+void JobJournal::jobFailed(const QString &relativePath)
+{
+    QMutexLocker locker(&m_mutex);
+    append(record({{"op", "fail"}, {"path", relativePath}}));
+}
+
+bool JobJournal::sync()
+{
+    QMutexLocker syncLocker(&m_syncMutex);
+    return writeBuffered();
+}
+
+QString JobJournal::getLastError() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_lastError;
+}
+
+void JobJournal::append(const QByteArray &line)
+{
+    if (m_batchOpen) {
+        m_buffer.append(line);
+    }
+}
+
+bool JobJournal::writeBuffered()
+{
+    // Called with m_syncMutex held. The group is taken out of the buffer, so
+    // records added while it is synced go into the next one.
+    QByteArray buffer;
+    QStringList unsyncedOutputs;
+    bool reopen = false;
+    QIODevice::OpenMode reopenMode;
+    bool close = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_sinceSync.restart();
+        buffer.swap(m_buffer);
+        unsyncedOutputs.swap(m_unsyncedOutputs);
+        std::swap(reopen, m_reopen);
+        reopenMode = m_reopenMode;
+        std::swap(close, m_closeAfterWrite);
+        m_writing = buffer;
+    }
+    const bool ok = writeGroup(buffer, unsyncedOutputs, reopen, reopenMode);
+    if (close) {
+        m_file.close();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_writing.clear();
+    return ok;
+}
+
+bool JobJournal::writeGroup(const QByteArray &buffer, const QStringList &unsyncedOutputs,
+                            bool reopen, QIODevice::OpenMode reopenMode)
+{
+    if (reopen) {
+        m_file.close();
+        if (!QDir().mkpath(QFileInfo(m_file.fileName()).absolutePath()) || !m_file.open(reopenMode)) {
+            QMutexLocker locker(&m_mutex);
+            m_lastError = QString("Failed to open journal %1: %2").arg(m_file.fileName(), m_file.errorString());
+            return false;
+        }
+    }
+    if (buffer.isEmpty() || !m_file.isOpen()) {
+        return true;
+    }
+
+#ifdef Q_OS_UNIX
+    // Outputs first, so no commit record outlives its file on power loss.
+    // One syncfs covers the whole group, renames included.
+    if (!unsyncedOutputs.isEmpty()) {
+#ifdef Q_OS_LINUX
+        int fd = ::open(QFile::encodeName(unsyncedOutputs.first()).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ::syncfs(fd);
+            ::close(fd);
+        }
+#else
+        for (const QString &output : unsyncedOutputs) {
+            int fd = ::open(QFile::encodeName(output).constData(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                ::fsync(fd);
+                ::close(fd);
+            }
+        }
+#endif
+    }
+#endif
+
+    if (m_file.write(buffer) != buffer.size() || !m_file.flush()) {
+        QMutexLocker locker(&m_mutex);
+        m_lastError = QString("Failed to write journal %1: %2").arg(m_file.fileName(), m_file.errorString());
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    ::fdatasync(m_file.handle());
+#endif
+    return true;
+}
+
+QString JobJournal::defaultPath(const QString &inputDirectory, const QString &outputDirectory,
+                                const QString &kind)
+{
+    QByteArray key = QDir(inputDirectory).absolutePath().toUtf8() + '\0' +
+                     QDir(outputDirectory).absolutePath().toUtf8();
+    QString fileName = QString::fromLatin1(
+        QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex()) +
+        (kind.isEmpty() ? QString() : '.' + kind) + ".journal";
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return QDir(cacheDir).filePath("journal/" + fileName);
+}
@@ -0,0 +1,96 @@
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+// Append-only record of one batch, one JSON object per line: begin, start,
+// commit (with output size), fail and end. A journal without an
+// end record belongs to an interrupted batch, and replaying it tells the next
+// run which outputs are known good and which jobs were cut off.
+//
+// Records are buffered and written in groups. Before a group is synced the
+// outputs it commits are flushed to disk, so a durable commit record always
+// refers to a durable file. Only sync() and the destructor touch the disk;
+// the rest just buffer, so they are cheap enough for the GUI thread.
+class JobJournal
+{
+public:
+    struct CommittedOutput {
+        qint64 size = 0;
+    };
+
+    explicit JobJournal(const QString &path);
+    ~JobJournal();
+
+    QString path() const { return m_file.fileName(); }
+
+    // Replay the journal on disk and the records not yet written; a missing
+    // journal is not an error
+    bool load();
+    bool hasUnfinishedBatch() const { return m_unfinished; }
+    QString unfinishedSettings() const { return m_unfinishedSettings; }
+    const QHash<QString, CommittedOutput> &committedOutputs() const { return m_committed; }
+    const QSet<QString> &interruptedJobs() const { return m_interrupted; }
+
+    // Start a new journal, or keep appending to the interrupted one. The file
+    // is opened and closed by the next sync.
+    void beginBatch(const QString &settings, bool resume);
+    void endBatch();
+
+    // Jobs are identified by their path relative to the input directory.
+    // All of these may be called from any thread.
+    void jobStarted(const QString &relativePath);
+    void jobCommitted(const QString &relativePath, const QString &outputPath, qint64 size);
+    void jobFailed(const QString &relativePath);
+
+    // Write buffered records now, e.g. before pausing. This can wait on
+    // syncfs, so keep it off the GUI thread.
+    bool sync();
+
+    QString getLastError() const;
+
+    // One journal per input and output pair; a non-empty kind names a
+    // separate one next to it, e.g. for watch mode
+    static QString defaultPath(const QString &inputDirectory, const QString &outputDirectory,
+                               const QString &kind = QString());
+
+private:
+    static const int SyncEveryCommits = 32;
+    static const qint64 SyncIntervalMs = 30000;
+
+    // m_mutex guards the buffered records and is only held briefly, so
+    // recording a job never waits for a sync. m_syncMutex orders the writes
+    // and guards the file; it is taken before m_mutex.
+    mutable QMutex m_mutex;
+    QMutex m_syncMutex;
+    QFile m_file;
+    QByteArray m_buffer;
+    QByteArray m_writing;   // The group being written, until it is on disk
+    QStringList m_unsyncedOutputs;
+    bool m_batchOpen = false;
+    bool m_reopen = false;
+    QIODevice::OpenMode m_reopenMode;
+    bool m_closeAfterWrite = false;
+    QElapsedTimer m_sinceSync;
+    QString m_lastError;
+
+    bool m_unfinished = false;
+    QString m_unfinishedSettings;
+    QHash<QString, CommittedOutput> m_committed;
+    QSet<QString> m_interrupted;
+
+    bool replay(const QByteArray &line);
+    void append(const QByteArray &record);
+    bool writeBuffered();
+    bool writeGroup(const QByteArray &buffer, const QStringList &unsyncedOutputs,
+                    bool reopen, QIODevice::OpenMode reopenMode);
+};
+
+#endif // JOBJOURNAL_H
@@ -0,0 +1,518 @@
+#include "LibraryIndex.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QMutexLocker>
+#include <QHash>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// On-disk layout (native byte order, the index is a local cache):
+//   Header | DirectoryRecord[directoryCount] | quint32 children[childCount]
+//   (padded to 8) | FileRecord[fileCount] | UTF-8 string pool
+// Directories are sorted by relative path and own a contiguous range of files
+// sorted by name, so both lookups are binary searches over the mapping.
+
+struct LibraryIndex::Header {
+    char magic[8];
+    quint32 version;
+    quint32 directoryCount;
+    quint32 childCount;
+    quint32 fileCount;
+    quint64 directoriesOffset;
+    quint64 childrenOffset;
+    quint64 filesOffset;
+    quint64 stringsOffset;
+    quint64 stringsSize;
+};
+
+struct LibraryIndex::DirectoryRecord {
+    quint32 pathOffset;
+    quint32 pathLength;
+    qint64 mtimeMs;
+    quint32 firstFile;
+    quint32 fileCount;
+    quint32 firstChild;
+    quint32 childCount;
+};
+
+struct LibraryIndex::FileRecord {
+    quint32 nameOffset;
+    quint32 nameLength;
+    qint64 size;
+    qint64 mtimeMs;
+    quint64 inode;
+    quint64 totalSamples;
+    quint32 sampleRate;
+    quint8 channels;
+    quint8 bitsPerSample;
+    quint8 flags;
+    quint8 outcome;
+    quint8 md5[16];
+    quint32 metadataBytes;
+    quint16 maxBlockSize;
+    quint16 reserved;
+};
+
+namespace {
+const char IndexMagic[8] = {'O', 'R', 'I', 'P', 'I', 'D', 'X', '\0'};
+const quint32 IndexVersion = 3;
+const quint8 FlagStreamInfoValid = 0x01;
+const quint8 FlagHasCueSheet = 0x02;
+const quint8 FlagSidecarCue = 0x04;
+
+int compareBytes(const char *data, quint32 length, const QByteArray &key)
+{
+    int result = memcmp(data, key.constData(), qMin<size_t>(length, size_t(key.size())));
+    if (result != 0) {
+        return result;
+    }
+    if (length == quint32(key.size())) {
+        return 0;
+    }
+    return length < quint32(key.size()) ? -1 : 1;
+}
+
+bool lessBytes(const QByteArray &a, const QByteArray &b)
+{
+    return compareBytes(a.constData(), a.size(), b) < 0;
+}
+
+qint64 align8(qint64 offset)
+{
+    return (offset + 7) & ~qint64(7);
+}
+}
+
+LibraryIndex::LibraryIndex(const QString &rootDirectory, const QString &indexPath)
+    : m_rootDirectory(rootDirectory)
+    , m_indexPath(indexPath.isEmpty() ? defaultIndexPath(rootDirectory) : indexPath)
+{
+    static_assert(sizeof(Header) == 64, "unexpected index header size");
+    static_assert(sizeof(DirectoryRecord) == 32, "unexpected directory record size");
+    static_assert(sizeof(FileRecord) == 72, "unexpected file record size");
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    close();
+}
+
+QString LibraryIndex::defaultIndexPath(const QString &rootDirectory)
+{
+    QByteArray rootKey = QDir(rootDirectory).absolutePath().toUtf8();
+    QString fileName = QString::fromLatin1(
+        QCryptographicHash::hash(rootKey, QCryptographicHash::Sha1).toHex()) + ".idx";
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return QDir(cacheDir).filePath("library-index/" + fileName);
+}
+
+bool LibraryIndex::load()
+{
+    QMutexLocker locker(&m_mutex);
+    return mapFile();
+}
+
+bool LibraryIndex::isLoaded() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_header != nullptr;
+}
+
+void LibraryIndex::close()
+{
+    QMutexLocker locker(&m_mutex);
+    unmapFile();
+}
+
+bool LibraryIndex::mapFile()
+{
+    unmapFile();
+
+    if (!QFile::exists(m_indexPath)) {
+        return false;
+    }
+
+    // Open read-write so outcomes can be updated in place; fall back to a
+    // read-only mapping if the cache directory is not writable
+    m_file.setFileName(m_indexPath);
+    if (!m_file.open(QIODevice::ReadWrite) && !m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(Header))) {
+        unmapFile();
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        unmapFile();
+        return false;
+    }
+
+    const Header *header = reinterpret_cast<const Header*>(m_data);
+    bool valid = memcmp(header->magic, IndexMagic, sizeof(IndexMagic)) == 0
+        && header->version == IndexVersion
+        && header->directoriesOffset + quint64(header->directoryCount) * sizeof(DirectoryRecord) <= quint64(m_size)
+        && header->childrenOffset + quint64(header->childCount) * sizeof(quint32) <= quint64(m_size)
+        && header->filesOffset + quint64(header->fileCount) * sizeof(FileRecord) <= quint64(m_size)
+        && header->stringsOffset + header->stringsSize <= quint64(m_size)
+        && header->directoriesOffset % 8 == 0 && header->filesOffset % 8 == 0;
+
+    if (!valid) {
+        qDebug() << "Ignoring incompatible library index" << m_indexPath;
+        unmapFile();
+        return false;
+    }
+
+    m_header = header;
+    m_directories = reinterpret_cast<const DirectoryRecord*>(m_data + header->directoriesOffset);
+    m_children = reinterpret_cast<const quint32*>(m_data + header->childrenOffset);
+    m_files = reinterpret_cast<FileRecord*>(m_data + header->filesOffset);
+    m_strings = reinterpret_cast<const char*>(m_data + header->stringsOffset);
+
+    // Reject ranges that point outside the tables
+    for (quint32 i = 0; i < header->directoryCount; ++i) {
+        const DirectoryRecord &dir = m_directories[i];
+        if (quint64(dir.firstFile) + dir.fileCount > header->fileCount ||
+            quint64(dir.firstChild) + dir.childCount > header->childCount) {
+            unmapFile();
+            return false;
+        }
+    }
+    for (quint32 i = 0; i < header->childCount; ++i) {
+        if (m_children[i] >= header->directoryCount) {
+            unmapFile();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void LibraryIndex::unmapFile()
+{
+    if (m_data) {
+        m_file.unmap(m_data);
+    }
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+    m_directories = nullptr;
+    m_children = nullptr;
+    m_files = nullptr;
+    m_strings = nullptr;
+}
+
+bool LibraryIndex::save(const QList<LibraryIndexDirectory> &directories)
+{
+    // Sort directories by their UTF-8 path so lookups can binary search
+    QList<QPair<QByteArray, int>> order;
+    order.reserve(directories.size());
+    for (int i = 0; i < directories.size(); ++i) {
+        order.append(qMakePair(directories[i].relativePath.toUtf8(), i));
+    }
+    std::sort(order.begin(), order.end(), [](const QPair<QByteArray, int> &a, const QPair<QByteArray, int> &b) {
+        return lessBytes(a.first, b.first);
+    });
+
+    QHash<QByteArray, quint32> indexByPath;
+    indexByPath.reserve(order.size());
+    for (int i = 0; i < order.size(); ++i) {
+        indexByPath.insert(order[i].first, quint32(i));
+    }
+
+    QByteArray strings;
+    auto addString = [&strings](const QByteArray &value) {
+        quint32 offset = quint32(strings.size());
+        strings.append(value);
+        return offset;
+    };
+
+    std::vector<DirectoryRecord> dirRecords;
+    std::vector<quint32> children;
+    std::vector<FileRecord> fileRecords;
+    dirRecords.reserve(order.size());
+
+    for (const auto &entry : order) {
+        const LibraryIndexDirectory &directory = directories[entry.second];
+
+        DirectoryRecord dir = {};
+        dir.pathOffset = addString(entry.first);
+        dir.pathLength = quint32(entry.first.size());
+        dir.mtimeMs = directory.mtimeMs;
+        dir.firstFile = quint32(fileRecords.size());
+        dir.firstChild = quint32(children.size());
+
+        QList<QPair<QByteArray, int>> fileOrder;
+        fileOrder.reserve(directory.files.size());
+        for (int i = 0; i < directory.files.size(); ++i) {
+            fileOrder.append(qMakePair(directory.files[i].name.toUtf8(), i));
+        }
+        std::sort(fileOrder.begin(), fileOrder.end(), [](const QPair<QByteArray, int> &a, const QPair<QByteArray, int> &b) {
+            return lessBytes(a.first, b.first);
+        });
+
+        for (const auto &fileEntry : fileOrder) {
+            const LibraryIndexFile &file = directory.files[fileEntry.second];
+            FileRecord record = {};
+            record.nameOffset = addString(fileEntry.first);
+            record.nameLength = quint32(fileEntry.first.size());
+            record.size = file.size;
+            record.mtimeMs = file.mtimeMs;
+            record.inode = file.inode;
+            record.totalSamples = file.streamInfo.totalSamples;
+            record.sampleRate = file.streamInfo.sampleRate;
+            record.channels = file.streamInfo.channels;
+            record.bitsPerSample = file.streamInfo.bitsPerSample;
+            record.maxBlockSize = file.streamInfo.maxBlockSize;
+            record.metadataBytes = file.streamInfo.metadataBytes;
+            record.flags = (file.streamInfo.valid ? FlagStreamInfoValid : 0) |
+                           (file.streamInfo.hasCueSheet ? FlagHasCueSheet : 0) |
+                           (file.hasSidecarCue ? FlagSidecarCue : 0);
+            record.outcome = quint8(file.outcome);
+            memcpy(record.md5, file.streamInfo.md5, sizeof(record.md5));
+            fileRecords.push_back(record);
+        }
+        dir.fileCount = quint32(fileRecords.size()) - dir.firstFile;
+
+        for (const QString &name : directory.subdirectories) {
+            QByteArray childPath = entry.first.isEmpty() ? name.toUtf8() : entry.first + '/' + name.toUtf8();
+            auto it = indexByPath.constFind(childPath);
+            if (it != indexByPath.constEnd()) {
+                children.push_back(it.value());
+            }
+        }
+        dir.childCount = quint32(children.size()) - dir.firstChild;
+
+        dirRecords.push_back(dir);
+    }
+
+    Header header = {};
+    memcpy(header.magic, IndexMagic, sizeof(IndexMagic));
+    header.version = IndexVersion;
+    header.directoryCount = quint32(dirRecords.size());
+    header.childCount = quint32(children.size());
+    header.fileCount = quint32(fileRecords.size());
+    header.directoriesOffset = sizeof(Header);
+    header.childrenOffset = header.directoriesOffset + dirRecords.size() * sizeof(DirectoryRecord);
+    header.filesOffset = align8(header.childrenOffset + children.size() * sizeof(quint32));
+    header.stringsOffset = header.filesOffset + fileRecords.size() * sizeof(FileRecord);
+    header.stringsSize = quint64(strings.size());
+
+    QMutexLocker locker(&m_mutex);
+
+    QDir().mkpath(QFileInfo(m_indexPath).absolutePath());
+    QSaveFile output(m_indexPath);
+    if (!output.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to write library index:" << output.errorString();
+        return false;
+    }
+
+    const char padding[8] = {};
+    qint64 childrenEnd = header.childrenOffset + children.size() * sizeof(quint32);
+
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(dirRecords.data()), dirRecords.size() * sizeof(DirectoryRecord));
+    output.write(reinterpret_cast<const char*>(children.data()), children.size() * sizeof(quint32));
+    output.write(padding, header.filesOffset - childrenEnd);
+    output.write(reinterpret_cast<const char*>(fileRecords.data()), fileRecords.size() * sizeof(FileRecord));
+    output.write(strings);
+
+    // The old mapping must go before the rename replaces the file
+    unmapFile();
+    if (!output.commit()) {
+        qDebug() << "Failed to write library index:" << output.errorString();
+        mapFile();
+        return false;
+    }
+
+    return mapFile();
+}
+
+int LibraryIndex::findDirectory(const QString &relativePath) const
+{
+    QMutexLocker locker(&m_mutex);
+    return findDirectoryLocked(relativePath.toUtf8());
+}
+
+qint64 LibraryIndex::directoryMtime(int directory) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_header || directory < 0 || quint32(directory) >= m_header->directoryCount) {
+        return 0;
+    }
+    return m_directories[directory].mtimeMs;
+}
+
+QStringList LibraryIndex::subdirectories(int directory) const
+{
+    QMutexLocker locker(&m_mutex);
+    QStringList names;
+    if (!m_header || directory < 0 || quint32(directory) >= m_header->directoryCount) {
+        return names;
+    }
+
+    const DirectoryRecord &dir = m_directories[directory];
+    names.reserve(dir.childCount);
+    for (quint32 i = 0; i < dir.childCount; ++i) {
+        const DirectoryRecord &child = m_directories[m_children[dir.firstChild + i]];
+        QByteArray path = stringAt(child.pathOffset, child.pathLength);
+        names.append(QString::fromUtf8(path.mid(path.lastIndexOf('/') + 1)));
+    }
+    return names;
+}
+
+QList<LibraryIndexFile> LibraryIndex::files(int directory) const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<LibraryIndexFile> result;
+    if (!m_header || directory < 0 || quint32(directory) >= m_header->directoryCount) {
+        return result;
+    }
+
+    const DirectoryRecord &dir = m_directories[directory];
+    result.reserve(dir.fileCount);
+    for (quint32 i = 0; i < dir.fileCount; ++i) {
+        result.append(fileFromRecord(m_files[dir.firstFile + i]));
+    }
+    return result;
+}
+
+bool LibraryIndex::findFile(int directory, const QString &name, LibraryIndexFile &file) const
+{
+    QMutexLocker locker(&m_mutex);
+    int index = findFileLocked(directory, name.toUtf8());
+    if (index < 0) {
+        return false;
+    }
+    file = fileFromRecord(m_files[index]);
+    return true;
+}
+
+bool LibraryIndex::setOutcome(const QString &relativePath, ConversionOutcome outcome)
+{
+    int slash = relativePath.lastIndexOf('/');
+    QByteArray directoryPath = slash < 0 ? QByteArray() : relativePath.left(slash).toUtf8();
+    QByteArray name = relativePath.mid(slash + 1).toUtf8();
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_header || !(m_file.openMode() & QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    int index = findFileLocked(findDirectoryLocked(directoryPath), name);
+    if (index < 0) {
+        return false;
+    }
+
+    m_files[index].outcome = quint8(outcome);
+    return true;
+}
+
+int LibraryIndex::directoryCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_header ? int(m_header->directoryCount) : 0;
+}
+
+int LibraryIndex::fileCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_header ? int(m_header->fileCount) : 0;
+}
+
+int LibraryIndex::findDirectoryLocked(const QByteArray &path) const
+{
+    if (!m_header) {
+        return -1;
+    }
+
+    int low = 0;
+    int high = int(m_header->directoryCount) - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        const DirectoryRecord &dir = m_directories[mid];
+        if (quint64(dir.pathOffset) + dir.pathLength > m_header->stringsSize) {
+            return -1;
+        }
+        int cmp = compareBytes(m_strings + dir.pathOffset, dir.pathLength, path);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+int LibraryIndex::findFileLocked(int directory, const QByteArray &name) const
+{
+    if (!m_header || directory < 0 || quint32(directory) >= m_header->directoryCount) {
+        return -1;
+    }
+
+    const DirectoryRecord &dir = m_directories[directory];
+    int low = int(dir.firstFile);
+    int high = int(dir.firstFile + dir.fileCount) - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        const FileRecord &file = m_files[mid];
+        if (quint64(file.nameOffset) + file.nameLength > m_header->stringsSize) {
+            return -1;
+        }
+        int cmp = compareBytes(m_strings + file.nameOffset, file.nameLength, name);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+LibraryIndexFile LibraryIndex::fileFromRecord(const FileRecord &record) const
+{
+    LibraryIndexFile file;
+    file.name = QString::fromUtf8(stringAt(record.nameOffset, record.nameLength));
+    file.size = record.size;
+    file.mtimeMs = record.mtimeMs;
+    file.inode = record.inode;
+    file.streamInfo.valid = record.flags & FlagStreamInfoValid;
+    file.streamInfo.hasCueSheet = record.flags & FlagHasCueSheet;
+    file.hasSidecarCue = record.flags & FlagSidecarCue;
+    file.streamInfo.sampleRate = record.sampleRate;
+    file.streamInfo.channels = record.channels;
+    file.streamInfo.bitsPerSample = record.bitsPerSample;
+    file.streamInfo.totalSamples = record.totalSamples;
+    file.streamInfo.maxBlockSize = record.maxBlockSize;
+    file.streamInfo.metadataBytes = record.metadataBytes;
+    memcpy(file.streamInfo.md5, record.md5, sizeof(record.md5));
+    file.outcome = static_cast<ConversionOutcome>(record.outcome);
+    return file;
+}
+
+QByteArray LibraryIndex::stringAt(quint32 offset, quint32 length) const
+{
+    if (!m_header || quint64(offset) + length > m_header->stringsSize) {
+        return QByteArray();
+    }
+    // Raw view into the mapping; callers convert before the mapping changes
+    return QByteArray::fromRawData(m_strings + offset, int(length));
+}
@@ -0,0 +1,96 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QFile>
+#include <QMutex>
+
+#include "FlacStreamInfo.h"
+
+// Result of the most recent conversion of an indexed file
+enum class ConversionOutcome : quint8 {
+    Unknown = 0,
+    Converted,
+    Failed
+};
+
+struct LibraryIndexFile {
+    QString name;             // File name within its directory
+    qint64 size = 0;
+    qint64 mtimeMs = 0;
+    quint64 inode = 0;
+    FlacStreamInfo streamInfo;
+    ConversionOutcome outcome = ConversionOutcome::Unknown;
+    bool hasSidecarCue = false; // A .cue with the same base name sits next to it
+};
+
+struct LibraryIndexDirectory {
+    QString relativePath;     // Relative to the input root, empty for the root itself
+    qint64 mtimeMs = 0;
+    QStringList subdirectories;
+    QList<LibraryIndexFile> files;
+};
+
+// Persistent per-root index of the input tree. The file is memory-mapped on
+// load and queried in place, so an unchanged tree costs one stat per directory.
+class LibraryIndex
+{
+public:
+    explicit LibraryIndex(const QString &rootDirectory, const QString &indexPath = QString());
+    ~LibraryIndex();
+
+    QString rootDirectory() const { return m_rootDirectory; }
+    QString indexPath() const { return m_indexPath; }
+    static QString defaultIndexPath(const QString &rootDirectory);
+
+    // Map the index file; returns false if it is missing or unreadable
+    bool load();
+    bool isLoaded() const;
+    void close();
+
+    // Replace the index with a fresh snapshot of the tree and remap it
+    bool save(const QList<LibraryIndexDirectory> &directories);
+
+    // Lookups, valid until the next save() or close()
+    int findDirectory(const QString &relativePath) const;
+    qint64 directoryMtime(int directory) const;
+    QStringList subdirectories(int directory) const;
+    QList<LibraryIndexFile> files(int directory) const;
+    bool findFile(int directory, const QString &name, LibraryIndexFile &file) const;
+
+    // Record a conversion result directly in the mapped file
+    bool setOutcome(const QString &relativePath, ConversionOutcome outcome);
+
+    int directoryCount() const;
+    int fileCount() const;
+
+private:
+    struct Header;
+    struct DirectoryRecord;
+    struct FileRecord;
+
+    QString m_rootDirectory;
+    QString m_indexPath;
+    QFile m_file;
+    mutable QMutex m_mutex;
+
+    // Views into the mapped file
+    uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    const Header *m_header = nullptr;
+    const DirectoryRecord *m_directories = nullptr;
+    const quint32 *m_children = nullptr;
+    FileRecord *m_files = nullptr;
+    const char *m_strings = nullptr;
+
+    bool mapFile();
+    void unmapFile();
+    int findDirectoryLocked(const QByteArray &path) const;
+    int findFileLocked(int directory, const QByteArray &name) const;
+    LibraryIndexFile fileFromRecord(const FileRecord &record) const;
+    QByteArray stringAt(quint32 offset, quint32 length) const;
+};
+
+#endif // LIBRARYINDEX_H
@@ -0,0 +1,377 @@
+#include "LoudnessAnalyzer.h"
+#include <QList>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+const double Pi = 3.14159265358979323846;
+const double AbsoluteGate = -70.0;     // LUFS
+const double RelativeGate = -10.0;     // LU below the absolute-gated loudness
+const double ReferenceLufs = -23.0;    // EBU R128, also the R128_*_GAIN reference
+const double SurroundWeight = 1.41;
+
+double energyToLufs(double energy)
+{
+    return -0.691 + 10.0 * std::log10(energy);
+}
+
+double lufsToEnergy(double lufs)
+{
+    return std::pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+// ITU-R BS.1770-4 Annex 2: 48-tap interpolation filter for 4x oversampling,
+// split into its four phases
+const float TruePeakTaps[4][12] = {
+    { 0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f,
+     -0.0594482421875f,  0.1373291015625f,  0.9721679687500f, -0.1022949218750f,
+      0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f},
+    {-0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f,
+     -0.1665039062500f,  0.4650878906250f,  0.7797851562500f, -0.2003173828125f,
+      0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f},
+    {-0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f,
+     -0.2003173828125f,  0.7797851562500f,  0.4650878906250f, -0.1665039062500f,
+      0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f},
+    {-0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f,
+     -0.1022949218750f,  0.9721679687500f,  0.1373291015625f, -0.0594482421875f,
+      0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f},
+};
+
+// BS.1770 channel weights in FLAC's channel order: LFE is left out and the
+// back and side channels count 1.41
+std::vector<double> channelWeights(int channels)
+{
+    std::vector<double> weights(size_t(channels), 1.0);
+    auto surround = [&](std::initializer_list<int> indices) {
+        for (int index : indices) {
+            weights[size_t(index)] = SurroundWeight;
+        }
+    };
+    switch (channels) {
+    case 4: surround({2, 3}); break;                                          // FL FR BL BR
+    case 5: surround({3, 4}); break;                                          // FL FR FC BL BR
+    case 6: weights[3] = 0.0; surround({4, 5}); break;                        // FL FR FC LFE BL BR
+    case 7: weights[3] = 0.0; surround({4, 5, 6}); break;                     // FL FR FC LFE BC SL SR
+    case 8: weights[3] = 0.0; surround({4, 5, 6, 7}); break;                  // FL FR FC LFE BL BR SL SR
+    default: break;
+    }
+    return weights;
+}
+}
+
+void LoudnessStats::addBlock(double energy)
+{
+    const double lufs = energyToLufs(energy);
+    if (!(lufs > AbsoluteGate)) {
+        return;
+    }
+    if (blockCounts.empty()) {
+        blockCounts.assign(Bins, 0);
+        blockEnergy.assign(Bins, 0.0);
+    }
+    const int bin = std::clamp(int((lufs - AbsoluteGate) * 10.0), 0, Bins - 1);
+    ++blockCounts[size_t(bin)];
+    blockEnergy[size_t(bin)] += energy;
+}
+
+void LoudnessStats::merge(const LoudnessStats &other)
+{
+    truePeak = std::max(truePeak, other.truePeak);
+    if (other.isEmpty()) {
+        return;
+    }
+    if (isEmpty()) {
+        blockCounts = other.blockCounts;
+        blockEnergy = other.blockEnergy;
+        return;
+    }
+    for (size_t bin = 0; bin < size_t(Bins); ++bin) {
+        blockCounts[bin] += other.blockCounts[bin];
+        blockEnergy[bin] += other.blockEnergy[bin];
+    }
+}
+
+double LoudnessStats::integratedLufs() const
+{
+    if (isEmpty()) {
+        return AbsoluteGate;
+    }
+
+    quint64 count = 0;
+    double energy = 0.0;
+    for (size_t bin = 0; bin < size_t(Bins); ++bin) {
+        count += blockCounts[bin];
+        energy += blockEnergy[bin];
+    }
+
+    // Bins wholly on one side of the relative gate are exact; the one it
+    // falls in is kept or dropped by the mean of its blocks
+    const double gateEnergy = lufsToEnergy(energyToLufs(energy / double(count)) + RelativeGate);
+    quint64 gatedCount = 0;
+    double gatedEnergy = 0.0;
+    for (size_t bin = 0; bin < size_t(Bins); ++bin) {
+        if (blockCounts[bin] > 0 && blockEnergy[bin] / blockCounts[bin] >= gateEnergy) {
+            gatedCount += blockCounts[bin];
+            gatedEnergy += blockEnergy[bin];
+        }
+    }
+    return gatedCount > 0 ? energyToLufs(gatedEnergy / double(gatedCount)) : AbsoluteGate;
+}
+
+double LoudnessStats::truePeakDbtp() const
+{
+    return truePeak > 0.0 ? 20.0 * std::log10(truePeak) : -std::numeric_limits<double>::infinity();
+}
+
+int LoudnessStats::r128Gain() const
+{
+    if (isEmpty()) {
+        return 0;
+    }
+    return std::clamp(int(std::lround((ReferenceLufs - integratedLufs()) * 256.0)), -32768, 32767);
+}
+
+QByteArray LoudnessStats::toByteArray() const
+{
+    QByteArray data = "r128 1\npeak " + QByteArray::number(truePeak, 'g', 17) + '\n';
+    for (int bin = 0; bin < Bins && !isEmpty(); ++bin) {
+        if (blockCounts[size_t(bin)] > 0) {
+            data += QByteArray::number(bin) + ' ' + QByteArray::number(blockCounts[size_t(bin)]) + ' ' +
+                    QByteArray::number(blockEnergy[size_t(bin)], 'g', 17) + '\n';
+        }
+    }
+    return data;
+}
+
+bool LoudnessStats::fromByteArray(const QByteArray &data, LoudnessStats &stats)
+{
+    const QList<QByteArray> lines = data.split('\n');
+    if (lines.size() < 2 || lines[0] != "r128 1" || !lines[1].startsWith("peak ")) {
+        return false;
+    }
+
+    LoudnessStats parsed;
+    bool ok = false;
+    parsed.truePeak = lines[1].mid(5).toDouble(&ok);
+    if (!ok) {
+        return false;
+    }
+    for (int i = 2; i < lines.size(); ++i) {
+        if (lines[i].isEmpty()) {
+            continue;
+        }
+        const QList<QByteArray> fields = lines[i].split(' ');
+        bool binOk = false, countOk = false, energyOk = false;
+        const int bin = fields.value(0).toInt(&binOk);
+        const quint32 count = fields.value(1).toUInt(&countOk);
+        const double energy = fields.value(2).toDouble(&energyOk);
+        if (fields.size() != 3 || !binOk || !countOk || !energyOk || bin < 0 || bin >= Bins) {
+            return false;
+        }
+        if (parsed.isEmpty()) {
+            parsed.blockCounts.assign(Bins, 0);
+            parsed.blockEnergy.assign(Bins, 0.0);
+        }
+        parsed.blockCounts[size_t(bin)] = count;
+        parsed.blockEnergy[size_t(bin)] = energy;
+    }
+    stats = parsed;
+    return true;
+}
+
+void LoudnessAnalyzer::init(int sampleRate, int channels)
+{
+    m_channels = channels;
+
+    // K-weighting: the high shelf of the head, then the RLB high-pass,
+    // designed for the actual rate as in libebur128
+    double f0 = 1681.974450955533;
+    const double gain = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(Pi * f0 / sampleRate);
+    const double vh = std::pow(10.0, gain / 20.0);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    m_shelf = {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+               2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(Pi * f0 / sampleRate);
+    a0 = 1.0 + k / q + k * k;
+    m_highPass = {1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    m_weights = channelWeights(channels);
+    m_state.assign(size_t(channels) * 4, 0.0);
+    m_squares.assign(size_t(channels), 0.0);
+    m_stepFrames = std::max<qint64>(1, std::lround(sampleRate / 10.0));
+    m_stepFill = 0;
+    m_stepCount = 0;
+    m_tails.assign(size_t(channels) * (TapsPerPhase - 1), 0.0f);
+    m_track = LoudnessStats();
+}
+
+void LoudnessAnalyzer::process(const float *pcm, qint64 frames)
+{
+    if (m_channels == 0 || frames <= 0) {
+        return;
+    }
+
+    truePeak(pcm, frames);
+
+    // Steps are weighted in one go each, so the sample loops have no branches
+    while (frames > 0) {
+        const qint64 count = std::min(frames, m_stepFrames - m_stepFill);
+        weight(pcm, count);
+        pcm += count * m_channels;
+        frames -= count;
+        m_stepFill += count;
+        if (m_stepFill == m_stepFrames) {
+            finishStep();
+        }
+    }
+}
+
+LoudnessStats LoudnessAnalyzer::takeTrack()
+{
+    LoudnessStats track = std::move(m_track);
+    m_track = LoudnessStats();
+    std::fill(m_squares.begin(), m_squares.end(), 0.0);
+    m_stepFill = 0;
+    m_stepCount = 0;
+    return track;
+}
+
+void LoudnessAnalyzer::weight(const float *pcm, qint64 frames)
+{
+    if (m_channels == 1) {
+        weightFixed<1>(pcm, frames);
+        return;
+    }
+    if (m_channels == 2) {
+        weightFixed<2>(pcm, frames);
+        return;
+    }
+
+    // Surround layouts are rare enough to run one channel at a time
+    const Biquad s = m_shelf;
+    const Biquad h = m_highPass;
+    for (int ch = 0; ch < m_channels; ++ch) {
+        double *z = m_state.data() + size_t(ch) * 4;
+        double sum = 0.0;
+        for (qint64 i = 0; i < frames; ++i) {
+            const double x = pcm[size_t(i) * m_channels + ch];
+            const double shelved = s.b0 * x + z[0];
+            z[0] = s.b1 * x - s.a1 * shelved + z[1];
+            z[1] = s.b2 * x - s.a2 * shelved;
+            const double y = h.b0 * shelved + z[2];
+            z[2] = h.b1 * shelved - h.a1 * y + z[3];
+            z[3] = h.b2 * shelved - h.a2 * y;
+            sum += y * y;
+        }
+        m_squares[size_t(ch)] += sum;
+    }
+}
+
+// The filters are recursive in time, so the channels are what runs side by
+// side: with a fixed count they sit in one vector register
+template <int Channels>
+void LoudnessAnalyzer::weightFixed(const float *pcm, qint64 frames)
+{
+    const Biquad s = m_shelf;
+    const Biquad h = m_highPass;
+    double z0[Channels], z1[Channels], z2[Channels], z3[Channels], sum[Channels];
+    for (int ch = 0; ch < Channels; ++ch) {
+        z0[ch] = m_state[size_t(ch) * 4];
+        z1[ch] = m_state[size_t(ch) * 4 + 1];
+        z2[ch] = m_state[size_t(ch) * 4 + 2];
+        z3[ch] = m_state[size_t(ch) * 4 + 3];
+        sum[ch] = 0.0;
+    }
+
+    for (qint64 i = 0; i < frames; ++i) {
+        for (int ch = 0; ch < Channels; ++ch) {
+            const double x = pcm[size_t(i) * Channels + ch];
+            const double shelved = s.b0 * x + z0[ch];
+            z0[ch] = s.b1 * x - s.a1 * shelved + z1[ch];
+            z1[ch] = s.b2 * x - s.a2 * shelved;
+            const double y = h.b0 * shelved + z2[ch];
+            z2[ch] = h.b1 * shelved - h.a1 * y + z3[ch];
+            z3[ch] = h.b2 * shelved - h.a2 * y;
+            sum[ch] += y * y;
+        }
+    }
+
+    for (int ch = 0; ch < Channels; ++ch) {
+        m_state[size_t(ch) * 4] = z0[ch];
+        m_state[size_t(ch) * 4 + 1] = z1[ch];
+        m_state[size_t(ch) * 4 + 2] = z2[ch];
+        m_state[size_t(ch) * 4 + 3] = z3[ch];
+        m_squares[size_t(ch)] += sum[ch];
+    }
+}
+
+void LoudnessAnalyzer::truePeak(const float *pcm, qint64 frames)
+{
+    const size_t history = TapsPerPhase - 1;
+    m_planar.resize(history + size_t(frames));
+    m_phase.resize(size_t(frames));
+
+    float peak = 0.0f;
+    for (int ch = 0; ch < m_channels; ++ch) {
+        float *tail = m_tails.data() + size_t(ch) * history;
+        float *x = m_planar.data();
+        std::copy(tail, tail + history, x);
+        for (qint64 i = 0; i < frames; ++i) {
+            x[history + size_t(i)] = pcm[size_t(i) * m_channels + ch];
+            peak = std::max(peak, std::fabs(x[history + size_t(i)]));
+        }
+
+        // Tap by tap over the whole block, so the inner loop is a plain
+        // multiply-add across samples
+        float *phase = m_phase.data();
+        for (const auto &taps : TruePeakTaps) {
+            std::fill(phase, phase + frames, 0.0f);
+            for (int k = 0; k < TapsPerPhase; ++k) {
+                const float tap = taps[k];
+                const float *input = x + k;
+                for (qint64 i = 0; i < frames; ++i) {
+                    phase[i] += tap * input[i];
+                }
+            }
+            for (qint64 i = 0; i < frames; ++i) {
+                peak = std::max(peak, std::fabs(phase[i]));
+            }
+        }
+
+        std::copy(x + frames, x + frames + history, tail);
+    }
+    m_track.truePeak = std::max(m_track.truePeak, double(peak));
+}
+
+void LoudnessAnalyzer::finishStep()
+{
+    double energy = 0.0;
+    for (int ch = 0; ch < m_channels; ++ch) {
+        energy += m_weights[size_t(ch)] * m_squares[size_t(ch)];
+        m_squares[size_t(ch)] = 0.0;
+    }
+    m_steps[size_t(m_stepCount % 4)] = energy;
+    ++m_stepCount;
+    m_stepFill = 0;
+
+    // A 400 ms block ends every 100 ms once four steps are in
+    if (m_stepCount >= 4) {
+        const double blockEnergy = (m_steps[0] + m_steps[1] + m_steps[2] + m_steps[3]) / double(4 * m_stepFrames);
+        m_track.addBlock(blockEnergy);
+    }
+
+    // Filter state decaying through silence would go denormal and slow
+    // every sample after it
+    for (double &z : m_state) {
+        if (std::fabs(z) < 1e-30) {
+            z = 0.0;
+        }
+    }
+}
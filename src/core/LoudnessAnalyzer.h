@@ -0,0 +1,84 @@
+#ifndef LOUDNESSANALYZER_H
+#define LOUDNESSANALYZER_H
+
+#include <QByteArray>
+#include <QtGlobal>
+#include <array>
+#include <vector>
+
+// Gating blocks and true peak of a track, or of an album made of merged
+// tracks. Blocks are kept as a histogram of 0.1 LU bins with their summed
+// energy, so albums merge exactly and the integrated loudness only rounds the
+// relative gate to a bin edge.
+struct LoudnessStats {
+    static const int Bins = 1000;         // -70 to +30 LUFS
+    std::vector<quint32> blockCounts;     // Empty until the first block above -70 LUFS
+    std::vector<double> blockEnergy;
+    double truePeak = 0.0;                // Linear, 1.0 is full scale
+
+    // No block passed the absolute gate: silence, or shorter than 400 ms
+    bool isEmpty() const { return blockCounts.empty(); }
+
+    void addBlock(double energy);
+    void merge(const LoudnessStats &other);
+
+    // ITU-R BS.1770-4 gated loudness, -70 LUFS when empty
+    double integratedLufs() const;
+    double truePeakDbtp() const;
+
+    // R128_TRACK_GAIN/R128_ALBUM_GAIN: dB in Q7.8 that bring the loudness to
+    // the -23 LUFS reference, clamped to 16 bits; 0 when empty
+    int r128Gain() const;
+
+    // Compact form for the output cache, only the bins in use
+    QByteArray toByteArray() const;
+    static bool fromByteArray(const QByteArray &data, LoudnessStats &stats);
+};
+
+// EBU R128 measurement of interleaved float PCM at the source rate, fed the
+// blocks the transcoder already decoded: K-weighting, 400 ms blocks every
+// 100 ms, and true peak from 4x polyphase oversampling. Mono and stereo take
+// fixed-stride paths the compiler can vectorize. Filter state carries over
+// from one track of an album image to the next; the blocks start over.
+class LoudnessAnalyzer
+{
+public:
+    void init(int sampleRate, int channels);
+    void process(const float *pcm, qint64 frames);
+
+    // Stats since init or the last call; the partial block at the end is
+    // dropped, as BS.1770 only gates complete blocks
+    LoudnessStats takeTrack();
+
+private:
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    static const int TapsPerPhase = 12;
+
+    int m_channels = 0;
+    Biquad m_shelf = {};
+    Biquad m_highPass = {};
+    std::vector<double> m_weights;   // Per channel: 0 for LFE, 1.41 for surrounds
+    std::vector<double> m_state;     // Per channel: shelf z1, z2, high-pass z1, z2
+    std::vector<double> m_squares;   // Per channel, K-weighted, in the current step
+
+    qint64 m_stepFrames = 0;         // 100 ms
+    qint64 m_stepFill = 0;
+    std::array<double, 4> m_steps = {};
+    int m_stepCount = 0;
+
+    std::vector<float> m_tails;      // Per channel, the last TapsPerPhase - 1 samples
+    std::vector<float> m_planar;     // One channel: its tail, then the block
+    std::vector<float> m_phase;      // One interpolated phase of that channel
+    LoudnessStats m_track;
+
+    void weight(const float *pcm, qint64 frames);
+    template <int Channels>
+    void weightFixed(const float *pcm, qint64 frames);
+    void truePeak(const float *pcm, qint64 frames);
+    void finishStep();
+};
+
+#endif // LOUDNESSANALYZER_H
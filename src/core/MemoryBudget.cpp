@@ -0,0 +1,73 @@
+#include "MemoryBudget.h"
+#include "FlacStreamInfo.h"
+#include "OpusEncoder.h"
+
+namespace {
+const qint64 KiB = 1024;
+const qint64 OpusSampleRate = 48000;
+
+// Largest block size the FLAC subset allows, for files the scan could not size
+const qint64 SubsetMaxBlockSize = 4608;
+const qint64 HighRateSubsetMaxBlockSize = 16384;
+
+// Per-job costs that don't depend on the stream: thread stack in use, decoder
+// and TagLib objects, file buffers, Ogg stream and page buffers
+const qint64 FixedOverhead = 1024 * KiB;
+// libopus encoder state and libsamplerate's sinc filter state, per channel
+const qint64 EncoderStatePerChannel = 64 * KiB;
+const qint64 ResamplerStatePerChannel = 256 * KiB;
+// Frame, packet and page buffers plus the Ogg stream of one more writer
+const qint64 WriterBuffers = 128 * KiB;
+// libFLAC keeps the decoded block plus residual and side buffers
+const qint64 DecoderBuffersPerSample = 3 * sizeof(qint32);
+// Pictures are held by TagLib on read, copied, base64 encoded into the Opus
+// comment header and written out through TagLib's page rewrite
+const qint64 MetadataCopies = 4;
+}
+
+qint64 MemoryBudget::estimateJobBytes(const FlacStreamInfo &info, int renditions, bool foldDualMono)
+{
+    const qint64 channels = qMax<qint64>(1, info.channels);
+    qint64 blockSize = info.maxBlockSize;
+    if (blockSize == 0) {
+        blockSize = info.sampleRate > 48000 ? HighRateSubsetMaxBlockSize : SubsetMaxBlockSize;
+    }
+
+    qint64 bytes = FixedOverhead + channels * EncoderStatePerChannel;
+    bytes += blockSize * channels * (DecoderBuffersPerSample + qint64(sizeof(float)));
+    if (info.sampleRate > 0 && info.sampleRate != OpusSampleRate) {
+        const qint64 resampledBlock = blockSize * OpusSampleRate / info.sampleRate + 1;
+        bytes += channels * (ResamplerStatePerChannel + resampledBlock * qint64(sizeof(float)));
+    }
+    bytes += qint64(info.metadataBytes) * MetadataCopies;
+    bytes += qint64(qMax(0, renditions - 1)) * (channels * EncoderStatePerChannel + WriterBuffers);
+    if (foldDualMono && channels == 2) {
+        bytes += qint64(info.sampleRate) * OpusEncoderImpl::DualMonoPrefixSeconds * qint64(sizeof(float));
+    }
+    return bytes;
+}
+
+bool MemoryBudget::fits(qint64 bytes) const
+{
+    return m_limit <= 0 || m_jobs == 0 || m_used + bytes <= m_limit;
+}
+
+void MemoryBudget::acquire(qint64 bytes)
+{
+    m_used += bytes;
+    m_jobs++;
+    m_peak = qMax(m_peak, m_used);
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    m_used = qMax<qint64>(0, m_used - bytes);
+    m_jobs = qMax(0, m_jobs - 1);
+}
+
+void MemoryBudget::reset()
+{
+    m_used = 0;
+    m_peak = 0;
+    m_jobs = 0;
+}
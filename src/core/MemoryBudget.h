@@ -0,0 +1,42 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QtGlobal>
+
+struct FlacStreamInfo;
+
+// Admission control for concurrent conversions by estimated peak memory.
+// Jobs are admitted while the sum of their estimates stays within the limit.
+// A job larger than the whole budget still runs, but only on its own.
+// Not thread safe: the controller admits and releases on the main thread.
+class MemoryBudget
+{
+public:
+    // Peak working set of one conversion, from what the scan read out of the
+    // file header. Audio is streamed one FLAC block at a time, so the block
+    // size, channel count, resampling and the tags and pictures that are
+    // copied to the output drive it, not the track length. Each rendition
+    // adds an encoder and its Ogg buffers; dual-mono folding holds back the
+    // first seconds of stereo.
+    static qint64 estimateJobBytes(const FlacStreamInfo &info, int renditions = 1, bool foldDualMono = false);
+
+    void setLimit(qint64 bytes) { m_limit = bytes; } // 0: unlimited
+    qint64 limit() const { return m_limit; }
+
+    bool fits(qint64 bytes) const;
+    void acquire(qint64 bytes);
+    void release(qint64 bytes);
+    void reset();
+
+    qint64 used() const { return m_used; }
+    qint64 peak() const { return m_peak; }
+    int activeJobs() const { return m_jobs; }
+
+private:
+    qint64 m_limit = 0;
+    qint64 m_used = 0;
+    qint64 m_peak = 0;
+    int m_jobs = 0;
+};
+
+#endif // MEMORYBUDGET_H
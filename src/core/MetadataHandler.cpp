@@ -1,4 +1,5 @@
 #include "MetadataHandler.h"
+#include "Tracer.h"
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
 #include <taglib/flacfile.h>
@@ -19,6 +20,7 @@ MetadataHandler::~MetadataHandler() = default;
 
 bool MetadataHandler::readFlacMetadata(const QString &filePath, AudioMetadata &metadata)
 {
+    TraceSpan span("read_flac_tags", "metadata");
     TagLib::FLAC::File file(filePath.toStdString().c_str());
     
     if (!file.isValid()) {
@@ -84,6 +86,7 @@ bool MetadataHandler::readFlacMetadata(const QString &filePath, AudioMetadata &m
 
 bool MetadataHandler::writeOpusMetadata(const QString &filePath, const AudioMetadata &metadata)
 {
+    TraceSpan span("write_opus_tags", "metadata");
     TagLib::Ogg::Opus::File file(filePath.toStdString().c_str());
     
     if (!file.isValid()) {
@@ -148,6 +151,25 @@ bool MetadataHandler::writeOpusMetadata(const QString &filePath, const AudioMeta
     return file.save();
 }
 
+bool MetadataHandler::updateOpusFields(const QString &filePath, const QMap<QString, QString> &fields)
+{
+    TraceSpan span("update_opus_tags", "metadata");
+    TagLib::Ogg::Opus::File file(filePath.toStdString().c_str());
+    
+    if (!file.isValid() || !file.tag()) {
+        m_lastError = "Invalid Opus file";
+        emit metadataError(m_lastError);
+        return false;
+    }
+    
+    for (auto it = fields.constBegin(); it != fields.constEnd(); ++it) {
+        file.tag()->addField(it.key().toUtf8().constData(),
+                             TagLib::String(it.value().toUtf8().constData(), TagLib::String::UTF8), true);
+    }
+    
+    return file.save();
+}
+
 bool MetadataHandler::copyMetadata(const QString &flacPath, const QString &opusPath)
 {
     AudioMetadata metadata;
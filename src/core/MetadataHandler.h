@@ -54,9 +54,15 @@ public:
     // Write metadata to Opus file
     bool writeOpusMetadata(const QString &filePath, const AudioMetadata &metadata);
     
+    // Replace single fields of an Opus file's comment, keeping all others
+    bool updateOpusFields(const QString &filePath, const QMap<QString, QString> &fields);
+    
     // Copy metadata from FLAC to Opus
     bool copyMetadata(const QString &flacPath, const QString &opusPath);
     
+    // Add pictureData as a base64 METADATA_BLOCK_PICTURE field
+    bool embedOpusPicture(TagLib::Ogg::XiphComment *xiphComment, const QByteArray &pictureData, const QString &mimeType);
+    
     QString getLastError() const { return m_lastError; }
     
 signals:
@@ -67,7 +73,6 @@ private:
     
     // Helper functions
     bool extractFlacPictures(TagLib::FLAC::File *file, AudioMetadata &metadata);
-    bool embedOpusPicture(TagLib::Ogg::XiphComment *xiphComment, const QByteArray &pictureData, const QString &mimeType);
     void copyStandardTags(TagLib::Tag *source, TagLib::Tag *dest);
     void copyVorbisComments(TagLib::FLAC::File *flacFile, TagLib::Ogg::Opus::File *opusFile);
 };
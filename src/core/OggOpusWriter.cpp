@@ -0,0 +1,339 @@
+#include "OggOpusWriter.h"
+#include "Tracer.h"
+#include <opus/opus.h>
+#include <QFile>
+#include <QIODevice>
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace {
+const int MaxPacketSize = 4000;
+const int OpusHeadSize = 19;
+const int OggPageHeaderSize = 27;
+}
+
+OggOpusWriter::OggOpusWriter(QIODevice *device)
+    : m_device(device)
+    , m_encoder(nullptr, opus_encoder_destroy)
+{
+    m_clock.start();
+}
+
+OggOpusWriter::~OggOpusWriter()
+{
+    if (m_streamInitialized) {
+        ogg_stream_clear(&m_stream);
+    }
+}
+
+bool OggOpusWriter::open(int sampleRate, int channels, int inputSampleRate)
+{
+    int error = 0;
+    OpusEncoder *encoder = opus_encoder_create(sampleRate, channels, OPUS_APPLICATION_AUDIO, &error);
+    if (error != OPUS_OK) {
+        m_lastError = QString("Failed to create Opus encoder: %1").arg(opus_strerror(error));
+        return false;
+    }
+    m_encoder.reset(encoder);
+
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(m_bitrate));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(m_complexity));
+    opus_encoder_ctl(encoder, OPUS_SET_VBR(m_vbr ? 1 : 0));
+    opus_encoder_ctl(encoder, OPUS_SET_VBR_CONSTRAINT(m_vbrConstrained ? 1 : 0));
+
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+
+    m_sampleRate = sampleRate;
+    m_channels = channels;
+    m_frameSize = sampleRate / 50;
+    m_granuleScale = 48000 / sampleRate;
+    m_lookahead = lookahead;
+    m_preskip = lookahead * m_granuleScale;
+    m_frame.assign(size_t(m_frameSize) * channels, 0.0f);
+    m_frameFill = 0;
+    m_packet.resize(MaxPacketSize);
+
+    // Random serial number
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(0, 0x7FFFFFFF);
+
+    if (ogg_stream_init(&m_stream, dis(gen)) != 0) {
+        m_lastError = "Failed to initialize Ogg stream";
+        m_encoder.reset();
+        return false;
+    }
+    m_streamInitialized = true;
+
+    // The identification and comment headers each get a page of their own
+    QByteArray header = createOpusHeader(channels, m_preskip, inputSampleRate);
+    QByteArray comment = createOpusComment();
+
+    ogg_packet op;
+    op.packet = reinterpret_cast<unsigned char*>(header.data());
+    op.bytes = header.size();
+    op.b_o_s = 1;
+    op.e_o_s = 0;
+    op.granulepos = 0;
+    op.packetno = m_packetNo++;
+    ogg_stream_packetin(&m_stream, &op);
+    if (!writePages(true)) {
+        return false;
+    }
+
+    op.packet = reinterpret_cast<unsigned char*>(comment.data());
+    op.bytes = comment.size();
+    op.b_o_s = 0;
+    op.packetno = m_packetNo++;
+    ogg_stream_packetin(&m_stream, &op);
+    return writePages(true);
+}
+
+bool OggOpusWriter::write(const float *pcm, qint64 frames)
+{
+    if (!m_encoder) {
+        m_lastError = "Encoder not initialized";
+        return false;
+    }
+
+    m_inputFrames += frames;
+
+    while (frames > 0) {
+        int count = int(std::min<qint64>(frames, m_frameSize - m_frameFill));
+        std::memcpy(m_frame.data() + size_t(m_frameFill) * m_channels, pcm,
+                    sizeof(float) * size_t(count) * m_channels);
+        m_frameFill += count;
+        pcm += size_t(count) * m_channels;
+        frames -= count;
+
+        if (m_frameFill == m_frameSize && !encodeFrame(false)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+qint64 OggOpusWriter::bufferBytes() const
+{
+    qint64 bytes = qint64(m_frame.capacity() * sizeof(float)) + qint64(m_packet.capacity()) + m_page.capacity();
+    if (m_streamInitialized) {
+        bytes += m_stream.body_storage + m_stream.lacing_storage * qint64(sizeof(int) + sizeof(ogg_int64_t));
+    }
+    return bytes;
+}
+
+bool OggOpusWriter::finish()
+{
+    if (!m_encoder) {
+        m_lastError = "Encoder not initialized";
+        return false;
+    }
+
+    // Keep encoding (padding with silence) until the decoder's output covers
+    // the pre-skip plus every input sample; the final granule trims the rest
+    const qint64 required = m_inputFrames + m_lookahead;
+    do {
+        std::fill(m_frame.begin() + size_t(m_frameFill) * m_channels, m_frame.end(), 0.0f);
+        m_frameFill = m_frameSize;
+        if (!encodeFrame(m_encodedFrames + m_frameSize >= required)) {
+            return false;
+        }
+    } while (m_encodedFrames < required);
+
+    return writePages(true);
+}
+
+bool OggOpusWriter::encodeFrame(bool endOfStream)
+{
+    qint64 start = m_clock.nsecsElapsed();
+    opus_int32 len;
+    {
+        TraceSpan span("opus_encode", "encoder", Tracer::Blocks);
+        len = opus_encode_float(m_encoder.get(), m_frame.data(), m_frameSize,
+                                m_packet.data(), MaxPacketSize);
+        span.setValue(len);
+    }
+    m_encodeNs += m_clock.nsecsElapsed() - start;
+    if (len < 0) {
+        m_lastError = QString("Opus encoding error: %1").arg(opus_strerror(len));
+        return false;
+    }
+
+    m_encodedFrames += m_frameSize;
+    m_frameFill = 0;
+
+    qint64 granulepos = m_encodedFrames * m_granuleScale;
+    if (endOfStream) {
+        granulepos = std::min(granulepos, m_preskip + m_inputFrames * m_granuleScale);
+    }
+
+    ogg_packet op;
+    op.packet = m_packet.data();
+    op.bytes = len;
+    op.b_o_s = 0;
+    op.e_o_s = endOfStream ? 1 : 0;
+    op.granulepos = granulepos;
+    op.packetno = m_packetNo++;
+    ogg_stream_packetin(&m_stream, &op);
+
+    bool flush = !m_firstAudioPageWritten;
+    m_firstAudioPageWritten = true;
+    return writePages(flush);
+}
+
+bool OggOpusWriter::writePages(bool flush)
+{
+    qint64 start = m_clock.nsecsElapsed();
+    qint64 traceStart = Tracer::isEnabled(Tracer::Blocks) ? Tracer::now() : -1;
+    int pages = 0;
+    bool success = true;
+    ogg_page og;
+    while (flush ? ogg_stream_flush(&m_stream, &og) : ogg_stream_pageout(&m_stream, &og)) {
+        // One write per page keeps unbuffered sinks at a single syscall
+        m_page.resize(og.header_len + og.body_len);
+        std::memcpy(m_page.data(), og.header, og.header_len);
+        std::memcpy(m_page.data() + og.header_len, og.body, og.body_len);
+
+        if (m_device->write(m_page) != m_page.size()) {
+            m_lastError = "Failed to write Ogg page: " + m_device->errorString();
+            success = false;
+            break;
+        }
+        m_bytesWritten += m_page.size();
+        pages++;
+    }
+    m_muxNs += m_clock.nsecsElapsed() - start;
+    
+    // Most packets complete no page; only calls that wrote something are traced
+    if (traceStart >= 0 && pages > 0) {
+        Tracer::record("ogg_write", "encoder", traceStart, Tracer::now(), pages);
+    }
+    return success;
+}
+
+QByteArray OggOpusWriter::createOpusHeader(int channels, int preskip, int inputSampleRate, int outputGain)
+{
+    QByteArray header(OpusHeadSize, '\0');
+    unsigned char *data = reinterpret_cast<unsigned char*>(header.data());
+
+    // OpusHead structure
+    memcpy(data, "OpusHead", 8);  // Magic signature
+    data[8] = 1;  // Version
+    data[9] = channels;  // Channel count
+
+    // Pre-skip (16-bit LE)
+    data[10] = preskip & 0xFF;
+    data[11] = (preskip >> 8) & 0xFF;
+
+    // Input sample rate (32-bit LE)
+    data[12] = inputSampleRate & 0xFF;
+    data[13] = (inputSampleRate >> 8) & 0xFF;
+    data[14] = (inputSampleRate >> 16) & 0xFF;
+    data[15] = (inputSampleRate >> 24) & 0xFF;
+
+    // Output gain (16-bit LE, Q7.8 dB)
+    data[16] = outputGain & 0xFF;
+    data[17] = (outputGain >> 8) & 0xFF;
+
+    // Channel mapping family
+    data[18] = 0;  // RTP mapping family
+
+    return header;
+}
+
+bool OggOpusWriter::setOutputGain(const QString &path, int outputGain, QString *error)
+{
+    auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite)) {
+        return fail("Failed to open output: " + file.errorString());
+    }
+
+    // The first page holds the OpusHead and nothing else
+    QByteArray page = file.read(OggPageHeaderSize);
+    if (page.size() != OggPageHeaderSize || !page.startsWith("OggS")) {
+        return fail("Output does not start with an Ogg page");
+    }
+    const int segments = static_cast<unsigned char>(page[26]);
+    page += file.read(segments);
+    const int headerLength = OggPageHeaderSize + segments;
+    int bodyLength = 0;
+    for (int i = OggPageHeaderSize; i < page.size(); ++i) {
+        bodyLength += static_cast<unsigned char>(page[i]);
+    }
+    page += file.read(bodyLength);
+    if (page.size() != headerLength + bodyLength || bodyLength < OpusHeadSize ||
+        page.mid(headerLength, 8) != "OpusHead") {
+        return fail("Output does not start with an OpusHead page");
+    }
+
+    unsigned char *data = reinterpret_cast<unsigned char*>(page.data());
+    data[headerLength + 16] = outputGain & 0xFF;
+    data[headerLength + 17] = (outputGain >> 8) & 0xFF;
+
+    ogg_page og;
+    og.header = data;
+    og.header_len = headerLength;
+    og.body = data + headerLength;
+    og.body_len = bodyLength;
+    ogg_page_checksum_set(&og);
+
+    if (!file.seek(0) || file.write(page) != page.size()) {
+        return fail("Failed to rewrite OpusHead: " + file.errorString());
+    }
+    return true;
+}
+
+int OggOpusWriter::headerChannels(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // The OpusHead follows the segment table of the first page
+    QByteArray page = file.read(OggPageHeaderSize);
+    if (page.size() != OggPageHeaderSize || !page.startsWith("OggS")) {
+        return 0;
+    }
+    file.skip(static_cast<unsigned char>(page[26]));
+    const QByteArray head = file.read(OpusHeadSize);
+    if (head.size() != OpusHeadSize || !head.startsWith("OpusHead")) {
+        return 0;
+    }
+    return static_cast<unsigned char>(head[9]);
+}
+
+QByteArray OggOpusWriter::createOpusComment()
+{
+    // OpusTags structure; real tags are written by MetadataHandler afterwards
+    const char *vendor = "OpusRipperGUI";
+    int vendorLen = strlen(vendor);
+
+    QByteArray comment(12 + vendorLen + 4, '\0');
+    unsigned char *data = reinterpret_cast<unsigned char*>(comment.data());
+
+    memcpy(data, "OpusTags", 8);  // Magic signature
+
+    // Vendor string length (32-bit LE)
+    data[8] = vendorLen & 0xFF;
+    data[9] = (vendorLen >> 8) & 0xFF;
+    data[10] = (vendorLen >> 16) & 0xFF;
+    data[11] = (vendorLen >> 24) & 0xFF;
+
+    // Vendor string
+    memcpy(data + 12, vendor, vendorLen);
+
+    // User comment count (32-bit LE), already zero
+
+    return comment;
+}
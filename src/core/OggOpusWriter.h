@@ -0,0 +1,103 @@
+#ifndef OGGOPUSWRITER_H
+#define OGGOPUSWRITER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+#include <memory>
+#include <vector>
+#include <ogg/ogg.h>
+
+struct OpusEncoder;
+
+class QIODevice;
+
+// Encodes interleaved float PCM into an Ogg Opus stream on any QIODevice.
+// Pages are written as soon as libogg releases them; the header pages and the
+// first audio page are flushed immediately so pipe consumers can start early.
+class OggOpusWriter
+{
+public:
+    explicit OggOpusWriter(QIODevice *device);
+    ~OggOpusWriter();
+
+    // Encoder settings, applied when the stream is opened
+    void setBitrate(int bitrate) { m_bitrate = bitrate; }
+    void setComplexity(int complexity) { m_complexity = complexity; }
+    void setVbr(bool enabled) { m_vbr = enabled; }
+    void setVbrConstraint(bool constrained) { m_vbrConstrained = constrained; }
+
+    // sampleRate must be one Opus accepts (8, 12, 16, 24 or 48 kHz);
+    // inputSampleRate is only recorded in the OpusHead for players
+    bool open(int sampleRate, int channels, int inputSampleRate);
+    bool isOpen() const { return m_encoder != nullptr; }
+
+    // Append frames of interleaved PCM at the encoder sample rate
+    bool write(const float *pcm, qint64 frames);
+
+    // Encode the remaining samples, mark the end of stream and flush
+    bool finish();
+
+    QString lastError() const { return m_lastError; }
+    qint64 bytesWritten() const { return m_bytesWritten; }
+    qint64 framesWritten() const { return m_inputFrames; }
+    int preskip() const { return m_preskip; }
+
+    // Wall time inside opus_encode_float and in Ogg paging plus sink writes
+    qint64 encodeNs() const { return m_encodeNs; }
+    qint64 muxNs() const { return m_muxNs; }
+
+    // Bytes held in frame, packet, page and Ogg stream buffers; they only grow,
+    // so after finish() this is the peak
+    qint64 bufferBytes() const;
+
+    // OpusHead and a vendor-only OpusTags packet; outputGain is dB in Q7.8
+    static QByteArray createOpusHeader(int channels, int preskip, int inputSampleRate, int outputGain = 0);
+    static QByteArray createOpusComment();
+
+    // Set the output gain of a finished file in place. The OpusHead has a page
+    // of its own, so only that page and its checksum are rewritten.
+    static bool setOutputGain(const QString &path, int outputGain, QString *error = nullptr);
+
+    // Channel count in the OpusHead of a finished file, 0 if it has none
+    static int headerChannels(const QString &path);
+
+private:
+    QIODevice *m_device;
+    std::unique_ptr<OpusEncoder, void(*)(OpusEncoder*)> m_encoder;
+    ogg_stream_state m_stream;
+    bool m_streamInitialized = false;
+
+    int m_bitrate = 128000;
+    int m_complexity = 10;
+    bool m_vbr = true;
+    bool m_vbrConstrained = false;
+
+    int m_sampleRate = 48000;
+    int m_channels = 2;
+    int m_frameSize = 960;          // 20 ms at the encoder rate
+    int m_granuleScale = 1;         // Granule positions always count 48 kHz samples
+    int m_lookahead = 0;            // At the encoder rate
+    int m_preskip = 0;              // At 48 kHz
+
+    std::vector<float> m_frame;
+    int m_frameFill = 0;
+    std::vector<unsigned char> m_packet;
+    QByteArray m_page;
+
+    qint64 m_packetNo = 0;
+    qint64 m_inputFrames = 0;
+    qint64 m_encodedFrames = 0;
+    qint64 m_bytesWritten = 0;
+    bool m_firstAudioPageWritten = false;
+    QString m_lastError;
+
+    QElapsedTimer m_clock;
+    qint64 m_encodeNs = 0;
+    qint64 m_muxNs = 0;
+
+    bool encodeFrame(bool endOfStream);
+    bool writePages(bool flush);
+};
+
+#endif // OGGOPUSWRITER_H
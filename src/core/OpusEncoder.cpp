@@ -1,596 +1,760 @@
 #include "OpusEncoder.h"
-#include <opus/opus.h>
-#include <ogg/ogg.h>
+#include "CancellationToken.h"
+#include "LoudnessAnalyzer.h"
+#include "OggOpusWriter.h"
+#include "PcmConversion.h"
+#include "Tracer.h"
 #include <FLAC++/decoder.h>
 #include <QFile>
 #include <QDir>
 #include <QDebug>
 #include <QFileInfo>
-#include <atomic>
-#include <cstring>
-#include <cmath>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QThreadPool>
 #include <algorithm>
-#include <random>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
 
-OpusEncoderImpl::OpusEncoderImpl(QObject *parent)
-    : QObject(parent)
-    , m_encoder(nullptr, opus_encoder_destroy)
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+bool isOpusSampleRate(int sampleRate)
 {
+    return sampleRate == 8000 || sampleRate == 12000 || sampleRate == 16000 ||
+           sampleRate == 24000 || sampleRate == 48000;
 }
 
-OpusEncoderImpl::~OpusEncoderImpl() = default;
-
-bool OpusEncoderImpl::initialize(int sampleRate, int channels, int bitrate)
+// Threads that encode the extra renditions of a block while the worker that
+// decoded it encodes the first. Tasks never wait on the pool themselves.
+QThreadPool *renditionPool()
 {
-    m_sampleRate = sampleRate;
-    m_channels = channels;
-    m_bitrate = bitrate;
-    
-    
-    int error = 0;
-    OpusEncoder *encoder = opus_encoder_create(sampleRate, channels, OPUS_APPLICATION_AUDIO, &error);
-    
-    if (error != OPUS_OK) {
-        m_lastError = QString("Failed to create Opus encoder: %1").arg(opus_strerror(error));
-        return false;
-    }
-    
-    m_encoder.reset(encoder);
-    
-    // Set encoder parameters
-    opus_encoder_ctl(m_encoder.get(), OPUS_SET_BITRATE(m_bitrate));
-    opus_encoder_ctl(m_encoder.get(), OPUS_SET_COMPLEXITY(m_complexity));
-    opus_encoder_ctl(m_encoder.get(), OPUS_SET_VBR(m_vbr ? 1 : 0));
-    
-    return true;
+    static QThreadPool pool;
+    return &pool;
 }
 
-bool OpusEncoderImpl::encodeFlacToOpus(const QString &inputPath, const QString &outputPath)
+// Hands every block of PCM to the writer of each rendition, one after the
+// other or, when parallel, the extra ones on the rendition pool
+class WriterFanout
 {
-    m_shouldStop = false;
-    m_progress = 0;
-    
-    // Step 1: Decode FLAC data
-    std::vector<float> samples;
-    int sampleRate = 0;
-    int channels = 0;
-    
-    emit progressUpdated(5);
-    
-    if (!decodeFlacData(inputPath, samples, sampleRate, channels)) {
-        emit encodingError(m_lastError);
-        return false;
+public:
+    void setParallel(bool parallel, const WorkerPriority &priority)
+    {
+        m_parallel = parallel;
+        m_priority = priority;
     }
-    
-    emit progressUpdated(50);
-    
-    // Step 2: Resample if necessary - Opus only supports specific sample rates
-    int opusSampleRate = 48000; // Target sample rate for Opus
-    if (sampleRate != 8000 && sampleRate != 12000 && sampleRate != 16000 && 
-        sampleRate != 24000 && sampleRate != 48000) {
-        // For now, we'll use 48kHz as the target
-        // TODO: Implement proper resampling
-        // For this initial version, we'll just use 48kHz and let Opus handle it
-    } else {
-        opusSampleRate = sampleRate;
+
+    void setWriters(const std::vector<OggOpusWriter*> &writers) { m_writers = writers; }
+    bool isOpen() const { return !m_writers.empty() && m_writers.front()->isOpen(); }
+
+    // Wall time spent in the writers, overlapping encodes counted once
+    qint64 wallNs() const { return m_wallNs; }
+
+    bool open(int sampleRate, int channels, int inputSampleRate, QString &error)
+    {
+        return forEach([=](OggOpusWriter &writer) { return writer.open(sampleRate, channels, inputSampleRate); }, error);
     }
-    
-    // Step 3: Initialize encoder with Opus-compatible sample rate
-    if (!initialize(opusSampleRate, channels, m_bitrate)) {
-        emit encodingError(m_lastError);
-        return false;
+
+    bool write(const float *pcm, qint64 frames, QString &error)
+    {
+        return forEach([=](OggOpusWriter &writer) { return writer.write(pcm, frames); }, error);
     }
-    
-    // Step 4: Resample if necessary
-    std::vector<float> resampledSamples;
-    if (sampleRate != opusSampleRate) {
-        resampledSamples = resampleAudio(samples, sampleRate, opusSampleRate, channels);
-    } else {
-        resampledSamples = samples;
+
+    bool finish(QString &error)
+    {
+        return forEach([](OggOpusWriter &writer) { return writer.finish(); }, error);
     }
-    
-    // Step 5: Encode to Ogg Opus
-    if (!writeOggOpusFile(resampledSamples, opusSampleRate, channels, outputPath)) {
-        emit encodingError(m_lastError);
-        return false;
+
+private:
+    std::vector<OggOpusWriter*> m_writers;
+    bool m_parallel = false;
+    WorkerPriority m_priority;
+    QElapsedTimer m_clock;
+    qint64 m_wallNs = 0;
+
+    template <typename Step>
+    bool forEach(const Step &step, QString &error)
+    {
+        if (!m_clock.isValid()) {
+            m_clock.start();
+        }
+        const qint64 start = m_clock.nsecsElapsed();
+        const size_t count = m_writers.size();
+        std::vector<char> ok(count, 0);
+
+        if (m_parallel && count > 1) {
+            QSemaphore done;
+            for (size_t i = 1; i < count; ++i) {
+                renditionPool()->start([&, i]() {
+                    m_priority.applyToCurrentThread();
+                    ok[i] = step(*m_writers[i]);
+                    done.release();
+                });
+            }
+            ok[0] = step(*m_writers[0]);
+            done.acquire(int(count - 1));
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                ok[i] = step(*m_writers[i]);
+                if (!ok[i]) {
+                    break;
+                }
+            }
+        }
+        m_wallNs += m_clock.nsecsElapsed() - start;
+
+        for (size_t i = 0; i < count; ++i) {
+            if (!ok[i]) {
+                error = m_writers[i]->lastError();
+                return false;
+            }
+        }
+        return true;
     }
-    
-    emit progressUpdated(100);
-    return true;
-}
+};
 
-void OpusEncoderImpl::stop()
+// Incremental libsamplerate conversion feeding straight into the Ogg writers
+class StreamResampler
 {
-    m_shouldStop = true;
-}
+public:
+    ~StreamResampler()
+    {
+        if (m_state) {
+            src_delete(m_state);
+        }
+    }
 
-void OpusEncoderImpl::setBitrate(int bitrate)
-{
-    m_bitrate = bitrate;
-    if (m_encoder) {
-        opus_encoder_ctl(m_encoder.get(), OPUS_SET_BITRATE(bitrate));
+    bool init(int quality, int channels, double ratio, QString &error)
+    {
+        int srcError = 0;
+        m_state = src_new(quality, channels, &srcError);
+        if (!m_state) {
+            error = QString("Resampling failed: %1").arg(src_strerror(srcError));
+            return false;
+        }
+        m_channels = channels;
+        m_ratio = ratio;
+        m_output.resize(4096 * size_t(channels));
+        m_clock.start();
+        return true;
     }
-}
 
-void OpusEncoderImpl::setComplexity(int complexity)
-{
-    m_complexity = complexity;
-    if (m_encoder) {
-        opus_encoder_ctl(m_encoder.get(), OPUS_SET_COMPLEXITY(complexity));
+    qint64 resampleNs() const { return m_resampleNs; }
+    qint64 bufferBytes() const { return qint64(m_output.capacity() * sizeof(float)); }
+
+    // Required after a flush with endOfInput before the next stream
+    void reset() { src_reset(m_state); }
+
+    bool process(const float *input, long frames, bool endOfInput, WriterFanout &writers, QString &error)
+    {
+        SRC_DATA data = {};
+        data.src_ratio = m_ratio;
+        data.end_of_input = endOfInput ? 1 : 0;
+
+        do {
+            data.data_in = input;
+            data.input_frames = frames;
+            data.data_out = m_output.data();
+            data.output_frames = long(m_output.size() / m_channels);
+
+            qint64 start = m_clock.nsecsElapsed();
+            int srcError;
+            {
+                TraceSpan span("resample", "encoder", Tracer::Blocks);
+                srcError = src_process(m_state, &data);
+            }
+            m_resampleNs += m_clock.nsecsElapsed() - start;
+            if (srcError != 0) {
+                error = QString("Resampling failed: %1").arg(src_strerror(srcError));
+                return false;
+            }
+
+            input += data.input_frames_used * m_channels;
+            frames -= data.input_frames_used;
+
+            if (data.output_frames_gen > 0 && !writers.write(m_output.data(), data.output_frames_gen, error)) {
+                return false;
+            }
+        } while (frames > 0 || (endOfInput && data.output_frames_gen > 0));
+
+        return true;
     }
-}
 
-void OpusEncoderImpl::setVbr(bool enabled)
+private:
+    SRC_STATE *m_state = nullptr;
+    int m_channels = 1;
+    double m_ratio = 1.0;
+    std::vector<float> m_output;
+    QElapsedTimer m_clock;
+    qint64 m_resampleNs = 0;
+};
+
+// FLAC stream decoder over a file descriptor. Each decoded block is converted
+// to float, resampled if needed and handed to the writer before the next read.
+// An album image is split on the way: every output takes the samples up to
+// its end and the block that crosses a boundary is divided between two. Each
+// output has one writer per rendition, all fed the same decoded and resampled
+// PCM. With dual-mono folding, stereo whose channels are identical is encoded
+// as mono: the first seconds are held back until they decide, and every later
+// block is checked again.
+class FlacStreamTranscoder : public FLAC::Decoder::Stream
 {
-    m_vbr = enabled;
-    if (m_encoder) {
-        opus_encoder_ctl(m_encoder.get(), OPUS_SET_VBR(enabled ? 1 : 0));
+public:
+    FlacStreamTranscoder(int fd, int resamplerQuality)
+        : m_fd(fd)
+        , m_resamplerQuality(resamplerQuality)
+    {
     }
-}
 
-void OpusEncoderImpl::setVbrConstraint(bool constrained)
-{
-    m_vbrConstrained = constrained;
-    if (m_encoder) {
-        opus_encoder_ctl(m_encoder.get(), OPUS_SET_VBR_CONSTRAINT(constrained ? 1 : 0));
+    // Outputs are filled in the order they are added, each from its first
+    // sample (per channel, at the source rate) up to the next one's. The
+    // first starts at 0 and the last runs to the end of the stream.
+    void addOutput(const std::vector<OggOpusWriter*> &writers, quint64 startSample = 0)
+    {
+        if (m_outputs.empty()) {
+            m_fanout.setWriters(writers);
+        } else {
+            m_outputs.back().endSample = startSample;
+        }
+        m_outputs.push_back({writers, std::numeric_limits<quint64>::max()});
+    }
+
+    void setParallel(bool parallel, const WorkerPriority &priority) { m_fanout.setParallel(parallel, priority); }
+
+    // Measure the loudness of every output from the decoded PCM on its way
+    // to the writers
+    void setAnalyzeLoudness(bool analyze) { m_analyze = analyze; }
+    const QList<LoudnessStats> &loudness() const { return m_loudness; }
+    qint64 analysisNs() const { return m_analysisNs; }
+
+    // Encode stereo as mono while both channels stay identical. Outputs are
+    // only opened once the prefix is checked. If the channels part after that,
+    // decoding stops with channelsDiverged() and has to start over without
+    // folding.
+    void setFoldDualMono(bool fold) { m_foldDualMono = fold; }
+    bool folded() const { return m_fold == Fold::Mono; }
+    bool channelsDiverged() const { return m_diverged; }
+
+    bool failed() const { return !m_error.isEmpty(); }
+    QString errorString() const { return m_error; }
+    quint64 totalSamples() const { return m_totalSamples; }
+    quint64 decodedSamples() const { return m_decodedSamples; }
+    int sampleRate() const { return m_sampleRate; }
+    qint64 resampleNs() const { return m_resampler ? m_resampler->resampleNs() : 0; }
+    qint64 writerWallNs() const { return m_fanout.wallNs(); }
+    bool resampled() const { return m_resampler != nullptr; }
+
+    // Buffers only grow, so this is the peak once decoding is done
+    qint64 bufferBytes() const
+    {
+        return qint64((m_pcm.capacity() + m_folded.capacity()) * sizeof(float)) + m_heldPeakBytes +
+               (m_resampler ? m_resampler->bufferBytes() : 0);
+    }
+
+    bool finishOutput()
+    {
+        if (!m_fanout.isOpen() && m_fold != Fold::Pending) {
+            m_error = "Invalid FLAC file format";
+            return false;
+        }
+        if (m_current + 1 < m_outputs.size()) {
+            m_error = QString("The audio ends before track %1 starts").arg(m_current + 2);
+            return false;
+        }
+        return finishCurrent();
     }
-}
 
-// FLAC decoder implementation
-class FlacDecoder : public FLAC::Decoder::File {
-public:
-    FlacDecoder(std::vector<float> &samples) : m_samples(samples) {}
-    
-    int getSampleRate() const { return m_sampleRate; }
-    int getChannels() const { return m_channels; }
-    int getBitsPerSample() const { return m_bitsPerSample; }
-    
 protected:
-    FLAC__StreamDecoderWriteStatus write_callback(const FLAC__Frame *frame, 
-                                                  const FLAC__int32 * const buffer[]) override {
-        if (!m_initialized) {
-            m_sampleRate = frame->header.sample_rate;
-            m_channels = frame->header.channels;
-            m_bitsPerSample = frame->header.bits_per_sample;
-            m_initialized = true;
-        }
-        
-        size_t samples = frame->header.blocksize;
-        
-        // Convert to float and interleave channels
-        for (size_t i = 0; i < samples; i++) {
-            for (int ch = 0; ch < m_channels; ch++) {
-                // Normalize to -1.0 to 1.0 range
-                float sample = buffer[ch][i] / float(1 << (m_bitsPerSample - 1));
-                m_samples.push_back(sample);
+    FLAC__StreamDecoderReadStatus read_callback(FLAC__byte buffer[], size_t *bytes) override
+    {
+#ifdef Q_OS_WIN
+        int length = ::_read(m_fd, buffer, unsigned(*bytes));
+#else
+        ssize_t length;
+        do {
+            length = ::read(m_fd, buffer, *bytes);
+        } while (length < 0 && errno == EINTR);
+#endif
+
+        if (length < 0) {
+            m_error = QString("Failed to read input: %1").arg(strerror(errno));
+            *bytes = 0;
+            return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+        }
+        if (length == 0) {
+            m_endOfInput = true;
+            *bytes = 0;
+            return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+        }
+
+        *bytes = size_t(length);
+        return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+    }
+
+    bool eof_callback() override
+    {
+        return m_endOfInput;
+    }
+
+    FLAC__StreamDecoderWriteStatus write_callback(const FLAC__Frame *frame,
+                                                  const FLAC__int32 * const buffer[]) override
+    {
+        if (m_sampleRate == 0 && !openOutput(frame->header)) {
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        }
+
+        const int channels = int(frame->header.channels);
+        if (channels != m_channels) {
+            m_error = "Channel count changes within the FLAC stream";
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        }
+
+        const unsigned blocksize = frame->header.blocksize;
+
+        // Checked on the integers, before conversion. Parting channels end a
+        // prefix that is still held; past it, the fold was wrong.
+        if (m_fold != Fold::Off && !planesIdentical(buffer[0], buffer[1], blocksize)) {
+            if (m_fold == Fold::Mono) {
+                m_diverged = true;
+                m_error = "The channels differ after the dual-mono prefix";
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            }
+            if (!resolveFold(false)) {
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
             }
         }
-        
+
+        // Identical channels only need the left one, unless the analyzer
+        // measures both
+        const int stride = m_fold != Fold::Off && !m_analyze ? 1 : channels;
+        m_pcm.resize(size_t(blocksize) * stride);
+        flacToInterleavedFloat(buffer, stride, blocksize, frame->header.bits_per_sample, m_pcm.data());
+
+        const float *pcm = m_pcm.data();
+        quint64 frames = blocksize;
+        while (frames > 0) {
+            // Up to the end of the current output; the last one takes everything
+            const quint64 end = m_outputs[m_current].endSample;
+            const quint64 take = end > m_decodedSamples ? std::min(frames, end - m_decodedSamples) : 0;
+            if (take > 0 && m_analyze) {
+                const qint64 start = m_clock.nsecsElapsed();
+                TraceSpan span("loudness", "encoder", Tracer::Blocks);
+                m_analyzer.process(pcm, qint64(take));
+                m_analysisNs += m_clock.nsecsElapsed() - start;
+            }
+            if (take > 0 && !writePcm(pcm, take, stride)) {
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            }
+            pcm += take * stride;
+            frames -= take;
+            m_decodedSamples += take;
+
+            if (m_decodedSamples >= end && m_current + 1 < m_outputs.size() && !startNextOutput()) {
+                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+            }
+        }
+
         return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
     }
-    
-    void metadata_callback(const FLAC__StreamMetadata *metadata) override {
+
+    void metadata_callback(const FLAC__StreamMetadata *metadata) override
+    {
         if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
-            // Reserve space for samples
-            size_t totalSamples = metadata->data.stream_info.total_samples;
-            m_samples.reserve(totalSamples * metadata->data.stream_info.channels);
+            m_totalSamples = metadata->data.stream_info.total_samples;
         }
     }
-    
-    void error_callback(FLAC__StreamDecoderErrorStatus status) override {
+
+    void error_callback(FLAC__StreamDecoderErrorStatus status) override
+    {
         qDebug() << "FLAC decoder error:" << FLAC__StreamDecoderErrorStatusString[status];
     }
-    
+
 private:
-    std::vector<float> &m_samples;
-    int m_sampleRate = 0;
+    struct Output {
+        std::vector<OggOpusWriter*> writers;
+        quint64 endSample;
+    };
+
+    enum class Fold {
+        Off,        // Encoded at the source channel count
+        Pending,    // Identical so far; the left channel is held
+        Mono        // Encoded as mono, still checked block by block
+    };
+
+    static constexpr quint64 FoldChunkFrames = 4096;
+
+    int m_fd;
+    int m_resamplerQuality;
+    std::vector<Output> m_outputs;
+    size_t m_current = 0;
+    WriterFanout m_fanout;      // Writers of the current output
+    std::unique_ptr<StreamResampler> m_resampler;
+    std::vector<float> m_pcm;
     int m_channels = 0;
-    int m_bitsPerSample = 0;
-    bool m_initialized = false;
-};
+    int m_sampleRate = 0;
+    int m_opusSampleRate = 0;
+    bool m_endOfInput = false;
+    quint64 m_totalSamples = 0;
+    quint64 m_decodedSamples = 0;
+    QString m_error;
+    bool m_analyze = false;
+    LoudnessAnalyzer m_analyzer;
+    QList<LoudnessStats> m_loudness;    // One per finished output
+    QElapsedTimer m_clock;
+    qint64 m_analysisNs = 0;
+    bool m_foldDualMono = false;
+    Fold m_fold = Fold::Off;
+    int m_outputChannels = 0;
+    quint64 m_prefixFrames = 0;
+    std::vector<float> m_held;          // Left channel of the undecided prefix
+    qint64 m_heldPeakBytes = 0;
+    std::vector<float> m_folded;        // One block in the other layout
+    bool m_diverged = false;
 
-bool OpusEncoderImpl::decodeFlacData(const QString &inputPath, std::vector<float> &samples, int &sampleRate, int &channels)
-{
-    QFileInfo fileInfo(inputPath);
-    if (!fileInfo.exists()) {
-        m_lastError = "Input file does not exist";
-        return false;
-    }
-    
-    FlacDecoder decoder(samples);
-    
-    FLAC__StreamDecoderInitStatus init_status = decoder.init(inputPath.toStdString());
-    if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
-        m_lastError = QString("Failed to initialize FLAC decoder: %1")
-            .arg(FLAC__StreamDecoderInitStatusString[init_status]);
-        return false;
-    }
-    
-    if (!decoder.process_until_end_of_stream()) {
-        m_lastError = "Failed to decode FLAC file";
-        return false;
-    }
-    
-    sampleRate = decoder.getSampleRate();
-    channels = decoder.getChannels();
-    
-    if (sampleRate == 0 || channels == 0) {
-        m_lastError = "Invalid FLAC file format";
-        return false;
-    }
-    
-    return true;
-}
+    bool openOutput(const FLAC__FrameHeader &header)
+    {
+        const int sampleRate = int(header.sample_rate);
+        m_sampleRate = sampleRate;
+        m_channels = int(header.channels);
+        if (m_analyze) {
+            m_clock.start();
+            m_analyzer.init(sampleRate, m_channels);
+        }
 
-bool OpusEncoderImpl::encodeToOpusFile(const std::vector<float> &samples, int sampleRate, int channels, const QString &outputPath)
-{
-    // Ensure output directory exists
-    QFileInfo outputInfo(outputPath);
-    QDir outputDir = outputInfo.dir();
-    if (!outputDir.mkpath(".")) {
-        m_lastError = "Failed to create output directory";
-        return false;
+        // Opus only supports specific sample rates; everything else goes to 48 kHz
+        m_opusSampleRate = isOpusSampleRate(sampleRate) ? sampleRate : 48000;
+
+        if (m_foldDualMono && m_channels == 2) {
+            m_fold = Fold::Pending;
+            m_outputChannels = 1;
+            m_prefixFrames = quint64(sampleRate) * OpusEncoderImpl::DualMonoPrefixSeconds;
+            m_held.reserve(m_prefixFrames + header.blocksize);
+            return true;
+        }
+        m_outputChannels = m_channels;
+        return openWriters();
     }
-    
-    QFile outputFile(outputPath);
-    if (!outputFile.open(QIODevice::WriteOnly)) {
-        m_lastError = "Failed to open output file: " + outputFile.errorString();
-        return false;
+
+    bool openWriters()
+    {
+        if (m_opusSampleRate != m_sampleRate) {
+            m_resampler = std::make_unique<StreamResampler>();
+            if (!m_resampler->init(m_resamplerQuality, m_outputChannels,
+                                   double(m_opusSampleRate) / m_sampleRate, m_error)) {
+                return false;
+            }
+        }
+
+        return m_fanout.open(m_opusSampleRate, m_outputChannels, m_sampleRate, m_error);
     }
-    
-    // Write Ogg Opus header
-    if (!writeOpusHeader(&outputFile, sampleRate, channels)) {
-        return false;
+
+    // pcm has stride channels: the source's, or one for a folded block
+    bool writePcm(const float *pcm, quint64 frames, int stride)
+    {
+        if (stride != m_outputChannels) {
+            m_folded.resize(frames);
+            leftOfStereo(pcm, frames, m_folded.data());
+            pcm = m_folded.data();
+        }
+        if (m_fold == Fold::Pending) {
+            m_held.insert(m_held.end(), pcm, pcm + frames);
+            return m_held.size() < m_prefixFrames || resolveFold(true);
+        }
+        return m_resampler ? m_resampler->process(pcm, long(frames), false, m_fanout, m_error)
+                           : m_fanout.write(pcm, qint64(frames), m_error);
     }
-    
-    // Write comment header
-    if (!writeOpusComment(&outputFile)) {
-        return false;
+
+    // The prefix has decided: open the writers as mono or stereo and hand
+    // them what was held, in chunks so stereo doesn't double the buffer
+    bool resolveFold(bool mono)
+    {
+        std::vector<float> held;
+        held.swap(m_held);
+        m_heldPeakBytes = qint64(held.capacity() * sizeof(float));
+        m_fold = mono ? Fold::Mono : Fold::Off;
+        m_outputChannels = mono ? 1 : m_channels;
+        if (!openWriters()) {
+            return false;
+        }
+
+        for (quint64 offset = 0; offset < held.size(); offset += FoldChunkFrames) {
+            const quint64 frames = std::min<quint64>(FoldChunkFrames, held.size() - offset);
+            const float *pcm = held.data() + offset;
+            if (!mono) {
+                m_folded.resize(frames * 2);
+                monoToStereo(pcm, frames, m_folded.data());
+                pcm = m_folded.data();
+            }
+            if (!writePcm(pcm, frames, m_outputChannels)) {
+                return false;
+            }
+        }
+        return true;
     }
-    
-    // Opus requires specific frame sizes
-    // For 48kHz: 120, 240, 480, 960, 1920, 2880 samples
-    // We'll use 960 samples (20ms) for good balance
-    const int frameSize = 960; // 20ms at 48kHz  
-    const int maxPacketSize = 4000;
-    std::vector<unsigned char> packet(maxPacketSize);
-    
-    // Process samples in frames
-    size_t samplesProcessed = 0;
-    int packetCount = 0;
-    
-    while (samplesProcessed < samples.size() / channels) {
-        if (m_shouldStop) {
-            outputFile.close();
-            outputFile.remove();
+
+    bool finishCurrent()
+    {
+        // The whole track so far was dual mono
+        if (m_fold == Fold::Pending && !resolveFold(true)) {
             return false;
         }
-        
-        // Prepare frame
-        std::vector<float> frame(frameSize * channels);
-        size_t frameSamples = std::min(size_t(frameSize), (samples.size() / channels) - samplesProcessed);
-        
-        // Copy samples to frame
-        for (size_t i = 0; i < frameSamples * channels; i++) {
-            frame[i] = samples[samplesProcessed * channels + i];
-        }
-        
-        // Pad with silence if needed
-        for (size_t i = frameSamples * channels; i < frame.size(); i++) {
-            frame[i] = 0.0f;
-        }
-        
-        // Encode frame
-        opus_int32 len = opus_encode_float(m_encoder.get(), frame.data(), frameSize, 
-                                          packet.data(), maxPacketSize);
-        
-        if (len < 0) {
-            m_lastError = QString("Opus encoding error: %1").arg(opus_strerror(len));
-            outputFile.close();
-            outputFile.remove();
+        if (m_analyze) {
+            m_loudness.append(m_analyzer.takeTrack());
+        }
+        if (m_resampler && !m_resampler->process(nullptr, 0, true, m_fanout, m_error)) {
             return false;
         }
-        
-        // Write packet to Ogg stream
-        // TODO: Implement proper Ogg encapsulation
-        // For now, we'll write a simple format
-        outputFile.write(reinterpret_cast<char*>(&len), sizeof(len));
-        outputFile.write(reinterpret_cast<char*>(packet.data()), len);
-        
-        samplesProcessed += frameSamples;
-        packetCount++;
-        
-        // Update progress
-        int progress = 50 + (samplesProcessed * 50) / (samples.size() / channels);
-        if (progress != m_progress) {
-            m_progress = progress;
-            emit progressUpdated(progress);
-        }
-    }
-    
-    outputFile.close();
-    return true;
+        return m_fanout.finish(m_error);
+    }
+
+    // Close the current output at a track boundary and open the next. The
+    // resampler is flushed into the finished track and starts over clean.
+    bool startNextOutput()
+    {
+        if (!finishCurrent()) {
+            return false;
+        }
+        ++m_current;
+        if (m_resampler) {
+            m_resampler->reset();
+        }
+        m_fanout.setWriters(m_outputs[m_current].writers);
+        return m_fanout.open(m_opusSampleRate, m_outputChannels, m_sampleRate, m_error);
+    }
+};
 }
 
-std::vector<uint8_t> OpusEncoderImpl::encodeFrame(const float *pcm, int frameSize)
+OpusEncoderImpl::OpusEncoderImpl(QObject *parent)
+    : QObject(parent)
 {
-    // TODO: Implement frame encoding
-    return std::vector<uint8_t>();
 }
 
-bool OpusEncoderImpl::writeOpusHeader(QIODevice *device, int sampleRate, int channels)
+OpusEncoderImpl::~OpusEncoderImpl() = default;
+
+bool OpusEncoderImpl::encodeFlacToOpus(const QString &inputPath, const QString &outputPath)
 {
-    // TODO: Implement Opus header writing
-    return true;
+    return encodeFlacToFiles(inputPath, {settings()}, {{outputPath}}, {0});
+}
+
+bool OpusEncoderImpl::encodeFlacToFiles(const QString &inputPath, const QList<Rendition> &renditions,
+                                        const QList<QStringList> &outputPaths, const QList<quint64> &trackStarts)
+{
+    QFile inputFile(inputPath);
+    if (!inputFile.open(QIODevice::ReadOnly)) {
+        m_lastError = "Failed to open input file: " + inputFile.errorString();
+        emit encodingError(m_lastError);
+        return false;
+    }
+
+    std::vector<std::unique_ptr<QFile>> outputFiles;
+    QList<QList<QIODevice*>> outputs;
+    auto removeOutputs = [&outputFiles]() {
+        for (const auto &outputFile : outputFiles) {
+            outputFile->close();
+            outputFile->remove();
+        }
+    };
+    for (const QStringList &trackPaths : outputPaths) {
+        QList<QIODevice*> trackOutputs;
+        for (const QString &outputPath : trackPaths) {
+            if (!QFileInfo(outputPath).dir().mkpath(".")) {
+                m_lastError = "Failed to create output directory";
+                emit encodingError(m_lastError);
+                removeOutputs();
+                return false;
+            }
+            auto outputFile = std::make_unique<QFile>(outputPath);
+            if (!outputFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                m_lastError = "Failed to open output file: " + outputFile->errorString();
+                emit encodingError(m_lastError);
+                removeOutputs();
+                return false;
+            }
+            trackOutputs.append(outputFile.get());
+            outputFiles.push_back(std::move(outputFile));
+        }
+        outputs.append(trackOutputs);
+    }
+
+    // Only files can start over when dual mono turns out to be stereo after
+    // all, so streams are never folded
+    m_foldActive = m_foldDualMono;
+    bool success = encodeTracks(inputFile.handle(), renditions, outputs, trackStarts);
+    m_foldActive = false;
+    if (!success && m_channelsDiverged) {
+        qDebug() << "Channels of" << inputPath << "differ after the dual-mono prefix, encoding it as stereo";
+        success = rewind(inputFile.handle(), outputFiles);
+        if (success) {
+            // Listeners take back what the folded pass reported, once
+            emit progressUpdated(0);
+            success = encodeTracks(inputFile.handle(), renditions, outputs, trackStarts);
+        }
+    }
+
+    if (success) {
+        for (const auto &outputFile : outputFiles) {
+            outputFile->close();
+        }
+    } else {
+        removeOutputs();
+    }
+
+    return success;
 }
 
-bool OpusEncoderImpl::writeOpusComment(QIODevice *device)
+bool OpusEncoderImpl::rewind(int inputFd, const std::vector<std::unique_ptr<QFile>> &outputFiles)
 {
-    // TODO: Implement Opus comment writing
+#ifdef Q_OS_WIN
+    const bool rewound = ::_lseek(inputFd, 0, SEEK_SET) == 0;
+#else
+    const bool rewound = ::lseek(inputFd, 0, SEEK_SET) == 0;
+#endif
+    if (!rewound) {
+        m_lastError = QString("Failed to rewind input: %1").arg(strerror(errno));
+        emit encodingError(m_lastError);
+        return false;
+    }
+    for (const auto &outputFile : outputFiles) {
+        if (!outputFile->seek(0) || !outputFile->resize(0)) {
+            m_lastError = "Failed to truncate output file: " + outputFile->errorString();
+            emit encodingError(m_lastError);
+            return false;
+        }
+    }
     return true;
 }
 
-uint32_t OpusEncoderImpl::calculateChecksum(const QByteArray &data)
+bool OpusEncoderImpl::encodeStream(int inputFd, QIODevice *output)
 {
-    // TODO: Implement CRC32 checksum
-    return 0;
+    return encodeTracks(inputFd, {settings()}, {{output}}, {0});
 }
 
-bool OpusEncoderImpl::writeOggOpusFile(const std::vector<float> &samples, int sampleRate, int channels, const QString &outputPath)
+bool OpusEncoderImpl::encodeTracks(int inputFd, const QList<Rendition> &renditions,
+                                   const QList<QList<QIODevice*>> &outputs, const QList<quint64> &trackStarts)
 {
-    // Ensure output directory exists
-    QFileInfo outputInfo(outputPath);
-    QDir outputDir = outputInfo.dir();
-    if (!outputDir.mkpath(".")) {
-        m_lastError = "Failed to create output directory";
+    m_shouldStop = false;
+    m_progress = 0;
+    m_lastError.clear();
+    m_timings = EncodeTimings();
+    m_loudness.clear();
+    m_channelsDiverged = false;
+
+    if (outputs.isEmpty() || renditions.isEmpty() || outputs.size() != trackStarts.size()) {
+        m_lastError = "Every output needs a start sample and a rendition";
+        emit encodingError(m_lastError);
         return false;
     }
-    
-    QFile outputFile(outputPath);
-    if (!outputFile.open(QIODevice::WriteOnly)) {
-        m_lastError = "Failed to open output file: " + outputFile.errorString();
-        return false;
+
+    QElapsedTimer clock;
+    clock.start();
+
+    std::vector<std::unique_ptr<OggOpusWriter>> writers;
+    FlacStreamTranscoder transcoder(inputFd, m_resamplerQuality);
+    transcoder.setParallel(m_parallelRenditions, m_priority);
+    transcoder.setAnalyzeLoudness(m_analyzeLoudness);
+    transcoder.setFoldDualMono(m_foldActive);
+    for (int track = 0; track < outputs.size(); ++track) {
+        if (outputs[track].size() != renditions.size()) {
+            m_lastError = "Every track needs one output per rendition";
+            emit encodingError(m_lastError);
+            return false;
+        }
+        std::vector<OggOpusWriter*> trackWriters;
+        for (int i = 0; i < renditions.size(); ++i) {
+            auto writer = std::make_unique<OggOpusWriter>(outputs[track][i]);
+            writer->setBitrate(renditions[i].bitrate);
+            writer->setComplexity(renditions[i].complexity);
+            writer->setVbr(renditions[i].vbr);
+            writer->setVbrConstraint(m_vbrConstrained);
+            trackWriters.push_back(writer.get());
+            writers.push_back(std::move(writer));
+        }
+        transcoder.addOutput(trackWriters, track == 0 ? 0 : trackStarts[track]);
     }
-    
-    // Initialize Ogg stream
-    ogg_stream_state os;
-    ogg_page og;
-    ogg_packet op;
-    
-    // Generate random serial number
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 0x7FFFFFFF);
-    int serialno = dis(gen);
-    
-    if (ogg_stream_init(&os, serialno) != 0) {
-        m_lastError = "Failed to initialize Ogg stream";
+
+    FLAC__StreamDecoderInitStatus initStatus = transcoder.init();
+    if (initStatus != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        m_lastError = QString("Failed to initialize FLAC decoder: %1")
+            .arg(FLAC__StreamDecoderInitStatusString[initStatus]);
+        emit encodingError(m_lastError);
         return false;
     }
-    
-    // Pre-skip for Opus (recommended 3840 samples at 48kHz = 80ms)
-    const int preskip = 3840;
-    int64_t granulepos = 0;
-    int64_t packetno = 0;
-    
-    // Create Opus header packet
-    unsigned char header_data[276];
-    int header_size = 0;
-    createOpusHeader(header_data, header_size, channels, preskip, sampleRate);
-    
-    op.packet = header_data;
-    op.bytes = header_size;
-    op.b_o_s = 1;
-    op.e_o_s = 0;
-    op.granulepos = 0;
-    op.packetno = packetno++;
-    
-    ogg_stream_packetin(&os, &op);
-    
-    // Write header page
-    while (ogg_stream_flush(&os, &og) != 0) {
-        outputFile.write(reinterpret_cast<char*>(og.header), og.header_len);
-        outputFile.write(reinterpret_cast<char*>(og.body), og.body_len);
-    }
-    
-    // Create comment header packet
-    unsigned char comment_data[1024];
-    int comment_size = 0;
-    createOpusComment(comment_data, comment_size);
-    
-    op.packet = comment_data;
-    op.bytes = comment_size;
-    op.b_o_s = 0;
-    op.e_o_s = 0;
-    op.granulepos = 0;
-    op.packetno = packetno++;
-    
-    ogg_stream_packetin(&os, &op);
-    
-    // Write comment page
-    while (ogg_stream_flush(&os, &og) != 0) {
-        outputFile.write(reinterpret_cast<char*>(og.header), og.header_len);
-        outputFile.write(reinterpret_cast<char*>(og.body), og.body_len);
-    }
-    
-    // Encode audio data
-    const int frameSize = 960; // 20ms at 48kHz
-    const int maxPacketSize = 4000;
-    std::vector<unsigned char> packet(maxPacketSize);
-    
-    size_t samplesProcessed = 0;
-    int totalFrames = (samples.size() / channels + frameSize - 1) / frameSize;
-    
-    while (samplesProcessed < samples.size() / channels) {
-        if (m_shouldStop) {
-            ogg_stream_clear(&os);
-            outputFile.close();
-            outputFile.remove();
-            return false;
+
+    // One block at a time, so stop requests, pauses and progress are handled
+    // between blocks. A paused worker waits here with its decoder, resampler
+    // and encoder state intact.
+    qint64 pausedNs = 0;
+    while (transcoder.get_state() != FLAC__STREAM_DECODER_END_OF_STREAM) {
+        if (m_shouldStop || (m_token && !m_token->checkpoint(&pausedNs))) {
+            m_lastError = "Conversion stopped";
+            break;
         }
-        
-        // Prepare frame
-        std::vector<float> frame(frameSize * channels);
-        size_t frameSamples = std::min(size_t(frameSize), (samples.size() / channels) - samplesProcessed);
-        
-        // Copy samples to frame
-        for (size_t i = 0; i < frameSamples * channels; i++) {
-            frame[i] = samples[samplesProcessed * channels + i];
-        }
-        
-        // Pad with silence if needed
-        for (size_t i = frameSamples * channels; i < frame.size(); i++) {
-            frame[i] = 0.0f;
-        }
-        
-        // Encode frame
-        if (!m_encoder) {
-            m_lastError = "Encoder not initialized";
-            ogg_stream_clear(&os);
-            outputFile.close();
-            outputFile.remove();
-            return false;
+
+        TraceSpan span("flac_block", "encoder", Tracer::Blocks);
+        if (!transcoder.process_single() || transcoder.failed()) {
+            m_lastError = transcoder.failed() ? transcoder.errorString()
+                                              : QString("Failed to decode FLAC stream");
+            break;
         }
-        
-        opus_int32 len = opus_encode_float(m_encoder.get(), frame.data(), frameSize, 
-                                          packet.data(), maxPacketSize);
-        
-        if (len < 0) {
-            m_lastError = QString("Opus encoding error: %1").arg(opus_strerror(len));
-            ogg_stream_clear(&os);
-            outputFile.close();
-            outputFile.remove();
-            return false;
+
+        if (transcoder.totalSamples() > 0) {
+            int progress = int(std::min<quint64>(99, transcoder.decodedSamples() * 100 / transcoder.totalSamples()));
+            if (progress != m_progress) {
+                m_progress = progress;
+                emit progressUpdated(progress);
+            }
         }
-        
-        // Calculate granulepos (number of samples at 48kHz)
-        granulepos += frameSize;
-        
-        // Create Ogg packet
-        op.packet = packet.data();
-        op.bytes = len;
-        op.b_o_s = 0;
-        op.e_o_s = (samplesProcessed + frameSamples >= samples.size() / channels) ? 1 : 0;
-        op.granulepos = granulepos - preskip;
-        op.packetno = packetno++;
-        
-        ogg_stream_packetin(&os, &op);
-        
-        // Write pages
-        while (ogg_stream_pageout(&os, &og) != 0) {
-            outputFile.write(reinterpret_cast<char*>(og.header), og.header_len);
-            outputFile.write(reinterpret_cast<char*>(og.body), og.body_len);
-        }
-        
-        samplesProcessed += frameSamples;
-        
-        // Update progress
-        int progress = 50 + (samplesProcessed * 50) / (samples.size() / channels);
-        if (progress != m_progress) {
-            m_progress = progress;
-            emit progressUpdated(progress);
-        }
-    }
-    
-    // Flush remaining pages
-    while (ogg_stream_flush(&os, &og) != 0) {
-        outputFile.write(reinterpret_cast<char*>(og.header), og.header_len);
-        outputFile.write(reinterpret_cast<char*>(og.body), og.body_len);
-    }
-    
-    ogg_stream_clear(&os);
-    outputFile.close();
-    return true;
-}
+    }
 
-void OpusEncoderImpl::createOpusHeader(unsigned char *header, int &headerSize, int channels, int preskip, int inputSampleRate)
-{
-    // OpusHead structure
-    memcpy(header, "OpusHead", 8);  // Magic signature
-    header[8] = 1;  // Version
-    header[9] = channels;  // Channel count
-    
-    // Pre-skip (16-bit LE)
-    header[10] = preskip & 0xFF;
-    header[11] = (preskip >> 8) & 0xFF;
-    
-    // Input sample rate (32-bit LE)
-    header[12] = inputSampleRate & 0xFF;
-    header[13] = (inputSampleRate >> 8) & 0xFF;
-    header[14] = (inputSampleRate >> 16) & 0xFF;
-    header[15] = (inputSampleRate >> 24) & 0xFF;
-    
-    // Output gain (16-bit LE) - 0 dB
-    header[16] = 0;
-    header[17] = 0;
-    
-    // Channel mapping family
-    header[18] = 0;  // RTP mapping family
-    
-    headerSize = 19;
-}
+    if (m_lastError.isEmpty() && !transcoder.finishOutput()) {
+        m_lastError = transcoder.errorString();
+    }
 
-void OpusEncoderImpl::createOpusComment(unsigned char *comment, int &commentSize)
-{
-    // OpusTags structure
-    memcpy(comment, "OpusTags", 8);  // Magic signature
-    
-    // Vendor string length (32-bit LE)
-    const char *vendor = "OpusRipperGUI";
-    int vendorLen = strlen(vendor);
-    comment[8] = vendorLen & 0xFF;
-    comment[9] = (vendorLen >> 8) & 0xFF;
-    comment[10] = (vendorLen >> 16) & 0xFF;
-    comment[11] = (vendorLen >> 24) & 0xFF;
-    
-    // Vendor string
-    memcpy(comment + 12, vendor, vendorLen);
-    
-    // User comment count (32-bit LE)
-    int pos = 12 + vendorLen;
-    comment[pos] = 0;
-    comment[pos + 1] = 0;
-    comment[pos + 2] = 0;
-    comment[pos + 3] = 0;
-    
-    commentSize = pos + 4;
+    transcoder.finish();
+
+    // Finished tracks keep their writer buffers until here, so they all count.
+    // Encode and mux time add up over renditions even when they overlap.
+    qint64 writerBufferBytes = 0;
+    for (const auto &writer : writers) {
+        m_timings.encodeNs += writer->encodeNs();
+        m_timings.muxNs += writer->muxNs();
+        writerBufferBytes += writer->bufferBytes();
+    }
+    m_timings.resampleNs = transcoder.resampleNs();
+    m_timings.analysisNs = transcoder.analysisNs();
+
+    // Decoding is whatever the downstream stages don't account for
+    m_timings.decodeNs = qMax<qint64>(0, clock.nsecsElapsed() - pausedNs - m_timings.resampleNs -
+                                         m_timings.analysisNs - transcoder.writerWallNs());
+    m_timings.samples = transcoder.decodedSamples();
+    m_timings.sampleRate = transcoder.sampleRate();
+    m_timings.resampled = transcoder.resampled();
+    m_timings.folded = transcoder.folded();
+    m_timings.peakBufferBytes = transcoder.bufferBytes() + writerBufferBytes;
+
+    // A fold that turned out wrong is retried by the caller, not reported
+    m_channelsDiverged = transcoder.channelsDiverged();
+    if (!m_lastError.isEmpty()) {
+        if (!m_channelsDiverged) {
+            emit encodingError(m_lastError);
+        }
+        return false;
+    }
+    m_loudness = transcoder.loudness();
+
+    m_progress = 100;
+    emit progressUpdated(100);
+    return true;
 }
 
-std::vector<float> OpusEncoderImpl::resampleAudio(const std::vector<float> &input, int inputSampleRate, int outputSampleRate, int channels)
+void OpusEncoderImpl::stop()
 {
-    // High-quality resampling using libsamplerate (Secret Rabbit Code)
-    
-    if (inputSampleRate == outputSampleRate) {
-        // No resampling needed
-        return input;
-    }
-    
-    double ratio = static_cast<double>(outputSampleRate) / inputSampleRate;
-    size_t inputFrames = input.size() / channels;
-    size_t outputFrames = static_cast<size_t>(std::ceil(inputFrames * ratio));
-    
-    std::vector<float> output(outputFrames * channels);
-    
-    // Set up the sample rate conversion
-    SRC_DATA srcData;
-    srcData.data_in = const_cast<float*>(input.data());
-    srcData.data_out = output.data();
-    srcData.input_frames = inputFrames;
-    srcData.output_frames = outputFrames;
-    srcData.src_ratio = ratio;
-    srcData.end_of_input = 1; // We're converting the entire buffer at once
-    
-    // Use the highest quality sinc interpolation
-    int error = src_simple(&srcData, SRC_SINC_BEST_QUALITY, channels);
-    
-    if (error != 0) {
-        m_lastError = QString("Resampling failed: %1").arg(src_strerror(error));
-        qDebug() << m_lastError;
-        return input; // Return original on error
-    }
-    
-    // Resize output to actual frames generated
-    output.resize(srcData.output_frames_gen * channels);
-    
-    return output;
-}
\ No newline at end of file
+    m_shouldStop = true;
+}
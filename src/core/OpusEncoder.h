@@ -1,79 +1,128 @@
 #ifndef OPUSENCODER_H
 #define OPUSENCODER_H
 
+#include <QList>
 #include <QObject>
 #include <QString>
-#include <QByteArray>
-#include <memory>
-#include <vector>
-#include <cstdint>
+#include <QStringList>
 #include <atomic>
+#include <memory>
 #include <samplerate.h>
+#include <vector>
 
-// Forward declarations for opus types
-struct OpusEncoder;
+#include "LoudnessAnalyzer.h"
+#include "Rendition.h"
+#include "WorkerPriority.h"
 
+class QFile;
 class QIODevice;
+class CancellationToken;
+
+// Wall time spent in each stage of the last encode, in nanoseconds
+struct EncodeTimings {
+    qint64 decodeNs = 0;      // FLAC decoding and conversion to float
+    qint64 resampleNs = 0;
+    qint64 encodeNs = 0;      // opus_encode_float
+    qint64 muxNs = 0;         // Ogg paging and writing to the sink
+    qint64 analysisNs = 0;    // EBU R128 loudness measurement
+    quint64 samples = 0;      // Decoded samples per channel
+    int sampleRate = 0;       // Of the source
+    bool resampled = false;
+    bool folded = false;      // Dual-mono stereo encoded as one channel
+    qint64 peakBufferBytes = 0;   // PCM, resampler and Ogg buffers at their largest
+};
 
+// Decodes FLAC and encodes Ogg Opus in a single streaming pass. Memory use is
+// bounded by one FLAC block plus one Opus frame, whatever the input length.
 class OpusEncoderImpl : public QObject
 {
     Q_OBJECT
-    
+
 public:
     explicit OpusEncoderImpl(QObject *parent = nullptr);
     ~OpusEncoderImpl();
-    
-    bool initialize(int sampleRate, int channels, int bitrate);
+
     bool encodeFlacToOpus(const QString &inputPath, const QString &outputPath);
+
+    // Decode once into outputPaths[track][rendition]. An album image is split
+    // into one file per track: trackStarts holds the first sample of each
+    // track at the source rate, and the first track also takes any audio
+    // before its start. Each rendition gets its own encoder and Ogg stream.
+    bool encodeFlacToFiles(const QString &inputPath, const QList<Rendition> &renditions,
+                           const QList<QStringList> &outputPaths, const QList<quint64> &trackStarts);
+
+    // Read a FLAC byte stream from a file descriptor (file, pipe or socket)
+    // and write Ogg Opus pages to output as they are produced
+    bool encodeStream(int inputFd, QIODevice *output);
+    bool encodeTracks(int inputFd, const QList<Rendition> &renditions,
+                      const QList<QList<QIODevice*>> &outputs, const QList<quint64> &trackStarts);
+
     void stop();
-    
+
     // Encoder settings
-    void setBitrate(int bitrate);
-    void setComplexity(int complexity);
-    void setVbr(bool enabled);
-    void setVbrConstraint(bool constrained);
-    
+    void setBitrate(int bitrate) { m_bitrate = bitrate; }
+    void setComplexity(int complexity) { m_complexity = complexity; }
+    void setVbr(bool enabled) { m_vbr = enabled; }
+    void setVbrConstraint(bool constrained) { m_vbrConstrained = constrained; }
+    void setResamplerQuality(int quality) { m_resamplerQuality = quality; }
+    int resamplerQuality() const { return m_resamplerQuality; }
+
+    // The settings above as a rendition, without an output root
+    Rendition settings() const { return {QString(), m_bitrate, m_complexity, m_vbr}; }
+
+    // Encode the renditions of a block on separate threads, which run with
+    // the given priority like the worker that decodes
+    void setParallelRenditions(bool parallel, const WorkerPriority &priority = WorkerPriority())
+    {
+        m_parallelRenditions = parallel;
+        m_priority = priority;
+    }
+
+    // Measure EBU R128 loudness and true peak of every output track from the
+    // decoded audio, in the same pass
+    void setAnalyzeLoudness(bool analyze) { m_analyzeLoudness = analyze; }
+    const QList<LoudnessStats> &trackLoudness() const { return m_loudness; } // Of the last encode, per track
+
+    // Encode stereo files whose channels are identical as mono, with half the
+    // encoder work. The first seconds decide; a file whose channels part later
+    // is encoded again in stereo. Only applies to encodeFlacToFiles.
+    void setFoldDualMono(bool fold) { m_foldDualMono = fold; }
+    static const int DualMonoPrefixSeconds = 10;
+
+    // Checked between FLAC blocks; not owned, may be null
+    void setCancellationToken(CancellationToken *token) { m_token = token; }
+
     // Get encoder info
     QString getLastError() const { return m_lastError; }
     int getProgress() const { return m_progress; }
-    
+    const EncodeTimings &lastTimings() const { return m_timings; }
+
 signals:
     void progressUpdated(int percentage);
     void encodingError(const QString &error);
-    
+
 private:
-    std::unique_ptr<OpusEncoder, void(*)(OpusEncoder*)> m_encoder;
-    
-    int m_sampleRate = 48000;
-    int m_channels = 2;
     int m_bitrate = 128000;
     int m_complexity = 10;
     bool m_vbr = true;
     bool m_vbrConstrained = false;
-    
+    int m_resamplerQuality = SRC_SINC_BEST_QUALITY;
+    bool m_parallelRenditions = false;
+    WorkerPriority m_priority;
+    bool m_analyzeLoudness = false;
+    QList<LoudnessStats> m_loudness;
+    bool m_foldDualMono = false;
+    bool m_foldActive = false;          // Outputs of this encode can start over
+    bool m_channelsDiverged = false;
+
     QString m_lastError;
     int m_progress = 0;
+    EncodeTimings m_timings;
     std::atomic<bool> m_shouldStop{false};
-    
-    // FLAC decoding
-    bool decodeFlacData(const QString &inputPath, std::vector<float> &samples, int &sampleRate, int &channels);
-    
-    // Opus encoding
-    bool encodeToOpusFile(const std::vector<float> &samples, int sampleRate, int channels, const QString &outputPath);
-    
-    // Helper functions
-    std::vector<uint8_t> encodeFrame(const float *pcm, int frameSize);
-    bool writeOpusHeader(QIODevice *device, int sampleRate, int channels);
-    bool writeOpusComment(QIODevice *device);
-    uint32_t calculateChecksum(const QByteArray &data);
-    
-    // Ogg Opus specific
-    bool writeOggOpusFile(const std::vector<float> &samples, int sampleRate, int channels, const QString &outputPath);
-    void createOpusHeader(unsigned char *header, int &headerSize, int channels, int preskip, int inputSampleRate);
-    void createOpusComment(unsigned char *comment, int &commentSize);
-    
-    // Resampling
-    std::vector<float> resampleAudio(const std::vector<float> &input, int inputSampleRate, int outputSampleRate, int channels);
+    CancellationToken *m_token = nullptr;
+
+    // Back to the start of the input with empty outputs
+    bool rewind(int inputFd, const std::vector<std::unique_ptr<QFile>> &outputFiles);
 };
 
-#endif // OPUSENCODER_H
\ No newline at end of file
+#endif // OPUSENCODER_H
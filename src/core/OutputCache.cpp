@@ -0,0 +1,204 @@
+#include "OutputCache.h"
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+namespace {
+// Bump when the encoder output changes for identical settings
+const int CacheFormatVersion = 2;
+}
+
+OutputCache::OutputCache(const QString &directory)
+    : m_directory(directory.isEmpty() ? defaultDirectory() : directory)
+{
+}
+
+QString OutputCache::defaultDirectory()
+{
+    QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return QDir(cacheDir).filePath("encodes");
+}
+
+QString OutputCache::cacheKey(const FlacStreamInfo &streamInfo, int bitrate, int complexity,
+                              bool vbr, int resamplerQuality, bool foldDualMono)
+{
+    if (!streamInfo.valid || !streamInfo.hasMd5()) {
+        return QString();
+    }
+
+    QByteArray material = QByteArray(reinterpret_cast<const char*>(streamInfo.md5),
+                                     sizeof(streamInfo.md5)).toHex();
+    material += QString(":%1:%2:%3:%4:%5:%6:%7:%8")
+        .arg(streamInfo.sampleRate)
+        .arg(streamInfo.channels)
+        .arg(streamInfo.bitsPerSample)
+        .arg(bitrate)
+        .arg(complexity)
+        .arg(vbr ? 1 : 0)
+        .arg(resamplerQuality)
+        .arg(CacheFormatVersion)
+        .toLatin1();
+    if (foldDualMono && streamInfo.channels == 2) {
+        material += ":fold";
+    }
+
+    return QString::fromLatin1(QCryptographicHash::hash(material, QCryptographicHash::Sha1).toHex());
+}
+
+QString OutputCache::find(const QString &key)
+{
+    if (key.isEmpty()) {
+        return QString();
+    }
+
+    QString entry = entryPath(key);
+    if (!QFile::exists(entry)) {
+        m_misses++;
+        return QString();
+    }
+
+    recordHit(entry);
+    return entry;
+}
+
+bool OutputCache::fetch(const QString &key, const QString &outputPath)
+{
+    if (key.isEmpty()) {
+        return false;
+    }
+
+    QString entry = entryPath(key);
+    if (!QFile::exists(entry) || !cloneFile(entry, outputPath)) {
+        m_misses++;
+        return false;
+    }
+
+    recordHit(entry);
+    return true;
+}
+
+bool OutputCache::store(const QString &key, const QString &outputPath, qint64 encodeCpuMs,
+                        const QByteArray &loudness)
+{
+    if (key.isEmpty()) {
+        return false;
+    }
+
+    QString entry = entryPath(key);
+    if (QFile::exists(entry)) {
+        if (!loudness.isEmpty() && !QFile::exists(entry + ".r128")) {
+            writeLoudness(entry, loudness);
+        }
+        return true;
+    }
+
+    if (!QDir().mkpath(QFileInfo(entry).absolutePath())) {
+        return false;
+    }
+
+    // Stage under a unique name so concurrent workers never see a partial entry
+    QString staging = QString("%1.%2-%3.tmp")
+        .arg(entry)
+        .arg(QCoreApplication::applicationPid())
+        .arg(quintptr(QThread::currentThreadId()));
+
+    if (!cloneFile(outputPath, staging)) {
+        QFile::remove(staging);
+        return false;
+    }
+
+    QFile cpuFile(entry + ".cpu");
+    if (cpuFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        cpuFile.write(QByteArray::number(encodeCpuMs));
+        cpuFile.close();
+    }
+    if (!loudness.isEmpty()) {
+        writeLoudness(entry, loudness);
+    }
+
+    // Another worker may have published the same key in the meantime
+    if (!QFile::rename(staging, entry)) {
+        QFile::remove(staging);
+    }
+
+    return true;
+}
+
+QByteArray OutputCache::loudness(const QString &key) const
+{
+    if (key.isEmpty()) {
+        return QByteArray();
+    }
+    QFile file(entryPath(key) + ".r128");
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void OutputCache::writeLoudness(const QString &entry, const QByteArray &loudness)
+{
+    // Atomic, as several workers may measure the same audio at once
+    QSaveFile file(entry + ".r128");
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(loudness);
+        file.commit();
+    }
+}
+
+void OutputCache::resetStatistics()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_savedCpuMs = 0;
+}
+
+void OutputCache::recordHit(const QString &entry)
+{
+    m_hits++;
+
+    QFile cpuFile(entry + ".cpu");
+    if (cpuFile.open(QIODevice::ReadOnly)) {
+        m_savedCpuMs += cpuFile.readAll().trimmed().toLongLong();
+    }
+}
+
+QString OutputCache::entryPath(const QString &key) const
+{
+    return QDir(m_directory).filePath(key.left(2) + "/" + key + ".opus");
+}
+
+bool OutputCache::cloneFile(const QString &sourcePath, const QString &destinationPath)
+{
+    QFile::remove(destinationPath);
+
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    // Share the extents on copy-on-write filesystems (btrfs, XFS)
+    int source = ::open(QFile::encodeName(sourcePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (source >= 0) {
+        int destination = ::open(QFile::encodeName(destinationPath).constData(),
+                                 O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool cloned = destination >= 0 && ::ioctl(destination, FICLONE, source) == 0;
+        if (destination >= 0) {
+            ::close(destination);
+        }
+        ::close(source);
+
+        if (cloned) {
+            return true;
+        }
+        QFile::remove(destinationPath);
+    }
+#endif
+
+    return QFile::copy(sourcePath, destinationPath);
+}
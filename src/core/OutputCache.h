@@ -0,0 +1,60 @@
+#ifndef OUTPUTCACHE_H
+#define OUTPUTCACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+
+#include "FlacStreamInfo.h"
+
+// Content-addressed store of finished encodes. Entries are keyed on the MD5 of
+// the decoded audio from STREAMINFO plus everything that affects the encoded
+// stream, so identical sources share one encode regardless of path or tags.
+class OutputCache
+{
+public:
+    explicit OutputCache(const QString &directory = QString());
+
+    QString directory() const { return m_directory; }
+    static QString defaultDirectory();
+
+    // Empty if the source carries no MD5 and therefore can't be cached.
+    // Folding only changes the key of stereo sources, so existing entries of
+    // everything else stay valid.
+    static QString cacheKey(const FlacStreamInfo &streamInfo, int bitrate, int complexity,
+                            bool vbr, int resamplerQuality, bool foldDualMono = false);
+
+    // Path of the cached encode, or empty on a miss; counted like fetch()
+    QString find(const QString &key);
+
+    // Materialize a cached encode at outputPath (reflink, falling back to a copy)
+    bool fetch(const QString &key, const QString &outputPath);
+
+    // Add a freshly encoded file; encodeCpuMs is credited on later hits.
+    // loudness, if given, is kept with the entry (and added to an existing
+    // one) so hits don't need a decode to be measured.
+    bool store(const QString &key, const QString &outputPath, qint64 encodeCpuMs,
+               const QByteArray &loudness = QByteArray());
+
+    // What store() kept as loudness for the entry, empty if nothing
+    QByteArray loudness(const QString &key) const;
+
+    // Statistics since the last reset, safe to read from any thread
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+    qint64 savedCpuMs() const { return m_savedCpuMs; }
+    void resetStatistics();
+
+private:
+    QString m_directory;
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_misses{0};
+    std::atomic<qint64> m_savedCpuMs{0};
+
+    QString entryPath(const QString &key) const;
+    static void writeLoudness(const QString &entry, const QByteArray &loudness);
+    void recordHit(const QString &entry);
+    static bool cloneFile(const QString &sourcePath, const QString &destinationPath);
+};
+
+#endif // OUTPUTCACHE_H
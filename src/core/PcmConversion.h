@@ -0,0 +1,69 @@
+#ifndef PCMCONVERSION_H
+#define PCMCONVERSION_H
+
+#include <FLAC/format.h>
+#include <cmath>
+#include <cstddef>
+
+// Convert one decoded FLAC block (planar integers) into interleaved float
+// normalized to -1.0 to 1.0. out must hold frames * channels samples.
+inline void flacToInterleavedFloat(const FLAC__int32 * const planes[], int channels,
+                                   unsigned frames, unsigned bitsPerSample, float *out)
+{
+    const float scale = std::ldexp(1.0f, -int(bitsPerSample - 1));
+
+    // Mono and stereo cover nearly every file; fixed strides let the compiler vectorize
+    if (channels == 1) {
+        const FLAC__int32 *mono = planes[0];
+        for (unsigned i = 0; i < frames; i++) {
+            out[i] = mono[i] * scale;
+        }
+    } else if (channels == 2) {
+        const FLAC__int32 *left = planes[0];
+        const FLAC__int32 *right = planes[1];
+        for (unsigned i = 0; i < frames; i++) {
+            out[2 * size_t(i)] = left[i] * scale;
+            out[2 * size_t(i) + 1] = right[i] * scale;
+        }
+    } else {
+        for (int ch = 0; ch < channels; ch++) {
+            const FLAC__int32 *plane = planes[ch];
+            float *dst = out + ch;
+            for (unsigned i = 0; i < frames; i++) {
+                dst[size_t(i) * channels] = plane[i] * scale;
+            }
+        }
+    }
+}
+
+// True when two decoded FLAC channels hold the same samples. The differences
+// are OR-ed together instead of returning at the first one, so the loop has no
+// exit and the compiler vectorizes it; one block is at most a few thousand
+// samples.
+inline bool planesIdentical(const FLAC__int32 *left, const FLAC__int32 *right, unsigned frames)
+{
+    FLAC__int32 difference = 0;
+    for (unsigned i = 0; i < frames; i++) {
+        difference |= left[i] ^ right[i];
+    }
+    return difference == 0;
+}
+
+// The left channel of interleaved stereo
+inline void leftOfStereo(const float *stereo, size_t frames, float *out)
+{
+    for (size_t i = 0; i < frames; i++) {
+        out[i] = stereo[2 * i];
+    }
+}
+
+// Mono duplicated into both channels of interleaved stereo
+inline void monoToStereo(const float *mono, size_t frames, float *out)
+{
+    for (size_t i = 0; i < frames; i++) {
+        out[2 * i] = mono[i];
+        out[2 * i + 1] = mono[i];
+    }
+}
+
+#endif // PCMCONVERSION_H
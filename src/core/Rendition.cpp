@@ -0,0 +1,52 @@
+#include "Rendition.h"
+#include <QStringList>
+
+bool Rendition::parse(const QString &spec, const Rendition &defaults, Rendition &rendition, QString *error)
+{
+    auto fail = [&](const QString &message) {
+        if (error) {
+            *error = QString("Invalid rendition \"%1\": %2").arg(spec, message);
+        }
+        return false;
+    };
+
+    // Split at the first colon, so the directory may contain more of them
+    const int separator = spec.indexOf(':');
+    if (separator <= 0 || separator == spec.size() - 1) {
+        return fail("expected KBPS[,cN][,cbr]:DIR");
+    }
+
+    Rendition parsed = defaults;
+    parsed.outputDirectory = spec.mid(separator + 1);
+
+    const QStringList fields = spec.left(separator).split(',');
+    bool ok = false;
+    const int kbps = fields[0].trimmed().toInt(&ok);
+    if (!ok || kbps < 6 || kbps > 510) {
+        return fail("bitrate must be 6-510 kbps");
+    }
+    parsed.bitrate = kbps * 1000;
+
+    for (int i = 1; i < fields.size(); ++i) {
+        const QString field = fields[i].trimmed().toLower();
+        if (field == "cbr" || field == "vbr") {
+            parsed.vbr = field == "vbr";
+        } else if (field.startsWith('c')) {
+            parsed.complexity = field.mid(1).toInt(&ok);
+            if (!ok || parsed.complexity < 0 || parsed.complexity > 10) {
+                return fail("complexity must be c0-c10");
+            }
+        } else {
+            return fail(QString("unknown setting \"%1\"").arg(field));
+        }
+    }
+
+    rendition = parsed;
+    return true;
+}
+
+QString Rendition::toString() const
+{
+    return QString("%1k c%2 %3 -> %4").arg(bitrate / 1000).arg(complexity)
+        .arg(QString(vbr ? "vbr" : "cbr"), outputDirectory);
+}
@@ -0,0 +1,29 @@
+#ifndef RENDITION_H
+#define RENDITION_H
+
+#include <QString>
+
+// One encoding of a batch, written under its own output root. A batch always
+// has the primary rendition from its main settings and may add more; all of
+// them are fed from the same decode.
+struct Rendition {
+    QString outputDirectory;
+    int bitrate = 128000;     // Bits per second
+    int complexity = 10;
+    bool vbr = true;
+
+    // "KBPS[,cN][,cbr|,vbr]:DIR", e.g. "64,c5,cbr:/music/mobile". Fields that
+    // are left out keep the values of defaults.
+    static bool parse(const QString &spec, const Rendition &defaults, Rendition &rendition,
+                      QString *error = nullptr);
+    QString toString() const;
+
+    bool operator==(const Rendition &other) const
+    {
+        return outputDirectory == other.outputDirectory && bitrate == other.bitrate &&
+               complexity == other.complexity && vbr == other.vbr;
+    }
+    bool operator!=(const Rendition &other) const { return !(*this == other); }
+};
+
+#endif // RENDITION_H
@@ -0,0 +1,19 @@
+#ifndef THREADCPUTIME_H
+#define THREADCPUTIME_H
+
+#include <QtGlobal>
+#include <ctime>
+
+// CPU time consumed by the calling thread, in milliseconds
+inline qint64 threadCpuTimeMs()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return qint64(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+#endif
+    return 0;
+}
+
+#endif // THREADCPUTIME_H
@@ -0,0 +1,222 @@
+#include "Tracer.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+#include <memory>
+#include <vector>
+
+std::atomic<int> Tracer::s_level{Tracer::Off};
+
+namespace {
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    qint64 startNs;
+    qint64 durationNs;
+    qint64 value;
+};
+
+// Events are stored in fixed chunks that are never moved, so the exporter can
+// read a chunk while its owner is still appending to it
+const int ChunkEvents = 4096;
+const int MaxChunksPerThread = 256;   // About 1M events (40 MB) per thread
+
+struct Chunk {
+    TraceEvent events[ChunkEvents];
+    std::atomic<int> count{0};
+    std::atomic<Chunk*> next{nullptr};
+};
+
+struct ThreadBuffer {
+    int tid = 0;
+    QString name;                      // Guarded by the registry mutex
+    Chunk *head = nullptr;
+    Chunk *tail = nullptr;             // Only touched by the owning thread
+    int chunks = 0;
+    std::atomic<qint64> dropped{0};
+};
+
+struct Registry {
+    Registry() { clock.start(); }
+
+    QElapsedTimer clock;
+    QMutex mutex;
+    // Kept after their threads exit so finished workers still show up
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+thread_local ThreadBuffer *t_buffer = nullptr;
+
+ThreadBuffer *threadBuffer()
+{
+    if (!t_buffer) {
+        auto buffer = std::make_unique<ThreadBuffer>();
+        buffer->head = buffer->tail = new Chunk;
+        buffer->chunks = 1;
+
+        Registry &reg = registry();
+        QMutexLocker locker(&reg.mutex);
+        buffer->tid = int(reg.buffers.size()) + 1;
+        QString objectName = QThread::currentThread()->objectName();
+        buffer->name = objectName.isEmpty() ? QString("Thread %1").arg(buffer->tid)
+                                            : QString("%1 %2").arg(objectName).arg(buffer->tid);
+        t_buffer = buffer.get();
+        reg.buffers.push_back(std::move(buffer));
+    }
+    return t_buffer;
+}
+
+QByteArray jsonString(const QString &text)
+{
+    QByteArray array = QJsonDocument(QJsonArray{text}).toJson(QJsonDocument::Compact);
+    return array.mid(1, array.size() - 2);
+}
+
+void appendMicroseconds(QByteArray &out, qint64 ns)
+{
+    out += QByteArray::number(ns / 1000);
+    out += '.';
+    out += QByteArray::number(ns % 1000).rightJustified(3, '0');
+}
+}
+
+void Tracer::setLevel(Level level)
+{
+    registry(); // Start the clock before the first span
+    s_level.store(level, std::memory_order_relaxed);
+}
+
+qint64 Tracer::now()
+{
+    return registry().clock.nsecsElapsed();
+}
+
+void Tracer::record(const char *name, const char *category, qint64 startNs, qint64 endNs, qint64 value)
+{
+    ThreadBuffer *buffer = threadBuffer();
+    Chunk *tail = buffer->tail;
+    int count = tail->count.load(std::memory_order_relaxed);
+
+    if (count == ChunkEvents) {
+        if (buffer->chunks >= MaxChunksPerThread) {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Chunk *chunk = new Chunk;
+        tail->next.store(chunk, std::memory_order_release);
+        buffer->tail = tail = chunk;
+        buffer->chunks++;
+        count = 0;
+    }
+
+    tail->events[count] = TraceEvent{name, category, startNs, endNs - startNs, value};
+    tail->count.store(count + 1, std::memory_order_release);
+}
+
+void Tracer::setThreadName(const QString &name)
+{
+    ThreadBuffer *buffer = threadBuffer();
+    QMutexLocker locker(&registry().mutex);
+    buffer->name = name;
+}
+
+bool Tracer::writeChromeTrace(const QString &path, QString *error)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error) {
+            *error = QString("Cannot write trace %1: %2").arg(path, file.errorString());
+        }
+        return false;
+    }
+
+    Registry &reg = registry();
+    QMutexLocker locker(&reg.mutex);
+
+    QByteArray out;
+    out.reserve(1 << 20);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":";
+    out += jsonString(QCoreApplication::applicationName());
+    out += "}}";
+
+    qint64 dropped = 0;
+    for (const auto &buffer : reg.buffers) {
+        out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+        out += QByteArray::number(buffer->tid);
+        out += ",\"args\":{\"name\":";
+        out += jsonString(buffer->name);
+        out += "}}";
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+
+        for (Chunk *chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            const int count = chunk->count.load(std::memory_order_acquire);
+            for (int i = 0; i < count; ++i) {
+                const TraceEvent &event = chunk->events[i];
+                out += ",\n{\"name\":\"";
+                out += event.name;
+                out += "\",\"cat\":\"";
+                out += event.category;
+                out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+                out += QByteArray::number(buffer->tid);
+                out += ",\"ts\":";
+                appendMicroseconds(out, event.startNs);
+                out += ",\"dur\":";
+                appendMicroseconds(out, event.durationNs);
+                if (event.value >= 0) {
+                    out += ",\"args\":{\"value\":";
+                    out += QByteArray::number(event.value);
+                    out += '}';
+                }
+                out += '}';
+            }
+
+            if (out.size() > (1 << 20)) {
+                file.write(out);
+                out.clear();
+            }
+        }
+    }
+
+    out += "\n],\"otherData\":{\"droppedEvents\":";
+    out += QByteArray::number(dropped);
+    out += "}}\n";
+    file.write(out);
+
+    if (!file.commit()) {
+        if (error) {
+            *error = QString("Cannot write trace %1: %2").arg(path, file.errorString());
+        }
+        return false;
+    }
+    return true;
+}
+
+void Tracer::clear()
+{
+    Registry &reg = registry();
+    QMutexLocker locker(&reg.mutex);
+    for (const auto &buffer : reg.buffers) {
+        Chunk *chunk = buffer->head->next.exchange(nullptr);
+        while (chunk) {
+            Chunk *next = chunk->next.load();
+            delete chunk;
+            chunk = next;
+        }
+        buffer->head->count.store(0);
+        buffer->tail = buffer->head;
+        buffer->chunks = 1;
+        buffer->dropped.store(0);
+    }
+}
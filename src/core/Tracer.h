@@ -0,0 +1,75 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <atomic>
+
+// Span tracing for whole batches, written as Chrome trace JSON that opens in
+// ui.perfetto.dev or chrome://tracing. Every thread appends to its own buffer
+// without taking a lock; while tracing is off a span costs one relaxed load.
+class Tracer
+{
+public:
+    enum Level {
+        Off = 0,
+        Files = 1,     // Per-file stages, pool queue waits and controller dispatch
+        Blocks = 2     // Also each resampler call, Opus frame and Ogg write
+    };
+
+    static void setLevel(Level level);
+    static Level level() { return Level(s_level.load(std::memory_order_relaxed)); }
+    static bool isEnabled(Level level = Files) { return s_level.load(std::memory_order_relaxed) >= level; }
+
+    // Nanoseconds on the trace clock, shared by all threads
+    static qint64 now();
+
+    // Record a finished span on the calling thread. name and category must
+    // outlive the tracer (string literals); value is shown unless negative.
+    static void record(const char *name, const char *category, qint64 startNs, qint64 endNs,
+                       qint64 value = -1);
+
+    // Label the calling thread in the trace viewer
+    static void setThreadName(const QString &name);
+
+    // Safe while other threads keep recording; returns false and sets error on failure
+    static bool writeChromeTrace(const QString &path, QString *error = nullptr);
+
+    // Drop recorded events; only call while no thread is recording
+    static void clear();
+
+private:
+    static std::atomic<int> s_level;
+};
+
+// Records the enclosing scope as one span
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, const char *category, Tracer::Level level = Tracer::Files)
+        : m_name(name)
+        , m_category(category)
+        , m_start(Tracer::isEnabled(level) ? Tracer::now() : -1)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (m_start >= 0) {
+            Tracer::record(m_name, m_category, m_start, Tracer::now(), m_value);
+        }
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    // E.g. the file index or frame count, shown in the span's arguments
+    void setValue(qint64 value) { m_value = value; }
+
+private:
+    const char *m_name;
+    const char *m_category;
+    qint64 m_start;
+    qint64 m_value = -1;
+};
+
+#endif // TRACER_H
@@ -0,0 +1,221 @@
+#include "WorkerPriority.h"
+#include <QFile>
+#include <QStringList>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef Q_OS_LINUX
+// From linux/ioprio.h and linux/mempolicy.h, which not every libc ships
+const int IoprioWhoProcess = 1;    // With a tid, just that thread
+const int IoprioClassBestEffort = 2;
+const int IoprioClassIdle = 3;
+const int IoprioClassShift = 13;
+const int IoprioLowestLevel = 7;
+const int MpolDefault = 0;
+const int MpolPreferred = 1;
+const int NodeMaskWords = 16;
+
+// What the thread ran with before the first policy was applied, so turning
+// background mode off puts it back instead of forcing nice 0 on everyone
+struct OriginalScheduling {
+    bool captured = false;
+    int nice = 0;
+    cpu_set_t affinity;
+};
+thread_local OriginalScheduling t_original;
+
+QString errnoString(const char *what)
+{
+    return QString("%1: %2").arg(QLatin1String(what), QString::fromLocal8Bit(std::strerror(errno)));
+}
+#endif
+
+const int MaxCpus = 8192;
+
+thread_local bool t_applied = false;
+thread_local WorkerPriority t_current;
+
+QString formatCpuList(const QList<int> &cpus)
+{
+    QStringList parts;
+    for (int i = 0; i < cpus.size();) {
+        int j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        parts << (i == j ? QString::number(cpus[i]) : QString("%1-%2").arg(cpus[i]).arg(cpus[j]));
+        i = j + 1;
+    }
+    return parts.join(',');
+}
+}
+
+QString WorkerPriority::toString() const
+{
+    QStringList parts;
+    if (background) {
+        parts << (niceLevel == 0 ? QString("SCHED_IDLE, idle I/O")
+                                 : QString("nice %1, lowest best-effort I/O").arg(niceLevel));
+    }
+    if (!cpus.isEmpty()) {
+        parts << QString("CPUs %1").arg(formatCpuList(cpus));
+    }
+    if (numaNode >= 0) {
+        parts << QString("NUMA node %1").arg(numaNode);
+    }
+    return parts.isEmpty() ? QString("normal priority") : parts.join(", ");
+}
+
+bool WorkerPriority::applyToCurrentThread(QString *error) const
+{
+    // Pool threads are reused, so this normally costs one comparison
+    if (t_applied ? t_current == *this : isDefault()) {
+        return true;
+    }
+    t_applied = true;
+    t_current = *this;
+
+    QStringList failures;
+#ifdef Q_OS_LINUX
+    const pid_t tid = pid_t(syscall(SYS_gettid));
+    if (!t_original.captured) {
+        errno = 0;
+        t_original.nice = getpriority(PRIO_PROCESS, id_t(tid));
+        if (errno != 0) {
+            t_original.nice = 0;
+        }
+        if (sched_getaffinity(tid, sizeof(cpu_set_t), &t_original.affinity) != 0) {
+            CPU_ZERO(&t_original.affinity);
+        }
+        t_original.captured = true;
+    }
+
+    // Scheduling class and nice level. With a tid both act on one thread only.
+    sched_param param{};
+    const bool idle = background && niceLevel == 0;
+    if (sched_setscheduler(tid, idle ? SCHED_IDLE : SCHED_OTHER, &param) != 0) {
+        failures << errnoString("scheduling policy");
+    }
+    if (!idle) {
+        const int nice = background ? qBound(1, niceLevel, 19) : t_original.nice;
+        if (setpriority(PRIO_PROCESS, id_t(tid), nice) != 0) {
+            failures << errnoString("nice level");
+        }
+    }
+
+    // I/O class. Zero means "derive from the nice level", the kernel default.
+    // Only schedulers that implement classes (BFQ, CFQ) act on it.
+    int ioprio = 0;
+    if (background) {
+        ioprio = idle ? IoprioClassIdle << IoprioClassShift
+                      : (IoprioClassBestEffort << IoprioClassShift) | IoprioLowestLevel;
+    }
+    if (syscall(SYS_ioprio_set, IoprioWhoProcess, tid, ioprio) != 0) {
+        failures << errnoString("I/O priority");
+    }
+
+    // CPU placement: the CPU set, narrowed to the NUMA node if there is one
+    QList<int> allowed = cpus;
+    if (numaNode >= 0) {
+        const QList<int> nodeCpus = numaNodeCpus(numaNode);
+        if (nodeCpus.isEmpty()) {
+            failures << QString("NUMA node %1 does not exist").arg(numaNode);
+        } else if (allowed.isEmpty()) {
+            allowed = nodeCpus;
+        } else {
+            allowed.erase(std::remove_if(allowed.begin(), allowed.end(),
+                                         [&](int cpu) { return !nodeCpus.contains(cpu); }),
+                          allowed.end());
+            if (allowed.isEmpty()) {
+                failures << QString("none of the CPUs are on NUMA node %1").arg(numaNode);
+            }
+        }
+    }
+    cpu_set_t set = t_original.affinity;
+    if (!allowed.isEmpty()) {
+        CPU_ZERO(&set);
+        for (int cpu : allowed) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+    }
+    if (CPU_COUNT(&set) > 0 && sched_setaffinity(tid, sizeof(set), &set) != 0) {
+        failures << errnoString("CPU affinity");
+    }
+
+    // First-touch allocation then puts the worker's buffers on its node; the
+    // preference, unlike a binding, still falls back when the node is full
+    long result;
+    if (numaNode >= 0 && numaNode < NodeMaskWords * int(8 * sizeof(unsigned long))) {
+        unsigned long mask[NodeMaskWords] = {};
+        const int bits = int(8 * sizeof(unsigned long));
+        mask[numaNode / bits] |= 1UL << (numaNode % bits);
+        result = syscall(SYS_set_mempolicy, MpolPreferred, mask, NodeMaskWords * bits + 1);
+    } else {
+        result = syscall(SYS_set_mempolicy, MpolDefault, nullptr, 0);
+    }
+    if (result != 0 && numaNode >= 0) {
+        failures << errnoString("memory policy");
+    }
+#else
+    if (!isDefault()) {
+        failures << QString("not supported on this platform");
+    }
+#endif
+
+    if (!failures.isEmpty() && error) {
+        *error = QString("Could not apply worker priority (%1): %2")
+            .arg(toString(), failures.join("; "));
+    }
+    return failures.isEmpty();
+}
+
+QList<int> WorkerPriority::parseCpuList(const QString &list, bool *ok)
+{
+    QList<int> cpus;
+    bool valid = !list.trimmed().isEmpty();
+    const QStringList parts = list.split(',', Qt::SkipEmptyParts);
+    for (const QString &part : parts) {
+        const QStringList range = part.trimmed().split('-');
+        bool firstOk = false;
+        bool lastOk = false;
+        const int first = range.value(0).toInt(&firstOk);
+        const int last = range.size() == 2 ? range.at(1).toInt(&lastOk) : first;
+        if (range.size() > 2 || !firstOk || (range.size() == 2 && !lastOk) ||
+            first < 0 || last < first || last >= MaxCpus) {
+            valid = false;
+            break;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.append(cpu);
+        }
+    }
+    if (!valid) {
+        cpus.clear();
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    if (ok) {
+        *ok = valid;
+    }
+    return cpus;
+}
+
+QList<int> WorkerPriority::numaNodeCpus(int node)
+{
+    QFile file(QString("/sys/devices/system/node/node%1/cpulist").arg(node));
+    if (node < 0 || !file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return parseCpuList(QString::fromLatin1(file.readAll()).trimmed());
+}
@@ -0,0 +1,41 @@
+#ifndef WORKERPRIORITY_H
+#define WORKERPRIORITY_H
+
+#include <QList>
+#include <QString>
+
+// How conversion worker threads are scheduled. The default leaves them alone.
+// In background mode each worker drops to SCHED_IDLE and the idle I/O class,
+// so it only gets CPU and disk time nobody else wants. With a nice level it
+// stays in normal scheduling at that level, in the lowest best-effort I/O
+// class. Workers can also be pinned to a CPU set or a NUMA node. Pinning to a
+// node also makes the worker prefer that node's memory, so its decode and
+// encode buffers are node-local.
+struct WorkerPriority {
+    bool background = false;
+    int niceLevel = 0;     // 0: SCHED_IDLE; 1-19: normal scheduling at this nice level
+    QList<int> cpus;       // Empty: any CPU
+    int numaNode = -1;     // -1: any node
+
+    bool isDefault() const { return !background && cpus.isEmpty() && numaNode < 0; }
+    QString toString() const;
+
+    bool operator==(const WorkerPriority &other) const
+    {
+        return background == other.background && niceLevel == other.niceLevel &&
+               cpus == other.cpus && numaNode == other.numaNode;
+    }
+    bool operator!=(const WorkerPriority &other) const { return !(*this == other); }
+
+    // Applies the policy to the calling thread. Cheap when the thread already
+    // runs with it. Returns false, with *error set, if any part could not be
+    // applied; the rest is still in effect. Going back to normal priority may
+    // need CAP_SYS_NICE, so a thread can stay lowered until the pool retires it.
+    bool applyToCurrentThread(QString *error = nullptr) const;
+
+    // "0-3,8,10-11" as used in /sys and by taskset -c
+    static QList<int> parseCpuList(const QString &list, bool *ok = nullptr);
+    static QList<int> numaNodeCpus(int node);
+};
+
+#endif // WORKERPRIORITY_H
@@ -2,12 +2,14 @@
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QIcon>
+#include <QDebug>
 
 using namespace Qt::StringLiterals;
 
 #include "controllers/ConversionController.h"
 #include "models/ConversionModel.h"
 #include "models/ProgressModel.h"
+#include "core/Tracer.h"
 
 int main(int argc, char *argv[])
 {
@@ -25,6 +27,14 @@ int main(int argc, char *argv[])
     // Register Style singleton
     qmlRegisterSingletonType(QUrl("qrc:/qt/qml/OpusRipperGUI/qml/theme/Style.qml"), "OpusRipperGUI", 1, 0, "Style");
     
+    // OPUS_RIPPER_TRACE=/path/trace.json records a Chrome trace of the session;
+    // OPUS_RIPPER_TRACE_LEVEL=blocks adds every frame
+    const QString tracePath = qEnvironmentVariable("OPUS_RIPPER_TRACE");
+    if (!tracePath.isEmpty()) {
+        Tracer::setLevel(qEnvironmentVariable("OPUS_RIPPER_TRACE_LEVEL") == "blocks" ? Tracer::Blocks : Tracer::Files);
+        Tracer::setThreadName("GUI");
+    }
+    
     QQmlApplicationEngine engine;
     
     // Set up import paths
@@ -38,5 +48,14 @@ int main(int argc, char *argv[])
     
     engine.load(url);
     
-    return app.exec();
+    int result = app.exec();
+    
+    if (!tracePath.isEmpty()) {
+        QString error;
+        if (!Tracer::writeChromeTrace(tracePath, &error)) {
+            qWarning().noquote() << error;
+        }
+    }
+    
+    return result;
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
 #include "ConversionModel.h"
 #include <QFileInfo>
-#include <algorithm>
+#include <utility>
+
+namespace {
+// For files whose STREAMINFO has no sample count: 16-bit stereo 44.1 kHz FLAC
+// averages around 110 kB per second of audio
+const double FallbackBytesPerAudioSecond = 110000.0;
+}
 
 ConversionModel::ConversionModel(QObject *parent)
     : QAbstractListModel(parent)
@@ -69,6 +75,7 @@ void ConversionModel::addFile(const ConversionItem &item)
     beginInsertRows(QModelIndex(), m_items.size(), m_items.size());
     m_items.append(item);
     m_pathToIndex[item.inputPath] = m_items.size() - 1;
+    countItem(m_items.size() - 1);
     endInsertRows();
     
     emit totalFilesChanged();
@@ -80,9 +87,12 @@ void ConversionModel::addFiles(const QList<ConversionItem> &items)
         return;
     
     beginInsertRows(QModelIndex(), m_items.size(), m_items.size() + items.size() - 1);
+    m_items.reserve(m_items.size() + items.size());
+    m_pathToIndex.reserve(m_items.size() + items.size());
     for (const auto &item : items) {
         m_items.append(item);
         m_pathToIndex[item.inputPath] = m_items.size() - 1;
+        countItem(m_items.size() - 1);
     }
     endInsertRows();
     
@@ -94,11 +104,15 @@ void ConversionModel::clear()
     beginResetModel();
     m_items.clear();
     m_pathToIndex.clear();
+    m_statusCounts.clear();
+    m_pendingCursor = 0;
+    m_remainingAudio = 0.0;
     endResetModel();
     
     emit totalFilesChanged();
     emit completedFilesChanged();
     emit failedFilesChanged();
+    emit skippedFilesChanged();
 }
 
 void ConversionModel::updateFileStatus(const QString &inputPath, const QString &status, int progress, const QString &error)
@@ -107,13 +121,15 @@ void ConversionModel::updateFileStatus(const QString &inputPath, const QString &
     if (index < 0)
         return;
     
-    m_items[index].status = status;
+    const double remainingBefore = remainingAudioOf(index);
+    setStatus(index, status);
     m_items[index].progress = progress;
     m_items[index].error = error;
+    accountAudio(remainingBefore, remainingAudioOf(index), status == "converting" || status == "completed");
     
     if (status == "converting") {
         m_items[index].startTime = QDateTime::currentDateTime();
-    } else if (status == "completed" || status == "failed") {
+    } else if (status == "completed" || status == "failed" || status == "skipped") {
         m_items[index].endTime = QDateTime::currentDateTime();
     }
     
@@ -125,6 +141,8 @@ void ConversionModel::updateFileStatus(const QString &inputPath, const QString &
         if (status == "failed") {
             emit failedFilesChanged();
         }
+    } else if (status == "skipped") {
+        emit skippedFilesChanged();
     }
     
     emit fileStatusChanged(inputPath, status);
@@ -136,22 +154,121 @@ void ConversionModel::updateFileProgress(const QString &inputPath, int progress)
     if (index < 0)
         return;
     
+    const double remainingBefore = remainingAudioOf(index);
     m_items[index].progress = progress;
+    const double remainingAfter = remainingAudioOf(index);
+    const bool converting = m_items.at(index).status == "converting";
+    accountAudio(remainingBefore, remainingAfter, converting);
+    // A file that starts over takes back the progress it had counted
+    if (converting && remainingAfter > remainingBefore) {
+        m_processedAudio -= remainingAfter - remainingBefore;
+    }
     
     QModelIndex modelIndex = createIndex(index, 0);
     emit dataChanged(modelIndex, modelIndex, {ProgressRole});
 }
 
+void ConversionModel::updateItem(const ConversionItem &item)
+{
+    int index = findItemIndex(item.inputPath);
+    if (index < 0)
+        return;
+    
+    const double remainingBefore = remainingAudioOf(index);
+    QString previousStatus = m_items[index].status;
+    m_items[index] = item;
+    m_items[index].status = previousStatus;
+    setStatus(index, item.status);
+    m_remainingAudio += remainingAudioOf(index) - remainingBefore;
+    
+    QModelIndex modelIndex = createIndex(index, 0);
+    emit dataChanged(modelIndex, modelIndex);
+    
+    if (previousStatus != item.status) {
+        emit completedFilesChanged();
+        emit failedFilesChanged();
+        emit skippedFilesChanged();
+        emit fileStatusChanged(item.inputPath, item.status);
+    }
+}
+
+void ConversionModel::resetStatuses()
+{
+    if (m_items.isEmpty())
+        return;
+    
+    for (auto &item : m_items) {
+        item.status = "pending";
+        item.progress = 0;
+        item.error.clear();
+        item.startTime = QDateTime();
+        item.endTime = QDateTime();
+    }
+    m_statusCounts.clear();
+    m_statusCounts.insert("pending", m_items.size());
+    m_pendingCursor = 0;
+    
+    // Recomputed outright here, which also drops any rounding drift
+    m_remainingAudio = 0.0;
+    for (const auto &item : std::as_const(m_items)) {
+        m_remainingAudio += audioSeconds(item);
+    }
+    
+    emit dataChanged(createIndex(0, 0), createIndex(m_items.size() - 1, 0));
+    emit completedFilesChanged();
+    emit failedFilesChanged();
+    emit skippedFilesChanged();
+}
+
+void ConversionModel::updateStatuses(const QList<int> &rows, const QString &status)
+{
+    // Bulk variant of updateFileStatus() with a single change notification
+    int first = m_items.size();
+    int last = -1;
+    for (int row : rows) {
+        if (row < 0 || row >= m_items.size())
+            continue;
+        const double remainingBefore = remainingAudioOf(row);
+        setStatus(row, status);
+        m_items[row].progress = 0;
+        m_items[row].error.clear();
+        accountAudio(remainingBefore, remainingAudioOf(row), status == "completed");
+        first = qMin(first, row);
+        last = qMax(last, row);
+    }
+    
+    if (last < 0)
+        return;
+    
+    emit dataChanged(createIndex(first, 0), createIndex(last, 0));
+    emit completedFilesChanged();
+    emit failedFilesChanged();
+    emit skippedFilesChanged();
+}
+
 int ConversionModel::completedFiles() const
 {
-    return std::count_if(m_items.begin(), m_items.end(),
-        [](const ConversionItem &item) { return item.status == "completed"; });
+    return m_statusCounts.value("completed");
 }
 
 int ConversionModel::failedFiles() const
 {
-    return std::count_if(m_items.begin(), m_items.end(),
-        [](const ConversionItem &item) { return item.status == "failed"; });
+    return m_statusCounts.value("failed");
+}
+
+int ConversionModel::skippedFiles() const
+{
+    return m_statusCounts.value("skipped");
+}
+
+int ConversionModel::activeFiles() const
+{
+    return m_statusCounts.value("converting");
+}
+
+int ConversionModel::pendingFiles() const
+{
+    return m_statusCounts.value("pending");
 }
 
 ConversionItem ConversionModel::getItem(int index) const
@@ -178,4 +295,71 @@ int ConversionModel::findItemIndex(const QString &inputPath) const
         return it.value();
     }
     return -1;
+}
+
+int ConversionModel::nextPendingIndex() const
+{
+    while (m_pendingCursor < m_items.size() && m_items.at(m_pendingCursor).status != "pending") {
+        ++m_pendingCursor;
+    }
+    return m_pendingCursor < m_items.size() ? m_pendingCursor : -1;
+}
+
+int ConversionModel::nextPendingIndex(int after) const
+{
+    for (int i = qMax(after + 1, m_pendingCursor); i < m_items.size(); ++i) {
+        if (m_items.at(i).status == "pending") {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ConversionModel::setStatus(int index, const QString &status)
+{
+    QString &current = m_items[index].status;
+    if (current == status)
+        return;
+    
+    m_statusCounts[current]--;
+    m_statusCounts[status]++;
+    current = status;
+    
+    if (status == "pending") {
+        m_pendingCursor = qMin(m_pendingCursor, index);
+    }
+}
+
+double ConversionModel::audioSeconds(const ConversionItem &item)
+{
+    const double duration = item.streamInfo.durationSeconds();
+    return duration > 0.0 ? duration : item.fileSize / FallbackBytesPerAudioSecond;
+}
+
+double ConversionModel::remainingAudioOf(int index) const
+{
+    const ConversionItem &item = m_items.at(index);
+    if (item.status != "pending" && item.status != "converting") {
+        return 0.0;
+    }
+    return audioSeconds(item) * (100 - qBound(0, item.progress, 100)) / 100.0;
+}
+
+void ConversionModel::accountAudio(double before, double after, bool converted)
+{
+    // Rows going back to pending add work without undoing what was counted as done
+    m_remainingAudio += after - before;
+    if (converted && after < before) {
+        m_processedAudio += before - after;
+    }
+}
+
+void ConversionModel::countItem(int index)
+{
+    m_remainingAudio += remainingAudioOf(index);
+    const QString &status = m_items.at(index).status;
+    m_statusCounts[status]++;
+    if (status == "pending") {
+        m_pendingCursor = qMin(m_pendingCursor, index);
+    }
 }
\ No newline at end of file
@@ -7,17 +7,26 @@
 #include <QList>
 #include <memory>
 
+#include "core/LibraryIndex.h"
+
 struct ConversionItem {
     QString inputPath;
     QString outputPath;
     QString fileName;
     QString relativePath;
     qint64 fileSize = 0;
-    QString status = "pending"; // pending, converting, completed, failed
+    QDateTime lastModified;
+    ConversionOutcome lastOutcome = ConversionOutcome::Unknown; // From the library index
+    FlacStreamInfo streamInfo;
+    QString cueSheetPath;       // Sidecar .cue of an album image
+    QString status = "pending"; // pending, converting, completed, failed, skipped
     int progress = 0;
     QString error;
     QDateTime startTime;
     QDateTime endTime;
+    
+    // Split into one output per track, in a directory at outputPath
+    bool isAlbumImage() const { return streamInfo.hasCueSheet || !cueSheetPath.isEmpty(); }
 };
 
 class ConversionModel : public QAbstractListModel
@@ -26,6 +35,7 @@ class ConversionModel : public QAbstractListModel
     Q_PROPERTY(int totalFiles READ totalFiles NOTIFY totalFilesChanged)
     Q_PROPERTY(int completedFiles READ completedFiles NOTIFY completedFilesChanged)
     Q_PROPERTY(int failedFiles READ failedFiles NOTIFY failedFilesChanged)
+    Q_PROPERTY(int skippedFiles READ skippedFiles NOTIFY skippedFilesChanged)
     
 public:
     enum ConversionRoles {
@@ -55,25 +65,57 @@ public:
     void clear();
     void updateFileStatus(const QString &inputPath, const QString &status, int progress = 0, const QString &error = QString());
     void updateFileProgress(const QString &inputPath, int progress);
+    void resetStatuses();
+    void updateStatuses(const QList<int> &rows, const QString &status);
+    void updateItem(const ConversionItem &item);
     
     // Getters
     int totalFiles() const { return m_items.size(); }
     int completedFiles() const;
     int failedFiles() const;
+    int skippedFiles() const;
+    int activeFiles() const;
+    int pendingFiles() const;
     ConversionItem getItem(int index) const;
     ConversionItem getItemByPath(const QString &inputPath) const;
     
+    // Audio still to convert in pending and converting rows, net of their
+    // progress, and a running total of audio actually converted. Failed and
+    // skipped rows leave the first without adding to the second, so they
+    // don't inflate the rate. Both are kept up to date incrementally, so they
+    // are O(1) to read.
+    double remainingAudioSeconds() const { return qMax(0.0, m_remainingAudio); }
+    double processedAudioSeconds() const { return m_processedAudio; }
+    static double audioSeconds(const ConversionItem &item);
+    
+    // First row still pending, or -1. Amortized O(1) while rows are taken in order.
+    int nextPendingIndex() const;
+    // First row after the given one that is still pending, or -1. Costs the rows skipped.
+    int nextPendingIndex(int after) const;
+    
 signals:
     void totalFilesChanged();
     void completedFilesChanged();
     void failedFilesChanged();
+    void skippedFilesChanged();
     void fileStatusChanged(const QString &inputPath, const QString &status);
     
 private:
     QList<ConversionItem> m_items;
     QHash<QString, int> m_pathToIndex; // For quick lookup by path
     
+    // Rows per status, kept in step with every status change so the counters
+    // don't rescan the list on each dataChanged
+    QHash<QString, int> m_statusCounts;
+    mutable int m_pendingCursor = 0; // No row before this one is pending
+    double m_remainingAudio = 0.0;
+    double m_processedAudio = 0.0;
+    
     int findItemIndex(const QString &inputPath) const;
+    void setStatus(int index, const QString &status);
+    void countItem(int index);
+    double remainingAudioOf(int index) const;
+    void accountAudio(double before, double after, bool converted);
 };
 
 #endif // CONVERSIONMODEL_H
\ No newline at end of file
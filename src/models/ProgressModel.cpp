@@ -1,5 +1,6 @@
 #include "ProgressModel.h"
 #include "ConversionModel.h"
+#include "core/ConversionMetrics.h"
 #include <QVariantMap>
 #include <QFileInfo>
 #include <QtMath>
@@ -27,7 +28,15 @@ void ProgressModel::setConversionModel(ConversionModel *model)
         connect(m_conversionModel, &ConversionModel::totalFilesChanged, this, &ProgressModel::totalFilesChanged);
         connect(m_conversionModel, &ConversionModel::completedFilesChanged, this, &ProgressModel::filesCompletedChanged);
         connect(m_conversionModel, &ConversionModel::failedFilesChanged, this, &ProgressModel::filesFailedChanged);
+        connect(m_conversionModel, &ConversionModel::skippedFilesChanged, this, &ProgressModel::filesSkippedChanged);
+        connect(m_conversionModel, &ConversionModel::modelReset, this, [this]() {
+            // A new scan; the last batch's audio totals no longer apply
+            m_audioClock.invalidate();
+            calculateProgress();
+        });
     }
+    
+    emit fileListChanged();
 }
 
 QString ProgressModel::timeElapsed() const
@@ -42,39 +51,28 @@ QString ProgressModel::timeElapsed() const
 
 QString ProgressModel::timeRemaining() const
 {
-    if (!m_isConverting || m_overallProgress <= 0) {
-        return QString();
-    }
-    
-    int elapsed = m_startTime.secsTo(QDateTime::currentDateTime());
-    if (elapsed <= 0 || m_overallProgress <= 0) {
-        return QString();
-    }
-    
-    int total = qRound(elapsed / m_overallProgress);
-    int remaining = total - elapsed;
-    
-    return formatTime(remaining);
+    const double eta = etaSeconds();
+    return eta >= 0 ? formatTime(qRound(eta)) : QString();
 }
 
-QVariantList ProgressModel::fileList() const
+double ProgressModel::etaSeconds() const
 {
-    QVariantList list;
-    
-    if (!m_conversionModel) {
-        return list;
-    }
-    
-    for (int i = 0; i < m_conversionModel->rowCount(); ++i) {
-        QVariantMap item;
-        item["fileName"] = m_conversionModel->data(m_conversionModel->index(i), ConversionModel::FileNameRole);
-        item["status"] = m_conversionModel->data(m_conversionModel->index(i), ConversionModel::StatusRole);
-        item["progress"] = m_conversionModel->data(m_conversionModel->index(i), ConversionModel::ProgressRole);
-        item["error"] = m_conversionModel->data(m_conversionModel->index(i), ConversionModel::ErrorRole);
-        list.append(item);
+    if (!m_isConverting || !m_conversionModel || m_audioRatePerWorker <= 0.0) {
+        return -1.0;
     }
     
-    return list;
+    // Near the end there are fewer files left than workers, and the ones that
+    // are left don't speed up to use the idle threads
+    const int filesLeft = m_conversionModel->pendingFiles() + m_conversionModel->activeFiles();
+    const int workers = qMax(1, qMin(m_workerCount, filesLeft));
+    return m_conversionModel->remainingAudioSeconds() / (m_audioRatePerWorker * workers);
+}
+
+QAbstractItemModel *ProgressModel::fileList() const
+{
+    // The view binds to the list model itself and only repaints changed rows;
+    // a QVariantList snapshot had to be rebuilt for every status change
+    return m_conversionModel;
 }
 
 void ProgressModel::startConversion()
@@ -82,6 +80,8 @@ void ProgressModel::startConversion()
     m_startTime = QDateTime::currentDateTime();
     m_isConverting = true;
     m_updateTimer->start();
+    sampleAudioRate(true);
+    sampleMetrics(true);
     
     emit isConvertingChanged();
     emit timeElapsedChanged();
@@ -91,6 +91,7 @@ void ProgressModel::stopConversion()
 {
     m_isConverting = false;
     m_updateTimer->stop();
+    sampleMetrics(false);
     
     emit isConvertingChanged();
 }
@@ -100,6 +101,7 @@ void ProgressModel::reset()
     m_totalFiles = 0;
     m_filesCompleted = 0;
     m_filesFailed = 0;
+    m_filesSkipped = 0;
     m_overallProgress = 0.0;
     m_currentFile.clear();
     m_currentFileProgress = 0.0;
@@ -107,12 +109,15 @@ void ProgressModel::reset()
     m_conversionTimes.clear();
     m_totalBytesProcessed = 0;
     m_totalBytesToProcess = 0;
+    m_audioClock.invalidate();
+    m_audioRatePerWorker = 0.0;
     
     m_updateTimer->stop();
     
     emit totalFilesChanged();
     emit filesCompletedChanged();
     emit filesFailedChanged();
+    emit filesSkippedChanged();
     emit overallProgressChanged();
     emit currentFileChanged();
     emit currentFileProgressChanged();
@@ -139,6 +144,15 @@ void ProgressModel::updateFileStatus(const QString &filePath, const QString &sta
     calculateProgress();
 }
 
+void ProgressModel::setMemoryUsage(qint64 usedBytes, qint64 peakBytes, qint64 budgetBytes)
+{
+    const double megabyte = 1024.0 * 1024.0;
+    m_memoryInUseMB = usedBytes / megabyte;
+    m_memoryPeakMB = peakBytes / megabyte;
+    m_memoryBudgetMB = budgetBytes / megabyte;
+    emit memoryUsageChanged();
+}
+
 void ProgressModel::setCurrentFile(const QString &filePath)
 {
     QFileInfo info(filePath);
@@ -148,8 +162,113 @@ void ProgressModel::setCurrentFile(const QString &filePath)
 
 void ProgressModel::updateTimes()
 {
+    sampleAudioRate(false);
     emit timeElapsedChanged();
     emit timeRemainingChanged();
+    sampleMetrics(false);
+}
+
+void ProgressModel::sampleAudioRate(bool resetBaseline)
+{
+    if (!m_conversionModel) {
+        return;
+    }
+    
+    const double processed = m_conversionModel->processedAudioSeconds();
+    if (resetBaseline || !m_audioClock.isValid()) {
+        m_audioClock.start();
+        m_lastAudioSampleMs = 0;
+        m_processedAudioBaseline = processed;
+        m_lastProcessedAudio = processed;
+        m_audioRatePerWorker = 0.0;
+        calculateProgress();
+        return;
+    }
+    
+    const qint64 nowMs = m_audioClock.elapsed();
+    const double seconds = (nowMs - m_lastAudioSampleMs) / 1000.0;
+    const int active = m_conversionModel->activeFiles();
+    if (seconds <= 0.0) {
+        return;
+    }
+    
+    // Paused or idle intervals say nothing about conversion speed
+    if (active > 0) {
+        const double timeConstant = 20.0;
+        const double alpha = 1.0 - qExp(-seconds / timeConstant);
+        const double rate = (processed - m_lastProcessedAudio) / seconds / active;
+        m_audioRatePerWorker = m_audioRatePerWorker > 0.0
+            ? m_audioRatePerWorker + alpha * (rate - m_audioRatePerWorker)
+            : rate;
+    }
+    m_lastAudioSampleMs = nowMs;
+    m_lastProcessedAudio = processed;
+    calculateProgress();
+}
+
+void ProgressModel::sampleMetrics(bool resetBaseline)
+{
+    if (!m_metrics) {
+        return;
+    }
+    
+    MetricsSample sample;
+    sample.timeNs = m_metrics->now();
+    sample.audioSeconds = m_metrics->audioSeconds();
+    sample.bytesRead = m_metrics->bytesRead();
+    sample.bytesWritten = m_metrics->bytesWritten();
+    for (int slot = 0; slot < m_metrics->workerSlots(); ++slot) {
+        sample.workerBusyNs.push_back(m_metrics->workerBusyNs(slot));
+    }
+    
+    if (resetBaseline) {
+        m_lastSample = sample;
+        m_realtimeFactor = m_readMBps = m_writeMBps = m_averageUtilization = 0.0;
+        m_workerUtilization.clear();
+        m_stageLatencies.clear();
+        emit metricsChanged();
+        return;
+    }
+    
+    const double seconds = (sample.timeNs - m_lastSample.timeNs) / 1e9;
+    if (seconds <= 0.0) {
+        return;
+    }
+    
+    // Files finish in bursts, so one-second rates are smoothed a little
+    const double alpha = 0.3;
+    auto smooth = [alpha](double previous, double current) {
+        return previous > 0.0 ? previous + alpha * (current - previous) : current;
+    };
+    m_realtimeFactor = smooth(m_realtimeFactor, (sample.audioSeconds - m_lastSample.audioSeconds) / seconds);
+    m_readMBps = smooth(m_readMBps, (sample.bytesRead - m_lastSample.bytesRead) / seconds / 1e6);
+    m_writeMBps = smooth(m_writeMBps, (sample.bytesWritten - m_lastSample.bytesWritten) / seconds / 1e6);
+    
+    // Busy time only counts while a worker holds a file, so idle pool threads read 0
+    m_workerUtilization.clear();
+    qint64 busyTotal = 0;
+    for (size_t slot = 0; slot < sample.workerBusyNs.size(); ++slot) {
+        qint64 previous = slot < m_lastSample.workerBusyNs.size() ? m_lastSample.workerBusyNs[slot] : 0;
+        qint64 busy = qMax<qint64>(0, sample.workerBusyNs[slot] - previous);
+        busyTotal += busy;
+        m_workerUtilization.append(qMin(1.0, busy / 1e9 / seconds));
+    }
+    m_averageUtilization = qMin(1.0, busyTotal / 1e9 / seconds / m_workerCount);
+    
+    m_stageLatencies.clear();
+    for (int stage = 0; stage < ConversionMetrics::StageCount; ++stage) {
+        const LatencyHistogram &histogram = m_metrics->stage(ConversionMetrics::Stage(stage));
+        QVariantMap entry;
+        entry["stage"] = QString(ConversionMetrics::stageName(ConversionMetrics::Stage(stage)));
+        entry["count"] = histogram.count();
+        entry["p50"] = histogram.percentile(50) / 1e6;
+        entry["p95"] = histogram.percentile(95) / 1e6;
+        entry["p99"] = histogram.percentile(99) / 1e6;
+        m_stageLatencies.append(entry);
+    }
+    
+    m_lastSample = sample;
+    emit metricsChanged();
 }
 
 void ProgressModel::onModelDataChanged()
@@ -158,16 +277,23 @@ void ProgressModel::onModelDataChanged()
         m_totalFiles = m_conversionModel->totalFiles();
         m_filesCompleted = m_conversionModel->completedFiles();
         m_filesFailed = m_conversionModel->failedFiles();
+        m_filesSkipped = m_conversionModel->skippedFiles();
         
         calculateProgress();
-        emit fileListChanged();
     }
 }
 
 void ProgressModel::calculateProgress()
 {
-    if (m_totalFiles > 0) {
-        m_overallProgress = static_cast<double>(m_filesCompleted + m_filesFailed) / m_totalFiles;
+    // Share of this batch's audio that is done, including the running files'
+    // progress; falls back to counting files before a batch has started
+    const double processed = m_conversionModel
+        ? m_conversionModel->processedAudioSeconds() - m_processedAudioBaseline : 0.0;
+    const double remaining = m_conversionModel ? m_conversionModel->remainingAudioSeconds() : 0.0;
+    if (m_audioClock.isValid() && processed + remaining > 0.0) {
+        m_overallProgress = qBound(0.0, processed / (processed + remaining), 1.0);
+    } else if (m_totalFiles > 0) {
+        m_overallProgress = static_cast<double>(m_filesCompleted + m_filesFailed + m_filesSkipped) / m_totalFiles;
     } else {
         m_overallProgress = 0.0;
     }
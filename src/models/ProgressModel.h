@@ -2,12 +2,16 @@
 #define PROGRESSMODEL_H
 
 #include <QObject>
+#include <QAbstractItemModel>
 #include <QTimer>
 #include <QDateTime>
-#include <QVariantList>
+#include <QElapsedTimer>
 #include <QList>
+#include <QVariantList>
+#include <vector>
 
 class ConversionModel;
+class ConversionMetrics;
 
 class ProgressModel : public QObject
 {
@@ -15,13 +19,28 @@ class ProgressModel : public QObject
     Q_PROPERTY(int totalFiles READ totalFiles NOTIFY totalFilesChanged)
     Q_PROPERTY(int filesCompleted READ filesCompleted NOTIFY filesCompletedChanged)
     Q_PROPERTY(int filesFailed READ filesFailed NOTIFY filesFailedChanged)
+    Q_PROPERTY(int filesSkipped READ filesSkipped NOTIFY filesSkippedChanged)
     Q_PROPERTY(double overallProgress READ overallProgress NOTIFY overallProgressChanged)
     Q_PROPERTY(QString currentFile READ currentFile NOTIFY currentFileChanged)
     Q_PROPERTY(double currentFileProgress READ currentFileProgress NOTIFY currentFileProgressChanged)
     Q_PROPERTY(bool isConverting READ isConverting NOTIFY isConvertingChanged)
     Q_PROPERTY(QString timeElapsed READ timeElapsed NOTIFY timeElapsedChanged)
     Q_PROPERTY(QString timeRemaining READ timeRemaining NOTIFY timeRemainingChanged)
-    Q_PROPERTY(QVariantList fileList READ fileList NOTIFY fileListChanged)
+    Q_PROPERTY(double etaSeconds READ etaSeconds NOTIFY timeRemainingChanged)
+    Q_PROPERTY(QAbstractItemModel* fileList READ fileList NOTIFY fileListChanged)
+    
+    // Live throughput, refreshed with the timers while converting
+    Q_PROPERTY(double realtimeFactor READ realtimeFactor NOTIFY metricsChanged)
+    Q_PROPERTY(double readMBps READ readMBps NOTIFY metricsChanged)
+    Q_PROPERTY(double writeMBps READ writeMBps NOTIFY metricsChanged)
+    Q_PROPERTY(double averageUtilization READ averageUtilization NOTIFY metricsChanged)
+    Q_PROPERTY(QVariantList workerUtilization READ workerUtilization NOTIFY metricsChanged)
+    Q_PROPERTY(QVariantList stageLatencies READ stageLatencies NOTIFY metricsChanged)
+    
+    // Estimated memory of the admitted jobs against the budget; 0 budget is unlimited
+    Q_PROPERTY(double memoryInUseMB READ memoryInUseMB NOTIFY memoryUsageChanged)
+    Q_PROPERTY(double memoryPeakMB READ memoryPeakMB NOTIFY memoryUsageChanged)
+    Q_PROPERTY(double memoryBudgetMB READ memoryBudgetMB NOTIFY memoryUsageChanged)
     
 public:
     explicit ProgressModel(QObject *parent = nullptr);
@@ -29,17 +48,35 @@ public:
     
     void setConversionModel(ConversionModel *model);
     
+    // Not owned; workers record into it while the model samples it every second
+    void setMetrics(const ConversionMetrics *metrics) { m_metrics = metrics; }
+    void setWorkerCount(int count) { m_workerCount = qMax(1, count); }
+    
     // Properties
     int totalFiles() const { return m_totalFiles; }
     int filesCompleted() const { return m_filesCompleted; }
     int filesFailed() const { return m_filesFailed; }
+    int filesSkipped() const { return m_filesSkipped; }
     double overallProgress() const { return m_overallProgress; }
     QString currentFile() const { return m_currentFile; }
     double currentFileProgress() const { return m_currentFileProgress; }
     bool isConverting() const { return m_isConverting; }
     QString timeElapsed() const;
     QString timeRemaining() const;
-    QVariantList fileList() const;
+    double etaSeconds() const; // -1 until the conversion rate is known
+    QAbstractItemModel *fileList() const;
+    
+    double realtimeFactor() const { return m_realtimeFactor; }
+    double readMBps() const { return m_readMBps; }
+    double writeMBps() const { return m_writeMBps; }
+    double averageUtilization() const { return m_averageUtilization; }
+    QVariantList workerUtilization() const { return m_workerUtilization; }
+    QVariantList stageLatencies() const { return m_stageLatencies; }
+    
+    double memoryInUseMB() const { return m_memoryInUseMB; }
+    double memoryPeakMB() const { return m_memoryPeakMB; }
+    double memoryBudgetMB() const { return m_memoryBudgetMB; }
+    void setMemoryUsage(qint64 usedBytes, qint64 peakBytes, qint64 budgetBytes);
     
     // Control methods
     void startConversion();
@@ -55,6 +92,7 @@ signals:
     void totalFilesChanged();
     void filesCompletedChanged();
     void filesFailedChanged();
+    void filesSkippedChanged();
     void overallProgressChanged();
     void currentFileChanged();
     void currentFileProgressChanged();
@@ -62,6 +100,8 @@ signals:
     void timeElapsedChanged();
     void timeRemainingChanged();
     void fileListChanged();
+    void metricsChanged();
+    void memoryUsageChanged();
     
 private slots:
     void updateTimes();
@@ -73,6 +113,7 @@ private:
     int m_totalFiles = 0;
     int m_filesCompleted = 0;
     int m_filesFailed = 0;
+    int m_filesSkipped = 0;
     double m_overallProgress = 0.0;
     QString m_currentFile;
     double m_currentFileProgress = 0.0;
@@ -86,7 +127,40 @@ private:
     qint64 m_totalBytesProcessed = 0;
     qint64 m_totalBytesToProcess = 0;
     
+    // Progress and ETA are measured in audio rather than files. The rate is
+    // audio seconds converted per busy worker per second, smoothed with a
+    // time-based exponential average so a burst of short tracks or one long
+    // one doesn't swing the estimate.
+    double m_processedAudioBaseline = 0.0;
+    double m_lastProcessedAudio = 0.0;
+    qint64 m_lastAudioSampleMs = 0;
+    double m_audioRatePerWorker = 0.0;
+    QElapsedTimer m_audioClock;
+    
+    // Throughput sampling; rates are over the last interval, lightly smoothed
+    struct MetricsSample {
+        qint64 timeNs = 0;
+        double audioSeconds = 0.0;
+        qint64 bytesRead = 0;
+        qint64 bytesWritten = 0;
+        std::vector<qint64> workerBusyNs;
+    };
+    const ConversionMetrics *m_metrics = nullptr;
+    int m_workerCount = 1;
+    MetricsSample m_lastSample;
+    double m_realtimeFactor = 0.0;
+    double m_readMBps = 0.0;
+    double m_writeMBps = 0.0;
+    double m_averageUtilization = 0.0;
+    QVariantList m_workerUtilization;
+    QVariantList m_stageLatencies;
+    double m_memoryInUseMB = 0.0;
+    double m_memoryPeakMB = 0.0;
+    double m_memoryBudgetMB = 0.0;
+    
     void calculateProgress();
+    void sampleAudioRate(bool resetBaseline);
+    void sampleMetrics(bool resetBaseline);
     void updateFileList();
     QString formatTime(int seconds) const;
 };
@@ -0,0 +1,253 @@
+#include "MetricsExporter.h"
+#include "SocketUtils.h"
+#include "core/ConversionMetrics.h"
+#include <QSaveFile>
+#include <QSocketNotifier>
+
+namespace {
+const int MaxRequestHeadSize = 8192;
+const int RequestTimeoutSeconds = 5;
+
+// Appends one metric family in the exposition format
+class MetricWriter
+{
+public:
+    explicit MetricWriter(QByteArray &out) : m_out(out) {}
+
+    void family(const char *name, const char *type, const char *help)
+    {
+        m_out += QByteArray("# HELP ") + name + ' ' + help + "\n# TYPE " + name + ' ' + type + '\n';
+    }
+
+    void sample(const QByteArray &name, double value, const QByteArray &labels = QByteArray())
+    {
+        m_out += name;
+        if (!labels.isEmpty()) {
+            m_out += '{' + labels + '}';
+        }
+        m_out += ' ' + QByteArray::number(value, 'g', 15) + '\n';
+    }
+
+    void metric(const char *name, const char *type, const char *help, double value)
+    {
+        family(name, type, help);
+        sample(name, value);
+    }
+
+    // Summary with the usual quantiles, values in seconds
+    void summary(const QByteArray &name, const LatencyHistogram &histogram, const QByteArray &labels = QByteArray())
+    {
+        const QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+        for (double quantile : {0.5, 0.9, 0.99}) {
+            sample(name, histogram.percentile(quantile * 100) / 1e9,
+                   prefix + "quantile=\"" + QByteArray::number(quantile) + '"');
+        }
+        sample(name + "_sum", histogram.sumNs() / 1e9, labels);
+        sample(name + "_count", double(histogram.count()), labels);
+    }
+
+private:
+    QByteArray &m_out;
+};
+
+#ifdef Q_OS_UNIX
+void sendResponse(int fd, const char *status, const QByteArray &contentType, const QByteArray &body, bool headOnly)
+{
+    QByteArray response = QByteArray("HTTP/1.1 ") + status + "\r\n"
+        "Content-Type: " + contentType + "\r\n"
+        "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n";
+    if (!headOnly) {
+        response += body;
+    }
+    sendAll(fd, response);
+}
+#endif
+}
+
+MetricsExporter::MetricsExporter(const ConversionMetrics *metrics, QObject *parent)
+    : QObject(parent)
+    , m_metrics(metrics)
+{
+    // Scrapes are tiny; one thread keeps a stalled client from touching the event loop
+    m_threadPool.setMaxThreadCount(1);
+    connect(&m_textfileTimer, &QTimer::timeout, this, &MetricsExporter::writeTextfile);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    close();
+    if (!m_textfilePath.isEmpty()) {
+        writeTextfile();
+    }
+}
+
+bool MetricsExporter::listen(const QString &address, quint16 port)
+{
+    close();
+
+#ifdef Q_OS_UNIX
+    int fd = openListenSocket(address, port, &m_port, &m_lastError);
+    if (fd < 0) {
+        return false;
+    }
+
+    m_listenFd = fd;
+    m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &MetricsExporter::acceptConnections);
+    return true;
+#else
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    m_lastError = "The metrics endpoint requires POSIX sockets";
+    return false;
+#endif
+}
+
+void MetricsExporter::close()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+
+#ifdef Q_OS_UNIX
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+    }
+#endif
+    m_listenFd = -1;
+
+    m_threadPool.waitForDone();
+}
+
+bool MetricsExporter::startTextfile(const QString &path, int intervalMs)
+{
+    m_textfilePath = path;
+    if (!writeTextfile()) {
+        m_textfilePath.clear();
+        return false;
+    }
+    m_textfileTimer.start(intervalMs);
+    return true;
+}
+
+bool MetricsExporter::writeTextfile()
+{
+    // The collector may read at any moment, so the file is replaced by rename
+    QSaveFile file(m_textfilePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(render()) < 0 || !file.commit()) {
+        m_lastError = QString("Failed to write metrics to %1: %2").arg(m_textfilePath, file.errorString());
+        return false;
+    }
+    return true;
+}
+
+QByteArray MetricsExporter::render() const
+{
+    QByteArray out;
+    MetricWriter writer(out);
+
+    writer.metric("opus_ripper_jobs_pending", "gauge",
+                  "Files waiting for a conversion worker.", m_metrics->jobsPending());
+    writer.metric("opus_ripper_jobs_active", "gauge",
+                  "Files being converted right now.", m_metrics->jobsActive());
+    writer.metric("opus_ripper_jobs_completed_total", "counter",
+                  "Files converted successfully.", double(m_metrics->filesRecorded()));
+    writer.metric("opus_ripper_jobs_failed_total", "counter",
+                  "Files whose conversion failed.", double(m_metrics->jobsFailed()));
+    writer.metric("opus_ripper_audio_seconds_total", "counter",
+                  "Seconds of audio in converted files.", m_metrics->audioSeconds());
+    writer.metric("opus_ripper_input_bytes_total", "counter",
+                  "FLAC bytes of converted files.", double(m_metrics->bytesRead()));
+    writer.metric("opus_ripper_output_bytes_total", "counter",
+                  "Opus bytes written.", double(m_metrics->bytesWritten()));
+    writer.metric("opus_ripper_encoder_cpu_seconds_total", "counter",
+                  "CPU time of conversion workers.", m_metrics->cpuSeconds());
+
+    writer.metric("opus_ripper_scans_total", "counter",
+                  "Completed library scans.", double(m_metrics->scans()));
+    writer.metric("opus_ripper_scanned_files_total", "counter",
+                  "FLAC files found by all scans.", double(m_metrics->filesScanned()));
+    writer.metric("opus_ripper_scan_duration_seconds_total", "counter",
+                  "Wall time spent scanning.", m_metrics->scanSeconds());
+    writer.metric("opus_ripper_last_scan_files_per_second", "gauge",
+                  "Scan rate of the most recent scan.", m_metrics->lastScanRate());
+
+    writer.family("opus_ripper_queue_latency_seconds", "summary",
+                  "Time from dispatch until a worker picks the file up.");
+    writer.summary("opus_ripper_queue_latency_seconds", m_metrics->lifetimeQueueLatency());
+
+    writer.family("opus_ripper_stage_duration_seconds", "summary",
+                  "Time per file spent in each conversion stage.");
+    for (int stage = 0; stage < ConversionMetrics::StageCount; ++stage) {
+        writer.summary("opus_ripper_stage_duration_seconds",
+                       m_metrics->lifetimeStage(ConversionMetrics::Stage(stage)),
+                       QByteArray("stage=\"") + ConversionMetrics::stageName(ConversionMetrics::Stage(stage)) + '"');
+    }
+
+    writer.family("opus_ripper_worker_busy_seconds_total", "counter",
+                  "Time each worker thread spent converting.");
+    for (int slot = 0; slot < m_metrics->workerSlots(); ++slot) {
+        writer.sample("opus_ripper_worker_busy_seconds_total", m_metrics->workerBusyNs(slot) / 1e9,
+                      "worker=\"" + QByteArray::number(slot) + '"');
+    }
+
+    return out;
+}
+
+void MetricsExporter::acceptConnections()
+{
+#ifdef Q_OS_UNIX
+    for (;;) {
+        int fd = ::accept(m_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        m_threadPool.start([this, fd]() { handleConnection(fd); });
+    }
+#endif
+}
+
+void MetricsExporter::handleConnection(int fd)
+{
+#ifdef Q_OS_UNIX
+    timeval timeout = {RequestTimeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    QByteArray head;
+    char buffer[1024];
+    while (!head.contains("\r\n\r\n") && head.size() < MaxRequestHeadSize) {
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            ::close(fd);
+            return;
+        }
+        head.append(buffer, int(received));
+    }
+
+    const QList<QByteArray> requestLine = head.left(head.indexOf("\r\n")).split(' ');
+    const QByteArray method = requestLine.value(0);
+    const QByteArray path = requestLine.value(1).split('?').value(0);
+    const bool headOnly = method == "HEAD";
+
+    if (method != "GET" && !headOnly) {
+        sendResponse(fd, "405 Method Not Allowed", "text/plain", "Method Not Allowed\n", false);
+    } else if (path != "/metrics") {
+        sendResponse(fd, "404 Not Found", "text/plain", "Not Found\n", headOnly);
+    } else {
+        sendResponse(fd, "200 OK", "text/plain; version=0.0.4; charset=utf-8", render(), headOnly);
+    }
+    ::close(fd);
+#else
+    Q_UNUSED(fd)
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+class QSocketNotifier;
+class ConversionMetrics;
+
+// Publishes ConversionMetrics in the Prometheus text format, either on an
+// HTTP endpoint (GET /metrics) or as a file for node_exporter's textfile
+// collector. Rendering only loads atomics, so scrapes never hold up workers.
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsExporter(const ConversionMetrics *metrics, QObject *parent = nullptr);
+    ~MetricsExporter();
+
+    bool listen(const QString &address, quint16 port);
+    void close();
+    quint16 serverPort() const { return m_port; }
+
+    // Rewrite path atomically now and then every intervalMs, and once more on destruction
+    bool startTextfile(const QString &path, int intervalMs = 15000);
+
+    QString getLastError() const { return m_lastError; }
+
+    QByteArray render() const;
+
+private slots:
+    void acceptConnections();
+    bool writeTextfile();
+
+private:
+    const ConversionMetrics *m_metrics;
+    QString m_lastError;
+
+    int m_listenFd = -1;
+    quint16 m_port = 0;
+    QSocketNotifier *m_notifier = nullptr;
+    QThreadPool m_threadPool;   // Reads requests off the event loop
+
+    QString m_textfilePath;
+    QTimer m_textfileTimer;
+
+    void handleConnection(int fd);
+};
+
+#endif // METRICSEXPORTER_H
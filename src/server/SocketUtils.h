@@ -0,0 +1,89 @@
+#ifndef SOCKETUTILS_H
+#define SOCKETUTILS_H
+
+#include <QByteArray>
+#include <QString>
+
+#ifdef Q_OS_UNIX
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Blocking send of the whole buffer; false once the peer is gone
+inline bool sendAll(int fd, const char *data, qint64 length)
+{
+    while (length > 0) {
+        ssize_t sent = ::send(fd, data, size_t(length), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+inline bool sendAll(int fd, const QByteArray &data)
+{
+    return sendAll(fd, data.constData(), data.size());
+}
+
+// Non-blocking, close-on-exec listening TCP socket on a numeric IPv4 or IPv6
+// address. Returns the fd and the bound port (useful for port 0), or -1.
+inline int openListenSocket(const QString &address, quint16 port, quint16 *boundPort, QString *error)
+{
+    sockaddr_storage storage = {};
+    socklen_t length = 0;
+    QByteArray host = address.toLatin1();
+
+    sockaddr_in *ipv4 = reinterpret_cast<sockaddr_in*>(&storage);
+    sockaddr_in6 *ipv6 = reinterpret_cast<sockaddr_in6*>(&storage);
+    if (inet_pton(AF_INET, host.constData(), &ipv4->sin_addr) == 1) {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(port);
+        length = sizeof(sockaddr_in);
+    } else if (inet_pton(AF_INET6, host.constData(), &ipv6->sin6_addr) == 1) {
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(port);
+        length = sizeof(sockaddr_in6);
+    } else {
+        *error = QString("Invalid listen address: %1").arg(address);
+        return -1;
+    }
+
+    int fd = ::socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        *error = QString("Failed to create socket: %1").arg(strerror(errno));
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0 || ::listen(fd, 128) != 0) {
+        *error = QString("Failed to listen on %1:%2: %3").arg(address).arg(port).arg(strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+
+    // Report the real port when an ephemeral one was requested
+    getsockname(fd, reinterpret_cast<sockaddr*>(&storage), &length);
+    *boundPort = ntohs(storage.ss_family == AF_INET ? ipv4->sin_port : ipv6->sin6_port);
+    return fd;
+}
+#endif
+
+#endif // SOCKETUTILS_H
@@ -0,0 +1,411 @@
+#include "TranscodeServer.h"
+#include "SocketUtils.h"
+#include "core/OpusEncoder.h"
+#include "core/OutputCache.h"
+#include "core/FileScanner.h"
+#include "core/FlacStreamInfo.h"
+#include "core/ThreadCpuTime.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QRunnable>
+#include <QSocketNotifier>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QUrl>
+#include <QUrlQuery>
+
+#ifdef Q_OS_UNIX
+#include <netinet/tcp.h>
+#endif
+
+namespace {
+const int MaxRequestHeadSize = 8192;
+const int RequestTimeoutSeconds = 5;
+// A client that stops reading for this long gives its worker back
+const int SendTimeoutSeconds = 30;
+
+#ifdef Q_OS_UNIX
+void sendStatus(int fd, int status, const char *reason, const QByteArray &extraHeaders = QByteArray())
+{
+    QByteArray body = QByteArray(reason) + "\n";
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(status) + ' ' + reason + "\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+        + extraHeaders +
+        "Connection: close\r\n\r\n" + body;
+    sendAll(fd, response);
+}
+
+// Sink for OggOpusWriter: every page becomes one HTTP chunk in a single send,
+// optionally teed into a file for the output cache
+class ResponseDevice : public QIODevice
+{
+public:
+    ResponseDevice(int fd, bool chunked, const std::atomic<bool> &stopping, const QElapsedTimer &clock)
+        : m_fd(fd)
+        , m_chunked(chunked)
+        , m_stopping(stopping)
+        , m_clock(clock)
+    {
+    }
+
+    void setTee(QFile *file) { m_tee = file; }
+    QFile *tee() const { return m_tee; }
+    qint64 bytesSent() const { return m_bytesSent; }
+    qint64 firstByteMs() const { return m_firstByteMs; }
+
+    bool finish()
+    {
+        return !m_chunked || sendAll(m_fd, "0\r\n\r\n", 5);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        Q_UNUSED(data)
+        Q_UNUSED(maxSize)
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 length) override
+    {
+        if (m_stopping) {
+            setErrorString("Server is shutting down");
+            return -1;
+        }
+
+        bool sent;
+        if (m_chunked) {
+            m_buffer = QByteArray::number(length, 16) + "\r\n";
+            m_buffer.append(data, length);
+            m_buffer.append("\r\n");
+            sent = sendAll(m_fd, m_buffer);
+        } else {
+            sent = sendAll(m_fd, data, length);
+        }
+
+        if (!sent) {
+            setErrorString(QString("Client connection lost: %1").arg(strerror(errno)));
+            return -1;
+        }
+
+        if (m_firstByteMs < 0) {
+            m_firstByteMs = m_clock.elapsed();
+        }
+        m_bytesSent += length;
+
+        // A failing cache write must not break the client's stream
+        if (m_tee && m_tee->write(data, length) != length) {
+            m_tee = nullptr;
+        }
+
+        return length;
+    }
+
+private:
+    int m_fd;
+    bool m_chunked;
+    const std::atomic<bool> &m_stopping;
+    const QElapsedTimer &m_clock;
+    QFile *m_tee = nullptr;
+    QByteArray m_buffer;
+    qint64 m_bytesSent = 0;
+    qint64 m_firstByteMs = -1;
+};
+#endif
+}
+
+class TranscodeRequest : public QRunnable
+{
+public:
+    TranscodeRequest(TranscodeServer *server, int fd)
+        : m_server(server)
+        , m_fd(fd)
+    {
+        setAutoDelete(true);
+        m_clock.start();
+    }
+
+    void run() override
+    {
+        m_server->handleConnection(m_fd, m_clock);
+        m_server->m_activeStreams--;
+    }
+
+private:
+    TranscodeServer *m_server;
+    int m_fd;
+    QElapsedTimer m_clock; // Started at accept, so first-byte times include queueing
+};
+
+TranscodeServer::TranscodeServer(const QString &rootDirectory, QObject *parent)
+    : QObject(parent)
+    , m_rootDirectory(QFileInfo(rootDirectory).canonicalFilePath())
+    , m_maxStreams(QThread::idealThreadCount())
+{
+    m_threadPool.setMaxThreadCount(m_maxStreams);
+    // Keep idle workers around so a new stream never waits for a thread to start
+    m_threadPool.setExpiryTimeout(-1);
+}
+
+TranscodeServer::~TranscodeServer()
+{
+    close();
+}
+
+void TranscodeServer::setMaxStreams(int count)
+{
+    m_maxStreams = qMax(1, count);
+    m_threadPool.setMaxThreadCount(m_maxStreams);
+}
+
+bool TranscodeServer::listen(const QString &address, quint16 port)
+{
+    close();
+
+#ifdef Q_OS_UNIX
+    if (m_rootDirectory.isEmpty()) {
+        m_lastError = "Root directory does not exist";
+        return false;
+    }
+
+    int fd = openListenSocket(address, port, &m_port, &m_lastError);
+    if (fd < 0) {
+        return false;
+    }
+
+    m_listenFd = fd;
+    m_stopping = false;
+    m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &TranscodeServer::acceptConnections);
+    return true;
+#else
+    Q_UNUSED(address)
+    Q_UNUSED(port)
+    m_lastError = "The transcoding server requires POSIX sockets";
+    return false;
+#endif
+}
+
+void TranscodeServer::close()
+{
+    // Running streams notice on their next page and abort
+    m_stopping = true;
+
+    delete m_notifier;
+    m_notifier = nullptr;
+
+#ifdef Q_OS_UNIX
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+    }
+#endif
+    m_listenFd = -1;
+
+    m_threadPool.waitForDone();
+}
+
+void TranscodeServer::acceptConnections()
+{
+#ifdef Q_OS_UNIX
+    for (;;) {
+        int fd = ::accept(m_listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+        // Admission control: a request that can't start right away is refused
+        // rather than queued, so accepted streams keep realtime throughput
+        if (m_activeStreams >= m_maxStreams) {
+            m_rejectedRequests++;
+            sendStatus(fd, 503, "Service Unavailable", "Retry-After: 1\r\n");
+
+            // Drain what the client already sent so close() doesn't reset the connection
+            char discard[2048];
+            while (::recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+            }
+            ::close(fd);
+
+            emit requestFinished(QString(), 503, 0, -1, 0, false);
+            continue;
+        }
+
+        m_activeStreams++;
+        m_threadPool.start(new TranscodeRequest(this, fd));
+    }
+#endif
+}
+
+void TranscodeServer::handleConnection(int fd, const QElapsedTimer &clock)
+{
+#ifdef Q_OS_UNIX
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval receiveTimeout = {RequestTimeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+    timeval sendTimeout = {SendTimeoutSeconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    // Read the request head; the body of a GET is ignored
+    QByteArray head;
+    char buffer[2048];
+    while (!head.contains("\r\n\r\n")) {
+        if (head.size() >= MaxRequestHeadSize) {
+            sendStatus(fd, 431, "Request Header Fields Too Large");
+            ::close(fd);
+            return;
+        }
+        ssize_t received = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            ::close(fd);
+            return;
+        }
+        head.append(buffer, int(received));
+    }
+
+    const QList<QByteArray> requestLine = head.left(head.indexOf("\r\n")).split(' ');
+    if (requestLine.size() != 3 || !requestLine[2].startsWith("HTTP/1.")) {
+        sendStatus(fd, 400, "Bad Request");
+        ::close(fd);
+        return;
+    }
+
+    const QByteArray &method = requestLine[0];
+    const QByteArray &target = requestLine[1];
+    const bool headOnly = method == "HEAD";
+    if (method != "GET" && !headOnly) {
+        sendStatus(fd, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n");
+        ::close(fd);
+        return;
+    }
+
+    int queryStart = target.indexOf('?');
+    QString urlPath = QUrl::fromPercentEncoding(target.left(queryStart));
+    QUrlQuery query(queryStart >= 0 ? QString::fromUtf8(target.mid(queryStart + 1)) : QString());
+
+    int bitrate = m_defaultBitrate;
+    if (query.hasQueryItem("bitrate")) {
+        bool ok = false;
+        bitrate = query.queryItemValue("bitrate").toInt(&ok);
+        if (!ok || bitrate < 6000 || bitrate > 510000) {
+            sendStatus(fd, 400, "Bad Request");
+            ::close(fd);
+            emit requestFinished(urlPath, 400, 0, -1, clock.elapsed(), false);
+            return;
+        }
+    }
+
+    QString filePath = resolvePath(urlPath);
+    QFile input(filePath);
+    if (filePath.isEmpty() || !input.open(QIODevice::ReadOnly)) {
+        sendStatus(fd, 404, "Not Found");
+        ::close(fd);
+        emit requestFinished(urlPath, 404, 0, -1, clock.elapsed(), false);
+        return;
+    }
+
+    OpusEncoderImpl encoder;
+    encoder.setBitrate(bitrate);
+    encoder.setComplexity(m_complexity);
+    encoder.setVbr(true);
+
+    std::shared_ptr<OutputCache> cache = m_outputCache;
+    QString cacheKey;
+    QString cachedPath;
+    if (cache && !headOnly) {
+        FlacStreamInfo streamInfo;
+        FlacStreamInfo::probe(filePath, streamInfo);
+        cacheKey = OutputCache::cacheKey(streamInfo, bitrate, m_complexity, true, encoder.resamplerQuality());
+        cachedPath = cache->find(cacheKey);
+    }
+
+    // Cached encodes have a known length and are sent as-is
+    QFile cached(cachedPath);
+    const bool fromCache = !cachedPath.isEmpty() && cached.open(QIODevice::ReadOnly);
+    const bool chunked = !fromCache && requestLine[2] == "HTTP/1.1";
+
+    QByteArray headers = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: audio/ogg\r\n"
+                         "Cache-Control: no-cache\r\n";
+    if (fromCache) {
+        headers += "Content-Length: " + QByteArray::number(cached.size()) + "\r\n";
+    } else if (chunked) {
+        headers += "Transfer-Encoding: chunked\r\n";
+    }
+    headers += "Connection: close\r\n\r\n";
+
+    // Headers go out before any decoding so the client sees the response at once
+    if (!sendAll(fd, headers) || headOnly) {
+        ::close(fd);
+        emit requestFinished(urlPath, 200, 0, -1, clock.elapsed(), false);
+        return;
+    }
+
+    ResponseDevice device(fd, chunked, m_stopping, clock);
+    device.open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+
+    bool success;
+    if (fromCache) {
+        success = true;
+        while (success && !cached.atEnd()) {
+            QByteArray block = cached.read(64 * 1024);
+            success = !block.isEmpty() && device.write(block) == block.size();
+        }
+    } else {
+        // Write through to the cache; the entry is only published once complete
+        QTemporaryFile tee;
+        if (cache && !cacheKey.isEmpty() && QDir().mkpath(cache->directory())) {
+            tee.setFileTemplate(QDir(cache->directory()).filePath("stream-XXXXXX.tmp"));
+            if (tee.open()) {
+                device.setTee(&tee);
+            }
+        }
+
+        qint64 cpuStart = threadCpuTimeMs();
+        success = encoder.encodeStream(input.handle(), &device) && device.finish();
+
+        if (success && device.tee()) {
+            tee.flush();
+            cache->store(cacheKey, tee.fileName(), threadCpuTimeMs() - cpuStart);
+        }
+    }
+
+    ::close(fd);
+    emit requestFinished(urlPath, 200, device.bytesSent(), device.firstByteMs(), clock.elapsed(), fromCache);
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(clock)
+#endif
+}
+
+QString TranscodeServer::resolvePath(const QString &urlPath) const
+{
+    // cleanPath on an absolute path drops any ".." that would climb above it
+    const QDir root(m_rootDirectory);
+    QFileInfo info(root.filePath(QDir::cleanPath("/" + urlPath).mid(1)));
+    QString canonicalPath = info.canonicalFilePath();
+
+    // Symlinks are followed, but never out of the served tree. Relative to
+    // the root rather than by prefix, so serving "/" works too.
+    const QString relativePath = root.relativeFilePath(canonicalPath);
+    if (canonicalPath.isEmpty() || !info.isFile() ||
+        relativePath.isEmpty() || relativePath == ".." || relativePath.startsWith("../") ||
+        QDir::isAbsolutePath(relativePath) ||
+        !FileScanner::hasFlacExtension(canonicalPath)) {
+        return QString();
+    }
+
+    return canonicalPath;
+}
@@ -0,0 +1,76 @@
+#ifndef TRANSCODESERVER_H
+#define TRANSCODESERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+
+class QElapsedTimer;
+class QSocketNotifier;
+class OutputCache;
+
+// Minimal HTTP/1.1 server that transcodes FLAC files under a root directory
+// on request: GET /Artist/Album/01.flac?bitrate=96000 answers with a chunked
+// Ogg Opus stream that starts as soon as the first FLAC block is decoded.
+// Every stream runs on its own worker; requests beyond the worker count are
+// refused with 503 instead of queueing behind long transcodes.
+class TranscodeServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TranscodeServer(const QString &rootDirectory, QObject *parent = nullptr);
+    ~TranscodeServer();
+
+    bool listen(const QString &address, quint16 port);
+    void close();
+    bool isListening() const { return m_listenFd >= 0; }
+    quint16 serverPort() const { return m_port; }
+    QString getLastError() const { return m_lastError; }
+
+    // Settings, to be changed before listen()
+    void setMaxStreams(int count);
+    int maxStreams() const { return m_maxStreams; }
+    void setDefaultBitrate(int bitrate) { m_defaultBitrate = bitrate; }
+    void setComplexity(int complexity) { m_complexity = complexity; }
+
+    // Write finished encodes through to this cache and serve repeats from it
+    void setOutputCache(std::shared_ptr<OutputCache> cache) { m_outputCache = std::move(cache); }
+
+    int activeStreams() const { return m_activeStreams; }
+    int rejectedRequests() const { return m_rejectedRequests; }
+
+signals:
+    // Emitted from worker threads once a response is complete
+    void requestFinished(const QString &path, int status, qint64 bytesSent,
+                         qint64 firstByteMs, qint64 elapsedMs, bool fromCache);
+
+private slots:
+    void acceptConnections();
+
+private:
+    friend class TranscodeRequest;
+
+    QString m_rootDirectory;
+    QString m_lastError;
+    int m_listenFd = -1;
+    quint16 m_port = 0;
+    QSocketNotifier *m_notifier = nullptr;
+    QThreadPool m_threadPool;
+
+    int m_maxStreams;
+    int m_defaultBitrate = 128000;
+    int m_complexity = 10;
+    std::shared_ptr<OutputCache> m_outputCache;
+
+    std::atomic<int> m_activeStreams{0};
+    std::atomic<int> m_rejectedRequests{0};
+    std::atomic<bool> m_stopping{false};
+
+    void handleConnection(int fd, const QElapsedTimer &clock);
+    QString resolvePath(const QString &urlPath) const;
+};
+
+#endif // TRANSCODESERVER_H